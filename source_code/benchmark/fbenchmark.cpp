@@ -0,0 +1,828 @@
+#include "../includes.h"
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#define BENCH_LOAD_REPEATS 3		//Number of loads per level and thread count (the fastest one is reported)
+#define BENCH_PHYSICS_STEPS 600		//Number of physics steps per level and thread count
+#define BENCH_DYNAMIC_BOXES 1000	//Number of dynamic boxes dropped into each level to give PhysX some work
+#define BENCH_STEP_SIZE (1.0f / 60.0f)
+#define BENCH_MOVER_STEPS 300		//Number of physics steps per mover count
+#define BENCH_MOVER_RAYCASTS 1000	//Number of raycasts after each mover step
+#define BENCH_STATIC_GRID 100			//The generated level has BENCH_STATIC_GRID^2 static boxes
+#define BENCH_QUERIES 10000			//Number of raycasts and sweeps against the generated level
+#define BENCH_MIRROR_STEPS 600		//Number of steps of the mirror picking stress scenario
+#define BENCH_COOKING_CACHE "cache/benchmark_physx"	//Cooking cache directory of the benchmark (emptied before measuring)
+#define BENCH_TRACER_WIDTH 480		//Primary rays per row of the CPU ray tracer benchmark (a quarter of focus_rt's resolution)
+#define BENCH_TRACER_HEIGHT 270		//Rows of the CPU ray tracer benchmark
+#define BENCH_TRACER_REPEATS 5		//Number of traced images per level and thread count
+#define BENCH_SWITCH_ROUNDS 3		//Number of times all levels are switched through per level switch variant
+#define MICRO_WARMUP_SAMPLES 2		//Samples run before measuring (caches, allocations, PhysX warm-up)
+#define MICRO_SAMPLES 20			//Measured samples per microbenchmark
+#define MICRO_LOAD_SAMPLES 5		//Measured samples of the level loading microbenchmarks (a few hundred ms each)
+#define MICRO_MIN_SAMPLE_MS 20.0	//The iterations per sample are doubled until a sample takes at least this long
+#define MICRO_DEFAULT_JSON "micro_benchmarks.json"
+
+/*
+Benchmark for the engine-wide job system.
+Measures the time for loading the CPU-data of each level and the average PhysX step time for different numbers of threads.
+Additionally compares moving platforms as static actors (moved with setGlobalPose) against kinematic actors (moved with setKinematicTarget),
+the time for cooking the triangle meshes of each level against loading them from the cooking cache,
+level physics load and reset times with and without snapshots,
+the insertion and scene query times of a large generated level for each broadphase, with and without a precomputed pruning structure,
+the mirror picking and highlighting time per step with hundreds of mirrors (individual queries with a linear search against batched
+queries with query ids), the BVH build time and ray throughput of the CPU ray tracer (with the focus hit value of each level's camera),
+and the physics cost of a level switch with a PhysX runtime per level (as before the runtime was shared) against the shared runtime.
+No window and no GPU are needed.
+Usage: focus_benchmark
+
+Microbenchmarks of the engine's CPU hot paths on every level: parsing the level file, load_scene_data (parsing and vertex extraction),
+fmodel_gpu_data construction (including the normal matrix) for all models, the CPU part of fscene::update with all models dirty
+(fscene::update_model_data, the buffer and TLAS updates need a GPU), fphysicscontroller::update steps and fplayercontrol updates
+of a walking and turning player (scripted input), and hsvinterpolator::interpolate.
+Every microbenchmark runs warm-up samples and then a fixed number of samples with the same number of iterations each, the iteration
+count is chosen such that a sample takes at least MICRO_MIN_SAMPLE_MS. The time per iteration is reported with median and median
+absolute deviation (robust against outliers like context switches) besides minimum, mean and standard deviation.
+The results are printed and written as JSON (default: micro_benchmarks.json), to track them over time.
+Usage: focus_benchmark --micro [json file]
+*/
+
+//Returns the current time in milliseconds
+static double now_ms()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Returns the fastest of several loads of the CPU-data of the given level in ms
+static double benchmark_load(const std::string& levelPath)
+{
+	double best = std::numeric_limits<double>::max();
+	for (int i = 0; i < BENCH_LOAD_REPEATS; ++i) {
+		double start = now_ms();
+		auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+		best = glm::min(best, now_ms() - start);
+	}
+	return best;
+}
+
+//Returns the average step time in ms of the given level with lots of falling boxes
+static double benchmark_physics(const std::string& levelPath, fphysicsruntime* runtime)
+{
+	auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+	auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+	physics->set_async(false);
+
+	//Static level geometry
+	for (fmodel& model : scene->get_models()) {
+		physics->create_rigid_static_for_triangle_mesh(&model);
+	}
+
+	//Dynamic boxes in a grid above the start position
+	glm::vec3 start = scene->get_camera().translation();
+	int perRow = static_cast<int>(std::ceil(std::sqrt(BENCH_DYNAMIC_BOXES / 10.0)));
+	PxShape* boxShape = physics->mPhysics->createShape(PxBoxGeometry(0.2f, 0.2f, 0.2f), *physics->mDefaultMaterial, true);
+	for (int i = 0; i < BENCH_DYNAMIC_BOXES; ++i) {
+		int layer = i / (perRow * perRow);
+		int x = i % perRow;
+		int z = (i / perRow) % perRow;
+		PxVec3 position(start.x + (x - perRow / 2) * 0.5f, start.y + 2.0f + layer * 0.5f, start.z + (z - perRow / 2) * 0.5f);
+		PxRigidDynamic* box = PxCreateDynamic(*physics->mPhysics, PxTransform(position), *boxShape, 1.0f);
+		physics->mPxScene->addActor(*box);
+	}
+	boxShape->release();
+
+	double total = 0.0;
+	for (int i = 0; i < BENCH_PHYSICS_STEPS; ++i) {
+		physics->update(BENCH_STEP_SIZE);
+		total += physics->get_last_wait_time();
+	}
+	physics->cleanup();
+	return total / BENCH_PHYSICS_STEPS;
+}
+
+struct cooking_result {
+	double mCookTime;		//Time for cooking all meshes of a level in ms (empty caches)
+	double mCachedTime;		//Time for loading all meshes of a level from the disk cache in ms
+};
+
+//Creates the triangle meshes of all models of the given level, once with empty caches and once from the disk cache
+static cooking_result benchmark_cooking(const std::string& levelPath, fphysicsruntime* runtime)
+{
+	auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+	std::filesystem::remove_all(BENCH_COOKING_CACHE);
+	runtime->release_cached_meshes();
+
+	cooking_result result;
+	double start = now_ms();
+	for (fmodel& model : scene->get_models()) {
+		runtime->get_triangle_mesh(model.mPositions, model.mIndices);
+	}
+	result.mCookTime = now_ms() - start;
+
+	runtime->release_cached_meshes();
+	start = now_ms();
+	for (fmodel& model : scene->get_models()) {
+		runtime->get_triangle_mesh(model.mPositions, model.mIndices);
+	}
+	result.mCachedTime = now_ms() - start;
+	return result;
+}
+
+struct snapshot_result {
+	double mLoadTime;			//Time for constructing the actors of all models in ms
+	double mResetTime;			//Time for resetting the kinematic actors by their stored poses in ms
+	double mSnapshotLoadTime;	//Time for loading the actors from the snapshot file (including taking the reset snapshot) in ms
+	double mSnapshotResetTime;	//Time for restoring the snapshot in ms
+};
+
+//Creates actors for all models of a level (every fourth one as kinematic box, the others as static triangle meshes).
+//Returns the kinematic actors.
+static std::vector<PxRigidDynamic*> create_level_actors(fphysicscontroller* physics, fscene* scene)
+{
+	std::vector<PxRigidDynamic*> kinematics;
+	for (fmodel& model : scene->get_models()) {
+		if (model.mModelIndex % 4 == 0) {
+			kinematics.push_back(physics->create_kinematic_for_scaled_unit_box(&model));
+		}
+		else {
+			physics->create_rigid_static_for_triangle_mesh(&model);
+		}
+	}
+	physics->finish_static_actors();
+	return kinematics;
+}
+
+//Moves all kinematic actors away from their initial poses
+static void move_kinematics(fphysicscontroller* physics, const std::vector<PxRigidDynamic*>& kinematics)
+{
+	for (PxRigidDynamic* kinematic : kinematics) {
+		PxTransform pose = kinematic->getGlobalPose();
+		physics->move_kinematic(kinematic, PxTransform(pose.p + PxVec3(1, 0, 0), pose.q));
+	}
+	physics->update(BENCH_STEP_SIZE);
+}
+
+//Measures the level physics load and reset times without snapshots (actors are constructed, poses are reset one by one)
+//and with snapshots (actors are taken from the snapshot file, the snapshot is restored)
+static snapshot_result benchmark_snapshots(const std::string& levelPath, fphysicsruntime* runtime)
+{
+	auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+	snapshot_result result;
+
+	//Warm up the cooking cache and store the snapshot file
+	std::filesystem::remove_all(BENCH_COOKING_CACHE);
+	runtime->mConfig.mUseSnapshotFiles = true;
+	{
+		auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+		create_level_actors(physics.get(), scene.get());
+		physics->take_snapshot();
+		physics->cleanup();
+	}
+
+	//Without snapshots: the meshes come from the disk cache, but every actor is constructed
+	runtime->release_cached_meshes();
+	runtime->mConfig.mUseSnapshotFiles = false;
+	{
+		double start = now_ms();
+		auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+		physics->set_async(false);
+		auto kinematics = create_level_actors(physics.get(), scene.get());
+		result.mLoadTime = now_ms() - start;
+
+		std::vector<PxTransform> initialPoses;
+		for (PxRigidDynamic* kinematic : kinematics) {
+			initialPoses.push_back(kinematic->getGlobalPose());
+		}
+		move_kinematics(physics.get(), kinematics);
+		start = now_ms();
+		for (size_t i = 0; i < kinematics.size(); ++i) {
+			physics->set_kinematic_pose(kinematics[i], initialPoses[i]);
+		}
+		result.mResetTime = now_ms() - start;
+		physics->cleanup();
+	}
+
+	//With snapshots
+	runtime->release_cached_meshes();
+	runtime->mConfig.mUseSnapshotFiles = true;
+	{
+		double start = now_ms();
+		auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+		physics->set_async(false);
+		auto kinematics = create_level_actors(physics.get(), scene.get());
+		physics->take_snapshot();
+		result.mSnapshotLoadTime = now_ms() - start;
+		if (!physics->is_loaded_from_snapshot()) {
+			LOG_ERROR("The snapshot file of " + levelPath + " has not been used");
+		}
+
+		move_kinematics(physics.get(), kinematics);
+		start = now_ms();
+		physics->restore_snapshot();
+		result.mSnapshotResetTime = now_ms() - start;
+		physics->cleanup();
+	}
+	return result;
+}
+
+struct switch_result {
+	double mOwnRuntimeTime;		//Average time of a level switch in ms, with a new PhysX runtime per level
+	double mSharedRuntimeTime;	//Average time of a level switch in ms, with one runtime for all levels
+};
+
+//Measures the physics part of level switches (releasing the previous level's physics, creating the next one with all actors),
+//cycling BENCH_SWITCH_ROUNDS times through the levels. The scenes are loaded beforehand. Without the disk cache, such that
+//a runtime per level has to cook every mesh again, while the shared runtime keeps its meshes in memory.
+//No other runtime may exist while this runs (the PhysX foundation is a singleton).
+static switch_result benchmark_level_switches(const std::vector<std::string>& levels, fphysicsconfig config)
+{
+	config.mCookingCacheDirectory = "";
+	config.mUseSnapshotFiles = false;
+	std::vector<std::unique_ptr<fscene>> scenes;
+	for (const auto& level : levels) {
+		scenes.push_back(fscene::load_scene_data(level, CHAR_PATH));
+	}
+	size_t switches = BENCH_SWITCH_ROUNDS * scenes.size();
+	switch_result result;
+
+	//A runtime per level: foundation, physics, cooking and dispatcher are created and released with every level
+	{
+		std::unique_ptr<fphysicsruntime> runtime;
+		std::unique_ptr<fphysicscontroller> physics;
+		double start = now_ms();
+		for (size_t i = 0; i < switches; ++i) {
+			if (physics) {
+				physics->cleanup();
+			}
+			physics.reset();
+			runtime.reset();
+			runtime = std::make_unique<fphysicsruntime>(config);
+			physics = std::make_unique<fphysicscontroller>(scenes[i % scenes.size()].get(), runtime.get());
+			create_level_actors(physics.get(), scenes[i % scenes.size()].get());
+		}
+		result.mOwnRuntimeTime = (now_ms() - start) / switches;
+		physics->cleanup();
+	}
+
+	//Shared runtime: only the level's scene and actors are created and released
+	{
+		fphysicsruntime runtime(config);
+		std::unique_ptr<fphysicscontroller> physics;
+		double start = now_ms();
+		for (size_t i = 0; i < switches; ++i) {
+			if (physics) {
+				physics->cleanup();
+			}
+			physics.reset();
+			physics = std::make_unique<fphysicscontroller>(scenes[i % scenes.size()].get(), &runtime);
+			create_level_actors(physics.get(), scenes[i % scenes.size()].get());
+		}
+		result.mSharedRuntimeTime = (now_ms() - start) / switches;
+		physics->cleanup();
+		physics.reset();
+	}
+	return result;
+}
+
+struct static_result {
+	double mInsertTime;		//Time for adding all static actors and simulating the first step in ms
+	double mRaycastTime;	//Time for BENCH_QUERIES raycasts in ms
+	double mSweepTime;		//Time for BENCH_QUERIES sphere sweeps in ms
+};
+
+//Builds a generated level with a grid of static boxes of varying heights and measures insertion and scene query times
+static static_result benchmark_statics(fphysicsruntime* runtime, bool pruningStructure)
+{
+	auto scene = fscene::load_scene_data(flevel1logic::level_path(), CHAR_PATH);
+	auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+	physics->set_async(false);
+
+	std::vector<PxRigidStatic*> actors;
+	for (int i = 0; i < BENCH_STATIC_GRID * BENCH_STATIC_GRID; ++i) {
+		float height = 0.5f + (i * 7919 % 13) * 0.25f;
+		PxTransform pose(PxVec3((i % BENCH_STATIC_GRID) * 2.0f, height, (i / BENCH_STATIC_GRID) * 2.0f));
+		PxRigidStatic* actor = physics->mPhysics->createRigidStatic(pose);
+		PxShape* shape = physics->mPhysics->createShape(PxBoxGeometry(0.9f, height, 0.9f), *physics->mDefaultMaterial, true);
+		actor->attachShape(*shape);
+		shape->release();
+		actors.push_back(actor);
+	}
+
+	//MBP: the generated level is larger than the scene (does nothing for the other broadphases)
+	physics->add_broadphase_regions(PxBounds3(PxVec3(-1.0f, 0.0f, -1.0f), PxVec3(BENCH_STATIC_GRID * 2.0f, 4.0f, BENCH_STATIC_GRID * 2.0f)));
+
+	static_result result;
+	double start = now_ms();
+	if (pruningStructure) {
+		for (PxRigidStatic* actor : actors) {
+			physics->add_static_actor(actor);
+		}
+		physics->finish_static_actors();
+	}
+	else {
+		//One by one, like the levels used to do it
+		for (PxRigidStatic* actor : actors) {
+			physics->mPxScene->addActor(*actor);
+		}
+	}
+	physics->update(BENCH_STEP_SIZE);
+	result.mInsertTime = now_ms() - start;
+
+	float extent = BENCH_STATIC_GRID * 2.0f;
+	start = now_ms();
+	for (int i = 0; i < BENCH_QUERIES; ++i) {
+		PxRaycastBuffer hit;
+		physics->mPxScene->raycast(PxVec3((i * 37 % 1000) / 1000.0f * extent, 10.0f, (i * 91 % 1000) / 1000.0f * extent), PxVec3(0, -1, 0), 20.0f, hit);
+	}
+	result.mRaycastTime = now_ms() - start;
+
+	start = now_ms();
+	for (int i = 0; i < BENCH_QUERIES; ++i) {
+		PxSweepBuffer hit;
+		PxTransform pose(PxVec3(-1.0f, 1.0f + (i % 5) * 0.5f, (i * 91 % 1000) / 1000.0f * extent));
+		physics->mPxScene->sweep(PxSphereGeometry(0.3f), pose, PxVec3(1, 0, 0), extent, hit);
+	}
+	result.mSweepTime = now_ms() - start;
+
+	physics->cleanup();
+	return result;
+}
+
+struct mirror_result {
+	double mIndividualTime;	//Time per step in ms with individual raycasts, linear search and highlighting of all mirrors
+	double mBatchedTime;	//Time per step in ms with batched queries, query ids and highlighting on changes only
+};
+
+//A ring of mirrors (border and plane) around the player, who turns around once during the scenario
+static mirror_result benchmark_mirrors(fphysicsruntime* runtime, int mirrorCount)
+{
+	auto scene = fscene::load_scene_data(flevel1logic::level_path(), CHAR_PATH);
+	auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+	physics->set_async(false);
+
+	std::vector<std::vector<PxRigidDynamic*>> mirrorActors;
+	std::vector<std::vector<uint32_t>> mirrorFlags;		//Stand-in for the models' flags
+	float radius = mirrorCount * 2.5f / PxTwoPi;
+	for (int i = 0; i < mirrorCount; ++i) {
+		float angle = i * PxTwoPi / mirrorCount;
+		PxVec3 direction(std::cos(angle), 0, std::sin(angle));
+		PxQuat facing(-angle, PxVec3(0, 1, 0));
+		PxRigidDynamic* border = PxCreateKinematic(*physics->mPhysics, PxTransform(direction * (radius + 0.1f), facing), PxBoxGeometry(0.1f, 1.2f, 1.2f), *physics->mDefaultMaterial, 1.0f);
+		PxRigidDynamic* plane = PxCreateKinematic(*physics->mPhysics, PxTransform(direction * radius, facing), PxBoxGeometry(0.05f, 1.0f, 1.0f), *physics->mDefaultMaterial, 1.0f);
+		physics->mPxScene->addActor(*border);
+		physics->mPxScene->addActor(*plane);
+		fphysicscontroller::set_query_id(border, i + 1);
+		fphysicscontroller::set_query_id(plane, i + 1);
+		mirrorActors.push_back({ border, plane });
+		mirrorFlags.push_back({ 0, 0 });
+	}
+	physics->update(BENCH_STEP_SIZE);
+
+	auto ray_direction = [](int step) {
+		float angle = step * PxTwoPi / BENCH_MIRROR_STEPS;
+		return PxVec3(std::cos(angle), 0, std::sin(angle));
+	};
+
+	//Individual raycasts (hover and click) with a linear search for the hit actor, all mirror flags are checked every step
+	mirror_result result;
+	double start = now_ms();
+	for (int step = 0; step < BENCH_MIRROR_STEPS; ++step) {
+		int picked = -1;
+		for (int ray = 0; ray < 2; ++ray) {
+			PxRaycastBuffer hit;
+			physics->mPxScene->raycast(PxVec3(0, 0, 0), ray_direction(step), radius * 2.0f, hit);
+			if (hit.hasBlock) {
+				for (size_t i = 0; i < mirrorActors.size(); ++i) {
+					if (std::find(mirrorActors[i].begin(), mirrorActors[i].end(), hit.block.actor) != mirrorActors[i].end()) {
+						picked = static_cast<int>(i);
+						break;
+					}
+				}
+			}
+		}
+		for (size_t i = 0; i < mirrorFlags.size(); ++i) {
+			for (uint32_t& flags : mirrorFlags[i]) {
+				flags = (static_cast<int>(i) == picked) ? (flags | 2) : (flags & ~2);
+			}
+		}
+	}
+	result.mIndividualTime = (now_ms() - start) / BENCH_MIRROR_STEPS;
+
+	//Batched query with query ids, flags only change for the previously and the newly highlighted mirror
+	int highlighted = -1;
+	start = now_ms();
+	for (int step = 0; step < BENCH_MIRROR_STEPS; ++step) {
+		size_t query = physics->queue_raycast(PxVec3(0, 0, 0), ray_direction(step), radius * 2.0f);
+		physics->execute_queries();
+		const PxRaycastHit& hit = physics->get_raycast_result(query);
+		int picked = (hit.shape != nullptr) ? static_cast<int>(fphysicscontroller::get_query_id(hit.shape)) - 1 : -1;
+		if (picked != highlighted) {
+			if (highlighted != -1) {
+				for (uint32_t& flags : mirrorFlags[highlighted]) {
+					flags &= ~2;
+				}
+			}
+			if (picked != -1) {
+				for (uint32_t& flags : mirrorFlags[picked]) {
+					flags |= 2;
+				}
+			}
+			highlighted = picked;
+		}
+	}
+	result.mBatchedTime = (now_ms() - start) / BENCH_MIRROR_STEPS;
+
+	physics->cleanup();
+	return result;
+}
+
+struct mover_result {
+	double mStepTime;		//Average step time in ms
+	double mRaycastTime;	//Average time for all raycasts of a step in ms
+};
+
+//Moves count platforms in a plane above a static floor grid every step and raycasts down onto them afterwards.
+//If kinematic is false, the platforms are static actors that are teleported like the levels used to do it.
+static mover_result benchmark_movers(fphysicsruntime* runtime, int count, bool kinematic)
+{
+	//The scene is only needed by the controller, the movers have no models
+	auto scene = fscene::load_scene_data(flevel1logic::level_path(), CHAR_PATH);
+	auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+	physics->set_async(false);
+
+	int perRow = static_cast<int>(std::ceil(std::sqrt(double(count))));
+	PxShape* floorShape = physics->mPhysics->createShape(PxBoxGeometry(1.0f, 0.1f, 1.0f), *physics->mDefaultMaterial, true);
+	for (int i = 0; i < perRow * perRow; ++i) {
+		PxRigidStatic* floor = PxCreateStatic(*physics->mPhysics, PxTransform(PxVec3((i % perRow) * 2.0f, 0.0f, (i / perRow) * 2.0f)), *floorShape);
+		physics->mPxScene->addActor(*floor);
+	}
+	floorShape->release();
+
+	std::vector<PxRigidActor*> movers;
+	PxShape* moverShape = physics->mPhysics->createShape(PxBoxGeometry(0.8f, 0.1f, 0.8f), *physics->mDefaultMaterial, true);
+	for (int i = 0; i < count; ++i) {
+		PxTransform pose(PxVec3((i % perRow) * 2.0f, 2.0f, (i / perRow) * 2.0f));
+		PxRigidActor* mover;
+		if (kinematic) {
+			mover = PxCreateKinematic(*physics->mPhysics, pose, *moverShape, 1.0f);
+		}
+		else {
+			mover = PxCreateStatic(*physics->mPhysics, pose, *moverShape);
+		}
+		physics->mPxScene->addActor(*mover);
+		movers.push_back(mover);
+	}
+	moverShape->release();
+
+	mover_result result = { 0.0, 0.0 };
+	for (int step = 0; step < BENCH_MOVER_STEPS; ++step) {
+		float offset = glm::sin(step * BENCH_STEP_SIZE) * 0.9f;
+		for (int i = 0; i < count; ++i) {
+			PxTransform pose(PxVec3((i % perRow) * 2.0f + offset, 2.0f, (i / perRow) * 2.0f));
+			if (kinematic) {
+				physics->move_kinematic(static_cast<PxRigidDynamic*>(movers[i]), pose);
+			}
+			else {
+				movers[i]->setGlobalPose(pose);
+			}
+		}
+		double stepStart = now_ms();
+		physics->update(BENCH_STEP_SIZE);
+		result.mStepTime += now_ms() - stepStart;
+
+		double raycastStart = now_ms();
+		for (int r = 0; r < BENCH_MOVER_RAYCASTS; ++r) {
+			float x = (r % perRow) * 2.0f + 0.37f * (r / perRow % 5);
+			float z = (r / perRow % perRow) * 2.0f;
+			PxRaycastBuffer hit;
+			physics->mPxScene->raycast(PxVec3(x, 5.0f, z), PxVec3(0, -1, 0), 10.0f, hit);
+		}
+		result.mRaycastTime += now_ms() - raycastStart;
+	}
+	physics->cleanup();
+	result.mStepTime /= BENCH_MOVER_STEPS;
+	result.mRaycastTime /= BENCH_MOVER_STEPS;
+	return result;
+}
+
+struct tracer_result {
+	double mBuildTime;		//Time for building the BVHs of all models in ms
+	double mRaysPerSecond;	//Closest hit queries per second
+	double mFocusHitValue;	//Focus hit value of the level's initial camera
+};
+
+//Traces full-screen primary rays (like default.rgen) from the camera of a level with the CPU ray tracer on all threads of the job system
+static tracer_result benchmark_tracer(const std::string& levelPath)
+{
+	auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+	fcputracer tracer(scene.get());
+	tracer_result result;
+	double start = now_ms();
+	tracer.build();
+	result.mBuildTime = now_ms() - start;
+
+	glm::mat4 camera = scene->get_camera().global_transformation_matrix();
+	glm::vec3 origin = glm::vec3(camera * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	float aspectRatio = float(BENCH_TRACER_WIDTH) / float(BENCH_TRACER_HEIGHT);
+	start = now_ms();
+	for (int repeat = 0; repeat < BENCH_TRACER_REPEATS; ++repeat) {
+		fjobsystem::instance().parallel_for(0, BENCH_TRACER_HEIGHT, 1, [&](size_t y) {
+			for (int x = 0; x < BENCH_TRACER_WIDTH; ++x) {
+				glm::vec2 d = (glm::vec2(float(x), float(y)) + glm::vec2(0.5f)) / glm::vec2(BENCH_TRACER_WIDTH, BENCH_TRACER_HEIGHT) * 2.0f - 1.0f;
+				glm::vec3 viewDirection = glm::normalize(glm::vec3(d.x * aspectRatio, -d.y, -std::sqrt(3.0f)));
+				glm::vec3 direction = glm::normalize(glm::vec3(camera * glm::vec4(viewDirection, 1.0f)) - origin);
+				fcputracer::hit h;
+				tracer.closest_hit(origin, direction, 0.001f, 100.0f, h);
+			}
+		});
+	}
+	double seconds = (now_ms() - start) / 1000.0;
+	result.mRaysPerSecond = double(BENCH_TRACER_WIDTH) * BENCH_TRACER_HEIGHT * BENCH_TRACER_REPEATS / seconds;
+	result.mFocusHitValue = tracer.compute_focus_hit_value(camera, aspectRatio, FOCUS_QUERY_RESOLUTION, 4);
+	return result;
+}
+
+//Time per iteration of a microbenchmark in ns
+struct micro_result {
+	std::string mName;
+	std::string mLevel;				//Empty if not level specific
+	uint64_t mIterations = 0;		//Iterations per sample
+	std::vector<double> mSamples;	//Time per iteration of every sample
+	double mMin = 0.0;
+	double mMedian = 0.0;
+	double mMean = 0.0;
+	double mStdDev = 0.0;
+	double mMad = 0.0;				//Median absolute deviation from the median
+};
+
+//Returns the median of values (reorders them)
+static double median(std::vector<double>& values)
+{
+	size_t middle = values.size() / 2;
+	std::nth_element(values.begin(), values.begin() + middle, values.end());
+	double result = values[middle];
+	if (values.size() % 2 == 0) {
+		result = (result + *std::max_element(values.begin(), values.begin() + middle)) / 2.0;
+	}
+	return result;
+}
+
+//Measures func (one iteration per call) after the iteration count has been calibrated
+template <typename F>
+static micro_result run_micro(const std::string& name, const std::string& level, int samples, F&& func)
+{
+	micro_result result;
+	result.mName = name;
+	result.mLevel = level;
+
+	auto run_sample = [&func](uint64_t iterations) {
+		double start = now_ms();
+		for (uint64_t i = 0; i < iterations; ++i) {
+			func();
+		}
+		return now_ms() - start;
+	};
+	uint64_t iterations = 1;
+	while (run_sample(iterations) < MICRO_MIN_SAMPLE_MS) {
+		iterations *= 2;
+	}
+	for (int i = 0; i < MICRO_WARMUP_SAMPLES; ++i) {
+		run_sample(iterations);
+	}
+	result.mIterations = iterations;
+	for (int i = 0; i < samples; ++i) {
+		result.mSamples.push_back(run_sample(iterations) * 1e6 / double(iterations));
+	}
+
+	std::vector<double> sorted = result.mSamples;
+	result.mMin = *std::min_element(sorted.begin(), sorted.end());
+	result.mMedian = median(sorted);
+	for (double sample : result.mSamples) {
+		result.mMean += sample / samples;
+	}
+	std::vector<double> deviations;
+	for (double sample : result.mSamples) {
+		result.mStdDev += (sample - result.mMean) * (sample - result.mMean) / glm::max(samples - 1, 1);
+		deviations.push_back(std::abs(sample - result.mMedian));
+	}
+	result.mStdDev = std::sqrt(result.mStdDev);
+	result.mMad = median(deviations);
+
+	std::cout << result.mName << ";" << result.mLevel << ";" << result.mIterations << ";" << result.mMedian << ";" << result.mMad << ";"
+		<< result.mMin << ";" << result.mMean << ";" << result.mStdDev << std::endl;
+	return result;
+}
+
+//Runs the microbenchmarks of one level
+static void micro_level(const std::string& levelPath, fphysicsruntime* runtime, std::vector<micro_result>& results)
+{
+	results.push_back(run_micro("parse_level_file", levelPath, MICRO_LOAD_SAMPLES, [&levelPath]() {
+		auto model = gvk::model_t::load_from_file(levelPath, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
+	}));
+	results.push_back(run_micro("load_scene_data", levelPath, MICRO_LOAD_SAMPLES, [&levelPath]() {
+		auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+	}));
+
+	auto scene = fscene::load_scene_data(levelPath, CHAR_PATH);
+	std::vector<fmodel>& models = scene->get_models();
+	std::vector<fmodel_gpu_data> gpuData;
+	gpuData.reserve(models.size());
+	results.push_back(run_micro("model_gpu_data_all_models", levelPath, MICRO_SAMPLES, [&models, &gpuData]() {
+		gpuData.clear();
+		for (const fmodel& model : models) {
+			gpuData.emplace_back(model);
+		}
+	}));
+	results.push_back(run_micro("scene_update_all_dirty", levelPath, MICRO_SAMPLES, [&scene, &models]() {
+		for (size_t i = 0; i < models.size(); ++i) {
+			scene->mark_model_dirty(i);
+		}
+		scene->update_model_data();
+	}));
+
+	//A player walking forward and turning around on the static level geometry
+	finput input;
+	input.start_scripted();
+	auto physics = std::make_unique<fphysicscontroller>(scene.get(), runtime);
+	physics->set_async(false);
+	for (fmodel& model : models) {
+		physics->create_rigid_static_for_triangle_mesh(&model);
+	}
+	physics->finish_static_actors();
+	auto player = std::make_unique<fplayercontrol>(physics.get(), scene.get(), &input, false, 1.5f);
+	results.push_back(run_micro("player_control_update", levelPath, MICRO_SAMPLES, [&input, &player]() {
+		input.script_frame(BENCH_STEP_SIZE, finput::key_bit(finput_key::w), glm::vec2(4.0f, 0.0f));
+		input.begin_frame();
+		player->pre_px_update(BENCH_STEP_SIZE);
+		player->post_px_update(BENCH_STEP_SIZE);
+		player->update(BENCH_STEP_SIZE);
+	}));
+	results.push_back(run_micro("physics_step", levelPath, MICRO_SAMPLES, [&physics]() {
+		physics->update(BENCH_STEP_SIZE);
+	}));
+	player->cleanup();
+	physics->cleanup();
+}
+
+//Writes the microbenchmark results as JSON. Throws a runtime_error if the file cannot be written.
+static void write_micro_json(const std::string& path, const std::vector<micro_result>& results)
+{
+	std::ofstream file(path);
+	if (!file) {
+		throw std::runtime_error("Could not write " + path);
+	}
+	std::time_t now = std::time(nullptr);
+	file << std::fixed << std::setprecision(3);
+	file << "{" << std::endl;
+	file << "  \"date\": \"" << std::put_time(std::gmtime(&now), "%Y-%m-%dT%H:%M:%SZ") << "\"," << std::endl;
+	file << "  \"threads\": " << fjobsystem::instance().worker_count() + 1 << "," << std::endl;
+	file << "  \"unit\": \"ns\"," << std::endl;
+	file << "  \"benchmarks\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const micro_result& r = results[i];
+		file << "    { \"name\": \"" << r.mName << "\", \"level\": \"" << r.mLevel << "\", \"iterations\": " << r.mIterations
+			<< ", \"median\": " << r.mMedian << ", \"mad\": " << r.mMad << ", \"min\": " << r.mMin << ", \"mean\": " << r.mMean
+			<< ", \"stddev\": " << r.mStdDev << ", \"samples\": [";
+		for (size_t j = 0; j < r.mSamples.size(); ++j) {
+			file << ((j > 0) ? ", " : "") << r.mSamples[j];
+		}
+		file << "] }" << ((i + 1 < results.size()) ? "," : "") << std::endl;
+	}
+	file << "  ]" << std::endl;
+	file << "}" << std::endl;
+}
+
+//Runs all microbenchmarks and writes them to the given JSON file
+static void run_micro_benchmarks(const std::vector<std::string>& levels, const std::string& jsonPath)
+{
+	fphysicsconfig physicsConfig;
+	physicsConfig.mConnectPvd = false;
+	physicsConfig.mCookingCacheDirectory = BENCH_COOKING_CACHE;
+	physicsConfig.mUseSnapshotFiles = false;
+	fphysicsruntime physicsRuntime(physicsConfig);
+
+	std::vector<micro_result> results;
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "name;level;iterations;median_ns;mad_ns;min_ns;mean_ns;stddev_ns" << std::endl;
+	for (const auto& level : levels) {
+		micro_level(level, &physicsRuntime, results);
+	}
+
+	//Level 1's score color (see flevel1logic::initialize)
+	hsvinterpolator interpolator;
+	interpolator.add_sample(0, glm::vec3(47, 0, 0.3));
+	interpolator.add_sample(1, glm::vec3(60, 1, 1));
+	float t = 0.0f;
+	glm::vec3 sum = glm::vec3(0.0f);
+	results.push_back(run_micro("hsv_interpolate", "", MICRO_SAMPLES, [&interpolator, &t, &sum]() {
+		t = (t > 1.2f) ? -0.2f : t + 0.001f;
+		sum += interpolator.interpolate(t);
+	}));
+	if (sum.x < 0.0f) {
+		//Keeps the interpolations from being optimized away
+		std::cout << sum.x << std::endl;
+	}
+
+	write_micro_json(jsonPath, results);
+	std::cout << "Written to " << jsonPath << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		std::vector<std::string> levels = { flevel1logic::level_path(), flevel2logic::level_path(), flevel3logic::level_path(), flevel4logic::level_path() };
+		if (argc > 1 && std::string(argv[1]) == "--micro") {
+			run_micro_benchmarks(levels, (argc > 2) ? argv[2] : MICRO_DEFAULT_JSON);
+			return 0;
+		}
+
+		//Worker counts: 0, 1, 3, 7, ... up to the hardware concurrency (the calling thread always helps, so threads = workers + 1)
+		size_t hardwareThreads = glm::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+		std::vector<size_t> threadCounts;
+		for (size_t threads = 1; threads < hardwareThreads; threads *= 2) {
+			threadCounts.push_back(threads);
+		}
+		threadCounts.push_back(hardwareThreads);
+
+		fphysicsconfig physicsConfig;
+		physicsConfig.mConnectPvd = false;
+		physicsConfig.mCookingCacheDirectory = BENCH_COOKING_CACHE;
+		physicsConfig.mUseSnapshotFiles = false;	//Only used by the snapshot benchmark
+
+		//Before the shared runtime is created
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "level_switch_runtime;switch_ms" << std::endl;
+		switch_result switchResult = benchmark_level_switches(levels, physicsConfig);
+		std::cout << "per_level;" << switchResult.mOwnRuntimeTime << std::endl << "shared;" << switchResult.mSharedRuntimeTime << std::endl << std::endl;
+
+		fphysicsruntime physicsRuntime(physicsConfig);
+
+		std::cout << "level;threads;load_ms;physics_step_ms" << std::endl;
+		for (size_t threads : threadCounts) {
+			fjobsystem::instance().set_worker_count(threads - 1);
+			for (const auto& level : levels) {
+				double loadTime = benchmark_load(level);
+				double stepTime = benchmark_physics(level, &physicsRuntime);
+				std::cout << level << ";" << threads << ";" << loadTime << ";" << stepTime << std::endl;
+			}
+		}
+
+		fjobsystem::instance().set_worker_count(hardwareThreads - 1);
+		std::cout << std::endl << "level;cook_ms;cached_ms" << std::endl;
+		for (const auto& level : levels) {
+			cooking_result result = benchmark_cooking(level, &physicsRuntime);
+			std::cout << level << ";" << result.mCookTime << ";" << result.mCachedTime << std::endl;
+		}
+
+		std::cout << std::endl << "level;load_ms;reset_ms;snapshot_load_ms;snapshot_reset_ms" << std::endl;
+		for (const auto& level : levels) {
+			snapshot_result result = benchmark_snapshots(level, &physicsRuntime);
+			std::cout << level << ";" << result.mLoadTime << ";" << result.mResetTime << ";" << result.mSnapshotLoadTime << ";" << result.mSnapshotResetTime << std::endl;
+		}
+		physicsRuntime.mConfig.mUseSnapshotFiles = false;
+
+		std::cout << std::endl << "broadphase;pruning_structure;insert_ms;raycasts_ms;sweeps_ms" << std::endl;
+		fphysicsconfig defaultConfig = physicsRuntime.mConfig;
+		std::vector<std::pair<PxBroadPhaseType::Enum, const char*>> broadPhases = { { PxBroadPhaseType::eSAP, "SAP" }, { PxBroadPhaseType::eMBP, "MBP" }, { PxBroadPhaseType::eABP, "ABP" } };
+		for (auto [broadPhase, name] : broadPhases) {
+			physicsRuntime.mConfig.mBroadPhase = broadPhase;
+			for (bool pruningStructure : { false, true }) {
+				static_result result = benchmark_statics(&physicsRuntime, pruningStructure);
+				std::cout << name << ";" << (pruningStructure ? "yes" : "no") << ";" << result.mInsertTime << ";" << result.mRaycastTime << ";" << result.mSweepTime << std::endl;
+			}
+		}
+		physicsRuntime.mConfig = defaultConfig;
+
+		std::cout << std::endl << "mirrors;individual_ms_per_step;batched_ms_per_step" << std::endl;
+		for (int count : { 100, 500, 1000 }) {
+			mirror_result result = benchmark_mirrors(&physicsRuntime, count);
+			std::cout << count << ";" << result.mIndividualTime << ";" << result.mBatchedTime << std::endl;
+		}
+
+		std::cout << std::endl << "movers;type;physics_step_ms;raycasts_ms" << std::endl;
+		for (int count : { 10, 100, 1000, 5000 }) {
+			for (bool kinematic : { false, true }) {
+				mover_result result = benchmark_movers(&physicsRuntime, count, kinematic);
+				std::cout << count << ";" << (kinematic ? "kinematic" : "static") << ";" << result.mStepTime << ";" << result.mRaycastTime << std::endl;
+			}
+		}
+
+		std::cout << std::endl << "level;threads;bvh_build_ms;mrays_per_s;mrays_per_s_per_thread;focus_hit_value" << std::endl;
+		for (size_t threads : threadCounts) {
+			fjobsystem::instance().set_worker_count(threads - 1);
+			for (const auto& level : levels) {
+				tracer_result result = benchmark_tracer(level);
+				std::cout << level << ";" << threads << ";" << result.mBuildTime << ";" << result.mRaysPerSecond / 1e6 << ";"
+					<< result.mRaysPerSecond / 1e6 / threads << ";" << result.mFocusHitValue << std::endl;
+			}
+		}
+		fjobsystem::instance().set_worker_count(hardwareThreads - 1);
+	}
+	catch (std::runtime_error& re)
+	{
+		LOG_ERROR_EM(re.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,412 @@
+#include "includes.h"
+#include <stb_image.h>	//The stb_image of Gears-Vk, which also loads the textures of fscene
+
+#define M_PI_F 3.14159265358979f
+
+//----------
+//---fimage---
+//----------
+
+void fimage::save_ppm(const std::string& path) const
+{
+	std::filesystem::path filePath(path);
+	if (filePath.has_parent_path()) {
+		std::error_code error;
+		std::filesystem::create_directories(filePath.parent_path(), error);
+	}
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+	file.write(reinterpret_cast<const char*>(mPixels.data()), mPixels.size() * sizeof(glm::u8vec3));
+	if (!file) {
+		throw std::runtime_error("Could not write image " + path);
+	}
+}
+
+fimage fimage::load_ppm(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::string magic;
+	uint32_t width = 0, height = 0, maxValue = 0;
+	file >> magic >> width >> height >> maxValue;
+	file.get();	//Single whitespace before the pixel data
+	if (!file || magic != "P6" || maxValue != 255) {
+		throw std::runtime_error("Could not read image " + path);
+	}
+	fimage image(width, height);
+	file.read(reinterpret_cast<char*>(image.mPixels.data()), image.mPixels.size() * sizeof(glm::u8vec3));
+	if (!file) {
+		throw std::runtime_error("Image " + path + " is incomplete");
+	}
+	return image;
+}
+
+fimage::difference fimage::compare(const fimage& a, const fimage& b, uint32_t tolerance, fimage* diff)
+{
+	if (a.mWidth != b.mWidth || a.mHeight != b.mHeight) {
+		throw std::runtime_error("Cannot compare images of different sizes (" + std::to_string(a.mWidth) + "x" + std::to_string(a.mHeight)
+			+ " and " + std::to_string(b.mWidth) + "x" + std::to_string(b.mHeight) + ")");
+	}
+	if (diff) {
+		*diff = fimage(a.mWidth, a.mHeight);
+	}
+	difference result;
+	double squaredSum = 0.0;
+	for (size_t i = 0; i < a.mPixels.size(); ++i) {
+		glm::ivec3 d = glm::abs(glm::ivec3(a.mPixels[i]) - glm::ivec3(b.mPixels[i]));
+		uint32_t maxChannel = static_cast<uint32_t>(glm::max(d.x, glm::max(d.y, d.z)));
+		squaredSum += double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z;
+		result.mMaxDifference = glm::max(result.mMaxDifference, maxChannel);
+		if (maxChannel > tolerance) {
+			++result.mBadPixels;
+		}
+		if (diff) {
+			diff->mPixels[i] = glm::u8vec3(glm::min(d * 4, glm::ivec3(255)));
+		}
+	}
+	result.mRmse = a.mPixels.empty() ? 0.0 : std::sqrt(squaredSum / double(3 * a.mPixels.size()));
+	return result;
+}
+
+//-----------------
+//---fcpurenderer---
+//-----------------
+
+//sRGB to linear, like the sampling of sRGB textures
+static float srgb_to_linear(float c)
+{
+	if (c <= 0.04045f) {
+		return c / 12.92f;
+	}
+	return std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+//gamma() of default.rgen
+static float gamma(float color)
+{
+	if (color <= 0.0031308f) {
+		return 12.92f * color;
+	}
+	return 1.055f * std::pow(color, 1.0f / 2.4f) - 0.055f;
+}
+
+//pow of the shaders: negative bases give NaN on the GPU, which max(..., 0) turns into 0
+static float shader_pow(float base, float exponent)
+{
+	return std::fmax(std::pow(base, exponent), 0.0f);
+}
+
+fcpurenderer::fcpurenderer(fscene* scene, const fcputracer* tracer) : mScene(scene), mTracer(tracer)
+{
+	//Same texture settings as fscene::create_gpu_data: diffuse textures in sRGB, normal maps linear
+	std::unordered_map<std::string, int> loadedTextures;
+	for (const gvk::material_config& config : scene->get_materials()) {
+		material mat;
+		mat.mDiffuse = glm::vec3(config.mDiffuseReflectivity);
+		mat.mAmbient = glm::vec3(config.mAmbientReflectivity);
+		mat.mSpecular = glm::vec3(config.mSpecularReflectivity);
+		mat.mShininess = config.mShininess;
+		mat.mReflectivity = config.mReflectivity;
+		if (!config.mDiffuseTex.empty()) {
+			mat.mDiffuseTexture = load_texture(config.mDiffuseTex, true, loadedTextures);
+		}
+		if (!config.mNormalsTex.empty()) {
+			mat.mNormalTexture = load_texture(config.mNormalsTex, false, loadedTextures);
+		}
+		mMaterials.push_back(mat);
+	}
+	mLights = scene->get_light_data();
+	mGradients = scene->get_perlin_gradients();
+}
+
+int fcpurenderer::load_texture(const std::string& path, bool srgb, std::unordered_map<std::string, int>& loaded)
+{
+	auto it = loaded.find(path);
+	if (it != loaded.end()) {
+		return it->second;
+	}
+	int width, height, channels;
+	stbi_set_flip_vertically_on_load(1);
+	stbi_uc* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+	stbi_set_flip_vertically_on_load(0);
+	if (!data) {
+		throw std::runtime_error("Could not load texture " + path);
+	}
+	texture tex;
+	tex.mWidth = static_cast<uint32_t>(width);
+	tex.mHeight = static_cast<uint32_t>(height);
+	tex.mTexels.resize(size_t(width) * height);
+	for (size_t i = 0; i < tex.mTexels.size(); ++i) {
+		glm::vec4 texel = glm::vec4(data[4 * i], data[4 * i + 1], data[4 * i + 2], data[4 * i + 3]) / 255.0f;
+		if (srgb) {
+			texel = glm::vec4(srgb_to_linear(texel.r), srgb_to_linear(texel.g), srgb_to_linear(texel.b), texel.a);
+		}
+		tex.mTexels[i] = texel;
+	}
+	stbi_image_free(data);
+	mTextures.push_back(std::move(tex));
+	int index = static_cast<int>(mTextures.size() - 1);
+	loaded[path] = index;
+	return index;
+}
+
+glm::vec4 fcpurenderer::texture::sample(const glm::vec2& uv) const
+{
+	if (!std::isfinite(uv.x) || !std::isfinite(uv.y)) {
+		return mTexels[0];
+	}
+	auto wrap = [](int64_t i, uint32_t size) {
+		int64_t m = i % int64_t(size);
+		return static_cast<uint32_t>(m < 0 ? m + size : m);
+	};
+	//Texel centers are at half-integer coordinates
+	float x = uv.x * mWidth - 0.5f;
+	float y = uv.y * mHeight - 0.5f;
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	uint32_t x0 = wrap(static_cast<int64_t>(fx), mWidth);
+	uint32_t x1 = wrap(static_cast<int64_t>(fx) + 1, mWidth);
+	uint32_t y0 = wrap(static_cast<int64_t>(fy), mHeight);
+	uint32_t y1 = wrap(static_cast<int64_t>(fy) + 1, mHeight);
+	float sx = x - fx;
+	float sy = y - fy;
+	glm::vec4 bottom = glm::mix(mTexels[size_t(y0) * mWidth + x0], mTexels[size_t(y0) * mWidth + x1], sx);
+	glm::vec4 top = glm::mix(mTexels[size_t(y1) * mWidth + x0], mTexels[size_t(y1) * mWidth + x1], sx);
+	return glm::mix(bottom, top, sy);
+}
+
+fimage fcpurenderer::render(const glm::mat4& cameraTransform, uint32_t width, uint32_t height, const ray_budget& budget, float fade) const
+{
+	fimage image(width, height);
+	float aspectRatio = float(width) / float(height);
+	glm::vec3 origin = glm::vec3(cameraTransform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	fjobsystem::instance().parallel_for(0, height, 1, [&](size_t y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			//Camera ray of default.rgen
+			glm::vec2 uv = (glm::vec2(float(x), float(y)) + glm::vec2(0.5f)) / glm::vec2(float(width), float(height));
+			glm::vec2 d = uv * 2.0f - 1.0f;
+			glm::vec3 viewDirection = glm::normalize(glm::vec3(d.x * aspectRatio, -d.y, -std::sqrt(3.0f)));
+			glm::vec3 direction = glm::normalize(glm::vec3(cameraTransform * glm::vec4(viewDirection, 1.0f)) - origin);
+
+			payload p;
+			p.mFocusRegion = std::fabs(d.x) < FOCUS_REGION_SIZE && std::fabs(d.y) < FOCUS_REGION_SIZE * aspectRatio;
+			p.mRecursions = p.mFocusRegion ? budget.mFocusDepth : budget.mPeripheryDepth;
+			trace(origin, direction, p, budget);
+
+			glm::vec3 color = p.mColor;
+			if (p.mFocusRegion) {
+				if (std::fabs(std::fabs(d.x) - FOCUS_REGION_SIZE) < 0.001f || std::fabs(std::fabs(d.y) - FOCUS_REGION_SIZE * aspectRatio) < 0.001f * aspectRatio) {
+					color -= glm::vec3(0.1f);
+				}
+				if (std::fabs(d.x) < 0.05f && std::fabs(d.y) < 0.001f * aspectRatio || std::fabs(d.y) < 0.05f * aspectRatio && std::fabs(d.x) < 0.001f) {
+					color += glm::vec3(0.2f);
+				}
+			}
+			color = (1.0f - fade) * color + fade * glm::vec3(1.0f, 1.0f, 0.21f);
+			color = glm::vec3(gamma(color.r), gamma(color.g), gamma(color.b));
+			//Conversion of the rgba8 storage image (NaN is stored as 0)
+			glm::vec3 stored = glm::vec3(std::fmax(color.r, 0.0f), std::fmax(color.g, 0.0f), std::fmax(color.b, 0.0f));
+			image.mPixels[y * width + x] = glm::u8vec3(glm::round(glm::min(stored, glm::vec3(1.0f)) * 255.0f));
+		}
+	});
+	return image;
+}
+
+void fcpurenderer::trace(const glm::vec3& origin, const glm::vec3& direction, payload& p, const ray_budget& budget) const
+{
+	auto& models = mScene->get_models();
+	fcputracer::hit h;
+	bool found = mTracer->trace_ray(origin, direction, CPU_RENDER_TMIN, CPU_RENDER_TMAX, false, [&](const fcputracer::hit& candidate) {
+		const fmodel& model = models[candidate.mModel];
+		const material& mat = mMaterials[model.mMaterialIndex];
+		surface s = get_surface(origin, direction, candidate);
+		//leaves.rahit: alpha test
+		if (model.mLeaf) {
+			return mat.mDiffuseTexture < 0 || mTextures[mat.mDiffuseTexture].sample(s.mUv).a > 0.1f;
+		}
+		//default.rahit: the focusphere and (in reflections) the character only tint the ray
+		glm::vec3 eye = glm::normalize(origin - s.mPosition);
+		int goalsphere = model.mFlags & 1;
+		float nl = glm::max(glm::dot(s.mNormal, eye), 0.0f);
+		bool accept = (goalsphere != 0 || p.mRenderCharacter) && nl > 0.01f;
+		if (accept && candidate.mT < p.mTransparentDist[goalsphere]) {
+			float tint = (goalsphere != 0) ? 2.0f * nl : 1.5f * std::exp(-6.0f * (nl - 1.0f) * (nl - 1.0f));
+			p.mTransparentColor[goalsphere] = tint * mat.mDiffuse;
+			p.mTransparentDist[goalsphere] = candidate.mT;
+		}
+		return false;
+	}, h);
+
+	//default.rmiss
+	if (!found) {
+		p.mColor = p.mTransparentColor[0] + p.mTransparentColor[1] + sky(direction);
+		return;
+	}
+
+	const fmodel& model = models[h.mModel];
+	const material& mat = mMaterials[model.mMaterialIndex];
+	surface s = get_surface(origin, direction, h);
+	glm::vec3 eye = glm::normalize(origin - s.mPosition);
+	glm::vec3 ambient = 0.9f * mat.mAmbient + 0.1f * glm::vec3(mScene->get_background_color());
+
+	//leaves.rchit: no normal mapping, no reflections, always shadowed
+	if (model.mLeaf) {
+		glm::vec3 texColor = (mat.mDiffuseTexture < 0) ? glm::vec3(1.0f) : glm::vec3(mTextures[mat.mDiffuseTexture].sample(s.mUv));
+		glm::vec3 dColor = mat.mDiffuse * texColor;
+		p.mColor = ambient * dColor + shade_lights(s.mPosition, eye, s.mNormal, dColor, mat, true);
+		return;
+	}
+
+	//default.rchit
+	glm::vec3 normal = s.mNormal;
+	if (mat.mNormalTexture >= 0) {
+		glm::vec3 bitangent = glm::cross(s.mNormal, s.mTangent);
+		glm::mat3 tbn = glm::mat3(s.mTangent, bitangent, s.mNormal);
+		glm::vec3 mapped = glm::normalize(glm::vec3(mTextures[mat.mNormalTexture].sample(s.mUv)) * 2.0f - 1.0f);
+		normal = glm::normalize(tbn * mapped);
+	}
+
+	glm::vec3 reflColor = glm::vec3(0.0f);
+	float reflCoeff = mat.mReflectivity;
+	float reflThroughput = p.mThroughput * reflCoeff;
+	//Outside the focus region, reflections only continue while they still contribute enough to the pixel
+	if (reflCoeff > 0.01f && p.mRecursions > 0 && (p.mFocusRegion || reflThroughput > budget.mMinThroughput)) {
+		payload reflection;
+		reflection.mThroughput = reflThroughput;
+		reflection.mRecursions = p.mRecursions - 1;
+		reflection.mRenderCharacter = true;
+		reflection.mFocusRegion = p.mFocusRegion;
+		trace(s.mPosition, glm::reflect(-eye, normal), reflection, budget);
+		reflColor = reflection.mColor;
+	}
+
+	glm::vec3 dColor = mat.mDiffuse;
+	if (mat.mDiffuseTexture >= 0) {
+		dColor *= glm::vec3(mTextures[mat.mDiffuseTexture].sample(s.mUv));
+	}
+	glm::vec3 ownColor = ambient * dColor + shade_lights(s.mPosition, eye, normal, dColor, mat, reflCoeff <= 0.5f);
+	if ((model.mFlags & 2) == 2 && reflCoeff < 0.01f) {
+		ownColor += glm::vec3(0.2f);
+	}
+
+	p.mColor = (1.0f - reflCoeff) * ownColor + reflCoeff * reflColor;
+	p.mColor += float(h.mT > p.mTransparentDist[0]) * p.mTransparentColor[0];
+	p.mColor += float(h.mT > p.mTransparentDist[1]) * p.mTransparentColor[1];
+}
+
+bool fcpurenderer::shadowed(const glm::vec3& origin, const glm::vec3& direction, float tMax) const
+{
+	//Back faces are culled, the focusphere and the character are ignored (shadowray.rahit) and the leaves alpha tested (leaves.rahit)
+	auto& models = mScene->get_models();
+	fcputracer::hit h;
+	return mTracer->trace_ray(origin, direction, CPU_RENDER_TMIN, tMax, true, [&](const fcputracer::hit& candidate) {
+		const fmodel& model = models[candidate.mModel];
+		const material& mat = mMaterials[model.mMaterialIndex];
+		if (!model.mLeaf) {
+			return false;
+		}
+		return mat.mDiffuseTexture < 0 || mTextures[mat.mDiffuseTexture].sample(get_surface(origin, direction, candidate).mUv).a > 0.1f;
+	}, h) && h.mT < tMax;
+}
+
+fcpurenderer::surface fcpurenderer::get_surface(const glm::vec3& origin, const glm::vec3& direction, const fcputracer::hit& h) const
+{
+	const fmodel& model = mScene->get_models()[h.mModel];
+	const glm::mat3& normalMatrix = mTracer->get_normal_matrix(h.mInstance);
+	uint32_t i0 = model.mIndices[3 * h.mTriangle];
+	uint32_t i1 = model.mIndices[3 * h.mTriangle + 1];
+	uint32_t i2 = model.mIndices[3 * h.mTriangle + 2];
+	glm::vec3 b = glm::vec3(1.0f - h.mBarycentrics.x - h.mBarycentrics.y, h.mBarycentrics.x, h.mBarycentrics.y);
+
+	surface s;
+	s.mPosition = origin + direction * h.mT;
+	glm::vec3 localNormal;
+	if (!model.mNormals.empty()) {
+		localNormal = b.x * model.mNormals[i0] + b.y * model.mNormals[i1] + b.z * model.mNormals[i2];
+	}
+	else {
+		localNormal = glm::cross(model.mPositions[i1] - model.mPositions[i0], model.mPositions[i2] - model.mPositions[i0]);
+	}
+	s.mNormal = glm::normalize(normalMatrix * localNormal);
+	glm::vec3 localTangent = model.mTangents.empty() ? glm::vec3(1.0f, 0.0f, 0.0f) : b.x * model.mTangents[i0] + b.y * model.mTangents[i1] + b.z * model.mTangents[i2];
+	s.mTangent = glm::normalize(normalMatrix * localTangent);
+	s.mUv = model.mTexCoords.empty() ? glm::vec2(0.0f) : b.x * model.mTexCoords[i0] + b.y * model.mTexCoords[i1] + b.z * model.mTexCoords[i2];
+	return s;
+}
+
+glm::vec3 fcpurenderer::shade_lights(const glm::vec3& position, const glm::vec3& eye, const glm::vec3& normal, const glm::vec3& color, const material& mat, bool checkShadows) const
+{
+	glm::vec3 result = glm::vec3(0.0f);
+	for (const gvk::lightsource_gpu_data& light : mLights) {
+		//phongPoint (type 2) and phongDirectional (type 1), other light types are ignored
+		glm::vec3 l;
+		glm::vec3 intensity = glm::vec3(light.mColor);
+		float shadowTMax;
+		if (light.mInfo.x == 2) {
+			l = glm::vec3(light.mPosition) - position;
+			float dist = glm::length(l);
+			l = glm::normalize(l);
+			shadowTMax = dist;
+			float att = light.mAttenuation.x + dist * light.mAttenuation.y + dist * dist * light.mAttenuation.z;
+			intensity /= att;
+		}
+		else if (light.mInfo.x == 1) {
+			l = glm::normalize(-glm::vec3(light.mDirection));
+			shadowTMax = 1000.0f;
+		}
+		else {
+			continue;
+		}
+
+		float shade = 1.0f;
+		if (checkShadows && shadowed(position, l, shadowTMax)) {
+			shade = 0.25f;
+		}
+		float nl = glm::max(glm::dot(normal, l), 0.0f);
+		glm::vec3 diffuse = color * intensity * nl;
+		float renderSpecular = float(shade > 0.99f) * float(nl > 0.0f);
+		glm::vec3 refl = glm::reflect(-l, normal);
+		float nr = shader_pow(glm::dot(eye, refl), mat.mShininess);
+		glm::vec3 specular = mat.mSpecular * intensity * nr * renderSpecular;
+		result += shade * (diffuse + specular);
+	}
+	return result;
+}
+
+glm::vec3 fcpurenderer::sky(const glm::vec3& direction) const
+{
+	float theta = std::acos(glm::clamp(direction.y, -1.0f, 1.0f));
+	float phi = std::atan2(direction.z, direction.x);
+	float alpha = 1.0f - glm::clamp(std::tan((theta - M_PI_F / 2.0f) / 1.2f), 0.0f, 1.0f);
+	glm::vec3 backgroundColor = alpha * glm::vec3(mScene->get_background_color());
+	float horizon = 1.9f * (theta - M_PI_F / 2.0f);
+	glm::vec3 color = glm::vec3(std::exp(-horizon * horizon) * 0.05f * (perlin(phi, theta, 1) + perlin(phi, theta, 2) + perlin(phi, theta, 4))) + backgroundColor;
+	//SRGBReverseGamma
+	color = glm::vec3(shader_pow(color.r, 2.2f), shader_pow(color.g, 2.2f), shader_pow(color.b, 2.2f));
+	return glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f));
+}
+
+float fcpurenderer::perlin(float phi, float theta, int level) const
+{
+	int lons = PERLIN_LONSEGS / level;
+	int lats = PERLIN_LATSEGS / level;
+	auto mod = [](float a, float b) { return a - b * std::floor(a / b); };
+	auto dotGridGradient = [&](int ix, int iy, float x, float y) {
+		float dx = x - ix;
+		float dy = y - iy;
+		int gx = (ix + level) % lons;
+		int gy = (iy + level) % lats;
+		size_t index = size_t(PERLIN_LATSEGS / level) * gx + 2 * gy;
+		return dx * mGradients[index] + dy * mGradients[index + 1];
+	};
+	float x = mod(phi / (2.0f * M_PI_F) * lons, float(lons));
+	float y = mod(theta / M_PI_F * lats, float(lats));
+	int x0 = int(x);
+	int x1 = x0 + 1;
+	int y0 = int(y);
+	int y1 = y0 + 1;
+	float sx = x - x0;
+	float sy = y - y0;
+	float ix0 = glm::mix(dotGridGradient(x0, y0, x, y), dotGridGradient(x1, y0, x, y), sx);
+	float ix1 = glm::mix(dotGridGradient(x0, y1, x, y), dotGridGradient(x1, y1, x, y), sx);
+	return glm::mix(ix0, ix1, sy);
+}
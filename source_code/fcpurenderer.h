@@ -0,0 +1,131 @@
+#pragma once
+#include "includes.h"
+
+#define CPU_RENDER_TMIN 0.001f		//Ray interval of the shaders
+#define CPU_RENDER_TMAX 100.0f
+#define CPU_RENDER_NO_HIT 200.0f	//Distance of a transparent hit that has not happened (transparentDist in the shaders)
+
+/*
+An 8-bit RGB image, which can be stored as binary PPM (P6)
+*/
+struct fimage {
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	std::vector<glm::u8vec3> mPixels;	//Row by row, starting at the top
+
+	//Differences between two images of the same size
+	struct difference {
+		double mRmse = 0.0;				//Root mean square error over all channels (0-255)
+		uint32_t mMaxDifference = 0;	//Largest difference of a channel (0-255)
+		uint64_t mBadPixels = 0;		//Number of pixels with a channel difference above the tolerance
+	};
+
+	fimage() {}
+	fimage(uint32_t width, uint32_t height) : mWidth(width), mHeight(height), mPixels(size_t(width) * height, glm::u8vec3(0)) {}
+
+	//Writes the image as PPM. Throws a runtime_error if the file cannot be written.
+	void save_ppm(const std::string& path) const;
+
+	//Reads a PPM written by save_ppm. Throws a runtime_error if the file cannot be read.
+	static fimage load_ppm(const std::string& path);
+
+	//Compares two images. Channel differences of at most tolerance are not counted as bad pixels.
+	//The difference image (written to diff, if given) shows the channel differences of every pixel scaled by 4.
+	//Throws a runtime_error if the image sizes differ.
+	static difference compare(const fimage& a, const fimage& b, uint32_t tolerance, fimage* diff = nullptr);
+};
+
+/*
+Reference renderer for the shading path of frenderer, running on the CPU (traces with fcputracer, in parallel on the job system).
+Mirrors default.rgen, default.rchit/.rahit/.rmiss, leaves.rchit/.rahit and the shadow rays ray by ray: the same camera rays, Phong
+shading with the lights of the light buffer and the material fields of the shaders, shadows, normal mapping, the Perlin sky,
+mirror recursion with the ray budget of the focus region and the periphery, the transparent focusphere and character, the focus
+region overlay, the fade and the gamma correction. Used to check changes to the shaders for visual equivalence without a ray
+tracing GPU (see the golden image test of focus_headless).
+Differences to the GPU: textures are sampled bilinearly from their full resolution (the GPU samples trilinearly from mipmaps),
+the materials are the loaded ones (changes through fscene::get_material_data are not seen), and a transparent model shows its
+closest accepted hit (on the GPU, the any-hit shaders keep the last one reported by the traversal).
+*/
+class fcpurenderer {
+public:
+	//Reflection recursion budget (as in frenderer's RayBudget uniform)
+	struct ray_budget {
+		uint32_t mFocusDepth = 4;		//Maximum reflection depth inside the central focus region
+		uint32_t mPeripheryDepth = 4;	//Maximum reflection depth outside the central focus region
+		float mMinThroughput = 0.05f;	//Reflections outside the focus region stop once the accumulated throughput drops below this
+	};
+
+	//The tracer has to be built and up to date with the scene (see fcputracer::update_instances).
+	//Loads the textures of the scene's materials, throws a runtime_error if one cannot be read.
+	fcpurenderer(fscene* scene, const fcputracer* tracer);
+
+	//Renders the scene from the given camera, fade as in frenderer::set_fade_value
+	fimage render(const glm::mat4& cameraTransform, uint32_t width, uint32_t height, const ray_budget& budget, float fade = 0.0f) const;
+
+private:
+	//A texture in linear color space
+	struct texture {
+		uint32_t mWidth = 0;
+		uint32_t mHeight = 0;
+		std::vector<glm::vec4> mTexels;	//Row by row, starting at the bottom (flipped on load like the textures of fscene)
+
+		//Bilinear lookup with repeat addressing
+		glm::vec4 sample(const glm::vec2& uv) const;
+	};
+
+	//Material fields used by the shaders
+	struct material {
+		glm::vec3 mDiffuse;
+		glm::vec3 mAmbient;
+		glm::vec3 mSpecular;
+		float mShininess;
+		float mReflectivity;
+		int mDiffuseTexture = -1;		//Index in mTextures, -1 = none
+		int mNormalTexture = -1;		//Index in mTextures, -1 = none
+	};
+
+	//Payload of a ray (RayTracingHit in the shaders)
+	struct payload {
+		glm::vec3 mColor = glm::vec3(0.0f);
+		glm::vec3 mTransparentColor[2] = { glm::vec3(0.0f), glm::vec3(0.0f) };	//0 = focusphere, 1 = character
+		float mTransparentDist[2] = { CPU_RENDER_NO_HIT, CPU_RENDER_NO_HIT };
+		float mThroughput = 1.0f;		//Accumulated reflection throughput
+		uint32_t mRecursions = 0;		//Remaining reflections
+		bool mRenderCharacter = false;
+		bool mFocusRegion = false;
+	};
+
+	//Shading data of a hit point
+	struct surface {
+		glm::vec3 mPosition;
+		glm::vec3 mNormal;				//Interpolated world space normal (without normal mapping)
+		glm::vec3 mTangent;				//Interpolated world space tangent
+		glm::vec2 mUv;
+	};
+
+	fscene* mScene;
+	const fcputracer* mTracer;
+	std::vector<material> mMaterials;
+	std::vector<texture> mTextures;
+	std::vector<gvk::lightsource_gpu_data> mLights;
+	std::vector<float> mGradients;		//Perlin gradients of the sky
+
+	//Loads a texture (once per path), returns its index in mTextures. srgb: convert the colors to linear space.
+	int load_texture(const std::string& path, bool srgb, std::unordered_map<std::string, int>& loaded);
+
+	//Traces a ray through the scene and fills the payload (traceRayEXT with the default hit group and miss shader)
+	void trace(const glm::vec3& origin, const glm::vec3& direction, payload& p, const ray_budget& budget) const;
+
+	//Returns true if a shadow ray towards a light is blocked (traceRayEXT with the shadow ray hit group)
+	bool shadowed(const glm::vec3& origin, const glm::vec3& direction, float tMax) const;
+
+	//Computes the interpolated surface data of a hit
+	surface get_surface(const glm::vec3& origin, const glm::vec3& direction, const fcputracer::hit& h) const;
+
+	//Phong shading of all lights (the light loop of default.rchit and leaves.rchit)
+	glm::vec3 shade_lights(const glm::vec3& position, const glm::vec3& eye, const glm::vec3& normal, const glm::vec3& color, const material& mat, bool checkShadows) const;
+
+	//Color of the sky in the given direction (default.rmiss without the transparent colors)
+	glm::vec3 sky(const glm::vec3& direction) const;
+	float perlin(float phi, float theta, int level) const;
+};
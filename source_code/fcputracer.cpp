@@ -0,0 +1,649 @@
+#include "includes.h"
+#include <stb_image.h>	//The stb_image of Gears-Vk, which also loads the textures of fscene
+
+//Node of the binary BVH, which is collapsed into the 4-wide BVH afterwards
+struct build_node {
+	glm::vec3 mMin, mMax;
+	uint32_t mLeft = 0, mRight = 0;		//Children (inner nodes)
+	uint32_t mFirst = 0, mCount = 0;	//Primitives (leaves, mCount > 0)
+};
+
+static float surface_area(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+//Builds the binary BVH over the primitives order[first, first + count) and returns the index of its root
+static uint32_t build_binary(std::vector<build_node>& nodes, std::vector<uint32_t>& order, const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs,
+	const std::vector<glm::vec3>& centroids, uint32_t first, uint32_t count)
+{
+	build_node node;
+	node.mMin = glm::vec3(std::numeric_limits<float>::max());
+	node.mMax = glm::vec3(-std::numeric_limits<float>::max());
+	glm::vec3 centroidMin = node.mMin;
+	glm::vec3 centroidMax = node.mMax;
+	for (uint32_t i = first; i < first + count; ++i) {
+		node.mMin = glm::min(node.mMin, mins[order[i]]);
+		node.mMax = glm::max(node.mMax, maxs[order[i]]);
+		centroidMin = glm::min(centroidMin, centroids[order[i]]);
+		centroidMax = glm::max(centroidMax, centroids[order[i]]);
+	}
+	uint32_t index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(node);
+	if (count <= CPU_BVH_LEAF_SIZE) {
+		nodes[index].mFirst = first;
+		nodes[index].mCount = count;
+		return index;
+	}
+
+	//Find the cheapest split plane over all axes with binning
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestBin = 0;
+	glm::vec3 extent = centroidMax - centroidMin;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (extent[axis] <= 0.0f) {
+			continue;
+		}
+		glm::vec3 binMin[CPU_BVH_BINS], binMax[CPU_BVH_BINS];
+		uint32_t binCount[CPU_BVH_BINS] = {};
+		for (int b = 0; b < CPU_BVH_BINS; ++b) {
+			binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+			binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+		}
+		float scale = CPU_BVH_BINS / extent[axis];
+		for (uint32_t i = first; i < first + count; ++i) {
+			int b = glm::min(static_cast<int>((centroids[order[i]][axis] - centroidMin[axis]) * scale), CPU_BVH_BINS - 1);
+			++binCount[b];
+			binMin[b] = glm::min(binMin[b], mins[order[i]]);
+			binMax[b] = glm::max(binMax[b], maxs[order[i]]);
+		}
+		//Sweep from the right to get the costs of the right sides, then from the left
+		float rightArea[CPU_BVH_BINS];
+		uint32_t rightCount[CPU_BVH_BINS];
+		glm::vec3 accMin = glm::vec3(std::numeric_limits<float>::max()), accMax = glm::vec3(-std::numeric_limits<float>::max());
+		uint32_t accCount = 0;
+		for (int b = CPU_BVH_BINS - 1; b > 0; --b) {
+			accMin = glm::min(accMin, binMin[b]);
+			accMax = glm::max(accMax, binMax[b]);
+			accCount += binCount[b];
+			rightArea[b] = surface_area(accMin, accMax);
+			rightCount[b] = accCount;
+		}
+		accMin = glm::vec3(std::numeric_limits<float>::max());
+		accMax = glm::vec3(-std::numeric_limits<float>::max());
+		accCount = 0;
+		for (int b = 0; b < CPU_BVH_BINS - 1; ++b) {
+			accMin = glm::min(accMin, binMin[b]);
+			accMax = glm::max(accMax, binMax[b]);
+			accCount += binCount[b];
+			if (accCount == 0 || rightCount[b + 1] == 0) {
+				continue;
+			}
+			float cost = surface_area(accMin, accMax) * accCount + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	uint32_t middle;
+	if (bestAxis >= 0) {
+		float scale = CPU_BVH_BINS / extent[bestAxis];
+		auto it = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t p) {
+			return glm::min(static_cast<int>((centroids[p][bestAxis] - centroidMin[bestAxis]) * scale), CPU_BVH_BINS - 1) <= bestBin;
+		});
+		middle = static_cast<uint32_t>(it - order.begin());
+	}
+	else {
+		//All centroids at the same position -> split by count
+		middle = first + count / 2;
+	}
+	uint32_t left = build_binary(nodes, order, mins, maxs, centroids, first, middle - first);
+	uint32_t right = build_binary(nodes, order, mins, maxs, centroids, middle, first + count - middle);
+	nodes[index].mLeft = left;
+	nodes[index].mRight = right;
+	return index;
+}
+
+fcputracer::fcputracer(fscene* scene)
+{
+	mScene = scene;
+	mYawRotating.resize(scene->get_models().size(), false);
+}
+
+void fcputracer::build()
+{
+	auto start = std::chrono::steady_clock::now();
+	auto& models = mScene->get_models();
+	auto meshes = std::make_shared<std::vector<mesh>>(models.size());
+	//The models are independent -> one job per model
+	fjobsystem::instance().parallel_for(0, models.size(), 1, [&meshes, &models](size_t m) {
+		const fmodel& model = models[m];
+		mesh& target = (*meshes)[m];
+		size_t triangleCount = model.mIndices.size() / 3;
+		std::vector<glm::vec3> mins(triangleCount), maxs(triangleCount);
+		target.mMin = glm::vec3(std::numeric_limits<float>::max());
+		target.mMax = glm::vec3(-std::numeric_limits<float>::max());
+		for (size_t t = 0; t < triangleCount; ++t) {
+			const glm::vec3& a = model.mPositions[model.mIndices[3 * t]];
+			const glm::vec3& b = model.mPositions[model.mIndices[3 * t + 1]];
+			const glm::vec3& c = model.mPositions[model.mIndices[3 * t + 2]];
+			mins[t] = glm::min(a, glm::min(b, c));
+			maxs[t] = glm::max(a, glm::max(b, c));
+			target.mMin = glm::min(target.mMin, mins[t]);
+			target.mMax = glm::max(target.mMax, maxs[t]);
+		}
+		target.mBvh = build_bvh(mins, maxs);
+		//Store the triangles in leaf order, such that a leaf reads consecutive memory
+		target.mTriangles.resize(triangleCount);
+		for (size_t i = 0; i < triangleCount; ++i) {
+			uint32_t t = target.mBvh.mPrimitives[i];
+			const glm::vec3& a = model.mPositions[model.mIndices[3 * t]];
+			const glm::vec3& b = model.mPositions[model.mIndices[3 * t + 1]];
+			const glm::vec3& c = model.mPositions[model.mIndices[3 * t + 2]];
+			target.mTriangles[i] = { a, b - a, c - a, t };
+		}
+	});
+	mMeshes = meshes;
+	//Alpha masks of the leaves for the focus query (once per texture)
+	auto& materials = mScene->get_materials();
+	auto masks = std::make_shared<std::vector<alpha_mask>>();
+	std::unordered_map<std::string, int> loaded;
+	mAlphaMaskOfMaterial.assign(materials.size(), -1);
+	for (const fmodel& model : models) {
+		const std::string& path = materials[model.mMaterialIndex].mDiffuseTex;
+		if (!model.mLeaf || path.empty() || mAlphaMaskOfMaterial[model.mMaterialIndex] >= 0) {
+			continue;
+		}
+		auto it = loaded.find(path);
+		if (it == loaded.end()) {
+			int width, height, channels;
+			stbi_set_flip_vertically_on_load(1);
+			stbi_uc* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+			stbi_set_flip_vertically_on_load(0);
+			if (!data) {
+				throw std::runtime_error("Could not load texture " + path);
+			}
+			alpha_mask mask;
+			mask.mWidth = static_cast<uint32_t>(width);
+			mask.mHeight = static_cast<uint32_t>(height);
+			mask.mAlpha.resize(size_t(width) * height);
+			for (size_t i = 0; i < mask.mAlpha.size(); ++i) {
+				mask.mAlpha[i] = data[4 * i + 3];
+			}
+			stbi_image_free(data);
+			masks->push_back(std::move(mask));
+			it = loaded.emplace(path, static_cast<int>(masks->size() - 1)).first;
+		}
+		mAlphaMaskOfMaterial[model.mMaterialIndex] = it->second;
+	}
+	mAlphaMasks = masks;
+	mBuildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	update_instances();
+	LOG_INFO("Built the CPU ray tracing BVHs of " + std::to_string(models.size()) + " models in " + std::to_string(mBuildTime) + " ms");
+}
+
+void fcputracer::update_instances()
+{
+	auto start = std::chrono::steady_clock::now();
+	auto& models = mScene->get_models();
+	auto& materials = mScene->get_materials();
+	mInstances.clear();
+	mInstanceOfModel.assign(models.size(), SIZE_MAX);
+	std::vector<glm::vec3> mins, maxs;
+	for (const fmodel& model : models) {
+		//Transparent models are invisible to the focus query, except the focusphere (marks the ray) and the leaves (alpha tested)
+		bool focusphere = (model.mFlags & 1) != 0;
+		bool opaque = !model.mTransparent || model.mLeaf;
+		const mesh& m = (*mMeshes)[model.mModelIndex];
+		if (m.mTriangles.empty()) {
+			continue;
+		}
+		instance inst;
+		inst.mModel = model.mModelIndex;
+		inst.mWorldToObject = glm::inverse(model.mTransformation);
+		inst.mNormalMatrix = glm::mat3(glm::transpose(inst.mWorldToObject));
+		inst.mOpaque = opaque && !focusphere;
+		inst.mFocusphere = focusphere;
+		inst.mAnyHit = model.mTransparent || model.mLeaf;
+		inst.mAlphaMask = model.mLeaf && model.mMaterialIndex < mAlphaMaskOfMaterial.size() ? mAlphaMaskOfMaterial[model.mMaterialIndex] : -1;
+		inst.mReflectivity = materials[model.mMaterialIndex].mReflectivity;
+		mInstanceOfModel[model.mModelIndex] = mInstances.size();
+		mInstances.push_back(inst);
+
+		glm::vec3 worldMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 worldMax = glm::vec3(-std::numeric_limits<float>::max());
+		for (int corner = 0; corner < 8; ++corner) {
+			glm::vec3 p = glm::vec3((corner & 1) ? m.mMax.x : m.mMin.x, (corner & 2) ? m.mMax.y : m.mMin.y, (corner & 4) ? m.mMax.z : m.mMin.z);
+			glm::vec3 world = glm::vec3(model.mTransformation * glm::vec4(p, 1.0f));
+			worldMin = glm::min(worldMin, world);
+			worldMax = glm::max(worldMax, world);
+		}
+		if (mYawRotating[model.mModelIndex]) {
+			//Circle around the rotation axis that contains all rotated corners
+			glm::vec3 pivot = glm::vec3(model.mTransformation[3]);
+			float radius = 0.0f;
+			for (int corner = 0; corner < 8; ++corner) {
+				glm::vec3 p = glm::vec3((corner & 1) ? m.mMax.x : m.mMin.x, (corner & 2) ? m.mMax.y : m.mMin.y, (corner & 4) ? m.mMax.z : m.mMin.z);
+				glm::vec3 world = glm::vec3(model.mTransformation * glm::vec4(p, 1.0f));
+				radius = glm::max(radius, glm::length(glm::vec2(world.x - pivot.x, world.z - pivot.z)));
+			}
+			worldMin = glm::vec3(pivot.x - radius, worldMin.y, pivot.z - radius);
+			worldMax = glm::vec3(pivot.x + radius, worldMax.y, pivot.z + radius);
+		}
+		mins.push_back(worldMin);
+		maxs.push_back(worldMax);
+	}
+	mInstanceBvh = build_bvh(mins, maxs);
+	mUpdateTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void fcputracer::set_yaw_rotating(size_t modelIndex)
+{
+	mYawRotating[modelIndex] = true;
+}
+
+void fcputracer::set_yaw(size_t modelIndex, float angle)
+{
+	assert(mYawRotating[modelIndex]);
+	size_t instanceIndex = mInstanceOfModel[modelIndex];
+	if (instanceIndex == SIZE_MAX) {
+		return;
+	}
+	//Rotation around the model's origin: the translation stays the same
+	const glm::mat4& transformation = mScene->get_models()[modelIndex].mTransformation;
+	glm::mat4 rotated = glm::mat4_cast(glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f))) * transformation;
+	rotated[3] = transformation[3];
+	instance& inst = mInstances[instanceIndex];
+	inst.mWorldToObject = glm::inverse(rotated);
+	inst.mNormalMatrix = glm::mat3(glm::transpose(inst.mWorldToObject));
+}
+
+fcputracer::bvh4 fcputracer::build_bvh(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs)
+{
+	bvh4 result;
+	uint32_t count = static_cast<uint32_t>(mins.size());
+	std::vector<glm::vec3> centroids(count);
+	result.mPrimitives.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		centroids[i] = 0.5f * (mins[i] + maxs[i]);
+		result.mPrimitives[i] = i;
+	}
+	std::vector<build_node> nodes;
+	nodes.reserve(count > 0 ? 2 * count : 1);
+	if (count > 0) {
+		build_binary(nodes, result.mPrimitives, mins, maxs, centroids, 0, count);
+	}
+
+	//Collapse: every 4-wide node takes the (up to) four largest descendants of a binary node as children
+	uint32_t depth = 0;
+	std::function<int32_t(std::vector<uint32_t>, uint32_t)> collapse = [&](std::vector<uint32_t> children, uint32_t level) -> int32_t {
+		depth = glm::max(depth, level);
+		//Open the largest inner nodes until there are four children
+		while (children.size() < 4) {
+			int best = -1;
+			float bestArea = -1.0f;
+			for (size_t c = 0; c < children.size(); ++c) {
+				const build_node& b = nodes[children[c]];
+				float area = surface_area(b.mMin, b.mMax);
+				if (b.mCount == 0 && area > bestArea) {
+					best = static_cast<int>(c);
+					bestArea = area;
+				}
+			}
+			if (best < 0) {
+				break;
+			}
+			uint32_t opened = children[best];
+			children[best] = nodes[opened].mLeft;
+			children.push_back(nodes[opened].mRight);
+		}
+
+		int32_t index = static_cast<int32_t>(result.mNodes.size());
+		result.mNodes.emplace_back();
+		float minX[4], minY[4], minZ[4], maxX[4], maxY[4], maxZ[4];
+		int32_t child[4];
+		uint32_t childCount[4];
+		for (size_t c = 0; c < 4; ++c) {
+			if (c >= children.size()) {
+				//Empty child: inverted bounds are never hit
+				minX[c] = minY[c] = minZ[c] = std::numeric_limits<float>::infinity();
+				maxX[c] = maxY[c] = maxZ[c] = -std::numeric_limits<float>::infinity();
+				child[c] = -1;
+				childCount[c] = 0;
+				continue;
+			}
+			const build_node& b = nodes[children[c]];
+			minX[c] = b.mMin.x; minY[c] = b.mMin.y; minZ[c] = b.mMin.z;
+			maxX[c] = b.mMax.x; maxY[c] = b.mMax.y; maxZ[c] = b.mMax.z;
+			if (b.mCount > 0) {
+				child[c] = static_cast<int32_t>(b.mFirst);
+				childCount[c] = b.mCount;
+			}
+			else {
+				child[c] = collapse({ b.mLeft, b.mRight }, level + 1);
+				childCount[c] = 0;
+			}
+		}
+		//The node vector may have grown in the meantime
+		bvh4_node& node = result.mNodes[index];
+		node.mMinX = _mm_loadu_ps(minX); node.mMinY = _mm_loadu_ps(minY); node.mMinZ = _mm_loadu_ps(minZ);
+		node.mMaxX = _mm_loadu_ps(maxX); node.mMaxY = _mm_loadu_ps(maxY); node.mMaxZ = _mm_loadu_ps(maxZ);
+		for (int c = 0; c < 4; ++c) {
+			node.mChild[c] = child[c];
+			node.mCount[c] = childCount[c];
+		}
+		return index;
+	};
+	//The root is a single leaf for very small primitive counts
+	collapse(nodes.empty() ? std::vector<uint32_t>() : std::vector<uint32_t>{ 0 }, 1);
+	//Every visited node replaces itself by at most four children on the stack
+	result.mStackSize = 3 * depth + 1;
+	return result;
+}
+
+fcputracer::ray fcputracer::make_ray(const glm::vec3& origin, const glm::vec3& direction)
+{
+	ray r;
+	r.mOrigin = origin;
+	r.mDirection = direction;
+	r.mOriginX = _mm_set1_ps(origin.x);
+	r.mOriginY = _mm_set1_ps(origin.y);
+	r.mOriginZ = _mm_set1_ps(origin.z);
+	r.mInvDirX = _mm_set1_ps(1.0f / direction.x);
+	r.mInvDirY = _mm_set1_ps(1.0f / direction.y);
+	r.mInvDirZ = _mm_set1_ps(1.0f / direction.z);
+	return r;
+}
+
+int fcputracer::intersect_children(const bvh4_node& node, const ray& r, float tMin, float tMax, float* tEntry)
+{
+	//Slab test of all four boxes at once. The near plane depends on the direction's sign, such that empty (inverted) boxes are never hit.
+	//A ray parallel to a slab that starts on one of its planes gives 0 * inf = NaN. _mm_max_ps/_mm_min_ps return the second operand
+	//if one is NaN, so each slab is passed first and the interval (which starts from tMin/tMax and is never NaN) second:
+	//a NaN slab does not restrict the interval, i.e. the ray counts as inside the slab.
+	bool negX = _mm_cvtss_f32(r.mInvDirX) < 0.0f;
+	bool negY = _mm_cvtss_f32(r.mInvDirY) < 0.0f;
+	bool negZ = _mm_cvtss_f32(r.mInvDirZ) < 0.0f;
+	__m128 nearX = _mm_mul_ps(_mm_sub_ps(negX ? node.mMaxX : node.mMinX, r.mOriginX), r.mInvDirX);
+	__m128 nearY = _mm_mul_ps(_mm_sub_ps(negY ? node.mMaxY : node.mMinY, r.mOriginY), r.mInvDirY);
+	__m128 nearZ = _mm_mul_ps(_mm_sub_ps(negZ ? node.mMaxZ : node.mMinZ, r.mOriginZ), r.mInvDirZ);
+	__m128 farX = _mm_mul_ps(_mm_sub_ps(negX ? node.mMinX : node.mMaxX, r.mOriginX), r.mInvDirX);
+	__m128 farY = _mm_mul_ps(_mm_sub_ps(negY ? node.mMinY : node.mMaxY, r.mOriginY), r.mInvDirY);
+	__m128 farZ = _mm_mul_ps(_mm_sub_ps(negZ ? node.mMinZ : node.mMaxZ, r.mOriginZ), r.mInvDirZ);
+	__m128 tNear = _mm_max_ps(nearZ, _mm_max_ps(nearY, _mm_max_ps(nearX, _mm_set1_ps(tMin))));
+	__m128 tFar = _mm_min_ps(farZ, _mm_min_ps(farY, _mm_min_ps(farX, _mm_set1_ps(tMax))));
+	_mm_storeu_ps(tEntry, tNear);
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+template <bool AnyHit, typename Accept>
+bool fcputracer::intersect_mesh(const mesh& m, const ray& r, float tMin, float& tMax, bool cullBackFaces, hit& candidate, hit* result, Accept accept) const
+{
+	//Degenerate geometry can give BVHs that are too deep for the fixed stack, they are traversed with a stack on the heap
+	int32_t fixedStack[CPU_BVH_STACK_SIZE];
+	std::vector<int32_t> heapStack;
+	int32_t* stack = fixedStack;
+	if (m.mBvh.mStackSize > CPU_BVH_STACK_SIZE) {
+		heapStack.resize(m.mBvh.mStackSize);
+		stack = heapStack.data();
+	}
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	bool found = false;
+	while (stackSize > 0) {
+		const bvh4_node& node = m.mBvh.mNodes[stack[--stackSize]];
+		float tEntry[4];
+		int mask = intersect_children(node, r, tMin, tMax, tEntry);
+		if (mask == 0) {
+			continue;
+		}
+		//Leaves first (they may shorten the ray), then push the inner nodes, farthest first, such that the nearest is visited next
+		int inner[4];
+		int innerCount = 0;
+		for (int c = 0; c < 4; ++c) {
+			if ((mask & (1 << c)) == 0) {
+				continue;
+			}
+			if (node.mCount[c] == 0) {
+				int i = innerCount++;
+				while (i > 0 && tEntry[inner[i - 1]] < tEntry[c]) {
+					inner[i] = inner[i - 1];
+					--i;
+				}
+				inner[i] = c;
+				continue;
+			}
+			for (uint32_t k = 0; k < node.mCount[c]; ++k) {
+				const triangle& tri = m.mTriangles[node.mChild[c] + k];
+				//Moeller-Trumbore, both sides unless culled (det < 0: the ray runs along the triangle's normal, i.e. hits its back face)
+				glm::vec3 p = glm::cross(r.mDirection, tri.mE2);
+				float det = glm::dot(tri.mE1, p);
+				if (std::fabs(det) < 1e-12f || (cullBackFaces && det < 0.0f)) {
+					continue;
+				}
+				float invDet = 1.0f / det;
+				glm::vec3 s = r.mOrigin - tri.mV0;
+				float u = glm::dot(s, p) * invDet;
+				if (u < 0.0f || u > 1.0f) {
+					continue;
+				}
+				glm::vec3 q = glm::cross(s, tri.mE1);
+				float v = glm::dot(r.mDirection, q) * invDet;
+				if (v < 0.0f || u + v > 1.0f) {
+					continue;
+				}
+				float t = glm::dot(tri.mE2, q) * invDet;
+				if (t < tMin || t > tMax) {
+					continue;
+				}
+				candidate.mT = t;
+				candidate.mTriangle = tri.mIndex;
+				candidate.mBarycentrics = glm::vec2(u, v);
+				if (!accept(candidate)) {
+					continue;
+				}
+				found = true;
+				if constexpr (AnyHit) {
+					return true;
+				}
+				tMax = t;
+				*result = candidate;
+			}
+		}
+		for (int i = 0; i < innerCount; ++i) {
+			assert(stackSize < static_cast<int>(m.mBvh.mStackSize));
+			stack[stackSize++] = node.mChild[inner[i]];
+		}
+	}
+	return found;
+}
+
+template <bool AnyHit, typename Filter, typename Accept>
+bool fcputracer::intersect(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, bool cullBackFaces, hit* result, Filter filter, Accept accept) const
+{
+	ray worldRay = make_ray(origin, direction);
+	//See intersect_mesh
+	int32_t fixedStack[CPU_BVH_STACK_SIZE];
+	std::vector<int32_t> heapStack;
+	int32_t* stack = fixedStack;
+	if (mInstanceBvh.mStackSize > CPU_BVH_STACK_SIZE) {
+		heapStack.resize(mInstanceBvh.mStackSize);
+		stack = heapStack.data();
+	}
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	bool found = false;
+	while (stackSize > 0) {
+		const bvh4_node& node = mInstanceBvh.mNodes[stack[--stackSize]];
+		float tEntry[4];
+		int mask = intersect_children(node, worldRay, tMin, tMax, tEntry);
+		for (int c = 0; c < 4; ++c) {
+			if ((mask & (1 << c)) == 0) {
+				continue;
+			}
+			if (node.mCount[c] == 0) {
+				assert(stackSize < static_cast<int>(mInstanceBvh.mStackSize));
+				stack[stackSize++] = node.mChild[c];
+				continue;
+			}
+			for (uint32_t k = 0; k < node.mCount[c]; ++k) {
+				size_t instanceIndex = mInstanceBvh.mPrimitives[node.mChild[c] + k];
+				const instance& inst = mInstances[instanceIndex];
+				if (!filter(inst)) {
+					continue;
+				}
+				//The direction is not normalized in object space, such that the distances stay the same
+				ray objectRay = make_ray(glm::vec3(inst.mWorldToObject * glm::vec4(origin, 1.0f)), glm::mat3(inst.mWorldToObject) * direction);
+				hit candidate;
+				candidate.mModel = inst.mModel;
+				candidate.mInstance = instanceIndex;
+				if (intersect_mesh<AnyHit>((*mMeshes)[inst.mModel], objectRay, tMin, tMax, cullBackFaces, candidate, result,
+					[&inst, &accept](const hit& h) { return accept(inst, h); })) {
+					found = true;
+					if constexpr (AnyHit) {
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return found;
+}
+
+bool fcputracer::closest_hit(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, hit& result) const
+{
+	return intersect<false>(origin, direction, tMin, tMax, false, &result,
+		[](const instance& inst) { return inst.mOpaque; },
+		[this](const instance& inst, const hit& h) { return inst.mAlphaMask < 0 || alpha_test(inst, h); });
+}
+
+bool fcputracer::trace_ray(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, bool cullBackFaces,
+	const std::function<bool(const hit&)>& anyHit, hit& result) const
+{
+	return intersect<false>(origin, direction, tMin, tMax, cullBackFaces, &result,
+		[](const instance&) { return true; },
+		[&anyHit](const instance& inst, const hit& h) { return !inst.mAnyHit || anyHit(h); });
+}
+
+bool fcputracer::hits_focusphere(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax) const
+{
+	//default.rahit only accepts the focusphere where its normal faces the eye (nl > 0.01)
+	glm::vec3 eye = -glm::normalize(direction);
+	return intersect<true>(origin, direction, tMin, tMax, false, nullptr,
+		[](const instance& inst) { return inst.mFocusphere; },
+		[this, &eye](const instance&, const hit& h) { return glm::dot(shading_normal(h), eye) > 0.01f; });
+}
+
+bool fcputracer::alpha_test(const instance& inst, const hit& h) const
+{
+	const fmodel& model = mScene->get_models()[h.mModel];
+	if (model.mTexCoords.empty()) {
+		return true;
+	}
+	const glm::vec2& uv0 = model.mTexCoords[model.mIndices[3 * h.mTriangle]];
+	const glm::vec2& uv1 = model.mTexCoords[model.mIndices[3 * h.mTriangle + 1]];
+	const glm::vec2& uv2 = model.mTexCoords[model.mIndices[3 * h.mTriangle + 2]];
+	glm::vec2 uv = (1.0f - h.mBarycentrics.x - h.mBarycentrics.y) * uv0 + h.mBarycentrics.x * uv1 + h.mBarycentrics.y * uv2;
+	return (*mAlphaMasks)[inst.mAlphaMask].sample(uv) > 0.1f;
+}
+
+float fcputracer::alpha_mask::sample(const glm::vec2& uv) const
+{
+	if (!std::isfinite(uv.x) || !std::isfinite(uv.y)) {
+		return mAlpha[0] / 255.0f;
+	}
+	auto wrap = [](int64_t i, uint32_t size) {
+		int64_t m = i % int64_t(size);
+		return static_cast<uint32_t>(m < 0 ? m + size : m);
+	};
+	//Texel centers are at half-integer coordinates
+	float x = uv.x * mWidth - 0.5f;
+	float y = uv.y * mHeight - 0.5f;
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	uint32_t x0 = wrap(static_cast<int64_t>(fx), mWidth);
+	uint32_t x1 = wrap(static_cast<int64_t>(fx) + 1, mWidth);
+	uint32_t y0 = wrap(static_cast<int64_t>(fy), mHeight);
+	uint32_t y1 = wrap(static_cast<int64_t>(fy) + 1, mHeight);
+	float sx = x - fx;
+	float sy = y - fy;
+	float bottom = glm::mix(float(mAlpha[size_t(y0) * mWidth + x0]), float(mAlpha[size_t(y0) * mWidth + x1]), sx);
+	float top = glm::mix(float(mAlpha[size_t(y1) * mWidth + x0]), float(mAlpha[size_t(y1) * mWidth + x1]), sx);
+	return glm::mix(bottom, top, sy) / 255.0f;
+}
+
+glm::vec3 fcputracer::shading_normal(const hit& h) const
+{
+	const fmodel& model = mScene->get_models()[h.mModel];
+	glm::vec3 localNormal;
+	if (!model.mNormals.empty()) {
+		const glm::vec3& n0 = model.mNormals[model.mIndices[3 * h.mTriangle]];
+		const glm::vec3& n1 = model.mNormals[model.mIndices[3 * h.mTriangle + 1]];
+		const glm::vec3& n2 = model.mNormals[model.mIndices[3 * h.mTriangle + 2]];
+		localNormal = (1.0f - h.mBarycentrics.x - h.mBarycentrics.y) * n0 + h.mBarycentrics.x * n1 + h.mBarycentrics.y * n2;
+	}
+	else {
+		const glm::vec3& a = model.mPositions[model.mIndices[3 * h.mTriangle]];
+		const glm::vec3& b = model.mPositions[model.mIndices[3 * h.mTriangle + 1]];
+		const glm::vec3& c = model.mPositions[model.mIndices[3 * h.mTriangle + 2]];
+		localNormal = glm::cross(b - a, c - a);
+	}
+	return glm::normalize(mInstances[h.mInstance].mNormalMatrix * localNormal);
+}
+
+bool fcputracer::trace_focus_ray(const glm::vec3& origin, const glm::vec3& direction, uint32_t maxDepth) const
+{
+	glm::vec3 o = origin;
+	glm::vec3 d = direction;
+	for (uint32_t depth = maxDepth + 1; depth > 0; --depth) {
+		//Same ray interval as the shaders
+		hit h;
+		bool opaqueHit = closest_hit(o, d, 0.001f, 100.0f, h);
+		//The focusphere is seen if it is in front of the closest opaque surface (default.rahit marks the ray and ignores the hit)
+		if (hits_focusphere(o, d, 0.001f, opaqueHit ? h.mT : 100.0f)) {
+			return true;
+		}
+		if (!opaqueHit) {
+			return false;
+		}
+		//Mirror reflection like in focusquery.rchit
+		const instance* inst = &mInstances[h.mInstance];
+		if (inst->mReflectivity <= 0.01f || depth == 1) {
+			return false;
+		}
+		glm::vec3 normal = shading_normal(h);
+		o = o + d * h.mT;
+		d = glm::reflect(d, normal);
+	}
+	return false;
+}
+
+double fcputracer::compute_focus_hit_value(const glm::mat4& cameraTransform, float aspectRatio, uint32_t resolution, uint32_t maxDepth) const
+{
+	//Same rays as focusquery.rgen: a resolution x resolution grid over the focus region
+	std::vector<uint32_t> rowHits(resolution, 0);
+	glm::vec3 origin = glm::vec3(cameraTransform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	fjobsystem::instance().parallel_for(0, resolution, 1, [&](size_t y) {
+		for (uint32_t x = 0; x < resolution; ++x) {
+			glm::vec2 uv = (glm::vec2(float(x), float(y)) + glm::vec2(0.5f)) / float(resolution);
+			glm::vec2 d = (uv * 2.0f - 1.0f) * glm::vec2(FOCUS_REGION_SIZE, FOCUS_REGION_SIZE * aspectRatio);
+			glm::vec3 viewDirection = glm::normalize(glm::vec3(d.x * aspectRatio, -d.y, -std::sqrt(3.0f)));
+			glm::vec3 direction = glm::normalize(glm::vec3(cameraTransform * glm::vec4(viewDirection, 1.0f)) - origin);
+			if (trace_focus_ray(origin, direction, maxDepth)) {
+				++rowHits[y];
+			}
+		}
+	});
+	uint64_t hits = 0;
+	for (uint32_t h : rowHits) {
+		hits += h;
+	}
+	//Scaled to the fraction of the screen like in frenderer::poll_focus_queries
+	double regionFraction = FOCUS_REGION_SIZE * glm::min(FOCUS_REGION_SIZE * double(aspectRatio), 1.0);
+	return double(hits) / double(resolution * resolution) * regionFraction;
+}
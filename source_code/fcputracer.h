@@ -0,0 +1,168 @@
+#pragma once
+#include "includes.h"
+
+#define CPU_BVH_BINS 12				//Number of bins for the SAH evaluation when building the BVHs
+#define CPU_BVH_LEAF_SIZE 4			//Maximum number of primitives in a BVH leaf
+#define CPU_BVH_STACK_SIZE 256		//Traversal stack size on the stack (deeper BVHs use a stack on the heap, see bvh4::mStackSize)
+
+/*
+CPU ray tracer for the models of a fscene. Needs no GPU, only the CPU-data of the scene (see fscene::load_scene_data).
+Every model gets a BVH over its triangles in object space (built once), and the instances are organized in a BVH over their
+world space bounds (rebuilt by update_instances after models have moved), just like the BLASs and the TLAS on the GPU.
+Both BVHs are built with the surface area heuristic and collapsed into 4-wide nodes, whose four child boxes are tested at once with SSE.
+Implements the focus query of frenderer (focusquery.rgen/.rchit and default.rahit): the focusphere (model flag 1) is transparent
+and only marks the ray, the character is invisible, the leaves are alpha tested with their diffuse texture (like leaves.rahit, which
+the focus query pipeline binds to them), all other models are opaque, and rays are reflected by materials with mReflectivity > 0.01.
+trace_ray gives other renderers (see fcpurenderer) the any-hit and culling semantics of traceRayEXT for the transparent models.
+The tracer only reads the scene, so rays can be traced from several threads at the same time.
+Copies of a built tracer share the model BVHs and can turn their yaw rotating instances independently (e.g. one copy per job).
+*/
+class fcputracer {
+public:
+	//A ray hit
+	struct hit {
+		float mT = 0.0f;				//Distance along the ray (in units of the ray direction)
+		size_t mModel = 0;				//Index of the hit model in the scene
+		uint32_t mTriangle = 0;			//Index of the hit triangle in the model's index list (divided by 3)
+		glm::vec2 mBarycentrics;		//Barycentric coordinates of the hit point with respect to the second and third vertex
+		size_t mInstance = 0;			//Index of the hit instance in the tracer
+	};
+
+	fcputracer(fscene* scene);
+
+	//Builds the BVHs of all models (in parallel) and the instance BVH, and loads the alpha masks of the models marked as leaves
+	//(so the level logic has to be initialized first, see flevel4logic)
+	void build();
+
+	//Rebuilds the instance BVH from the current model transformations. Has to be called after models have moved (and after build).
+	void update_instances();
+
+	//Lets the instance of a model rotate around the vertical axis through the model's origin (like the mirrors in
+	//fplayercontrol::pre_px_update). Its bounds in the instance BVH cover all rotations, so set_yaw needs no update_instances.
+	//Takes effect with the next update_instances.
+	void set_yaw_rotating(size_t modelIndex);
+
+	//Turns the instance of a yaw rotating model by angle (radians) relative to the model's transformation in the scene.
+	//Only changes this tracer, not the scene.
+	void set_yaw(size_t modelIndex, float angle);
+
+	//Returns the closest hit of a model seen by the focus query in [tMin, tMax], if any (leaf hits with alpha <= 0.1 are ignored)
+	bool closest_hit(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, hit& result) const;
+
+	//Returns the closest hit in [tMin, tMax] like traceRayEXT: hits of opaque models are always accepted, hits of the transparent ones
+	//(focusphere, character and leaves) are passed to anyHit first, which returns false to ignore them (like ignoreIntersectionEXT).
+	//cullBackFaces skips triangles that face away from the ray origin (counter-clockwise triangles face towards their normal).
+	bool trace_ray(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, bool cullBackFaces,
+		const std::function<bool(const hit&)>& anyHit, hit& result) const;
+
+	//Returns true if the ray hits the focusphere in [tMin, tMax] at a point that faces the ray origin (the test of default.rahit)
+	bool hits_focusphere(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax) const;
+
+	//Returns true if the ray sees the focusphere, directly or via at most maxDepth mirror reflections
+	bool trace_focus_ray(const glm::vec3& origin, const glm::vec3& direction, uint32_t maxDepth) const;
+
+	//Computes the focus hit value of the given camera like the focus query of frenderer (resolution^2 rays through the focus region,
+	//scaled to the fraction of the screen). The rays are traced in parallel on the job system.
+	double compute_focus_hit_value(const glm::mat4& cameraTransform, float aspectRatio, uint32_t resolution, uint32_t maxDepth) const;
+
+	//Returns the matrix that transforms the object space normals of an instance to world space
+	const glm::mat3& get_normal_matrix(size_t instanceIndex) const { return mInstances[instanceIndex].mNormalMatrix; }
+
+	//Returns the time of the last build and update_instances in ms
+	double get_build_time() const { return mBuildTime; }
+	double get_update_time() const { return mUpdateTime; }
+
+private:
+	//Four children of a BVH node with their bounds in SoA layout. A child with mCount > 0 is a leaf, which references
+	//mCount primitives starting at mChild. A child with mCount == 0 is an inner node (mChild >= 0) or empty (mChild < 0).
+	struct bvh4_node {
+		__m128 mMinX, mMinY, mMinZ;
+		__m128 mMaxX, mMaxY, mMaxZ;
+		int32_t mChild[4];
+		uint32_t mCount[4];
+	};
+
+	//A BVH with its primitives in leaf order
+	struct bvh4 {
+		std::vector<bvh4_node> mNodes;
+		std::vector<uint32_t> mPrimitives;	//Indices of the primitives in leaf order
+		uint32_t mStackSize = 1;			//Entries needed by the traversal stack (at most three per level are left on the stack)
+	};
+
+	//Triangle of a model in object space, prepared for the ray-triangle test
+	struct triangle {
+		glm::vec3 mV0, mE1, mE2;
+		uint32_t mIndex;				//Index of the triangle in the model's index list (divided by 3)
+	};
+
+	//Alpha channel of a diffuse texture for the alpha test of the leaves
+	struct alpha_mask {
+		uint32_t mWidth = 0;
+		uint32_t mHeight = 0;
+		std::vector<uint8_t> mAlpha;	//Row by row, starting at the bottom (flipped on load like the textures of fscene)
+
+		//Bilinear lookup with repeat addressing (like the sampler of the textures, without mipmaps as in the ray tracing shaders)
+		float sample(const glm::vec2& uv) const;
+	};
+
+	//Object space data of a model
+	struct mesh {
+		bvh4 mBvh;
+		std::vector<triangle> mTriangles;	//In leaf order
+		glm::vec3 mMin, mMax;				//Object space bounds
+	};
+
+	//A model in world space
+	struct instance {
+		size_t mModel;
+		glm::mat4 mWorldToObject;
+		glm::mat3 mNormalMatrix;
+		bool mOpaque;					//Seen by the focus query
+		bool mFocusphere;
+		bool mAnyHit;					//Transparent or alpha tested, i.e. hits are passed to the any-hit callback of trace_ray
+		int mAlphaMask;					//Index in mAlphaMasks for the alpha test of the focus query, -1 = none
+		float mReflectivity;
+	};
+
+	//A ray prepared for the box tests
+	struct ray {
+		glm::vec3 mOrigin, mDirection;
+		__m128 mOriginX, mOriginY, mOriginZ;
+		__m128 mInvDirX, mInvDirY, mInvDirZ;
+	};
+
+	fscene* mScene;
+	std::shared_ptr<std::vector<mesh>> mMeshes;	//One per model, shared by copies of the tracer (never changed after build)
+	std::shared_ptr<std::vector<alpha_mask>> mAlphaMasks;	//Of the leaf materials, shared by copies of the tracer (never changed after build)
+	std::vector<int> mAlphaMaskOfMaterial;	//Per material: index in mAlphaMasks, -1 if it has none
+	std::vector<instance> mInstances;		//One per model with triangles
+	std::vector<size_t> mInstanceOfModel;	//Per model: index in mInstances, SIZE_MAX if there is none
+	std::vector<bool> mYawRotating;			//Per model: whether set_yaw can turn it
+	bvh4 mInstanceBvh;						//Over the world space bounds of mInstances
+	double mBuildTime = 0.0;
+	double mUpdateTime = 0.0;
+
+	//Builds a 4-wide BVH with the surface area heuristic for primitives with the given bounds
+	static bvh4 build_bvh(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs);
+
+	static ray make_ray(const glm::vec3& origin, const glm::vec3& direction);
+
+	//Returns false if a hit of an alpha tested instance lies in a transparent part of its texture (alpha <= 0.1, see leaves.rahit)
+	bool alpha_test(const instance& inst, const hit& h) const;
+
+	//Returns the normalized world space normal at a hit (interpolated from the vertex normals like in the shaders)
+	glm::vec3 shading_normal(const hit& h) const;
+
+	//Tests the ray against the four children of a node. Returns a bit mask of the hit children and their entry distances.
+	static int intersect_children(const bvh4_node& node, const ray& r, float tMin, float tMax, float* tEntry);
+
+	//Traverses the instance BVH and the BVHs of the instances accepted by filter. Every hit is passed to accept(instance, hit),
+	//which can ignore it by returning false. With AnyHit, returns at the first accepted hit.
+	template <bool AnyHit, typename Filter, typename Accept>
+	bool intersect(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, bool cullBackFaces, hit* result, Filter filter, Accept accept) const;
+
+	//Intersects the ray (in object space) with a mesh. Shortens tMax to the closest accepted hit, whose triangle, distance and
+	//barycentrics are written to candidate (the model and instance have to be set by the caller).
+	template <bool AnyHit, typename Accept>
+	bool intersect_mesh(const mesh& m, const ray& r, float tMin, float& tMax, bool cullBackFaces, hit& candidate, hit* result, Accept accept) const;
+};
@@ -0,0 +1,222 @@
+#include "includes.h"
+
+void fflythrough::initialize()
+{
+	if (!mSettings.mPathFile.empty()) {
+		mKeys = load_path(mSettings.mPathFile);
+		if (mKeys.size() < 2) {
+			throw std::runtime_error("The camera path " + mSettings.mPathFile + " needs at least two keys");
+		}
+	}
+	else {
+		//A closed circle around the start position, looking outwards
+		glm::vec3 start = mScene->get_camera().translation();
+		for (int k = 0; k <= FLYTHROUGH_DEFAULT_KEYS; ++k) {
+			float angle = glm::two_pi<float>() * float(k) / float(FLYTHROUGH_DEFAULT_KEYS);
+			glm::vec3 outwards = glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle));
+			mKeys.push_back({ start + FLYTHROUGH_DEFAULT_RADIUS * outwards, start + (FLYTHROUGH_DEFAULT_RADIUS + 1.0f) * outwards });
+		}
+	}
+	if (mSettings.mOutputPath.empty()) {
+		auto mainWnd = gvk::context().main_window();
+		mSettings.mOutputPath = "flythrough_level" + std::to_string(mSettings.mLevel) + "_" + std::to_string(mainWnd->resolution().x) + "x"
+			+ std::to_string(mainWnd->resolution().y) + "_fif" + std::to_string(mainWnd->number_of_frames_in_flight()) + ".json";
+	}
+	mSettings.mFrames = glm::max(mSettings.mFrames, 2u);
+	mFrameTimes.reserve(mSettings.mFrames);
+	place_camera(0.0f);
+	LOG_INFO("Fly-through of level " + std::to_string(mSettings.mLevel) + " along " + std::to_string(mKeys.size()) + " keys, "
+		+ std::to_string(mSettings.mWarmupFrames) + " warm-up and " + std::to_string(mSettings.mFrames) + " measured frames");
+}
+
+void fflythrough::update()
+{
+	auto now = std::chrono::steady_clock::now();
+	//The frame time of a frame is measured at the start of the next one
+	if (mFrame > mSettings.mWarmupFrames) {
+		mFrameTimes.push_back(std::chrono::duration<double, std::milli>(now - mLastFrame).count());
+		const frenderer::ray_counts<uint32_t>& counts = mRenderer->get_ray_counts();
+		mRayCounts += counts;
+		uint64_t rays = counts.mShadowRays;
+		for (uint32_t r : counts.mRaysPerDepth) {
+			rays += r;
+		}
+		mMaxRaysPerFrame = glm::max(mMaxRaysPerFrame, rays);
+	}
+	else if (mFrame == mSettings.mWarmupFrames) {
+		mRenderer->get_gpu_timer().start_collecting();
+		mFocusQueryStartCounts = mRenderer->get_level_focus_query_ray_counts(mFocusQueryStartCount);
+	}
+	mLastFrame = now;
+
+	if (mFrameTimes.size() >= mSettings.mFrames) {
+		write_results(mSettings.mOutputPath);
+		LOG_INFO("Fly-through finished, results written to " + mSettings.mOutputPath);
+		gvk::current_composition()->stop();
+		return;
+	}
+
+	//Fixed step per frame, such that every run renders the same images
+	uint32_t measured = (mFrame > mSettings.mWarmupFrames) ? mFrame - mSettings.mWarmupFrames : 0;
+	place_camera(float(measured) / float(mSettings.mFrames - 1) * float(mKeys.size() - 1));
+	++mFrame;
+}
+
+void fflythrough::place_camera(float t)
+{
+	key k = sample_path(mKeys, t);
+	gvk::camera& camera = mScene->get_camera();
+	camera.set_translation(k.mPosition);
+	glm::vec3 direction = k.mTarget - k.mPosition;
+	if (glm::length(direction) > 1e-4f) {
+		camera.set_rotation(glm::quatLookAt(glm::normalize(direction), glm::vec3(0, 1, 0)));
+	}
+}
+
+void fflythrough::write_key(std::ostream& stream, const gvk::camera& camera)
+{
+	glm::vec3 position = camera.translation();
+	glm::vec3 target = position - camera.z_axis();
+	stream << position.x << " " << position.y << " " << position.z << " " << target.x << " " << target.y << " " << target.z << std::endl;
+}
+
+std::vector<fflythrough::key> fflythrough::load_path(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file) {
+		throw std::runtime_error("Could not read camera path " + path);
+	}
+	std::vector<key> keys;
+	std::string line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream values(line);
+		key k;
+		if (values >> k.mPosition.x >> k.mPosition.y >> k.mPosition.z >> k.mTarget.x >> k.mTarget.y >> k.mTarget.z) {
+			keys.push_back(k);
+		}
+	}
+	return keys;
+}
+
+fflythrough::key fflythrough::sample_path(const std::vector<key>& keys, float t)
+{
+	size_t last = keys.size() - 1;
+	t = glm::clamp(t, 0.0f, float(last));
+	size_t i = glm::min(static_cast<size_t>(t), last - 1);
+	float u = t - float(i);
+	//The end keys are repeated as outer control points
+	const key& k0 = keys[(i > 0) ? i - 1 : i];
+	const key& k1 = keys[i];
+	const key& k2 = keys[i + 1];
+	const key& k3 = keys[glm::min(i + 2, last)];
+	auto spline = [u](const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+		return 0.5f * (2.0f * p1 + (p2 - p0) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u * u + (3.0f * p1 - p0 - 3.0f * p2 + p3) * u * u * u);
+	};
+	return { spline(k0.mPosition, k1.mPosition, k2.mPosition, k3.mPosition), spline(k0.mTarget, k1.mTarget, k2.mTarget, k3.mTarget) };
+}
+
+fflythrough::distribution fflythrough::compute_distribution(std::vector<double> values)
+{
+	distribution d;
+	if (values.empty()) {
+		return d;
+	}
+	std::sort(values.begin(), values.end());
+	auto percentile = [&values](double p) { return values[static_cast<size_t>(std::ceil(p * values.size())) - 1]; };
+	d.mMin = values.front();
+	d.mMax = values.back();
+	d.mMedian = percentile(0.5);
+	d.mP90 = percentile(0.9);
+	d.mP99 = percentile(0.99);
+	for (double v : values) {
+		d.mMean += v / values.size();
+	}
+	for (double v : values) {
+		d.mStdDev += (v - d.mMean) * (v - d.mMean) / values.size();
+	}
+	d.mStdDev = std::sqrt(d.mStdDev);
+	return d;
+}
+
+void fflythrough::write_results(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file) {
+		throw std::runtime_error("Could not write " + path);
+	}
+	auto write_distribution = [&file](const distribution& d) {
+		file << "\"min\": " << d.mMin << ", \"mean\": " << d.mMean << ", \"median\": " << d.mMedian << ", \"p90\": " << d.mP90
+			<< ", \"p99\": " << d.mP99 << ", \"max\": " << d.mMax << ", \"stddev\": " << d.mStdDev;
+	};
+	auto mainWnd = gvk::context().main_window();
+	std::time_t now = std::time(nullptr);
+	file << std::fixed << std::setprecision(4);
+	file << "{" << std::endl;
+	file << "  \"date\": \"" << std::put_time(std::gmtime(&now), "%Y-%m-%dT%H:%M:%SZ") << "\"," << std::endl;
+	file << "  \"level\": " << mSettings.mLevel << "," << std::endl;
+	file << "  \"path\": \"" << (mSettings.mPathFile.empty() ? "default" : mSettings.mPathFile) << "\"," << std::endl;
+	file << "  \"resolution\": [" << mainWnd->resolution().x << ", " << mainWnd->resolution().y << "]," << std::endl;
+	file << "  \"frames_in_flight\": " << mainWnd->number_of_frames_in_flight() << "," << std::endl;
+	file << "  \"presentation_mode\": \"" << mSettings.mPresentationMode << "\"," << std::endl;
+	file << "  \"direct_output\": " << (mRenderer->is_direct_output() ? "true" : "false") << "," << std::endl;
+	//The renderer's values, the depth may have been clamped to the device's limit
+	file << "  \"ray_budget\": " << mRenderer->get_ray_budget() << "," << std::endl;
+	file << "  \"max_depth\": " << mRenderer->get_max_recursion_depth() << "," << std::endl;
+	file << "  \"min_throughput\": " << mRenderer->get_min_reflection_throughput() << "," << std::endl;
+	file << "  \"warmup_frames\": " << mSettings.mWarmupFrames << "," << std::endl;
+	file << "  \"frames\": " << mFrameTimes.size() << "," << std::endl;
+
+	file << "  \"frame_time_ms\": { ";
+	write_distribution(compute_distribution(mFrameTimes));
+	file << ", \"samples\": [";
+	for (size_t i = 0; i < mFrameTimes.size(); ++i) {
+		file << ((i > 0) ? ", " : "") << mFrameTimes[i];
+	}
+	file << "] }," << std::endl;
+
+	file << "  \"gpu_ms\": {" << std::endl;
+	const auto& gpuTimes = mRenderer->get_gpu_timer().get_collected_times();
+	size_t scope = 0;
+	for (const auto& [name, times] : gpuTimes) {
+		file << "    \"" << name << "\": { \"frames\": " << times.size() << ", ";
+		write_distribution(compute_distribution(times));
+		file << " }" << ((++scope < gpuTimes.size()) ? "," : "") << std::endl;
+	}
+	file << "  }," << std::endl;
+
+	fscene::memory_report memory = mScene->get_memory_report();
+	file << "  \"memory_mb\": { \"cpu\": " << fscene::memory_report::megabytes(memory.cpu_bytes()) << ", \"gpu\": "
+		<< fscene::memory_report::megabytes(memory.gpu_bytes()) << ", \"cpu_data_released\": " << (mScene->is_cpu_data_released() ? "true" : "false") << " }," << std::endl;
+
+	//Average counts per frame
+	double frames = double(glm::max(mFrameTimes.size(), size_t(1)));
+	uint64_t reflectionRays = 0;
+	for (size_t depth = 1; depth < RAY_DEPTH_COUNTERS; ++depth) {
+		reflectionRays += mRayCounts.mRaysPerDepth[depth];
+	}
+	file << std::setprecision(1);
+	file << "  \"rays_per_frame\": { \"primary\": " << mRayCounts.mRaysPerDepth[0] / frames << ", \"reflection\": " << reflectionRays / frames
+		<< ", \"shadow\": " << mRayCounts.mShadowRays / frames << ", \"max_total\": " << mMaxRaysPerFrame << ", \"per_depth\": [";
+	for (size_t depth = 0; depth < RAY_DEPTH_COUNTERS; ++depth) {
+		file << ((depth > 0) ? ", " : "") << mRayCounts.mRaysPerDepth[depth] / frames;
+	}
+	file << "] }," << std::endl;
+	file << "  \"invocations_per_frame\": { \"closest_hit\": " << mRayCounts.mClosestHits / frames << ", \"leaves_closest_hit\": " << mRayCounts.mLeavesClosestHits / frames
+		<< ", \"shadow_closest_hit\": " << mRayCounts.mShadowClosestHits / frames << ", \"any_hit\": " << mRayCounts.mAnyHits / frames
+		<< ", \"leaves_any_hit\": " << mRayCounts.mLeavesAnyHits / frames << ", \"shadow_any_hit\": " << mRayCounts.mShadowAnyHits / frames
+		<< ", \"miss\": " << mRayCounts.mMisses / frames << ", \"shadow_miss\": " << mRayCounts.mShadowMisses / frames << " }," << std::endl;
+
+	//The focus query counts separately, averaged over the queries completed while measuring
+	uint64_t queries;
+	frenderer::ray_counts<uint64_t> focusQueryCounts = mRenderer->get_level_focus_query_ray_counts(queries);
+	focusQueryCounts -= mFocusQueryStartCounts;
+	queries -= mFocusQueryStartCount;
+	double queryCount = double(glm::max(queries, uint64_t(1)));
+	file << "  \"focus_query\": { \"queries\": " << queries << ", \"rays_per_query\": [";
+	for (size_t depth = 0; depth < RAY_DEPTH_COUNTERS; ++depth) {
+		file << ((depth > 0) ? ", " : "") << focusQueryCounts.mRaysPerDepth[depth] / queryCount;
+	}
+	file << "], \"any_hit\": " << focusQueryCounts.mAnyHits / queryCount << ", \"leaves_any_hit\": " << focusQueryCounts.mLeavesAnyHits / queryCount << " }" << std::endl;
+	file << "}" << std::endl;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "includes.h"
+
+#define FLYTHROUGH_FRAMES 1800				//Default number of measured frames
+#define FLYTHROUGH_WARMUP_FRAMES 120		//Default number of frames at the start of the path before measuring (pipeline and cache warm-up)
+#define FLYTHROUGH_DEFAULT_RADIUS 3.0f		//Radius of the default path around the level's start camera
+#define FLYTHROUGH_DEFAULT_KEYS 8			//Number of keys of the default path
+#define CAMERA_RECORD_INTERVAL 0.5f			//Seconds of gameplay between two keys of a recorded camera path
+
+/*
+Benchmark mode of focus_rt: moves the camera of the scene along a spline path with a fixed step per frame, such that every run
+renders exactly the same frames, and measures the frames. The level logic is paused by fgamecontrol (no player control, physics
+or animations), so the scene is static and only the camera moves.
+The path is a text file with one key per line: camera position and look-at target ("px py pz tx ty tz", # starts a comment).
+It is either authored or recorded while playing (focus_rt --record-camera, see write_key). Without a path file, the camera circles
+around the level's start position and looks outwards. Positions and targets are interpolated with Catmull-Rom splines.
+After the warm-up frames, the frame times (CPU time between two frames), the GPU times of the renderer's scopes (see fgputimer)
+and the ray and shader invocation counts (see frenderer::ray_counts) are collected. At the end of the path they are written
+as JSON and the game stops.
+*/
+class fflythrough : public gvk::invokee {
+public:
+	struct settings {
+		int mLevel = 1;									//Level to load (1-4)
+		std::string mPathFile;							//Camera path ("" = default path)
+		uint32_t mFrames = FLYTHROUGH_FRAMES;			//Number of measured frames
+		uint32_t mWarmupFrames = FLYTHROUGH_WARMUP_FRAMES;
+		std::string mOutputPath;						//JSON file ("" = flythrough_level<n>_<width>x<height>_fif<n>.json)
+		std::string mPresentationMode = "mailbox";		//Only for the report, the mode is set on the window
+		uint64_t mRayBudget = 0;						//Rays per frame, 0 = unlimited (see frenderer::set_ray_budget)
+		uint32_t mMaxDepth = DEFAULT_MAX_RECURSION_DEPTH;	//Maximum reflection depth (see frenderer::set_max_recursion_depth)
+		float mMinThroughput = DEFAULT_MIN_THROUGHPUT;	//See frenderer::set_min_reflection_throughput
+	};
+
+	//A key of the camera path
+	struct key {
+		glm::vec3 mPosition;
+		glm::vec3 mTarget;
+	};
+
+	fflythrough(const settings& config, fscene* scene, frenderer* renderer) : mSettings(config), mScene(scene), mRenderer(renderer) {}
+
+	//Loads the camera path (or creates the default path). Throws a runtime_error if the path file cannot be read or has less than two keys.
+	void initialize() override;
+
+	//Moves the camera and collects the measurements of the last frame. Writes the results and stops the game at the end of the path.
+	void update() override;
+
+	//Execution order per frame: Game Control, Level Logic, Fly-through and Scene, Renderer
+	int32_t execution_order() const override {
+		return 3;
+	}
+
+	//Writes the current key of a camera as a line of a path file
+	static void write_key(std::ostream& stream, const gvk::camera& camera);
+
+	//Reads a path file. Throws a runtime_error if it cannot be read.
+	static std::vector<key> load_path(const std::string& path);
+
+	//Returns the key on the Catmull-Rom spline through the keys at t (0 = first key, keys.size() - 1 = last key)
+	static key sample_path(const std::vector<key>& keys, float t);
+
+private:
+	//Distribution of a measured value
+	struct distribution {
+		double mMin = 0.0;
+		double mMean = 0.0;
+		double mMedian = 0.0;
+		double mP90 = 0.0;
+		double mP99 = 0.0;
+		double mMax = 0.0;
+		double mStdDev = 0.0;
+	};
+
+	settings mSettings;
+	fscene* mScene;
+	frenderer* mRenderer;
+	std::vector<key> mKeys;
+	uint32_t mFrame = 0;								//Frames since the start, including the warm-up
+	std::chrono::steady_clock::time_point mLastFrame;
+	std::vector<double> mFrameTimes;					//Measured frame times in ms
+	frenderer::ray_counts<uint64_t> mRayCounts;			//Sum over the measured frames
+	uint64_t mMaxRaysPerFrame = 0;						//Most rays (primary, reflection and shadow) in one measured frame
+	frenderer::ray_counts<uint64_t> mFocusQueryStartCounts;	//Focus query counts of the level when the measurement started
+	uint64_t mFocusQueryStartCount = 0;					//Completed focus queries of the level when the measurement started
+
+	//Moves the scene's camera to the key at t
+	void place_camera(float t);
+
+	static distribution compute_distribution(std::vector<double> values);
+
+	//Writes the results as JSON. Throws a runtime_error if the file cannot be written.
+	void write_results(const std::string& path) const;
+};
@@ -6,42 +6,158 @@ fgamecontrol::fgamecontrol(avk::queue* q) {
 	mLevelId = 1;
 }
 
+//Loads the scene and creates the level logic of a level. T is the flevellogic class
+template <typename T>
+void fgamecontrol::create_level() {
+	mScene = fscene::load_scene(T::level_path(), CHAR_PATH);
+	mLevelLogic = std::make_unique<T>(mScene.get(), mPhysicsRuntime.get(), &mInput);
+	//Peak: the new scene with all of its CPU data, while the scene of the previous level still exists (see update)
+	fscene::memory_report report = mScene->get_memory_report();
+	mPeakCpuBytes = report.cpu_bytes();
+	mPeakGpuBytes = report.gpu_bytes() + report.mBuildInputs;
+	if (mOldScene) {
+		fscene::memory_report oldReport = mOldScene->get_memory_report();
+		mPeakCpuBytes += oldReport.cpu_bytes();
+		mPeakGpuBytes += oldReport.gpu_bytes();
+	}
+	mLevelLoaded = true;
+}
+
 void fgamecontrol::initialize()
 {
-	mScene = fscene::load_scene(flevel1logic::level_path(), CHAR_PATH);
-	mLevelLogic = std::make_unique<flevel1logic>(mScene.get());
+	fphysicsconfig physicsConfig;
+	//A recording is replayed with the physics step settings it has been recorded with
+	if (!mReplayPath.empty()) {
+		mInput.start_replay(mReplayPath, physicsConfig);
+	}
+	else if (!mRecordPath.empty()) {
+		mInput.start_recording(mRecordPath, physicsConfig);
+	}
+	mPhysicsRuntime = std::make_unique<fphysicsruntime>(physicsConfig);
+	switch (mLevelId) {
+		case 2: {
+			create_level<flevel2logic>();
+			break;
+		}
+		case 3: {
+			create_level<flevel3logic>();
+			break;
+		}
+		case 4: {
+			create_level<flevel4logic>();
+			break;
+		}
+		default: {
+			mLevelId = 1;
+			create_level<flevel1logic>();
+		}
+	}
+	if (!mCameraRecordPath.empty()) {
+		mCameraRecord.open(mCameraRecordPath);
+		if (!mCameraRecord) {
+			throw std::runtime_error("Could not create camera path " + mCameraRecordPath);
+		}
+		mCameraRecord << "#Level " << mLevelId << std::endl;
+	}
 
 	mRenderer.set_queue(mQueue);
 	mRenderer.set_scene(mScene.get());
 	mRenderer.set_level_logic(mLevelLogic.get());
+	mRenderer.set_gpu_timing_csv(mGpuTimingPath);
+	mRenderer.set_ray_budget(mRaysPerFrameBudget);
+	mRenderer.set_max_recursion_depth(mMaxRecursionDepth);
+	mRenderer.set_min_reflection_throughput(mMinReflectionThroughput);
 	
 	gvk::input().set_cursor_mode(gvk::cursor::cursor_disabled_raw_input);
 
 	gvk::current_composition()->add_element(*get_level_logic());
 	gvk::current_composition()->add_element(*get_scene());
 	gvk::current_composition()->add_element(*get_renderer());
+
+	//Capture: the levels stand still at their start (see update_capture)
+	if (!mCaptureDirectory.empty()) {
+		std::filesystem::create_directories(mCaptureDirectory);
+		mLevelLogic->set_paused(true);
+	}
+
+	//Benchmark: no player control, physics or animations, only the camera moves
+	if (mBenchmark) {
+		mLevelLogic->set_paused(true);
+		mFlythrough = std::make_unique<fflythrough>(*mBenchmark, mScene.get(), &mRenderer);
+		gvk::current_composition()->add_element(*mFlythrough);
+	}
 }
 
 void fgamecontrol::update()
 {
+	FPROFILE_SCOPE("fgamecontrol::update");
 	mOldScene.reset();
 	mOldLevelLogic.reset();
 
+	//The level logic of a new level has been initialized by now (and has created the physics actors from the geometry)
+	if (mLevelLoaded) {
+		mLevelLoaded = false;
+		if (mReleaseCpuData) {
+			mScene->release_cpu_data();
+		}
+		fscene::memory_report report = mScene->get_memory_report();
+		LOG_INFO("Memory of level " + std::to_string(mLevelId) + ": peak CPU " + fscene::memory_report::megabytes(mPeakCpuBytes) + " MB, GPU "
+			+ fscene::memory_report::megabytes(mPeakGpuBytes) + " MB while loading; steady state " + report.to_string());
+	}
+
 	//Esc -> Stop Game
 	if (gvk::input().key_pressed(gvk::key_code::escape)) {
 		gvk::current_composition()->stop();
 	}
-	//Tab -> Pause game
-	if (gvk::input().key_pressed(gvk::key_code::tab)) {
+	if (!mCaptureDirectory.empty()) {
+		update_capture();
+		return;
+	}
+	//Tab -> Pause game (not in the benchmark, which always keeps the level paused)
+	if (gvk::input().key_pressed(gvk::key_code::tab) && !mBenchmark) {
 		bool newstate = gvk::input().is_cursor_disabled();
 		mLevelLogic->set_paused(newstate);
 		gvk::input().set_cursor_mode(newstate ? gvk::cursor::arrow_cursor : gvk::cursor::cursor_disabled_raw_input);
 	}
+	//F8 -> Toggle between ray tracing directly into the swap chain and copying from the offscreen image
+	if (gvk::input().key_pressed(gvk::key_code::f8)) {
+		mRenderer.set_direct_output(!mRenderer.is_direct_output());
+		LOG_INFO(mRenderer.is_direct_output() ? "Direct swap chain output enabled." : "Direct swap chain output disabled.");
+	}
+	//F9 -> Start the profiler, or write the events recorded since the last trace
+	if (gvk::input().key_pressed(gvk::key_code::f9)) {
+		if (fprofiler::is_enabled()) {
+			write_profiler_trace();
+		}
+		else {
+			fprofiler::set_enabled(true);
+			LOG_INFO("Profiler started, press F9 again to write the trace.");
+		}
+	}
+
+	//Gameplay input and frame time (see finput). While paused, nothing is read or recorded and the level flow
+	//(fading, level switches) stands still, such that a replay takes the same course as the recorded session.
+	bool paused = mLevelLogic->is_paused();
+	if (!paused && !mInput.begin_frame()) {
+		LOG_INFO("Replay finished after " + std::to_string(mInput.frame_count()) + " frames.");
+		gvk::current_composition()->stop();
+		return;
+	}
+	float deltaT = paused ? 0.0f : mInput.delta_time();
+
+	//Camera path recording
+	if (mCameraRecord.is_open() && !paused) {
+		mCameraRecordTime += deltaT;
+		if (mCameraRecordTime >= CAMERA_RECORD_INTERVAL) {
+			fflythrough::write_key(mCameraRecord, mScene->get_camera());
+			mCameraRecordTime -= CAMERA_RECORD_INTERVAL;
+		}
+	}
 
 	//Fade-In
 	if (mFadeIn >= 0) {
 		mRenderer.set_fade_value(mFadeIn);
-		mFadeIn -= gvk::time().delta_time() * 1.0;
+		mFadeIn -= deltaT * 1.0;
 		if (mFadeIn <= 0.0f) {
 			mFadeIn = -1.0f;
 			mRenderer.set_fade_value(0.0f);
@@ -53,19 +169,21 @@ void fgamecontrol::update()
 		mRenderer.set_fade_value(mFadeIn);
 	}
 
+	//A replay switches the level in the frame in which the recorded session did (the recorded level of a frame is the one
+	//at its end, see set_level below), independent of the status and the fading of the replayed level
+	bool replay = (mInput.get_mode() == finput::mode::REPLAY);
+	bool switchLevel = replay && !paused && mInput.level() != mLevelId;
+
 	//If Won -> Fade Out and Load Next Level
 	if (mLevelLogic->level_status() == levelstatus::WON) {
 		if (mFadeOut < 0.0f) {
 			mFadeOut = 1.0f;
 		}
 		else {
-			mFadeOut -= gvk::time().delta_time() * 0.5;
-			mRenderer.set_fade_value(1 - mFadeOut);
-			if (mFadeOut <= 0) {
-				next_level();
-				mFadeOut = -1.0f;
-				mRenderer.set_fade_value(1.0f);
-				mFirstFrame = true;
+			mFadeOut -= deltaT * 0.5;
+			mRenderer.set_fade_value(glm::min(1 - mFadeOut, 1.0f));
+			if (mFadeOut <= 0 && !replay) {
+				switchLevel = true;
 			}
 		}
 	}
@@ -73,11 +191,50 @@ void fgamecontrol::update()
 	else if (mLevelLogic->level_status() == levelstatus::LOST) {
 		mLevelLogic->reset();
 	}
+
+	if (switchLevel) {
+		next_level();
+		mFadeOut = -1.0f;
+		mRenderer.set_fade_value(1.0f);
+		mFirstFrame = true;
+	}
+
+	if (!paused) {
+		mInput.set_level(mLevelId);
+	}
+}
+
+void fgamecontrol::update_capture()
+{
+	mRenderer.set_fade_value(0.0f);
+	++mCaptureFrame;
+	if (mCaptureFrame == CAPTURE_WARMUP_FRAMES) {
+		mRenderer.capture_frame((std::filesystem::path(mCaptureDirectory) / ("level" + std::to_string(mLevelId) + ".ppm")).string());
+	}
+	else if (mCaptureFrame > CAPTURE_WARMUP_FRAMES) {
+		//The renderer has written the capture in the last frame
+		next_level();
+		mLevelLogic->set_paused(true);
+		mCaptureFrame = 0;
+	}
 }
 
 void fgamecontrol::finalize()
 {
+	mInput.stop();
 	gvk::context().device().waitIdle();
+	mRenderer.log_level_ray_counts();
+	if (fprofiler::is_enabled()) {
+		write_profiler_trace();
+		fprofiler::set_enabled(false);
+	}
+}
+
+void fgamecontrol::write_profiler_trace()
+{
+	std::string path = PROFILE_TRACE_PREFIX + std::to_string(mTraceCount++) + ".json";
+	size_t events = fprofiler::write_trace(path);
+	LOG_INFO("Written " + std::to_string(events) + " profiler events to " + path);
 }
 
 fscene* fgamecontrol::get_scene() {
@@ -96,19 +253,24 @@ frenderer* fgamecontrol::get_renderer() {
 //Switches the level to a new one. T is the flevellogic class
 template <typename T>
 void fgamecontrol::switch_level() {
+	FPROFILE_SCOPE("fgamecontrol::switch_level");
+	double switchStart = glfwGetTime();
 	gvk::current_composition()->remove_element(*mScene.get());
 	gvk::current_composition()->remove_element(*mLevelLogic.get());
 	mScene->disable();
 	mLevelLogic->disable();
 	mOldScene = std::move(mScene);
 	mOldLevelLogic = std::move(mLevelLogic);
-	mScene = fscene::load_scene(T::level_path(), CHAR_PATH);
+	create_level<T>();
 	mRenderer.set_scene(mScene.get());
-	mLevelLogic = std::make_unique<T>(mScene.get());
 	mRenderer.set_level_logic(mLevelLogic.get());
 	gvk::current_composition()->add_element(*mScene.get());
 	gvk::current_composition()->add_element(*mLevelLogic.get());
 	++mLevelId;
+	if (mCameraRecord.is_open()) {
+		mCameraRecord << "#Level " << mLevelId << std::endl;
+	}
+	LOG_INFO("Switched to level " + std::to_string(mLevelId) + " in " + std::to_string((glfwGetTime() - switchStart) * 1000.0) + " ms");
 }
 
 //Stops the current level and loads the next one, or stops the game if over
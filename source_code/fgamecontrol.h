@@ -2,6 +2,8 @@
 #pragma once
 #include "includes.h"
 #define CHAR_PATH "assets/anothersimplechar2.dae"
+#define PROFILE_TRACE_PREFIX "profile_trace_"	//Chrome traces of the profiler are written to PROFILE_TRACE_PREFIX<n>.json
+#define CAPTURE_WARMUP_FRAMES 8				//Frames a level is rendered before it is captured, such that every frame in flight has received the scene
 
 /*
 This class manages the game on a high level. It creates scene, level logic and renderer, and
@@ -26,12 +28,67 @@ public:
 		return 1;
 	}
 
-	//Checks for controlling key strokes (esc/tab) and level status change
+	//Checks for controlling key strokes (esc/tab/f8/f9) and level status change
 	void update() override;
 
-	//Called at the end of the game
+	//Called at the end of the game. Writes the profiler's trace if it is recording.
 	void finalize() override;
 
+	//Records the gameplay input of the session to the given file (see finput). Has to be called before the game starts.
+	void set_recording(const std::string& path) {
+		mRecordPath = path;
+	}
+
+	//Replays the gameplay input from the given recording instead of reading it from the devices. The game stops at the end
+	//of the recording. Has to be called before the game starts.
+	void set_replay(const std::string& path) {
+		mReplayPath = path;
+	}
+
+	//Writes the GPU times of the frames to the given CSV file (see fgputimer). Has to be called before the game starts.
+	void set_gpu_timing_csv(const std::string& path) {
+		mGpuTimingPath = path;
+	}
+
+	//Starts the profiler (see fprofiler) with the game instead of with the first F9. Has to be called before the game starts.
+	void set_profiling(bool profiling) {
+		fprofiler::set_enabled(profiling);
+	}
+
+	//Runs a fly-through benchmark instead of the game: loads the given level, pauses its logic and moves the camera along
+	//the path (see fflythrough). Has to be called before the game starts.
+	void set_benchmark(const fflythrough::settings& config) {
+		mBenchmark = std::make_unique<fflythrough::settings>(config);
+		mLevelId = config.mLevel;
+	}
+
+	//Records the camera every CAMERA_RECORD_INTERVAL seconds of gameplay as a path for the fly-through benchmark.
+	//Has to be called before the game starts.
+	void set_camera_recording(const std::string& path) {
+		mCameraRecordPath = path;
+	}
+
+	//Instead of playing, captures one frame of every level (with its logic paused, from the start camera and without fade) to
+	//level<id>.ppm in the given directory and stops after the last level (see frenderer::capture_frame). focus_headless --compare-gpu
+	//compares these captures with the CPU reference renderer. Has to be called before the game starts.
+	void set_capture(const std::string& directory) {
+		mCaptureDirectory = directory;
+	}
+
+	//Sets the ray budget of the renderer: rays per frame (0 = unlimited), maximum reflection depth and minimum reflection throughput
+	//outside the focus region (see frenderer::set_ray_budget). Has to be called before the game starts.
+	void set_ray_budget(uint64_t raysPerFrame, uint32_t maxDepth, float minThroughput) {
+		mRaysPerFrameBudget = raysPerFrame;
+		mMaxRecursionDepth = maxDepth;
+		mMinReflectionThroughput = minThroughput;
+	}
+
+	//Whether the geometry and the assimp scene of a level are freed once its GPU-data and physics actors have been created
+	//(see fscene::release_cpu_data, default: true). Has to be called before the game starts.
+	void set_release_cpu_data(bool release) {
+		mReleaseCpuData = release;
+	}
+
 	//--------------------------
 	//---Getter functions-------
 	//--------------------------
@@ -48,7 +105,22 @@ private:
 	//--------------------------
 	avk::queue* mQueue;
 	
+	std::unique_ptr<fphysicsruntime> mPhysicsRuntime;	//Global PhysX objects, shared by all levels (declared first, such that it is released last)
+	finput mInput;								//Gameplay input (live, recorded or replayed)
+	std::string mRecordPath;					//Path of the input recording ("" = no recording)
+	std::string mReplayPath;					//Path of the replayed input recording ("" = live input)
+	std::string mGpuTimingPath;					//Path of the GPU timing CSV ("" = none)
+	std::unique_ptr<fflythrough::settings> mBenchmark;	//Settings of the fly-through benchmark (nullptr = normal game)
+	std::unique_ptr<fflythrough> mFlythrough;	//Camera path of the benchmark
+	std::string mCameraRecordPath;				//Path of the recorded camera path ("" = none)
+	std::ofstream mCameraRecord;
+	float mCameraRecordTime = 0.0f;				//Gameplay time since the last recorded camera key
+	std::string mCaptureDirectory;				//Directory of the captured frames ("" = normal game)
+	uint32_t mCaptureFrame = 0;					//Frames since the current level has been loaded in capture mode
 	frenderer mRenderer;						//Renderer object (constant)
+	uint64_t mRaysPerFrameBudget = 0;			//Ray budget settings of the renderer (see set_ray_budget)
+	uint32_t mMaxRecursionDepth = DEFAULT_MAX_RECURSION_DEPTH;
+	float mMinReflectionThroughput = DEFAULT_MIN_THROUGHPUT;
 	std::unique_ptr<fscene> mScene;				//Scene object pointer (changes)
 	std::unique_ptr<flevellogic> mLevelLogic;	//Level Logic object pointer (changes)
 
@@ -56,6 +128,11 @@ private:
 	float mFadeOut = -1.0f;						//Helper variable for fading out
 	float mFadeIn = -1.0f;						//Helper variable for fading in
 	bool mFirstFrame = false;					//Helepr variable, identifying whether this is the first frame of a new level (except for L1)
+	int mTraceCount = 0;						//Number of written profiler traces
+	bool mReleaseCpuData = true;				//Whether the upload-only CPU data of the scenes is freed
+	bool mLevelLoaded = false;					//Whether a new level has been created whose memory has not been reported yet
+	size_t mPeakCpuBytes = 0;					//Memory of the scenes right after loading the current level (including the previous level's scene)
+	size_t mPeakGpuBytes = 0;
 
 	std::unique_ptr<fscene> mOldScene;			//Old scene to be deleted after successful initialization of a new one
 	std::unique_ptr<flevellogic> mOldLevelLogic;//Old level logic to be deleted after successful initialization of a new one
@@ -65,9 +142,18 @@ private:
 	//---Helper functions-------
 	//--------------------------
 
+	//Writes the events recorded by the profiler since the last trace to the next trace file
+	void write_profiler_trace();
+
 	//Stops the current level and loads the next one, or stops the game if over.
 	void next_level();
 
+	//Capture mode part of update: captures the current level after the warm-up frames and switches to the next one afterwards
+	void update_capture();
+
+	//Loads the scene and creates the level logic of a level. T is the flevellogic class.
+	template <typename T> void create_level();
+
 	//Switches the level to a new one. T is the flevellogic class.
 	template <typename T> void switch_level();
 }; 
@@ -0,0 +1,151 @@
+#include "includes.h"
+
+void fgputimer::initialize(avk::queue* queue, size_t framesInFlight)
+{
+	mFrames.clear();
+	auto queueFamilies = gvk::context().physical_device().getQueueFamilyProperties();
+	uint32_t validBits = queueFamilies[queue->family_index()].timestampValidBits;
+	if (validBits == 0) {
+		LOG_WARNING("The queue does not support timestamps, GPU timings are disabled.");
+		return;
+	}
+	mTimestampMask = (validBits >= 64) ? ~uint64_t(0) : ((uint64_t(1) << validBits) - 1);
+	mTimestampPeriod = gvk::context().physical_device().getProperties().limits.timestampPeriod;
+	mFrames.resize(framesInFlight);
+	for (frame& f : mFrames) {
+		f.mPool = gvk::context().device().createQueryPoolUnique(vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, 2 * GPU_TIMER_MAX_SCOPES));
+	}
+}
+
+void fgputimer::read_results(size_t inFlightIndex)
+{
+	if (!is_supported() || !mFrames[inFlightIndex].mPending) {
+		return;
+	}
+	frame& f = mFrames[inFlightIndex];
+	f.mPending = false;
+	if (f.mNames.empty()) {
+		return;
+	}
+	//Pairs of timestamp and availability, no waiting
+	std::vector<uint64_t> results(4 * f.mNames.size(), 0);
+	auto result = gvk::context().device().getQueryPoolResults(f.mPool.get(), 0, static_cast<uint32_t>(2 * f.mNames.size()),
+		results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+	if (result != vk::Result::eSuccess && result != vk::Result::eNotReady) {
+		return;
+	}
+
+	uint64_t first = results[0] & mTimestampMask;
+	for (size_t s = 0; s < f.mNames.size(); ++s) {
+		if (results[4 * s + 1] == 0 || results[4 * s + 3] == 0) {
+			continue;
+		}
+		uint64_t start = results[4 * s] & mTimestampMask;
+		uint64_t end = results[4 * s + 2] & mTimestampMask;
+		double startNs = double((start - first) & mTimestampMask) * mTimestampPeriod;
+		double durationNs = double((end - start) & mTimestampMask) * mTimestampPeriod;
+		double ms = durationNs / 1e6;
+
+		history& h = mHistories[f.mNames[s]];
+		h.mTimes[h.mCount % GPU_TIMER_HISTORY] = ms;
+		++h.mCount;
+		if (mCollecting) {
+			mCollected[f.mNames[s]].push_back(ms);
+		}
+		if (fprofiler::is_enabled()) {
+			int64_t cpuStart = f.mCpuStart + static_cast<int64_t>(startNs);
+			fprofiler::record_gpu(f.mNames[s], cpuStart, cpuStart + static_cast<int64_t>(durationNs));
+		}
+		if (fprofiler::is_enabled() || mCsv.is_open()) {
+			statistics stats = compute_statistics(h);
+			if (fprofiler::is_enabled()) {
+				fprofiler::record_counter(f.mNames[s], "avg_ms", stats.mAverage);
+				fprofiler::record_counter(f.mNames[s], "p99_ms", stats.mP99);
+			}
+			if (mCsv.is_open()) {
+				mCsv << f.mFrameId << ";" << f.mNames[s] << ";" << ms << ";" << stats.mMin << ";" << stats.mAverage << ";" << stats.mP99 << "\n";
+			}
+		}
+	}
+}
+
+void fgputimer::begin_frame(avk::command_buffer_t& cmd, size_t inFlightIndex, int64_t frameId)
+{
+	if (!is_supported()) {
+		return;
+	}
+	frame& f = mFrames[inFlightIndex];
+	cmd.handle().resetQueryPool(f.mPool.get(), 0, 2 * GPU_TIMER_MAX_SCOPES);
+	f.mNames.clear();
+	f.mFrameId = frameId;
+	f.mCpuStart = fprofiler::now_ns();
+	f.mPending = true;
+}
+
+uint32_t fgputimer::begin(avk::command_buffer_t& cmd, size_t inFlightIndex, const char* name)
+{
+	if (!is_supported() || mFrames[inFlightIndex].mNames.size() >= GPU_TIMER_MAX_SCOPES) {
+		return UINT32_MAX;
+	}
+	frame& f = mFrames[inFlightIndex];
+	uint32_t scope = static_cast<uint32_t>(f.mNames.size());
+	f.mNames.push_back(name);
+	cmd.handle().writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, f.mPool.get(), 2 * scope);
+	return scope;
+}
+
+void fgputimer::end(avk::command_buffer_t& cmd, size_t inFlightIndex, uint32_t scope)
+{
+	if (scope == UINT32_MAX) {
+		return;
+	}
+	cmd.handle().writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, mFrames[inFlightIndex].mPool.get(), 2 * scope + 1);
+}
+
+fgputimer::statistics fgputimer::compute_statistics(const history& h)
+{
+	statistics stats;
+	stats.mFrames = glm::min(h.mCount, uint32_t(GPU_TIMER_HISTORY));
+	if (stats.mFrames == 0) {
+		return stats;
+	}
+	stats.mLast = h.mTimes[(h.mCount - 1) % GPU_TIMER_HISTORY];
+	std::vector<double> sorted(h.mTimes.begin(), h.mTimes.begin() + stats.mFrames);
+	std::sort(sorted.begin(), sorted.end());
+	stats.mMin = sorted.front();
+	for (double t : sorted) {
+		stats.mAverage += t / stats.mFrames;
+	}
+	stats.mP99 = sorted[static_cast<size_t>(std::ceil(0.99 * stats.mFrames)) - 1];
+	return stats;
+}
+
+fgputimer::statistics fgputimer::get_statistics(const std::string& name) const
+{
+	auto h = mHistories.find(name);
+	return (h == mHistories.end()) ? statistics() : compute_statistics(h->second);
+}
+
+std::vector<std::string> fgputimer::get_scope_names() const
+{
+	std::vector<std::string> names;
+	for (const auto& [name, h] : mHistories) {
+		names.push_back(name);
+	}
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+void fgputimer::set_csv_path(const std::string& path)
+{
+	mCsv.close();
+	if (path.empty()) {
+		return;
+	}
+	mCsv.open(path);
+	if (!mCsv) {
+		throw std::runtime_error("Could not create " + path);
+	}
+	mCsv << std::fixed << std::setprecision(4);
+	mCsv << "frame;scope;gpu_ms;min_ms;avg_ms;p99_ms" << std::endl;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "includes.h"
+
+#define GPU_TIMER_MAX_SCOPES 16		//Maximum number of timed scopes per frame
+#define GPU_TIMER_HISTORY 600		//Number of frames in the rolling statistics of a scope
+
+/*
+GPU timestamp profiler for the commands of a frame.
+Every frame in flight has its own timestamp query pool. begin_frame resets the pool of the current in-flight index in the first
+command buffer of the frame, begin and end write timestamps around the commands of a scope (top and bottom of the pipe).
+read_results reads the pool of an in-flight index without waiting, after its frame has completed (i.e. before the index is
+used again), and adds the GPU times of the scopes to their rolling statistics over the last GPU_TIMER_HISTORY frames.
+The timings also go to the trace profiler (as intervals on the GPU track and as counters of the statistics) and, if set,
+to a CSV file with one line per scope and frame.
+The GPU clock is not calibrated against the CPU clock, the GPU intervals of a frame are placed at the CPU time of begin_frame.
+*/
+class fgputimer {
+public:
+	//Rolling statistics of a scope in ms
+	struct statistics {
+		double mLast = 0.0;
+		double mMin = 0.0;
+		double mAverage = 0.0;
+		double mP99 = 0.0;
+		uint32_t mFrames = 0;		//Number of frames in the statistics
+	};
+
+	//Creates the query pools. The timer stays disabled if the queue does not support timestamps.
+	void initialize(avk::queue* queue, size_t framesInFlight);
+
+	//Returns whether timestamps are written
+	bool is_supported() const { return !mFrames.empty(); }
+
+	//Reads the timestamps of the last frame that used the in-flight index, without waiting. Has to be called before begin_frame
+	//of that index, when the frame has completed.
+	void read_results(size_t inFlightIndex);
+
+	//Resets the queries of the in-flight index for a new frame. Has to be recorded into the first submitted command buffer of the frame.
+	void begin_frame(avk::command_buffer_t& cmd, size_t inFlightIndex, int64_t frameId);
+
+	//Writes the start timestamp of a scope (name must be a string literal). Returns the scope for end, UINT32_MAX if the
+	//timer is not supported or all scopes of the frame are used.
+	uint32_t begin(avk::command_buffer_t& cmd, size_t inFlightIndex, const char* name);
+
+	//Writes the end timestamp of a scope returned by begin
+	void end(avk::command_buffer_t& cmd, size_t inFlightIndex, uint32_t scope);
+
+	//Returns the rolling statistics of the scope with the given name (all zero if it has not been measured yet)
+	statistics get_statistics(const std::string& name) const;
+
+	//Returns the names of all measured scopes
+	std::vector<std::string> get_scope_names() const;
+
+	//Keeps the GPU time of every frame from now on, in addition to the rolling statistics (e.g. for a benchmark run).
+	//Drops the times kept so far.
+	void start_collecting() { mCollected.clear(); mCollecting = true; }
+
+	//Returns the GPU times in ms of every frame since start_collecting, per scope
+	const std::unordered_map<std::string, std::vector<double>>& get_collected_times() const { return mCollected; }
+
+	//Writes the GPU time and statistics of every scope and frame to the given CSV file from now on ("" = stop).
+	//Throws a runtime_error if the file cannot be created.
+	void set_csv_path(const std::string& path);
+
+private:
+	//Queries of a frame in flight
+	struct frame {
+		vk::UniqueQueryPool mPool;
+		std::vector<const char*> mNames;	//Per scope
+		int64_t mFrameId = -1;
+		int64_t mCpuStart = 0;				//Profiler time of begin_frame in ns
+		bool mPending = false;				//Whether the queries have been written and not read yet
+	};
+
+	//Rolling GPU times of a scope
+	struct history {
+		std::vector<double> mTimes = std::vector<double>(GPU_TIMER_HISTORY, 0.0);	//Ring buffer in ms
+		uint32_t mCount = 0;				//Number of recorded frames
+	};
+
+	std::vector<frame> mFrames;
+	std::unordered_map<std::string, history> mHistories;
+	double mTimestampPeriod = 1.0;			//ns per timestamp tick
+	uint64_t mTimestampMask = ~uint64_t(0);	//Valid bits of the timestamps
+	std::ofstream mCsv;
+	bool mCollecting = false;
+	std::unordered_map<std::string, std::vector<double>> mCollected;	//GPU times since start_collecting per scope
+
+	static statistics compute_statistics(const history& h);
+};
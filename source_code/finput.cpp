@@ -0,0 +1,178 @@
+#include "includes.h"
+
+//Gears-Vk key of each finput_key (same order)
+static const gvk::key_code kKeyCodes[] = {
+	gvk::key_code::w, gvk::key_code::a, gvk::key_code::s, gvk::key_code::d,
+	gvk::key_code::e, gvk::key_code::q, gvk::key_code::space, gvk::key_code::f10
+};
+
+finput::~finput()
+{
+	stop();
+}
+
+void finput::start_recording(const std::string& path, const fphysicsconfig& config)
+{
+	stop();
+	std::filesystem::path filePath(path);
+	if (filePath.has_parent_path()) {
+		std::error_code error;
+		std::filesystem::create_directories(filePath.parent_path(), error);
+	}
+	mRecording.open(path, std::ios::binary | std::ios::trunc);
+	if (!mRecording) {
+		throw std::runtime_error("Could not create input recording " + path);
+	}
+	uint32_t header[2] = { FINPUT_MAGIC, FINPUT_VERSION };
+	int32_t maxCatchUpSteps = config.mMaxCatchUpSteps;
+	mRecording.write(reinterpret_cast<const char*>(header), sizeof(header));
+	mRecording.write(reinterpret_cast<const char*>(&config.mStepRate), sizeof(config.mStepRate));
+	mRecording.write(reinterpret_cast<const char*>(&maxCatchUpSteps), sizeof(maxCatchUpSteps));
+	mMode = mode::RECORD;
+	mFrameCount = 0;
+	LOG_INFO("Recording input to " + path);
+}
+
+void finput::start_replay(const std::string& path, fphysicsconfig& config)
+{
+	stop();
+	mReplay.open(path, std::ios::binary);
+	uint32_t header[2] = { 0, 0 };
+	float stepRate = 0.0f;
+	int32_t maxCatchUpSteps = 0;
+	mReplay.read(reinterpret_cast<char*>(header), sizeof(header));
+	mReplay.read(reinterpret_cast<char*>(&stepRate), sizeof(stepRate));
+	mReplay.read(reinterpret_cast<char*>(&maxCatchUpSteps), sizeof(maxCatchUpSteps));
+	if (!mReplay || header[0] != FINPUT_MAGIC || header[1] != FINPUT_VERSION) {
+		mReplay.close();
+		throw std::runtime_error("Could not read input recording " + path);
+	}
+	config.mStepRate = stepRate;
+	config.mMaxCatchUpSteps = maxCatchUpSteps;
+	mMode = mode::REPLAY;
+	mFrameCount = 0;
+	LOG_INFO("Replaying input from " + path);
+}
+
+void finput::start_scripted()
+{
+	stop();
+	mMode = mode::SCRIPTED;
+	mScriptedFrame = frame();
+	mFrameCount = 0;
+}
+
+void finput::script_frame(float deltaTime, uint16_t keysDown, const glm::vec2& cursorDelta, uint8_t buttons)
+{
+	mScriptedFrame.mDeltaTime = deltaTime;
+	mScriptedFrame.mCursorDelta = cursorDelta;
+	mScriptedFrame.mKeysReleased = mScriptedFrame.mKeysDown & ~keysDown;
+	mScriptedFrame.mKeysDown = keysDown;
+	mScriptedFrame.mButtons = buttons;
+}
+
+void finput::stop()
+{
+	if (mMode == mode::RECORD) {
+		if (mFramePending) {
+			write_frame(mFrame);
+			mFramePending = false;
+		}
+		mRecording.close();
+		LOG_INFO("Recorded " + std::to_string(mFrameCount) + " frames of input");
+	}
+	else if (mMode == mode::REPLAY) {
+		mReplay.close();
+	}
+	mMode = mode::LIVE;
+}
+
+bool finput::begin_frame()
+{
+	if (mMode == mode::REPLAY) {
+		if (!read_frame(mFrame)) {
+			mFrame = frame();
+			return false;
+		}
+		++mFrameCount;
+		return true;
+	}
+	if (mMode == mode::SCRIPTED) {
+		uint8_t level = mFrame.mLevel;
+		mFrame = mScriptedFrame;
+		mFrame.mLevel = level;
+		++mFrameCount;
+		return true;
+	}
+	//The level of a frame is only known at its end (see set_level), so a frame is written when the next one begins
+	if (mFramePending) {
+		write_frame(mFrame);
+	}
+	uint8_t level = mFrame.mLevel;
+	mFrame = poll();
+	mFrame.mLevel = level;
+	mFramePending = (mMode == mode::RECORD);
+	++mFrameCount;
+	return true;
+}
+
+void finput::set_level(int level)
+{
+	if (mMode != mode::REPLAY) {
+		mFrame.mLevel = static_cast<uint8_t>(level);
+	}
+}
+
+void finput::set_focus_hit_value(double value)
+{
+	if (mMode != mode::REPLAY) {
+		mFrame.mFocusHitValue = value;
+	}
+}
+
+finput::frame finput::poll()
+{
+	frame f;
+	//Stored with the precision of the recording, such that live and replayed sessions see exactly the same values
+	f.mDeltaTime = gvk::time().delta_time();
+	f.mCursorDelta = glm::vec2(gvk::input().delta_cursor_position());
+	for (uint16_t k = 0; k < static_cast<uint16_t>(std::size(kKeyCodes)); ++k) {
+		if (gvk::input().key_down(kKeyCodes[k])) {
+			f.mKeysDown |= key_bit(static_cast<finput_key>(k));
+		}
+		if (gvk::input().key_released(kKeyCodes[k])) {
+			f.mKeysReleased |= key_bit(static_cast<finput_key>(k));
+		}
+	}
+	for (uint8_t button = 0; button < 3; ++button) {
+		if (gvk::input().mouse_button_down(button)) {
+			f.mButtons |= (1u << button);
+		}
+	}
+	return f;
+}
+
+void finput::write_frame(const frame& f)
+{
+	mRecording.write(reinterpret_cast<const char*>(&f.mDeltaTime), sizeof(f.mDeltaTime));
+	mRecording.write(reinterpret_cast<const char*>(&f.mCursorDelta.x), sizeof(f.mCursorDelta.x));
+	mRecording.write(reinterpret_cast<const char*>(&f.mCursorDelta.y), sizeof(f.mCursorDelta.y));
+	mRecording.write(reinterpret_cast<const char*>(&f.mKeysDown), sizeof(f.mKeysDown));
+	mRecording.write(reinterpret_cast<const char*>(&f.mKeysReleased), sizeof(f.mKeysReleased));
+	mRecording.write(reinterpret_cast<const char*>(&f.mButtons), sizeof(f.mButtons));
+	mRecording.write(reinterpret_cast<const char*>(&f.mLevel), sizeof(f.mLevel));
+	mRecording.write(reinterpret_cast<const char*>(&f.mFocusHitValue), sizeof(f.mFocusHitValue));
+}
+
+bool finput::read_frame(frame& f)
+{
+	mReplay.read(reinterpret_cast<char*>(&f.mDeltaTime), sizeof(f.mDeltaTime));
+	mReplay.read(reinterpret_cast<char*>(&f.mCursorDelta.x), sizeof(f.mCursorDelta.x));
+	mReplay.read(reinterpret_cast<char*>(&f.mCursorDelta.y), sizeof(f.mCursorDelta.y));
+	mReplay.read(reinterpret_cast<char*>(&f.mKeysDown), sizeof(f.mKeysDown));
+	mReplay.read(reinterpret_cast<char*>(&f.mKeysReleased), sizeof(f.mKeysReleased));
+	mReplay.read(reinterpret_cast<char*>(&f.mButtons), sizeof(f.mButtons));
+	mReplay.read(reinterpret_cast<char*>(&f.mLevel), sizeof(f.mLevel));
+	mReplay.read(reinterpret_cast<char*>(&f.mFocusHitValue), sizeof(f.mFocusHitValue));
+	return static_cast<bool>(mReplay);
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include "includes.h"
+
+#define FINPUT_MAGIC 0x504E4946u	//"FINP" at the start of every recording
+#define FINPUT_VERSION 2u
+
+//Keys that are used by the gameplay (and therefore recorded)
+enum class finput_key : uint16_t {
+	w, a, s, d, e, q, space, f10
+};
+
+/*
+Input and frame time of the gameplay (level logic and player control), read once per frame in begin_frame.
+Live: Everything comes from Gears-Vk. Can additionally be recorded to a compact binary log (one record per frame).
+Replay: Everything comes from such a log. Since the frame times determine the fixed physics steps (see flevellogic),
+the recorded session is reproduced step by step, with or without window (see focus_headless). The focus hit value and the level
+of every frame are recorded as well: the focus hit value comes from the GPU with a varying delay, and a replay has to switch
+the levels in the same frames as the recorded session.
+Scripted: Everything is set by the program (e.g. by the bots of focus_headless --server) before each frame.
+The game control keys (esc/tab/f8) are not part of the gameplay and are still read from Gears-Vk.
+*/
+class finput {
+public:
+	enum class mode {
+		LIVE, RECORD, REPLAY, SCRIPTED
+	};
+
+	~finput();
+
+	//Starts recording to the given file. The physics step settings are stored as well, because the fixed steps depend on them.
+	//Throws a runtime_error if the file cannot be created.
+	void start_recording(const std::string& path, const fphysicsconfig& config);
+
+	//Starts replaying the given file and sets the physics step settings of the recording in config.
+	//Throws a runtime_error if the file cannot be read.
+	void start_replay(const std::string& path, fphysicsconfig& config);
+
+	//Starts scripted input: begin_frame takes the input set by script_frame
+	void start_scripted();
+
+	//Sets the input of the next scripted frame. keysDown is a combination of key_bit values, the released keys are
+	//the ones that were down in the previous scripted frame and are not anymore.
+	void script_frame(float deltaTime, uint16_t keysDown, const glm::vec2& cursorDelta, uint8_t buttons = 0);
+
+	//Stops recording, replaying or scripting and switches back to live input
+	void stop();
+
+	//Reads the input of a new frame (from Gears-Vk or from the replayed log). Returns false if the replay has ended.
+	bool begin_frame();
+
+	//Sets the level that is running in the current frame (stored in recordings, ignored while replaying)
+	void set_level(int level);
+
+	//Sets the focus hit value that the level logic uses in the current frame (stored in recordings, ignored while replaying)
+	void set_focus_hit_value(double value);
+
+	mode get_mode() const {
+		return mMode;
+	}
+
+	//Time since the last frame in seconds
+	float delta_time() const {
+		return mFrame.mDeltaTime;
+	}
+
+	bool key_down(finput_key key) const {
+		return (mFrame.mKeysDown & key_bit(key)) != 0;
+	}
+
+	bool key_released(finput_key key) const {
+		return (mFrame.mKeysReleased & key_bit(key)) != 0;
+	}
+
+	//button: 0 = left, 1 = right, 2 = middle
+	bool mouse_button_down(int button) const {
+		return (mFrame.mButtons & (1u << button)) != 0;
+	}
+
+	glm::vec2 delta_cursor_position() const {
+		return mFrame.mCursorDelta;
+	}
+
+	//Returns the level of the current frame (the recorded one while replaying)
+	int level() const {
+		return mFrame.mLevel;
+	}
+
+	//Returns the focus hit value of the current frame (the recorded one while replaying)
+	double focus_hit_value() const {
+		return mFrame.mFocusHitValue;
+	}
+
+	//Returns the number of frames read so far
+	uint64_t frame_count() const {
+		return mFrameCount;
+	}
+
+	static uint16_t key_bit(finput_key key) {
+		return static_cast<uint16_t>(1u << static_cast<uint16_t>(key));
+	}
+
+private:
+	//Input of one frame. Stored field by field (26 bytes per frame)
+	struct frame {
+		float mDeltaTime = 0.0f;
+		glm::vec2 mCursorDelta = glm::vec2(0.0f);
+		uint16_t mKeysDown = 0;
+		uint16_t mKeysReleased = 0;
+		uint8_t mButtons = 0;
+		uint8_t mLevel = 0;
+		double mFocusHitValue = 0.0;
+	};
+
+	mode mMode = mode::LIVE;
+	frame mFrame;							//Input of the current frame
+	frame mScriptedFrame;					//Input of the next scripted frame
+	bool mFramePending = false;				//Whether mFrame still has to be written to the recording
+	uint64_t mFrameCount = 0;
+	std::ofstream mRecording;
+	std::ifstream mReplay;
+
+	//Reads the current input from Gears-Vk
+	static frame poll();
+	void write_frame(const frame& f);
+	bool read_frame(frame& f);
+};
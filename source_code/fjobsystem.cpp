@@ -0,0 +1,150 @@
+#include "includes.h"
+
+//Queue index of the current thread if it is a worker, -1 otherwise
+static thread_local int tWorkerIndex = -1;
+
+fjobsystem& fjobsystem::instance()
+{
+	static fjobsystem jobSystem;
+	return jobSystem;
+}
+
+fjobsystem::fjobsystem()
+{
+	size_t hardwareThreads = std::thread::hardware_concurrency();
+	start_workers(hardwareThreads > 1 ? hardwareThreads - 1 : 0);
+}
+
+fjobsystem::~fjobsystem()
+{
+	stop_workers();
+}
+
+void fjobsystem::set_worker_count(size_t count)
+{
+	stop_workers();
+	start_workers(count);
+}
+
+void fjobsystem::start_workers(size_t count)
+{
+	mStop = false;
+	mQueues.clear();
+	for (size_t i = 0; i <= count; ++i) {
+		mQueues.push_back(std::make_unique<job_queue>());
+	}
+	for (size_t i = 0; i < count; ++i) {
+		mThreads.emplace_back(&fjobsystem::worker_loop, this, i);
+	}
+}
+
+void fjobsystem::stop_workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStop = true;
+	}
+	mWakeUp.notify_all();
+	for (auto& thread : mThreads) {
+		thread.join();
+	}
+	mThreads.clear();
+	//Jobs that have not been taken by the workers are done here
+	while (run_one(mQueues.size() - 1));
+}
+
+void fjobsystem::submit(std::function<void()> function, counter* jobCounter)
+{
+	if (jobCounter != nullptr) {
+		jobCounter->mPending.fetch_add(1, std::memory_order_relaxed);
+	}
+	auto& queue = *mQueues[own_queue_index()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mMutex);
+		queue.mJobs.push_back({ std::move(function), jobCounter });
+	}
+	{
+		//Increase under the sleep mutex, so that no worker can miss the wake up between checking and sleeping
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		++mQueuedJobs;
+	}
+	mWakeUp.notify_one();
+}
+
+void fjobsystem::wait(counter& jobCounter)
+{
+	size_t ownIndex = own_queue_index();
+	while (jobCounter.mPending.load(std::memory_order_acquire) > 0) {
+		if (!run_one(ownIndex)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void fjobsystem::worker_loop(size_t index)
+{
+	tWorkerIndex = static_cast<int>(index);
+	fprofiler::set_thread_name("Worker " + std::to_string(index));
+	while (true) {
+		if (run_one(index)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWakeUp.wait(lock, [this]() { return mStop || mQueuedJobs > 0; });
+		if (mStop) {
+			return;
+		}
+	}
+}
+
+size_t fjobsystem::own_queue_index() const
+{
+	return tWorkerIndex >= 0 ? static_cast<size_t>(tWorkerIndex) : mQueues.size() - 1;
+}
+
+bool fjobsystem::take_job(size_t ownIndex, job& result)
+{
+	//Own queue: newest job first (its data is most likely still in the cache)
+	{
+		auto& queue = *mQueues[ownIndex];
+		std::lock_guard<std::mutex> lock(queue.mMutex);
+		if (!queue.mJobs.empty()) {
+			result = std::move(queue.mJobs.back());
+			queue.mJobs.pop_back();
+			return true;
+		}
+	}
+	//Steal the oldest job of another queue
+	for (size_t offset = 1; offset < mQueues.size(); ++offset) {
+		auto& queue = *mQueues[(ownIndex + offset) % mQueues.size()];
+		std::lock_guard<std::mutex> lock(queue.mMutex);
+		if (!queue.mJobs.empty()) {
+			result = std::move(queue.mJobs.front());
+			queue.mJobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool fjobsystem::run_one(size_t ownIndex)
+{
+	if (mQueuedJobs == 0) {
+		return false;
+	}
+	job current;
+	if (!take_job(ownIndex, current)) {
+		return false;
+	}
+	--mQueuedJobs;
+	try {
+		current.mFunction();
+	}
+	catch (std::exception& e) {
+		LOG_ERROR(std::string("Job failed: ") + e.what());
+	}
+	if (current.mCounter != nullptr) {
+		current.mCounter->mPending.fetch_sub(1, std::memory_order_release);
+	}
+	return true;
+}
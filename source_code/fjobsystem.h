@@ -0,0 +1,98 @@
+#pragma once
+#include "includes.h"
+
+/*
+Engine-wide work-stealing thread pool. Sized from the hardware by default (one thread less than the hardware concurrency,
+because the main thread helps executing jobs while waiting).
+Every worker has its own job queue. A worker takes its own newest jobs first and steals the oldest jobs of other workers
+when it runs out of work. Jobs submitted from threads outside the pool (e.g. the main thread) go to a shared queue.
+Used by PhysX (through fpxdispatcher), scene loading and per-frame batch work.
+*/
+class fjobsystem {
+public:
+	//Counts the unfinished jobs of a group. Pass it to submit and wait for it with wait.
+	struct counter {
+		std::atomic<uint32_t> mPending = 0;
+	};
+
+	//Returns the engine-wide job system
+	static fjobsystem& instance();
+
+	~fjobsystem();
+
+	//Sets the number of worker threads (0 = all work is done by the waiting thread).
+	//Must not be called while jobs are running.
+	void set_worker_count(size_t count);
+
+	//Returns the number of worker threads
+	size_t worker_count() const { return mThreads.size(); }
+
+	//Schedules a job. If a counter is given, it is increased immediately and decreased after the job has finished.
+	void submit(std::function<void()> job, counter* jobCounter = nullptr);
+
+	//Waits until all jobs of the counter have finished. Executes other jobs in the meantime instead of blocking.
+	void wait(counter& jobCounter);
+
+	//Calls func(i) for every i in [begin, end). The range is split into chunks of grainSize indices, which are executed in parallel.
+	//Returns after all chunks have finished.
+	template <typename F>
+	void parallel_for(size_t begin, size_t end, size_t grainSize, F&& func);
+
+private:
+	struct job {
+		std::function<void()> mFunction;
+		counter* mCounter;
+	};
+
+	struct job_queue {
+		std::mutex mMutex;
+		std::deque<job> mJobs;
+	};
+
+	std::vector<std::unique_ptr<job_queue>> mQueues;	//One queue per worker, the last one is shared by all other threads
+	std::vector<std::thread> mThreads;					//Worker threads
+	std::mutex mSleepMutex;								//Protects the sleeping of idle workers
+	std::condition_variable mWakeUp;					//Wakes up idle workers when new jobs arrive
+	std::atomic<uint32_t> mQueuedJobs = 0;				//Number of jobs in all queues
+	std::atomic<bool> mStop = false;					//Tells the workers to stop
+
+	fjobsystem();
+
+	void start_workers(size_t count);
+	void stop_workers();
+	void worker_loop(size_t index);
+
+	//Index of the calling thread's queue
+	size_t own_queue_index() const;
+	//Takes a job from the own queue or steals one from another queue
+	bool take_job(size_t ownIndex, job& result);
+	//Executes a single job if there is one. Returns false if there was nothing to do.
+	bool run_one(size_t ownIndex);
+};
+
+template <typename F>
+void fjobsystem::parallel_for(size_t begin, size_t end, size_t grainSize, F&& func)
+{
+	if (end <= begin) {
+		return;
+	}
+	grainSize = glm::max(grainSize, size_t(1));
+	//Not worth the overhead -> Do it directly
+	if (mThreads.empty() || end - begin <= grainSize) {
+		for (size_t i = begin; i < end; ++i) {
+			func(i);
+		}
+		return;
+	}
+
+	counter chunks;
+	for (size_t chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize) {
+		size_t chunkEnd = glm::min(chunkBegin + grainSize, end);
+		submit([&func, chunkBegin, chunkEnd]() {
+			for (size_t i = chunkBegin; i < chunkEnd; ++i) {
+				func(i);
+			}
+		}, &chunks);
+	}
+	wait(chunks);
+}
@@ -1,7 +1,7 @@
 //Author: Simon Fraiss
 #include "includes.h"
 
-flevel1logic::flevel1logic(fscene* scene) : flevellogic(scene) {
+flevel1logic::flevel1logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input) : flevellogic(scene, physicsRuntime, input) {
 	
 }
 
@@ -11,35 +11,42 @@ void flevel1logic::initialize() {
 	initialCameraRot = mScene->get_camera().rotation();
 
 	//---CREATE PHYSICS AND PLAYER CONTROLLER---
-	physics = std::make_unique<fphysicscontroller>(mScene);
-	player = std::make_unique<fplayercontrol>(physics.get(), mScene, false, 1.5, (PxUserControllerHitReport*)this);
+	physics = std::make_unique<fphysicscontroller>(mScene, mPhysicsRuntime);
+	player = std::make_unique<fplayercontrol>(physics.get(), mScene, mInput, false, 1.5, (PxUserControllerHitReport*)this);
 	
 	//---CREATE ACTORS FOR MODELS---
 	for (int i = 1; i <= 7; ++i) {
 		auto instance = mScene->get_model_by_name("Wall" + std::to_string(i));
-		physics->create_rigid_static_for_scaled_plane(instance);
+		physics->create_rigid_static_for_triangle_mesh(instance);
 	}
 	for (int i = 1; i <= 10; ++i) {
 		auto instance = mScene->get_model_by_name("Floor" + std::to_string(i));
-		auto moving = i >= 7 && i <= 9;
-		auto actor = physics->create_rigid_static_for_scaled_unit_box(instance, moving);
-		if (moving) {
-			movingFloors[i - 7] = actor;
+		if (i >= 7 && i <= 9) {
+			movingFloors[i - 7] = physics->create_kinematic_for_convex_mesh(instance);
+		}
+		else {
+			physics->create_rigid_static_for_triangle_mesh(instance);
 		}
 	}
 
 	auto finalRegionRes = mScene->get_model_by_name("FinalFloor");
-	finalRegionActor = physics->create_rigid_static_for_scaled_unit_box(finalRegionRes, true);
+	finalRegionActor = physics->create_kinematic_for_convex_mesh(finalRegionRes);
 	player->set_final_region(finalRegionActor);
 
 	sphereInstance = mScene->get_model_by_name("Sphere");
 	auto mirrorBorderInstance = mScene->get_model_by_name("MirrorBorder");
 	auto mirrorPlaneInstance = mScene->get_model_by_name("MirrorPlane");
 
-	mirrorBorderActor = physics->create_rigid_static_for_scaled_unit_box(mirrorBorderInstance, true);
-	mirrorPlaneActor = physics->create_rigid_static_for_scaled_plane(mirrorPlaneInstance, true);
+	mirrorBorderActor = physics->create_kinematic_for_scaled_unit_box(mirrorBorderInstance);
+	mirrorPlaneActor = physics->create_kinematic_for_scaled_plane(mirrorPlaneInstance);
 	player->add_mirror({ mirrorBorderActor, mirrorPlaneActor });
 
+	//---ADD ALL STATIC ACTORS AT ONCE---
+	physics->finish_static_actors();
+
+	//---SNAPSHOT OF THE INITIAL PHYSICS STATE FOR LEVEL RESET---
+	physics->take_snapshot();
+
 	//---INITIALIZE HSV INTERPOLATOR---
 	interpolator.add_sample(0, glm::vec3(47, 0, 0.3));
 	interpolator.add_sample(1, glm::vec3(60, 1, 1));
@@ -67,7 +74,7 @@ levelstatus flevel1logic::update(float deltaT, double focusHitValue)
 		return levelstatus::WON;
 	}
 
-	if (gvk::input().key_released(gvk::key_code::f10)) {
+	if (mInput->key_released(finput_key::f10)) {
 		score = 100.0f;
 		return levelstatus::WON;
 	}
@@ -80,24 +87,27 @@ levelstatus flevel1logic::update(float deltaT, double focusHitValue)
 
 void flevel1logic::fixed_update(float stepSize)
 {
+	//---FETCH RESULTS OF THE LAST PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->fetch_results();
+
 	//---ANIMATE PLATTFORMS---
 	accTime += stepSize;
 	float xA = -(22 + 1.5 * cos(2 * accTime));
 	float xB = -(22 - 1.5 * cos(2 * accTime));
 	PxTransform oldpose[4];
 	PxTransform newpose[4];
-	oldpose[0] = movingFloors[0]->getGlobalPose();
+	oldpose[0] = physics->get_kinematic_pose(movingFloors[0]);
 	newpose[0] = PxTransform(PxVec3(xA, oldpose[0].p.y, oldpose[0].p.z), oldpose[0].q);
-	movingFloors[0]->setGlobalPose(newpose[0]);
-	oldpose[1] = movingFloors[1]->getGlobalPose();
+	physics->move_kinematic(movingFloors[0], newpose[0]);
+	oldpose[1] = physics->get_kinematic_pose(movingFloors[1]);
 	newpose[1] = PxTransform(PxVec3(xB, oldpose[1].p.y, oldpose[1].p.z), oldpose[1].q);
-	movingFloors[1]->setGlobalPose(newpose[1]);
-	oldpose[2] = movingFloors[2]->getGlobalPose();
+	physics->move_kinematic(movingFloors[1], newpose[1]);
+	oldpose[2] = physics->get_kinematic_pose(movingFloors[2]);
 	newpose[2] = PxTransform(PxVec3(xA, oldpose[2].p.y, oldpose[2].p.z), oldpose[2].q);
-	movingFloors[2]->setGlobalPose(newpose[2]);
-	oldpose[3] = finalRegionActor->getGlobalPose();
+	physics->move_kinematic(movingFloors[2], newpose[2]);
+	oldpose[3] = physics->get_kinematic_pose(finalRegionActor);
 	newpose[3] = PxTransform(PxVec3(xB, oldpose[3].p.y, oldpose[3].p.z), oldpose[3].q);
-	finalRegionActor->setGlobalPose(newpose[3]);
+	physics->move_kinematic(finalRegionActor, newpose[3]);
 
 	//---UPDATE PHYSICS AND PLAYER---
 	player->pre_px_update(stepSize);
@@ -113,16 +123,21 @@ void flevel1logic::fixed_update(float stepSize)
 			onPlatform[i] = false;
 		}
 	}
+
+	//---START NEXT PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->simulate_async(stepSize);
 }
 
 void flevel1logic::reset()
 {
+	//---RESET PHYSICS TO THE STATE AFTER INITIALIZATION---
+	physics->restore_snapshot();
+
 	//---RESET TO INITIAL DATA---
 	accTime = 0;
 	mScene->get_camera().set_rotation(initialCameraRot);
 	mScene->get_camera().set_translation(initialCameraPos);
 	player->update_position();
-	player->reset_mirrors();
 	score = 0;
 }
 
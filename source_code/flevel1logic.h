@@ -10,7 +10,7 @@ public:
 		return "assets/level1g.dae";
 	}
 
-	flevel1logic(fscene* scene);
+	flevel1logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input);
 
 	void initialize() override;
 
@@ -36,10 +36,10 @@ private:
 	glm::vec3 initialCameraPos;								//Initial camera position
 	glm::quat initialCameraRot;								//Initial camera rotation
 	fmodel* sphereInstance;									//Focusphere model data
-	PxRigidStatic* mirrorBorderActor;						//Actor for mirror border
-	PxRigidStatic* mirrorPlaneActor;						//Actor for mirror plane
-	PxRigidStatic* movingFloors[3];							//Actors for moving floors (except goal floor)
-	PxRigidStatic* finalRegionActor;						//Actor for goal floor
+	PxRigidDynamic* mirrorBorderActor;						//Actor for mirror border
+	PxRigidDynamic* mirrorPlaneActor;						//Actor for mirror plane
+	PxRigidDynamic* movingFloors[3];						//Actors for moving floors (except goal floor)
+	PxRigidDynamic* finalRegionActor;						//Actor for goal floor
 	float accTime = 0;										//Accumulated time since start
 	double score = 0;										//Current score
 	bool onPlatform[4] = { false, false, false, false };	//Whether the player touches a platform
@@ -1,7 +1,7 @@
 //Author: Simon Fraiss
 #include "includes.h"
 
-flevel2logic::flevel2logic(fscene* scene) : flevellogic(scene) {
+flevel2logic::flevel2logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input) : flevellogic(scene, physicsRuntime, input) {
 	
 }
 
@@ -11,8 +11,8 @@ void flevel2logic::initialize() {
 	initialCameraRot = mScene->get_camera().rotation();
 
 	//---CREATE PHYSICS AND PLAYER CONTROLLER---
-	physics = std::make_unique<fphysicscontroller>(mScene);
-	player = std::make_unique<fplayercontrol>(physics.get(), mScene, false, 1.5);
+	physics = std::make_unique<fphysicscontroller>(mScene, mPhysicsRuntime);
+	player = std::make_unique<fplayercontrol>(physics.get(), mScene, mInput, false, 1.5);
 
 	//---CREATE ACTORS FOR MODELS---
 	std::vector<std::string> solids = {
@@ -22,27 +22,33 @@ void flevel2logic::initialize() {
 
 	for (const std::string& name : solids) {
 		auto instance = mScene->get_model_by_name(name);
-		auto actor = physics->create_rigid_static_for_scaled_unit_box(instance);
+		physics->create_rigid_static_for_triangle_mesh(instance);
 	}
 
 	auto floor7 = mScene->get_model_by_name("Floor7");
-	finalFloorActor = physics->create_rigid_static_for_scaled_unit_box(floor7);
+	finalFloorActor = physics->create_rigid_static_for_triangle_mesh(floor7);
 
 	auto finalRegion = mScene->get_model_by_name("FinalRegion");
-	finalRegionActor = physics->create_rigid_static_for_scaled_unit_box(finalRegion);
+	finalRegionActor = physics->create_rigid_static_for_triangle_mesh(finalRegion);
 	player->set_final_region(finalRegionActor);
 
 	auto wall = mScene->get_model_by_name("WallX2");
-	movingWallActor = physics->create_rigid_static_for_scaled_unit_box(wall, true);
+	movingWallActor = physics->create_kinematic_for_convex_mesh(wall);
 
 	sphereInstance = mScene->get_model_by_name("Sphere");
 	auto mirrorBorderInstance = mScene->get_model_by_name("MirrorBorder");
 	auto mirrorPlaneInstance = mScene->get_model_by_name("MirrorPlane");
 
-	mirrorBorderActor = physics->create_rigid_static_for_scaled_unit_box(mirrorBorderInstance, true);
-	mirrorPlaneActor = physics->create_rigid_static_for_scaled_plane(mirrorPlaneInstance, true);
+	mirrorBorderActor = physics->create_kinematic_for_scaled_unit_box(mirrorBorderInstance);
+	mirrorPlaneActor = physics->create_kinematic_for_scaled_plane(mirrorPlaneInstance);
 	player->add_mirror({ mirrorBorderActor, mirrorPlaneActor });
 
+	//---ADD ALL STATIC ACTORS AT ONCE---
+	physics->finish_static_actors();
+
+	//---SNAPSHOT OF THE INITIAL PHYSICS STATE FOR LEVEL RESET---
+	physics->take_snapshot();
+
 	//---INITIALIZE HSV INTERPOLATOR---
 	interpolator.add_sample(0, glm::vec3(47, 0, 0.5));
 	interpolator.add_sample(1, glm::vec3(60, 1, 1));
@@ -70,7 +76,7 @@ levelstatus flevel2logic::update(float deltaT, double focusHitValue)
 		return levelstatus::WON;
 	}
 
-	if (gvk::input().key_released(gvk::key_code::f10)) {
+	if (mInput->key_released(finput_key::f10)) {
 		score = 100.0f;
 		return levelstatus::WON;
 	}
@@ -83,6 +89,9 @@ levelstatus flevel2logic::update(float deltaT, double focusHitValue)
 
 void flevel2logic::fixed_update(float stepSize)
 {
+	//---FETCH RESULTS OF THE LAST PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->fetch_results();
+
 	//---ANIMATE WALL IF NECESSARY---
 	accTime += stepSize;
 	PxVec3 finFloorMin = finalFloorActor->getWorldBounds().minimum;
@@ -94,9 +103,9 @@ void flevel2logic::fixed_update(float stepSize)
 			wallMovingRightStart = accTime;
 		}
 		float z = glm::min(-36.0f + 8.0f * ((accTime - wallMovingRightStart) / 4.0f), -28.0f);
-		PxTransform oldpose = movingWallActor->getGlobalPose();
+		PxTransform oldpose = physics->get_kinematic_pose(movingWallActor);
 		PxTransform newpose = PxTransform(PxVec3(oldpose.p.x, oldpose.p.y, z), oldpose.q);
-		movingWallActor->setGlobalPose(newpose);
+		physics->move_kinematic(movingWallActor, newpose);
 	}
 	else {
 		if (wallMovingRightStart > 0) {
@@ -105,9 +114,9 @@ void flevel2logic::fixed_update(float stepSize)
 		}
 		if (wallMovingLeftStart > 0) {
 			float z = glm::max(-28.0f - 8.0f * ((accTime - wallMovingLeftStart) / 4.0f), -36.0f);
-			PxTransform oldpose = movingWallActor->getGlobalPose();
+			PxTransform oldpose = physics->get_kinematic_pose(movingWallActor);
 			PxTransform newpose = PxTransform(PxVec3(oldpose.p.x, oldpose.p.y, z), oldpose.q);
-			movingWallActor->setGlobalPose(newpose);
+			physics->move_kinematic(movingWallActor, newpose);
 			if (accTime - wallMovingLeftStart > 4.0f) {
 				wallMovingLeftStart = -1.0f;
 			}
@@ -118,16 +127,21 @@ void flevel2logic::fixed_update(float stepSize)
 	player->pre_px_update(stepSize);
 	physics->update(stepSize);
 	player->post_px_update(stepSize);
+
+	//---START NEXT PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->simulate_async(stepSize);
 }
 
 void flevel2logic::reset()
 {
+	//---RESET PHYSICS TO THE STATE AFTER INITIALIZATION---
+	physics->restore_snapshot();
+
 	//---RESET TO INITIAL DATA---
 	accTime = 0;
 	mScene->get_camera().set_rotation(initialCameraRot);
 	mScene->get_camera().set_translation(initialCameraPos);
 	player->update_position();
-	player->reset_mirrors();
 	score = 0;
 }
 
@@ -10,7 +10,7 @@ public:
 		return "assets/level2.dae";
 	}
 
-	flevel2logic(fscene* scene);
+	flevel2logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input);
 
 	void initialize() override;
 
@@ -31,9 +31,9 @@ private:
 	glm::vec3 initialCameraPos;							//Initial camera position
 	glm::quat initialCameraRot;							//Initial camera rotation
 	fmodel* sphereInstance;								//Focusphere model data
-	PxRigidStatic* mirrorBorderActor;					//Actor for mirror border
-	PxRigidStatic* mirrorPlaneActor;					//Actor for mirror plane
-	PxRigidStatic* movingWallActor;						//Actor for moving wall
+	PxRigidDynamic* mirrorBorderActor;					//Actor for mirror border
+	PxRigidDynamic* mirrorPlaneActor;					//Actor for mirror plane
+	PxRigidDynamic* movingWallActor;					//Actor for moving wall
 	PxRigidStatic* finalFloorActor;						//Actor for last floor contianing the goal floor
 	PxRigidStatic* finalRegionActor;					//Actor for goal floor
 	float wallMovingRightStart = -1.0f;					//Used for animating the wall
@@ -3,7 +3,7 @@
 #define _USE_MATH_DEFINES
 #include <Math.h>
 
-flevel3logic::flevel3logic(fscene* scene) : flevellogic(scene) {
+flevel3logic::flevel3logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input) : flevellogic(scene, physicsRuntime, input) {
 }
 
 void flevel3logic::initialize() {
@@ -12,8 +12,8 @@ void flevel3logic::initialize() {
 	initialCameraRot = mScene->get_camera().rotation();
 
 	//---- CREATE PHYSICS AND PLAYER OBJECTS -----
-	physics = std::make_unique<fphysicscontroller>(mScene);
-	player = std::make_unique<fplayercontrol>(physics.get(), mScene, false, 1.5, (PxUserControllerHitReport*)this);
+	physics = std::make_unique<fphysicscontroller>(mScene, mPhysicsRuntime);
+	player = std::make_unique<fplayercontrol>(physics.get(), mScene, mInput, false, 1.5, (PxUserControllerHitReport*)this);
 
 	//---CREATE ACTORS FOR MODELS---
 	//Floors
@@ -22,16 +22,18 @@ void flevel3logic::initialize() {
 	};
 	for (uint32_t i = 0; i < floornames.size(); ++i) {
 		auto instance = mScene->get_model_by_name(floornames[i]);
-		auto actor = physics->create_rigid_static_for_scaled_unit_box(instance, (i == 2));
 		if (i == 2) {
-			movingFloorActor = actor;
+			movingFloorActor = physics->create_kinematic_for_convex_mesh(instance);
 			player->set_final_region(movingFloorActor);
 		}
+		else {
+			physics->create_rigid_static_for_triangle_mesh(instance);
+		}
 	}
 
 	//Wall
 	auto wallX = mScene->get_model_by_name("WallX");
-	physics->create_rigid_static_for_scaled_unit_box(wallX);
+	physics->create_rigid_static_for_triangle_mesh(wallX);
 
 	//DoorWalls
 	std::vector<std::string> doorwalls = {
@@ -39,45 +41,51 @@ void flevel3logic::initialize() {
 	};
 	for (const std::string& name : doorwalls) {
 		auto instance = mScene->get_model_by_name(name);
-		physics->create_rigid_static_for_scaled_plane(instance);
+		physics->create_rigid_static_for_triangle_mesh(instance);
 	}
 
-	//"Invisible" Walls
+	//"Invisible" Walls (boxes, there is no geometry for them in the scene file)
 	PxShape* wallShape = physics->mPhysics->createShape(PxBoxGeometry(2.93, 3.23, 0.1), *physics->mDefaultMaterial, false);
 	PxTransform wall1t = PxTransform(PxVec3(-5.44, 2.93, 5.55), PxQuat(M_PI / 2, PxVec3(0, 0, 1)));
 	PxRigidStatic* wall1a = physics->mPhysics->createRigidStatic(wall1t);
 	wall1a->attachShape(*wallShape);
-	physics->mPxScene->addActor(*wall1a);
+	physics->add_static_actor(wall1a);
 	PxTransform wall2t = PxTransform(PxVec3(5.44, 2.93, 5.55), PxQuat(M_PI / 2, PxVec3(0, 0, 1)));
 	PxRigidStatic* wall2a = physics->mPhysics->createRigidStatic(wall2t);
 	wall2a->attachShape(*wallShape);
-	physics->mPxScene->addActor(*wall2a);
+	physics->add_static_actor(wall2a);
 	PxTransform wall3t = PxTransform(PxVec3(5.44, 2.93, 3.37), PxQuat(M_PI / 2, PxVec3(0, 0, 1)));
 	PxRigidStatic* wall3a = physics->mPhysics->createRigidStatic(wall3t);
 	wall3a->attachShape(*wallShape);
-	physics->mPxScene->addActor(*wall3a);
+	physics->add_static_actor(wall3a);
 	PxTransform wall4t = PxTransform(PxVec3(-5.44, 2.93, 3.37), PxQuat(M_PI / 2, PxVec3(0, 0, 1)));
 	PxRigidStatic* wall4a = physics->mPhysics->createRigidStatic(wall4t);
 	wall4a->attachShape(*wallShape);
-	physics->mPxScene->addActor(*wall4a);
+	physics->add_static_actor(wall4a);
 	wallShape->release();
 
 	//Mirror
 	auto mirrorBorderInstance = mScene->get_model_by_name("MirrorBorder1");
 	auto mirrorPlaneInstance = mScene->get_model_by_name("MirrorPlane1");
-	mirrorBorderActor = physics->create_rigid_static_for_scaled_unit_box(mirrorBorderInstance, true);
-	mirrorPlaneActor = physics->create_rigid_static_for_scaled_plane(mirrorPlaneInstance, true);
+	mirrorBorderActor = physics->create_kinematic_for_scaled_unit_box(mirrorBorderInstance);
+	mirrorPlaneActor = physics->create_kinematic_for_scaled_plane(mirrorPlaneInstance);
 	player->add_mirror({ mirrorBorderActor, mirrorPlaneActor }, 14.75f);
 
 	//Rotating Wall
 	auto movingWallInstance = mScene->get_model_by_name("RotWall");
 
-	movingWallActor = physics->create_rigid_static_for_scaled_unit_box(movingWallInstance, true);
+	movingWallActor = physics->create_kinematic_for_convex_mesh(movingWallInstance);
 	movingWallPxOriginalTransformation = movingWallActor->getGlobalPose();
 
 	//Sphere
 	sphereInstance = mScene->get_model_by_name("Sphere");
 
+	//---ADD ALL STATIC ACTORS AT ONCE---
+	physics->finish_static_actors();
+
+	//---SNAPSHOT OF THE INITIAL PHYSICS STATE FOR LEVEL RESET---
+	physics->take_snapshot();
+
 	//---INITIALIZE HSV INTERPOLATOR---
 	interpolator.add_sample(0, glm::vec3(60, 0, 0.7));
 	interpolator.add_sample(1, glm::vec3(60, 1, 1));
@@ -105,7 +113,7 @@ levelstatus flevel3logic::update(float deltaT, double focusHitValue)
 		return levelstatus::WON;
 	}
 
-	if (gvk::input().key_released(gvk::key_code::f10)) {
+	if (mInput->key_released(finput_key::f10)) {
 		score = 100.0f;
 		return levelstatus::WON;
 	}
@@ -118,14 +126,17 @@ levelstatus flevel3logic::update(float deltaT, double focusHitValue)
 
 void flevel3logic::fixed_update(float stepSize)
 {
+	//---FETCH RESULTS OF THE LAST PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->fetch_results();
+
 	//---ANIMATE PLATTFORM---
 	float tsin = sin(platformAccTime / 5.0);
 	float tcos = cos(platformAccTime / 5.0);
 	float floorx = -(tsin * 12.0f);
 	float floorz = -18.0f + tcos * 12.0f;
-	auto oldfloorpose = movingFloorActor->getGlobalPose();
+	auto oldfloorpose = physics->get_kinematic_pose(movingFloorActor);
 	auto newfloorpose = PxTransform(PxVec3(floorx, oldfloorpose.p.y, floorz), oldfloorpose.q);
-	movingFloorActor->setGlobalPose(newfloorpose);
+	physics->move_kinematic(movingFloorActor, newfloorpose);
 
 	//Move Rotating Wall
 	float rotwallangle = 0.0f;
@@ -142,7 +153,7 @@ void flevel3logic::fixed_update(float stepSize)
 	}
 	PxQuat rot = PxQuat(rotwallangle, PxVec3(0, 1, 0));
 	PxQuat newPxQuat = rot * movingWallPxOriginalTransformation.q;
-	movingWallActor->setGlobalPose(PxTransform(movingWallPxOriginalTransformation.p, newPxQuat));
+	physics->move_kinematic(movingWallActor, PxTransform(movingWallPxOriginalTransformation.p, newPxQuat));
 
 	//---UPDATE PHYSICS AND PLAYER---
 	player->pre_px_update(stepSize);
@@ -161,10 +172,16 @@ void flevel3logic::fixed_update(float stepSize)
 		player->beam_along(distance);
 		onPlatform = false;
 	}
+
+	//---START NEXT PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->simulate_async(stepSize);
 }
 
 void flevel3logic::reset()
 {
+	//---RESET PHYSICS TO THE STATE AFTER INITIALIZATION---
+	physics->restore_snapshot();
+
 	//---RESET TO INITIAL DATA---
 	platformAccTime = 0;
 	onPlatform = false;
@@ -172,7 +189,6 @@ void flevel3logic::reset()
 	mScene->get_camera().set_rotation(initialCameraRot);
 	mScene->get_camera().set_translation(initialCameraPos);
 	player->update_position();
-	player->reset_mirrors();
 	score = 0;
 }
 
@@ -9,7 +9,7 @@ public:
 		return "assets/level3g.dae";
 	}
 
-	flevel3logic(fscene* scene);
+	flevel3logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input);
 
 	void initialize() override;
 
@@ -35,10 +35,10 @@ private:
 	glm::vec3 initialCameraPos;							//Initial camera position
 	glm::quat initialCameraRot;							//Initial camera rotation
 	fmodel* sphereInstance;								//Focusphere model data
-	PxRigidStatic* mirrorBorderActor;					//Actor for moveable mirror border
-	PxRigidStatic* mirrorPlaneActor;					//Actor for moveable mirror plane
-	PxRigidStatic* movingFloorActor;					//Actor for moving goal floor
-	PxRigidStatic* movingWallActor;						//Actor for moving wall
+	PxRigidDynamic* mirrorBorderActor;					//Actor for moveable mirror border
+	PxRigidDynamic* mirrorPlaneActor;					//Actor for moveable mirror plane
+	PxRigidDynamic* movingFloorActor;					//Actor for moving goal floor
+	PxRigidDynamic* movingWallActor;					//Actor for moving wall
 	PxTransform movingWallPxOriginalTransformation;		//Initial transformation of moving wall actor
 	bool onPlatform = false;							//Whether the player touches the goal paltform
 	bool platformMoving = false;						//Whether the goal platform is in motion
@@ -1,7 +1,7 @@
 //Author: Simon Fraiss
 #include "includes.h"
 
-flevel4logic::flevel4logic(fscene* scene) : flevellogic(scene) {
+flevel4logic::flevel4logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input) : flevellogic(scene, physicsRuntime, input) {
 }
 
 void flevel4logic::initialize() {
@@ -10,17 +10,17 @@ void flevel4logic::initialize() {
 	initialCameraRot = mScene->get_camera().rotation();
 
 	//---- CREATE PHYSICS AND PLAYER OBJECTS -----
-	physics = std::make_unique<fphysicscontroller>(mScene);
-	player = std::make_unique<fplayercontrol>(physics.get(), mScene, false, 1.5, (PxUserControllerHitReport*)this);
+	physics = std::make_unique<fphysicscontroller>(mScene, mPhysicsRuntime);
+	player = std::make_unique<fplayercontrol>(physics.get(), mScene, mInput, false, 1.5, (PxUserControllerHitReport*)this);
 
 	//---CREATE ACTORS FOR MODELS---
 	for (int i = 1; i <= 4; ++i) {
 		auto instance = mScene->get_model_by_name("Platform" + std::to_string(i));
-		platformActors[i - 1] = physics->create_rigid_static_for_scaled_unit_box(instance, true);
+		platformActors[i - 1] = physics->create_kinematic_for_convex_mesh(instance);
 	}
 
 	auto finalRegionInstance = mScene->get_model_by_name("FinalRegion");
-	finalRegionActor = physics->create_rigid_static_for_scaled_unit_box(finalRegionInstance, true);
+	finalRegionActor = physics->create_kinematic_for_convex_mesh(finalRegionInstance);
 	player->set_final_region(finalRegionActor);
 
 	sphereInstance = mScene->get_model_by_name("Sphere");
@@ -33,15 +33,21 @@ void flevel4logic::initialize() {
 	//activate leave shader
 	leavesInstance->mLeaf = true;
 
-	physics->create_rigid_static_for_scaled_plane(groundFloorInstance, false);
+	physics->create_rigid_static_for_triangle_mesh(groundFloorInstance, false);
 
-	mirrorBorder1Actor = physics->create_rigid_static_for_scaled_unit_box(mirrorBorder1Instance, true);
-	mirrorPlane1Actor = physics->create_rigid_static_for_scaled_plane(mirrorPlane1Instance, true);
+	mirrorBorder1Actor = physics->create_kinematic_for_scaled_unit_box(mirrorBorder1Instance);
+	mirrorPlane1Actor = physics->create_kinematic_for_scaled_plane(mirrorPlane1Instance);
 	player->add_mirror({ mirrorBorder1Actor, mirrorPlane1Actor });
 
-	mirrorBorder2Actor = physics->create_rigid_static_for_scaled_unit_box(mirrorBorder2Instance, true);
-	mirrorPlane2Actor = physics->create_rigid_static_for_scaled_plane(mirrorPlane2Instance, true);
+	mirrorBorder2Actor = physics->create_kinematic_for_scaled_unit_box(mirrorBorder2Instance);
+	mirrorPlane2Actor = physics->create_kinematic_for_scaled_plane(mirrorPlane2Instance);
 	player->add_mirror({ mirrorBorder2Actor, mirrorPlane2Actor });
+
+	//---ADD ALL STATIC ACTORS AT ONCE---
+	physics->finish_static_actors();
+
+	//---SNAPSHOT OF THE INITIAL PHYSICS STATE FOR LEVEL RESET---
+	physics->take_snapshot();
 }
 
 levelstatus flevel4logic::update(float deltaT, double focusHitValue)
@@ -66,7 +72,7 @@ levelstatus flevel4logic::update(float deltaT, double focusHitValue)
 		return levelstatus::WON;
 	}
 
-	if (gvk::input().key_released(gvk::key_code::f10)) {
+	if (mInput->key_released(finput_key::f10)) {
 		score = 100.0f;
 		return levelstatus::WON;
 	}
@@ -79,6 +85,9 @@ levelstatus flevel4logic::update(float deltaT, double focusHitValue)
 
 void flevel4logic::fixed_update(float stepSize)
 {
+	//---FETCH RESULTS OF THE LAST PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->fetch_results();
+
 	//---ANIMATE PLATTFORMS---
 	accTime += stepSize;
 
@@ -95,13 +104,13 @@ void flevel4logic::fixed_update(float stepSize)
 	PxTransform oldpose[5];
 	PxTransform newpose[5];
 	for (int i = 0; i < 4; ++i) {
-		oldpose[i] = platformActors[i]->getGlobalPose();
+		oldpose[i] = physics->get_kinematic_pose(platformActors[i]);
 		newpose[i] = PxTransform(PxVec3(x[i], oldpose[i].p.y, z[i]), oldpose[i].q);
-		platformActors[i]->setGlobalPose(newpose[i]);
+		physics->move_kinematic(platformActors[i], newpose[i]);
 	}
 	//Final Region
 	glm::vec3 camPos = mScene->get_camera().translation();
-	oldpose[4] = finalRegionActor->getGlobalPose();
+	oldpose[4] = physics->get_kinematic_pose(finalRegionActor);
 	auto frMin = finalRegionActor->getWorldBounds().minimum;
 	auto frMax = finalRegionActor->getWorldBounds().maximum;
 	if (camPos.x >= frMin.x && camPos.x <= frMax.x && camPos.z >= frMin.z && camPos.z <= frMax.z) {
@@ -110,13 +119,13 @@ void flevel4logic::fixed_update(float stepSize)
 			newy = glm::max(oldpose[4].p.y - stepSize * 2.0f, 0.9f);
 		}
 		newpose[4] = PxTransform(PxVec3(oldpose[4].p.x, newy, oldpose[4].p.z), oldpose[4].q);
-		finalRegionActor->setGlobalPose(newpose[4]);
+		physics->move_kinematic(finalRegionActor, newpose[4]);
 	}
 	else {
 		if (oldpose[4].p.y < 7.02) {
 			float newy = glm::min(oldpose[4].p.y + stepSize * 2.0f, 7.029f);
 			newpose[4] = PxTransform(PxVec3(oldpose[4].p.x, newy, oldpose[4].p.z), oldpose[4].q);
-			finalRegionActor->setGlobalPose(newpose[4]);
+			physics->move_kinematic(finalRegionActor, newpose[4]);
 		}
 		else {
 			newpose[4] = oldpose[4];
@@ -124,11 +133,11 @@ void flevel4logic::fixed_update(float stepSize)
 	}
 
 	//Mirror-Movement:
-	PxTransform oldmirrorpose = mirrorPlane1Actor->getGlobalPose();
+	PxTransform oldmirrorpose = physics->get_kinematic_pose(mirrorPlane1Actor);
 	float newy = -3.0f * cos(accTime * 0.7f) + 9.0f;
 	PxTransform newmirrorpose = PxTransform(PxVec3(oldmirrorpose.p.x, newy, oldmirrorpose.p.z), oldmirrorpose.q);
-	mirrorPlane1Actor->setGlobalPose(newmirrorpose);
-	mirrorBorder1Actor->setGlobalPose(newmirrorpose);
+	physics->move_kinematic(mirrorPlane1Actor, newmirrorpose);
+	physics->move_kinematic(mirrorBorder1Actor, newmirrorpose);
 
 	//---UPDATE PHYSICS AND PLAYER---
 	player->pre_px_update(stepSize);
@@ -144,16 +153,21 @@ void flevel4logic::fixed_update(float stepSize)
 			onPlatform[i] = false;
 		}
 	}
+
+	//---START NEXT PHYSICS STEP (ASYNCHRONOUS MODE)---
+	physics->simulate_async(stepSize);
 }
 
 void flevel4logic::reset()
 {
+	//---RESET PHYSICS TO THE STATE AFTER INITIALIZATION---
+	physics->restore_snapshot();
+
 	//---RESET TO INITIAL DATA---
 	accTime = 0;
 	mScene->get_camera().set_rotation(initialCameraRot);
 	mScene->get_camera().set_translation(initialCameraPos); 
 	player->update_position();
-	player->reset_mirrors();
 	score = 0;
 }
 
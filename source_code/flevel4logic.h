@@ -9,7 +9,7 @@ public:
 		return "assets/level4.dae";
 	}
 
-	flevel4logic(fscene* scene);
+	flevel4logic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input);
 
 	void initialize() override;
 
@@ -34,12 +34,12 @@ private:
 	glm::vec3 initialCameraPos;								//Initial camera position
 	glm::quat initialCameraRot;								//Initial camera rotation
 	fmodel* sphereInstance;									//Focusphere model data
-	PxRigidStatic* mirrorBorder1Actor;						//Actor for mirror 1 border
-	PxRigidStatic* mirrorPlane1Actor;						//Actor for mirror 1 plane
-	PxRigidStatic* mirrorBorder2Actor;						//Actor for mirror 2 border
-	PxRigidStatic* mirrorPlane2Actor;						//Actor for mirror 2 plane
-	PxRigidStatic* platformActors[4];						//Actors for moving platforms
-	PxRigidStatic* finalRegionActor;						//Actor for goal platform
+	PxRigidDynamic* mirrorBorder1Actor;						//Actor for mirror 1 border
+	PxRigidDynamic* mirrorPlane1Actor;						//Actor for mirror 1 plane
+	PxRigidDynamic* mirrorBorder2Actor;						//Actor for mirror 2 border
+	PxRigidDynamic* mirrorPlane2Actor;						//Actor for mirror 2 plane
+	PxRigidDynamic* platformActors[4];						//Actors for moving platforms
+	PxRigidDynamic* finalRegionActor;						//Actor for goal platform
 	bool onPlatform[4] = { false, false, false, false };	//Whether the player touches a platform
 	float accTime = 0;										//Accumulated time since start
 	double score = 0;										//Current score
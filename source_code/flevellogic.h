@@ -18,8 +18,12 @@ public:
 		throw new std::runtime_error("No level path given!");
 	}
 
-	flevellogic(fscene* scene) {
+	//physicsRuntime: Global PhysX objects, shared by all levels
+	//input: Input and frame time of the gameplay (live, recorded or replayed), begin_frame is called by the owner of the level
+	flevellogic(fscene* scene, fphysicsruntime* physicsRuntime, finput* input) {
 		this->mScene = scene;
+		this->mPhysicsRuntime = physicsRuntime;
+		this->mInput = input;
 	}
 
 	//--------------------------
@@ -27,18 +31,33 @@ public:
 	//make sure to override initialize and finalize!
 	//if you want to override update and fixed_udpate, please override the corresponding protected functions.
 
+	//Runs the physics steps that are due (see fphysicsconfig::mStepRate) before the per-frame update.
+	//The scene renders the dynamic models between the last two steps, so the physics rate can be lower than the frame rate.
 	void update() override { 
+		FPROFILE_SCOPE("flevellogic::update");
 		if (!mLevelPaused) {
-			mStatus = update(gvk::time().delta_time(), mFocusHitValue);
+			const float stepSize = 1.0f / mPhysicsRuntime->mConfig.mStepRate;
+			mStepAccumulator += mInput->delta_time();
+			int steps = 0;
+			while (mStepAccumulator >= stepSize && steps < mPhysicsRuntime->mConfig.mMaxCatchUpSteps) {
+				FPROFILE_SCOPE("flevellogic::fixed_update");
+				mScene->begin_physics_step();
+				fixed_update(stepSize);
+				mStepAccumulator -= stepSize;
+				++steps;
+				++mStepCount;
+			}
+			//Too far behind (e.g. after loading or a hitch) -> drop the remaining time instead of catching up over the next frames
+			if (mStepAccumulator >= stepSize) {
+				mStepAccumulator = glm::mod(mStepAccumulator, stepSize);
+			}
+			mScene->set_interpolation_alpha(mStepAccumulator / stepSize);
+			//The focus hit value arrives from the GPU a varying number of frames late, so it is part of the recorded input (see finput)
+			mInput->set_focus_hit_value(mFocusHitValue);
+			mStatus = update(mInput->delta_time(), mInput->focus_hit_value());
 		}
 	}
 
-	void fixed_update() override {
-		if (!mLevelPaused) {
-			fixed_update(gvk::time().fixed_delta_time());
-		}
-	};
-
 	//Execution order per frame: Game Control, Level Logic, Scene, Renderer
 	int32_t execution_order() const override {
 		return 2;
@@ -61,6 +80,15 @@ public:
 		this->mLevelPaused = paused;
 	}
 
+	bool is_paused() const {
+		return mLevelPaused;
+	}
+
+	//Returns the number of physics steps since the level has been created
+	uint64_t step_count() const {
+		return mStepCount;
+	}
+
 	//Sets the current Focus Hit Value (sphere-visibility-score).
 	//This is managed by the renderer, which fetches this value from the gpu.
 	void set_focus_hit_value(double val) {
@@ -69,6 +97,8 @@ public:
 
 protected:
 	fscene* mScene;
+	fphysicsruntime* mPhysicsRuntime;
+	finput* mInput;
 
 	//Overrideable update-function. Called every frame. Returns the current level status.
 	//Delta Time and current Focus Hit Value are passed automatically.
@@ -76,12 +106,14 @@ protected:
 		return levelstatus::RUNNING;
 	}
 
-	//Overrideable fixed_update-function. Called in regular time steps. Used for physics updates.
+	//Overrideable fixed_update-function. Called in regular time steps (possibly several times per frame) before update. Used for physics updates.
 	//Step Size is passed automatically.
 	virtual void fixed_update(float stepSize) {};
 
 private:
 	levelstatus mStatus = levelstatus::RUNNING;
 	bool mLevelPaused = false;
+	float mStepAccumulator = 0.0f;	//Time that has passed since the last physics step
+	uint64_t mStepCount = 0;		//Number of physics steps so far
 	double mFocusHitValue = 0;
 };
\ No newline at end of file
@@ -0,0 +1,182 @@
+#include "includes.h"
+
+flevelsolver::flevelsolver(fscene* scene) : mScene(scene), mTracer(scene)
+{
+	bool foundSphere = false;
+	bool foundGoal = false;
+	auto& models = scene->get_models();
+	for (const fmodel& model : models) {
+		if (model.mName == "Sphere") {
+			glm::vec3 min, max;
+			world_bounds(model, min, max);
+			mSphereCenter = 0.5f * (min + max);
+			foundSphere = true;
+		}
+		else if (model.mName == "FinalFloor" || model.mName == "FinalRegion") {
+			world_bounds(model, mGoalMin, mGoalMax);
+			foundGoal = true;
+		}
+		else if (model.mName.rfind("MirrorPlane", 0) == 0 && !model.mIndices.empty()) {
+			mirror m;
+			m.mModels.push_back(model.mModelIndex);
+			std::string borderName = "MirrorBorder" + model.mName.substr(std::string("MirrorPlane").size());
+			for (const fmodel& border : models) {
+				if (border.mName == borderName) {
+					m.mModels.push_back(border.mModelIndex);
+				}
+			}
+			glm::vec3 min, max;
+			world_bounds(model, min, max);
+			m.mCenter = 0.5f * (min + max);
+			m.mPivot = glm::vec3(model.mTransformation[3]);
+			const glm::vec3& a = model.mPositions[model.mIndices[0]];
+			const glm::vec3& b = model.mPositions[model.mIndices[1]];
+			const glm::vec3& c = model.mPositions[model.mIndices[2]];
+			m.mNormal = glm::normalize(glm::mat3(glm::transpose(glm::inverse(model.mTransformation))) * glm::cross(b - a, c - a));
+			m.mRadius = 0.0f;
+			for (const glm::vec3& p : model.mPositions) {
+				m.mRadius = glm::max(m.mRadius, glm::length(glm::vec3(model.mTransformation * glm::vec4(p, 1.0f)) - m.mPivot));
+			}
+			mMirrors.push_back(m);
+		}
+	}
+	if (!foundSphere || !foundGoal) {
+		throw std::runtime_error("The level has no focusphere (Sphere) or no goal region (FinalFloor/FinalRegion)");
+	}
+	for (const mirror& m : mMirrors) {
+		for (size_t model : m.mModels) {
+			mTracer.set_yaw_rotating(model);
+		}
+	}
+	mTracer.build();
+}
+
+void flevelsolver::world_bounds(const fmodel& model, glm::vec3& min, glm::vec3& max)
+{
+	min = glm::vec3(std::numeric_limits<float>::max());
+	max = glm::vec3(-std::numeric_limits<float>::max());
+	for (const glm::vec3& p : model.mPositions) {
+		glm::vec3 world = glm::vec3(model.mTransformation * glm::vec4(p, 1.0f));
+		min = glm::min(min, world);
+		max = glm::max(max, world);
+	}
+}
+
+flevelsolver::plane flevelsolver::turned_plane(const mirror& m, float yaw)
+{
+	glm::mat3 rotation = glm::mat3_cast(glm::angleAxis(yaw, glm::vec3(0.0f, 1.0f, 0.0f)));
+	return { m.mPivot + rotation * (m.mCenter - m.mPivot), rotation * m.mNormal };
+}
+
+glm::vec3 flevelsolver::reflect_point(const glm::vec3& point, const plane& p)
+{
+	return point - 2.0f * glm::dot(point - p.mPoint, p.mNormal) * p.mNormal;
+}
+
+int flevelsolver::check(const fcputracer& tracer, const glm::vec3& eye, const std::vector<plane>& planes, const std::vector<std::vector<uint32_t>>& sequences,
+	uint32_t maxDepth, uint64_t& prunedRays, uint64_t& tracedRays) const
+{
+	for (const std::vector<uint32_t>& sequence : sequences) {
+		//Image method: the focusphere as seen through the mirrors of the sequence (the last mirror is applied first)
+		glm::vec3 target = mSphereCenter;
+		for (size_t k = sequence.size(); k > 0; --k) {
+			target = reflect_point(target, planes[sequence[k - 1]]);
+		}
+		glm::vec3 direction = target - eye;
+		if (glm::length(direction) < 1e-6f) {
+			continue;
+		}
+		direction = glm::normalize(direction);
+
+		//The unfolded ray has to pass through every mirror of the sequence, as seen through the mirrors before it
+		bool possible = true;
+		for (size_t k = 0; k < sequence.size() && possible; ++k) {
+			const mirror& m = mMirrors[sequence[k]];
+			glm::vec3 center = m.mPivot;
+			for (size_t j = k; j > 0; --j) {
+				center = reflect_point(center, planes[sequence[j - 1]]);
+			}
+			float along = glm::dot(center - eye, direction);
+			possible = along > -m.mRadius && glm::length(center - eye - along * direction) <= m.mRadius;
+		}
+		if (!possible) {
+			++prunedRays;
+			continue;
+		}
+		++tracedRays;
+		if (tracer.trace_focus_ray(eye, direction, maxDepth)) {
+			return static_cast<int>(sequence.size());
+		}
+	}
+	return -1;
+}
+
+flevelsolver::result flevelsolver::solve(const settings& config) const
+{
+	auto start = std::chrono::steady_clock::now();
+	const size_t mirrorCount = mMirrors.size();
+	const uint32_t angleSteps = glm::max(config.mAngleSteps, 1u);
+	const uint32_t positionSteps = glm::max(config.mPositionSteps, 1u);
+
+	//All sequences of distinct mirrors with at most mMaxDepth reflections, the direct view first
+	std::vector<std::vector<uint32_t>> sequences = { {} };
+	for (size_t first = 0; first < sequences.size(); ++first) {
+		if (sequences[first].size() >= glm::min(size_t(config.mMaxDepth), mirrorCount)) {
+			continue;
+		}
+		for (uint32_t m = 0; m < mirrorCount; ++m) {
+			if (std::find(sequences[first].begin(), sequences[first].end(), m) == sequences[first].end()) {
+				std::vector<uint32_t> longer = sequences[first];
+				longer.push_back(m);
+				sequences.push_back(longer);
+			}
+		}
+	}
+
+	//One job per eye position and yaw of the first mirror, which checks all yaws of the other mirrors
+	uint64_t firstAngles = (mirrorCount > 0) ? angleSteps : 1;
+	uint64_t otherCombinations = 1;
+	for (size_t m = 1; m < mirrorCount; ++m) {
+		otherCombinations *= angleSteps;
+	}
+	size_t jobCount = size_t(positionSteps) * positionSteps * firstAngles;
+	std::vector<std::vector<solution>> jobSolutions(jobCount);
+	std::vector<uint64_t> jobPruned(jobCount, 0), jobTraced(jobCount, 0);
+	fjobsystem::instance().parallel_for(0, jobCount, 1, [&](size_t job) {
+		size_t position = job / firstAngles;
+		glm::vec2 cell = (glm::vec2(float(position % positionSteps), float(position / positionSteps)) + glm::vec2(0.5f)) / float(positionSteps);
+		glm::vec3 eye = glm::vec3(glm::mix(mGoalMin.x, mGoalMax.x, cell.x), mGoalMax.y + SOLVER_EYE_HEIGHT, glm::mix(mGoalMin.z, mGoalMax.z, cell.y));
+
+		fcputracer tracer = mTracer;
+		std::vector<float> yaws(mirrorCount);
+		std::vector<plane> planes(mirrorCount);
+		for (uint64_t combination = 0; combination < otherCombinations; ++combination) {
+			uint64_t digits = combination;
+			for (size_t m = 0; m < mirrorCount; ++m) {
+				uint64_t step = (m == 0) ? job % firstAngles : digits % angleSteps;
+				if (m > 0) {
+					digits /= angleSteps;
+				}
+				yaws[m] = glm::two_pi<float>() * float(step) / float(angleSteps);
+				planes[m] = turned_plane(mMirrors[m], yaws[m]);
+				for (size_t model : mMirrors[m].mModels) {
+					tracer.set_yaw(model, yaws[m]);
+				}
+			}
+			int reflections = check(tracer, eye, planes, sequences, config.mMaxDepth, jobPruned[job], jobTraced[job]);
+			if (reflections >= 0) {
+				jobSolutions[job].push_back({ eye, yaws, static_cast<uint32_t>(reflections) });
+			}
+		}
+	});
+
+	result r;
+	r.mConfigurations = uint64_t(jobCount) * otherCombinations;
+	for (size_t job = 0; job < jobCount; ++job) {
+		r.mSolutions.insert(r.mSolutions.end(), jobSolutions[job].begin(), jobSolutions[job].end());
+		r.mPrunedRays += jobPruned[job];
+		r.mTracedRays += jobTraced[job];
+	}
+	r.mTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return r;
+}
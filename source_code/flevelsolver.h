@@ -0,0 +1,82 @@
+#pragma once
+#include "includes.h"
+
+#define SOLVER_EYE_HEIGHT 1.5f		//Height of the player's eyes above the goal region (eyeheight of the levels' fplayercontrol)
+
+/*
+Checks whether a level can be solved, i.e. whether the focusphere can be seen from the goal region for some mirror orientations.
+Works on the CPU-data of the level (loaded with fscene::load_scene_data, no level logic, so everything is at its initial position).
+The mirrors are found by name (MirrorPlane<n> and MirrorBorder<n>) and turned around the vertical axis through their origins,
+like fplayercontrol::pre_px_update does. The goal region is FinalFloor or FinalRegion, the eye stands SOLVER_EYE_HEIGHT above it.
+Every combination of eye position (a grid over the goal region) and mirror yaw angles (a grid over the full circle) is checked.
+Candidate view rays are found with the image method: the focusphere's center is mirrored at the planes of every sequence of
+distinct mirrors, so the ray towards the mirrored center reflects exactly towards the focusphere. Sequences whose unfolded
+ray misses the bounding sphere of one of its mirrors are pruned, the others are traced with fcputracer::trace_focus_ray,
+which checks occlusion and the finite mirror sizes. The combinations are checked in parallel on the job system, every job
+turns the mirrors of its own copy of the tracer.
+*/
+class flevelsolver {
+public:
+	struct settings {
+		uint32_t mAngleSteps = 72;		//Number of yaw angles per mirror (over 360 degrees)
+		uint32_t mPositionSteps = 4;	//Number of eye positions per axis of the goal region
+		uint32_t mMaxDepth = 4;			//Maximum number of reflections (as in the focus query)
+	};
+
+	//An eye position and mirror orientation from which the focusphere is seen
+	struct solution {
+		glm::vec3 mEye;
+		std::vector<float> mYaws;		//Per mirror: angle in radians relative to the level file
+		uint32_t mReflections;			//Number of reflections of the found view ray
+	};
+
+	struct result {
+		std::vector<solution> mSolutions;
+		uint64_t mConfigurations = 0;	//Number of checked combinations of eye position and mirror yaws
+		uint64_t mPrunedRays = 0;		//Number of candidate rays skipped by the bounds
+		uint64_t mTracedRays = 0;		//Number of candidate rays traced
+		double mTime = 0.0;				//Time in ms
+	};
+
+	//The scene must not change while the solver exists. Throws a runtime_error if the level has no goal region or no focusphere.
+	flevelsolver(fscene* scene);
+
+	//Number of mirrors found in the level
+	size_t mirror_count() const { return mMirrors.size(); }
+
+	result solve(const settings& config) const;
+
+private:
+	struct mirror {
+		std::vector<size_t> mModels;	//Plane and border
+		glm::vec3 mCenter;				//Center of the plane's vertices in world space
+		glm::vec3 mNormal;				//Normal of the plane in world space (at yaw 0)
+		glm::vec3 mPivot;				//Origin of the plane model (the rotation axis runs through it)
+		float mRadius;					//Radius of a sphere around mPivot containing the plane at every yaw
+	};
+
+	//A mirror plane at a given yaw
+	struct plane {
+		glm::vec3 mPoint;
+		glm::vec3 mNormal;
+	};
+
+	fscene* mScene;
+	fcputracer mTracer;
+	std::vector<mirror> mMirrors;
+	glm::vec3 mSphereCenter;
+	glm::vec3 mGoalMin, mGoalMax;		//World space bounds of the goal region
+
+	//Returns the world space bounds of a model's vertices
+	static void world_bounds(const fmodel& model, glm::vec3& min, glm::vec3& max);
+
+	//Returns the plane of a mirror turned by yaw
+	static plane turned_plane(const mirror& m, float yaw);
+
+	static glm::vec3 reflect_point(const glm::vec3& point, const plane& p);
+
+	//Checks an eye position with the given mirror planes. Returns the number of reflections of the first view ray that sees
+	//the focusphere, -1 if there is none. tracer must have the mirrors turned like the planes.
+	int check(const fcputracer& tracer, const glm::vec3& eye, const std::vector<plane>& planes, const std::vector<std::vector<uint32_t>>& sequences,
+		uint32_t maxDepth, uint64_t& prunedRays, uint64_t& tracedRays) const;
+};
@@ -4,18 +4,141 @@
 /*
 Main-Function, Starting point of the application.
 Initializes the application.
+Arguments:
+--record <file>: Records the gameplay input to the given file
+--replay <file>: Replays the gameplay input of the given recording (focus_headless replays it without window)
+--profile: Starts the profiler with the game (otherwise with F9), the trace is written with F9 and at the end
+--gpu-timings <file>: Writes the GPU times of every frame (TLAS update, focus query, ray tracing, copy) and their statistics as CSV
+--record-camera <file>: Records the camera as path for the fly-through benchmark
+--benchmark <level>: Flies through the level along a camera path instead of playing and writes the frame times, GPU times and ray
+  counts as JSON (see fflythrough). Options: --path <file> (camera path, default: circle around the start), --frames <n>,
+  --warmup <n>, --output <file>
+--ray-budget <rays>: Maximum number of primary and reflection rays per frame, the reflection depth is lowered in the periphery first
+  (default: 0 = unlimited)
+--max-depth <n>: Maximum reflection depth (default: 4, clamped to the device's ray tracing recursion limit)
+--min-throughput <t>: Reflections outside the focus region end below this accumulated throughput (default: 0.05)
+--capture <directory>: Captures the first frame of every level (paused, from the start camera) to level<id>.ppm in the directory and
+  exits, for the comparison with the CPU reference renderer (focus_headless --compare-gpu <directory>)
+--keep-cpu-data: Keeps the geometry and the assimp scene of the levels after loading (see fscene::release_cpu_data)
+--resolution <width>x<height>, --frames-in-flight <n>, --present <immediate|mailbox|fifo>: Window settings (default: 1920x1080, 3, mailbox)
 */
-int main() // <== Starting point ==
+int main(int argc, char* argv[]) // <== Starting point ==
 {
 	try {
+		fprofiler::set_thread_name("Main");
+		std::string recordPath, replayPath, gpuTimingPath, cameraRecordPath, captureDirectory;
+		bool profiling = false;
+		bool releaseCpuData = true;
+		bool benchmark = false;
+		fflythrough::settings benchmarkSettings;
+		uint32_t width = 1920, height = 1080, framesInFlight = 3;
+		std::string presentationName = "mailbox";
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "--record" && i + 1 < argc) {
+				recordPath = argv[++i];
+			}
+			else if (arg == "--replay" && i + 1 < argc) {
+				replayPath = argv[++i];
+			}
+			else if (arg == "--gpu-timings" && i + 1 < argc) {
+				gpuTimingPath = argv[++i];
+			}
+			else if (arg == "--record-camera" && i + 1 < argc) {
+				cameraRecordPath = argv[++i];
+			}
+			else if (arg == "--capture" && i + 1 < argc) {
+				captureDirectory = argv[++i];
+			}
+			else if (arg == "--profile") {
+				profiling = true;
+			}
+			else if (arg == "--keep-cpu-data") {
+				releaseCpuData = false;
+			}
+			else if (arg == "--benchmark" && i + 1 < argc) {
+				benchmark = true;
+				if (std::sscanf(argv[++i], "%d", &benchmarkSettings.mLevel) != 1 || benchmarkSettings.mLevel < 1 || benchmarkSettings.mLevel > 4) {
+					throw std::runtime_error("Invalid benchmark level " + std::string(argv[i]));
+				}
+			}
+			else if (arg == "--path" && i + 1 < argc) {
+				benchmarkSettings.mPathFile = argv[++i];
+			}
+			else if (arg == "--frames" && i + 1 < argc) {
+				if (std::sscanf(argv[++i], "%u", &benchmarkSettings.mFrames) != 1) {
+					throw std::runtime_error("Invalid number of frames " + std::string(argv[i]));
+				}
+			}
+			else if (arg == "--warmup" && i + 1 < argc) {
+				if (std::sscanf(argv[++i], "%u", &benchmarkSettings.mWarmupFrames) != 1) {
+					throw std::runtime_error("Invalid number of warm-up frames " + std::string(argv[i]));
+				}
+			}
+			else if (arg == "--output" && i + 1 < argc) {
+				benchmarkSettings.mOutputPath = argv[++i];
+			}
+			else if (arg == "--resolution" && i + 1 < argc) {
+				if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+					throw std::runtime_error("Invalid resolution " + std::string(argv[i]) + ", expected <width>x<height>");
+				}
+			}
+			else if (arg == "--frames-in-flight" && i + 1 < argc) {
+				if (std::sscanf(argv[++i], "%u", &framesInFlight) != 1 || framesInFlight == 0) {
+					throw std::runtime_error("Invalid number of frames in flight " + std::string(argv[i]));
+				}
+			}
+			else if (arg == "--present" && i + 1 < argc) {
+				presentationName = argv[++i];
+			}
+			else if (arg == "--ray-budget" && i + 1 < argc) {
+				unsigned long long rays;
+				if (std::sscanf(argv[++i], "%llu", &rays) != 1) {
+					throw std::runtime_error("Invalid ray budget " + std::string(argv[i]));
+				}
+				benchmarkSettings.mRayBudget = rays;
+			}
+			else if (arg == "--max-depth" && i + 1 < argc) {
+				if (std::sscanf(argv[++i], "%u", &benchmarkSettings.mMaxDepth) != 1) {
+					throw std::runtime_error("Invalid reflection depth " + std::string(argv[i]));
+				}
+			}
+			else if (arg == "--min-throughput" && i + 1 < argc) {
+				if (std::sscanf(argv[++i], "%f", &benchmarkSettings.mMinThroughput) != 1 || !(benchmarkSettings.mMinThroughput >= 0.0f)) {
+					throw std::runtime_error("Invalid minimum throughput " + std::string(argv[i]));
+				}
+			}
+		}
+		gvk::presentation_mode presentationMode = gvk::presentation_mode::mailbox;
+		if (presentationName == "immediate") {
+			presentationMode = gvk::presentation_mode::immediate;
+		}
+		else if (presentationName == "fifo") {
+			presentationMode = gvk::presentation_mode::fifo;
+		}
+		else if (presentationName != "mailbox") {
+			throw std::runtime_error("Invalid presentation mode " + presentationName + ", expected immediate, mailbox or fifo");
+		}
+		benchmarkSettings.mPresentationMode = presentationName;
+
 		// Create a window and open it
 		auto mainWnd = gvk::context().create_window("Focus!");
-		mainWnd->set_resolution({ 1920, 1080 });
-		mainWnd->set_presentaton_mode(gvk::presentation_mode::mailbox);
-		mainWnd->set_number_of_concurrent_frames(3u);
-		mainWnd->set_number_of_presentable_images(3u);
+		mainWnd->set_resolution({ width, height });
+		mainWnd->set_presentaton_mode(presentationMode);
+		mainWnd->set_number_of_concurrent_frames(framesInFlight);
+		// The swap chain needs at least two images, even with a single frame in flight
+		mainWnd->set_number_of_presentable_images(glm::max(framesInFlight, 2u));
 		mainWnd->request_srgb_framebuffer(false);
 		mainWnd->open();
+		bool swapChainStorage = false;
+#if DIRECT_SWAPCHAIN_OUTPUT
+		// Allow ray tracing directly into the swap chain images, but only if the surface supports it (otherwise the swap chain
+		// could not be created). The renderer falls back to copying from its offscreen images.
+		swapChainStorage = frenderer::swap_chain_supports_storage(mainWnd->handle()->mHandle);
+		if (swapChainStorage) {
+			mainWnd->set_image_usage_properties(avk::image_usage::color_attachment | avk::image_usage::transfer_destination | avk::image_usage::presentable | avk::image_usage::tiling_optimal | avk::image_usage::shader_storage);
+		}
+#endif
 
 		auto& singleQueue = gvk::context().create_queue({}, avk::queue_selection_preference::versatile_queue, mainWnd);
 		mainWnd->add_queue_family_ownership(singleQueue);
@@ -23,6 +146,18 @@ int main() // <== Starting point ==
 
 		// Create an instance of fgamecontrol, which in turn will create the other cg_elements for our composition
 		auto control = fgamecontrol(&singleQueue);
+		control.set_recording(recordPath);
+		control.set_replay(replayPath);
+		control.set_gpu_timing_csv(gpuTimingPath);
+		control.set_camera_recording(cameraRecordPath);
+		control.set_profiling(profiling);
+		control.set_release_cpu_data(releaseCpuData);
+		control.set_capture(captureDirectory);
+		control.set_ray_budget(benchmarkSettings.mRayBudget, benchmarkSettings.mMaxDepth, benchmarkSettings.mMinThroughput);
+		control.get_renderer()->set_swap_chain_storage(swapChainStorage);
+		if (benchmark) {
+			control.set_benchmark(benchmarkSettings);
+		}
 
 		// Create a composition of game control, level logic, scene and renderer.
 		// These objects have their own initialize, update, fixed_update, render and finalize functions 
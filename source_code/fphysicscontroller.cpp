@@ -1,132 +1,570 @@
 //Author: Simon Fraiss
 #include "includes.h"
 
-fphysicscontroller::fphysicscontroller(fscene* scene) {
+fphysicscontroller::fphysicscontroller(fscene* scene, fphysicsruntime* runtime) {
 	this->scene = scene;
+	mRuntime = runtime;
+	mPhysics = runtime->mPhysics;
+	mCooking = runtime->mCooking;
+	mDefaultMaterial = runtime->mDefaultMaterial;
 
-	mFoundation = PxCreateFoundation(PX_PHYSICS_VERSION, gDefaultAllocatorCallback, gDefaultErrorCallback);
-	if (!mFoundation) {
-		throw std::runtime_error("PxCreateFoundation failed!");
-	}
+	PxSceneDesc sceneDesc = PxSceneDesc(mPhysics->getTolerancesScale());
+	sceneDesc.gravity = runtime->mConfig.mGravity;
+	sceneDesc.filterShader = PxDefaultSimulationFilterShader;
+	sceneDesc.cpuDispatcher = runtime->mDispatcher;
+	sceneDesc.broadPhaseType = runtime->mConfig.mBroadPhase;
+	sceneDesc.staticStructure = runtime->mConfig.mStaticPruner;
+	sceneDesc.dynamicStructure = runtime->mConfig.mDynamicPruner;
+	//Only the actors that moved during a step are reported and synced to the scene
+	sceneDesc.flags |= PxSceneFlag::eENABLE_ACTIVE_ACTORS;
+	mPxScene = mPhysics->createScene(sceneDesc);
+	mPxScene->setVisualizationParameter(PxVisualizationParameter::eSCALE, 1.0f);
+	mPxScene->setVisualizationParameter(PxVisualizationParameter::eACTOR_AXES, 2.0f);
 
-	bool recordMemoryAllocations = true;
+	//The regions have to exist before the first actor is added, otherwise it starts out of bounds
+	add_broadphase_regions(scene_bounds());
 
-#if _DEBUG
-	mPvd = PxCreatePvd(*mFoundation);
-	mTransport = PxDefaultPvdSocketTransportCreate("localhost", 5425, 10);
-	mPvd->connect(*mTransport, PxPvdInstrumentationFlag::eALL);
-#endif
+	mControllerManager = PxCreateControllerManager(*mPxScene);
 
-	mPhysics = PxCreatePhysics(PX_PHYSICS_VERSION, *mFoundation, PxTolerancesScale(), recordMemoryAllocations, mPvd);
-	if (!mPhysics) {
-		throw std::runtime_error("PxCreatePhysics failed!");
+	//---LOAD THE SNAPSHOT OF THE LAST START---
+	if (runtime->mConfig.mUseSnapshotFiles) {
+		mSnapshotPath = runtime->cache_file_path(scene_hash(), ".snap");
+	}
+	if (!mSnapshotPath.empty() && runtime->read_cache_file(mSnapshotPath, mSnapshotData)) {
+		auto loadStart = std::chrono::steady_clock::now();
+		if (deserialize_snapshot(mSnapshotData, mLoadedSnapshot)) {
+			LOG_INFO("Loaded physics snapshot " + mSnapshotPath + " in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count()) + " ms");
+		}
+		else {
+			mSnapshotData.clear();
+		}
 	}
+}
+
+void fphysicscontroller::add_static_actor(PxRigidStatic* actor) {
+	mPendingStatics.push_back(actor);
+}
 
-	mCooking = PxCreateCooking(PX_PHYSICS_VERSION, *mFoundation, PxCookingParams(PxTolerancesScale()));
-	if (!mCooking) {
-		throw std::runtime_error("PxCreateCooking failed!");
+void fphysicscontroller::finish_static_actors() {
+	if (mPendingStatics.empty()) {
+		return;
 	}
-	mDispatcher = PxDefaultCpuDispatcherCreate(2);
-	PxSceneDesc sceneDesc = PxSceneDesc(PxTolerancesScale());
-	sceneDesc.gravity = PxVec3(0.0f, -9.81f, 0.0f);
-	sceneDesc.filterShader = PxDefaultSimulationFilterShader;
-	sceneDesc.cpuDispatcher = mDispatcher;
-	mPxScene = mPhysics->createScene(sceneDesc);
-	mPxScene->setVisualizationParameter(PxVisualizationParameter::eSCALE, 1.0f);
-	mPxScene->setVisualizationParameter(PxVisualizationParameter::eACTOR_AXES, 2.0f);
+	auto start = std::chrono::steady_clock::now();
+	PxPruningStructure* pruningStructure = mPhysics->createPruningStructure(mPendingStatics.data(), static_cast<PxU32>(mPendingStatics.size()));
+	if (pruningStructure != nullptr) {
+		mPxScene->addActors(*pruningStructure);
+		mPruningStructures.push_back(pruningStructure);
+	}
+	else {
+		//Should not happen, but the actors can still be added without the precomputed structure
+		LOG_ERROR("Creating the pruning structure failed, adding static actors without it");
+		std::vector<PxActor*> actors(mPendingStatics.begin(), mPendingStatics.end());
+		mPxScene->addActors(actors.data(), static_cast<PxU32>(actors.size()));
+	}
+	LOG_INFO("Added " + std::to_string(mPendingStatics.size()) + " static actors in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) + " ms");
+	mPendingStatics.clear();
+}
 
-	mControllerManager = PxCreateControllerManager(*mPxScene);
+PxBounds3 fphysicscontroller::scene_bounds() const {
+	PxBounds3 bounds = PxBounds3::empty();
+	for (const fmodel& model : scene->get_models()) {
+		for (const glm::vec3& position : model.mPositions) {
+			glm::vec3 p = glm::vec3(model.mTransformation * glm::vec4(position, 1.0f));
+			bounds.include(PxVec3(p.x, p.y, p.z));
+		}
+	}
+	return bounds;
+}
 
-	mDefaultMaterial = mPhysics->createMaterial(1, 1, 0.3);
+void fphysicscontroller::add_broadphase_regions(const PxBounds3& bounds) {
+	if (mRuntime->mConfig.mBroadPhase != PxBroadPhaseType::eMBP || bounds.isEmpty()) {
+		return;
+	}
+	PxBounds3 levelBounds = bounds;
+	//Leave room for falling and jumping out of the level
+	levelBounds.fattenFast(10.0f);
+	std::vector<PxBounds3> regionBounds(mRuntime->mConfig.mMbpSubdivisions * mRuntime->mConfig.mMbpSubdivisions);
+	PxU32 regionCount = PxBroadPhaseExt::createRegionsFromWorldBounds(regionBounds.data(), levelBounds, mRuntime->mConfig.mMbpSubdivisions);
+	for (PxU32 i = 0; i < regionCount; ++i) {
+		PxBroadPhaseRegion region;
+		region.bounds = regionBounds[i];
+		region.userData = nullptr;
+		//Objects that are already in the scene are assigned to the new regions
+		mPxScene->addBroadPhaseRegion(region, true);
+	}
 }
 
 void fphysicscontroller::update(const float& stepSize) {
-	mPxScene->simulate(stepSize);
+	FPROFILE_SCOPE("fphysicscontroller::update");
+	finish_static_actors();
+	if (!mAsync) {
+		FPROFILE_SCOPE("PhysX simulate and fetch");
+		auto simulateStart = std::chrono::steady_clock::now();
+		mPxScene->simulate(stepSize);
+		mPxScene->fetchResults(true);
+		collect_active_actors();
+		mLastOverlapTime = 0;
+		mLastWaitTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - simulateStart).count();
+		record_step_timing();
+	}
+	apply_to_dynamic_objects();
+}
+
+void fphysicscontroller::fetch_results() {
+	if (!mSimulating) {
+		return;
+	}
+	FPROFILE_SCOPE("PhysX fetch");
+	auto fetchStart = std::chrono::steady_clock::now();
 	mPxScene->fetchResults(true);
+	collect_active_actors();
+	mSimulating = false;
+	mLastOverlapTime = std::chrono::duration<double, std::milli>(fetchStart - mSimulateStartTime).count();
+	mLastWaitTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fetchStart).count();
+	record_step_timing();
+	apply_to_dynamic_objects();
+}
 
-	double updateTime = glfwGetTime();
+void fphysicscontroller::simulate_async(const float& stepSize) {
+	if (!mAsync) {
+		return;
+	}
+	fetch_results();
+	finish_static_actors();
+	FPROFILE_SCOPE("PhysX simulate");
+	mPxScene->simulate(stepSize);
+	mSimulating = true;
+	mSimulateStartTime = std::chrono::steady_clock::now();
+}
 
-	//----- APPLY TO DYNAMIC RIGID BODIES -----
-	for (dynamicobject obj : dynamicObjects) {
-		PxTransform t = obj.dynamicActor->getGlobalPose();
+void fphysicscontroller::set_async(bool async) {
+	fetch_results();
+	mAsync = async;
+}
+
+void fphysicscontroller::apply_to_dynamic_objects(bool snap) {
+	//----- APPLY TO MOVED DYNAMIC RIGID BODIES -----
+	for (size_t index : movedObjects) {
+		dynamicobject& obj = dynamicObjects[index];
+		obj.moved = false;
+		//Kinematic targets are only applied by the next simulation, but the models should show them right away
+		PxRigidDynamic* kinematic = obj.dynamicActor->is<PxRigidDynamic>();
+		PxTransform t = (kinematic != nullptr) ? get_kinematic_pose(kinematic) : obj.dynamicActor->getGlobalPose();
+		//Kinematics are reported again after reaching a target that has already been synced
+		if (t.p == obj.syncedPose.p && t.q == obj.syncedPose.q) {
+			continue;
+		}
+		obj.syncedPose = t;
 		glm::mat4x3 transform = utility::to_glm_mat4x3(t);
-		obj.dynamicInstance->mTransformation = transform * obj.scale;
+		scene->set_model_transform(obj.dynamicInstance->mModelIndex, glm::mat4(transform * obj.scale), snap);
+		if (obj.syncedStep != mSyncStep) {
+			obj.syncedStep = mSyncStep;
+			++mSyncedObjects;
+		}
 	}
+	movedObjects.clear();
 }
 
-PxRigidStatic* fphysicscontroller::create_rigid_static_for_scaled_unit_box(fmodel* instance, bool dynamic)
+void fphysicscontroller::mark_moved(PxActor* actor) {
+	auto it = dynamicObjectIndices.find(actor);
+	if (it == dynamicObjectIndices.end()) {
+		return;
+	}
+	dynamicobject& obj = dynamicObjects[it->second];
+	if (!obj.moved) {
+		obj.moved = true;
+		movedObjects.push_back(it->second);
+	}
+}
+
+void fphysicscontroller::collect_active_actors() {
+	//A new step begins with the results of a simulation
+	mSyncedObjects = 0;
+	++mSyncStep;
+	PxU32 activeCount = 0;
+	PxActor** activeActors = mPxScene->getActiveActors(activeCount);
+	for (PxU32 i = 0; i < activeCount; ++i) {
+		mark_moved(activeActors[i]);
+	}
+}
+
+void fphysicscontroller::record_step_timing() {
+	mOverlapTimeSum += mLastOverlapTime;
+	mWaitTimeSum += mLastWaitTime;
+	if (++mTimedSteps < PHYSICS_TIMING_LOG_INTERVAL) {
+		return;
+	}
+	LOG_INFO(std::string(mAsync ? "Asynchronous" : "Synchronous") + " physics step: " + std::to_string(mOverlapTimeSum / mTimedSteps)
+		+ " ms overlapped with rendering, " + std::to_string(mWaitTimeSum / mTimedSteps) + " ms waiting on the main thread (average over "
+		+ std::to_string(mTimedSteps) + " steps)");
+	mOverlapTimeSum = 0;
+	mWaitTimeSum = 0;
+	mTimedSteps = 0;
+}
+
+PxTransform fphysicscontroller::unscaled_pose(const glm::mat4& transform, glm::vec3& scale)
 {
-	glm::mat4x3 transform = instance->mTransformation;
 	glm::vec3 p0 = transform * glm::vec4(0, 0, 0, 1);
 	glm::vec3 p1 = transform * glm::vec4(1, 0, 0, 1);
 	glm::vec3 p2 = transform * glm::vec4(0, 1, 0, 1);
 	glm::vec3 p3 = transform * glm::vec4(0, 0, 1, 1);
-	float xscale = glm::distance(p0, p1);
-	float yscale = glm::distance(p0, p2);
-	float zscale = glm::distance(p0, p3);
-	glm::mat4 invScale = glm::mat4(1 / xscale, 0, 0, 0, 0, 1 / yscale, 0, 0, 0, 0, 1 / zscale, 0, 0, 0, 0, 1);
-	glm::mat4 newTransf = glm::mat4(transform) * invScale;
+	scale = glm::vec3(glm::distance(p0, p1), glm::distance(p0, p2), glm::distance(p0, p3));
+	glm::mat4 invScale = glm::mat4(1 / scale.x, 0, 0, 0, 0, 1 / scale.y, 0, 0, 0, 0, 1 / scale.z, 0, 0, 0, 0, 1);
+	glm::mat4 newTransf = transform * invScale;
 	float transvals[16] = { newTransf[0][0], newTransf[0][1], newTransf[0][2], newTransf[0][3], newTransf[1][0], newTransf[1][1], newTransf[1][2], newTransf[1][3],
 		newTransf[2][0], newTransf[2][1], newTransf[2][2], newTransf[2][3], newTransf[3][0], newTransf[3][1], newTransf[3][2], newTransf[3][3] };
 	PxMat44 pxMat = PxMat44(transvals);
-	PxTransform pxTransform = PxTransform(pxMat);
-	PxRigidStatic* actor = mPhysics->createRigidStatic(pxTransform);
-	actor->userData = instance;
-	PxShape* shape = mPhysics->createShape(PxBoxGeometry(xscale, yscale, zscale), *mDefaultMaterial, true);
+	return PxTransform(pxMat);
+}
+
+void fphysicscontroller::attach_shape(PxRigidActor* actor, const PxGeometry& geometry)
+{
+	PxShape* shape = mPhysics->createShape(geometry, *mDefaultMaterial, true);
 	actor->attachShape(*shape);
 	shape->release();
-	mPxScene->addActor(*actor);
+}
+
+void fphysicscontroller::add_actor_for_model(PxRigidActor* actor, fmodel* instance, const glm::vec3& scale, bool dynamic)
+{
+	actor->userData = instance;
+	PxRigidStatic* staticActor = actor->is<PxRigidStatic>();
+	if (staticActor != nullptr) {
+		add_static_actor(staticActor);
+	}
+	else {
+		mPxScene->addActor(*actor);
+	}
 	if (dynamic) {
-		dynamicObjects.push_back({ actor, instance, glm::scale(glm::mat4(1.0f), glm::vec3(xscale, yscale, zscale)) });
+		dynamicObjectIndices[actor] = dynamicObjects.size();
+		dynamicObjects.push_back({ actor, instance, glm::scale(glm::mat4(1.0f), scale), actor->getGlobalPose() });
 	}
-	return actor;
+	if (!mSnapshotIds.emplace(actor, snapshot_id(instance)).second) {
+		LOG_ERROR("Model " + instance->mName + " has more than one actor, only the first one is part of the physics snapshot");
+	}
+}
+
+PxRigidStatic* fphysicscontroller::create_rigid_static_for_scaled_unit_box(fmodel* instance, bool dynamic)
+{
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_STATIC, PxGeometryType::eBOX);
+	if (actor == nullptr) {
+		actor = mPhysics->createRigidStatic(pxTransform);
+		attach_shape(actor, PxBoxGeometry(scale.x, scale.y, scale.z));
+	}
+	add_actor_for_model(actor, instance, scale, dynamic);
+	return actor->is<PxRigidStatic>();
 }
 
 PxRigidStatic* fphysicscontroller::create_rigid_static_for_scaled_plane(fmodel* instance, bool dynamic)
 {
-	glm::mat4x3 transform = instance->mTransformation;
-	glm::vec3 p0 = transform * glm::vec4(0, 0, 0, 1);
-	glm::vec3 p1 = transform * glm::vec4(1, 0, 0, 1);
-	glm::vec3 p2 = transform * glm::vec4(0, 1, 0, 1);
-	glm::vec3 p3 = transform * glm::vec4(0, 0, 1, 1);
-	float xscale = glm::distance(p0, p1);
-	float yscale = glm::distance(p0, p2);
-	float zscale = glm::distance(p0, p3);
 	float thickness = 0.1f;
-	glm::mat4 invScale = glm::mat4(1 / xscale, 0, 0, 0, 0, 1 / yscale, 0, 0, 0, 0, 1 / zscale, 0, 0, 0, 0, 1);
-	glm::mat4 newTransf = glm::mat4(transform) * invScale;
-	float transvals[16] = { newTransf[0][0], newTransf[0][1], newTransf[0][2], newTransf[0][3], newTransf[1][0], newTransf[1][1], newTransf[1][2], newTransf[1][3],
-		newTransf[2][0], newTransf[2][1], newTransf[2][2], newTransf[2][3], newTransf[3][0], newTransf[3][1], newTransf[3][2], newTransf[3][3] };
-	PxMat44 pxMat = PxMat44(transvals);
-	PxTransform pxTransform = PxTransform(pxMat);
-	PxRigidStatic* actor = mPhysics->createRigidStatic(pxTransform);
-	actor->userData = instance;
-	PxShape* shape = mPhysics->createShape(PxBoxGeometry(xscale, yscale, thickness), *mDefaultMaterial, true);
-	actor->attachShape(*shape);
-	shape->release();
-	mPxScene->addActor(*actor);
-	if (dynamic) {
-		dynamicObjects.push_back({ actor, instance, glm::scale(glm::mat4(1.0f), glm::vec3(xscale, yscale, zscale)) });
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_STATIC, PxGeometryType::eBOX);
+	if (actor == nullptr) {
+		actor = mPhysics->createRigidStatic(pxTransform);
+		attach_shape(actor, PxBoxGeometry(scale.x, scale.y, thickness));
+	}
+	add_actor_for_model(actor, instance, scale, dynamic);
+	return actor->is<PxRigidStatic>();
+}
+
+PxRigidStatic* fphysicscontroller::create_rigid_static_for_triangle_mesh(fmodel* instance, bool dynamic)
+{
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_STATIC, PxGeometryType::eTRIANGLEMESH);
+	if (actor == nullptr) {
+		PxTriangleMesh* mesh = mRuntime->get_triangle_mesh(instance->mPositions, instance->mIndices);
+		actor = mPhysics->createRigidStatic(pxTransform);
+		attach_shape(actor, PxTriangleMeshGeometry(mesh, PxMeshScale(PxVec3(scale.x, scale.y, scale.z)), PxMeshGeometryFlag::eDOUBLE_SIDED));
 	}
+	add_actor_for_model(actor, instance, scale, dynamic);
+	return actor->is<PxRigidStatic>();
+}
+
+PxRigidStatic* fphysicscontroller::create_rigid_static_for_convex_mesh(fmodel* instance, bool dynamic)
+{
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_STATIC, PxGeometryType::eCONVEXMESH);
+	if (actor == nullptr) {
+		PxConvexMesh* mesh = mRuntime->get_convex_mesh(instance->mPositions);
+		actor = mPhysics->createRigidStatic(pxTransform);
+		attach_shape(actor, PxConvexMeshGeometry(mesh, PxMeshScale(PxVec3(scale.x, scale.y, scale.z))));
+	}
+	add_actor_for_model(actor, instance, scale, dynamic);
+	return actor->is<PxRigidStatic>();
+}
+
+PxRigidDynamic* fphysicscontroller::create_kinematic_for_convex_mesh(fmodel* instance)
+{
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_DYNAMIC, PxGeometryType::eCONVEXMESH);
+	if (actor == nullptr) {
+		PxConvexMesh* mesh = mRuntime->get_convex_mesh(instance->mPositions);
+		actor = create_kinematic(pxTransform);
+		attach_shape(actor, PxConvexMeshGeometry(mesh, PxMeshScale(PxVec3(scale.x, scale.y, scale.z))));
+	}
+	add_actor_for_model(actor, instance, scale, true);
+	return actor->is<PxRigidDynamic>();
+}
+
+PxRigidDynamic* fphysicscontroller::create_kinematic_for_scaled_unit_box(fmodel* instance)
+{
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_DYNAMIC, PxGeometryType::eBOX);
+	if (actor == nullptr) {
+		actor = create_kinematic(pxTransform);
+		attach_shape(actor, PxBoxGeometry(scale.x, scale.y, scale.z));
+	}
+	add_actor_for_model(actor, instance, scale, true);
+	return actor->is<PxRigidDynamic>();
+}
+
+PxRigidDynamic* fphysicscontroller::create_kinematic_for_scaled_plane(fmodel* instance)
+{
+	float thickness = 0.1f;
+	glm::vec3 scale;
+	PxTransform pxTransform = unscaled_pose(instance->mTransformation, scale);
+	PxRigidActor* actor = take_loaded_actor(instance, PxConcreteType::eRIGID_DYNAMIC, PxGeometryType::eBOX);
+	if (actor == nullptr) {
+		actor = create_kinematic(pxTransform);
+		attach_shape(actor, PxBoxGeometry(scale.x, scale.y, thickness));
+	}
+	add_actor_for_model(actor, instance, scale, true);
+	return actor->is<PxRigidDynamic>();
+}
+
+PxRigidDynamic* fphysicscontroller::create_kinematic(const PxTransform& pose)
+{
+	PxRigidDynamic* actor = mPhysics->createRigidDynamic(pose);
+	actor->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
 	return actor;
 }
 
-void fphysicscontroller::cleanup() {
-	mDefaultMaterial->release();
-	mControllerManager->release();
-	mPxScene->release();
-	delete mDispatcher;
-	mCooking->release();
-	mPhysics->release();
-	if (mPvd != nullptr) {
-		mPvd->release();
-		mTransport->release();
+void fphysicscontroller::move_kinematic(PxRigidDynamic* actor, const PxTransform& target)
+{
+	actor->setKinematicTarget(target);
+	mark_moved(actor);
+}
+
+PxTransform fphysicscontroller::get_kinematic_pose(PxRigidDynamic* actor)
+{
+	PxTransform target;
+	if (actor->getKinematicTarget(target)) {
+		return target;
+	}
+	return actor->getGlobalPose();
+}
+
+void fphysicscontroller::set_kinematic_pose(PxRigidDynamic* actor, const PxTransform& pose)
+{
+	actor->setGlobalPose(pose);
+	mark_moved(actor);
+}
+
+size_t fphysicscontroller::queue_raycast(const PxVec3& origin, const PxVec3& direction, float distance)
+{
+	mRaycastQueries.push_back({ origin, direction, distance });
+	return mRaycastQueries.size() - 1;
+}
+
+size_t fphysicscontroller::queue_sweep(const PxGeometry& geometry, const PxTransform& pose, const PxVec3& direction, float distance)
+{
+	mSweepQueries.push_back({ PxGeometryHolder(geometry), pose, direction, distance });
+	return mSweepQueries.size() - 1;
+}
+
+void fphysicscontroller::execute_queries()
+{
+	//Nothing queued -> keep the last results
+	if (mRaycastQueries.empty() && mSweepQueries.empty()) {
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	mRaycastResults.assign(mRaycastQueries.size(), PxRaycastHit());
+	mSweepResults.assign(mSweepQueries.size(), PxSweepHit());
+	//Scene queries only read the scene -> they can run in parallel
+	fjobsystem::instance().parallel_for(0, mRaycastQueries.size(), 16, [this](size_t i) {
+		const raycastquery& query = mRaycastQueries[i];
+		PxRaycastBuffer hit;
+		if (mPxScene->raycast(query.origin, query.direction, query.distance, hit) && hit.hasBlock) {
+			mRaycastResults[i] = hit.block;
+		}
+	});
+	fjobsystem::instance().parallel_for(0, mSweepQueries.size(), 16, [this](size_t i) {
+		const sweepquery& query = mSweepQueries[i];
+		PxSweepBuffer hit;
+		if (mPxScene->sweep(query.geometry.any(), query.pose, query.direction, query.distance, hit) && hit.hasBlock) {
+			mSweepResults[i] = hit.block;
+		}
+	});
+	mRaycastQueries.clear();
+	mSweepQueries.clear();
+	mLastQueryTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void fphysicscontroller::set_query_id(PxRigidActor* actor, uint32_t id)
+{
+	std::vector<PxShape*> shapes(actor->getNbShapes());
+	actor->getShapes(shapes.data(), static_cast<PxU32>(shapes.size()));
+	for (PxShape* shape : shapes) {
+		PxFilterData filterData = shape->getQueryFilterData();
+		filterData.word0 = id;
+		shape->setQueryFilterData(filterData);
+	}
+}
+
+void fphysicscontroller::take_snapshot()
+{
+	auto start = std::chrono::steady_clock::now();
+	bool loadedSnapshotComplete = mLoadedSnapshot.mCollection != nullptr && mLoadedSnapshotMatches
+		&& mTakenSnapshotActors == mLoadedSnapshot.mCollection->getNbIds();
+	if (!loadedSnapshotComplete) {
+		//Serialize the actors (complete adds their shapes and meshes, the materials are referenced from the shared collection)
+		PxCollection* collection = PxCreateCollection();
+		for (auto& [actor, id] : mSnapshotIds) {
+			collection->add(*actor, id);
+		}
+		PxSerialization::complete(*collection, *mRuntime->mSerializationRegistry, mRuntime->mSharedCollection);
+		PxDefaultMemoryOutputStream stream;
+		bool serialized = PxSerialization::isSerializable(*collection, *mRuntime->mSerializationRegistry, mRuntime->mSharedCollection)
+			&& PxSerialization::serializeCollectionToBinary(stream, *collection, *mRuntime->mSerializationRegistry, mRuntime->mSharedCollection);
+		collection->release();
+		if (!serialized) {
+			LOG_ERROR("Serializing the physics snapshot failed, the level cannot be reset");
+			return;
+		}
+		mSnapshotData.assign(stream.getData(), stream.getData() + stream.getSize());
+		if (!mSnapshotPath.empty()) {
+			mRuntime->write_cache_file(mSnapshotPath, mSnapshotData.data(), mSnapshotData.size());
+		}
+	}
+	release_snapshot(mResetSnapshot);
+	deserialize_snapshot(mSnapshotData, mResetSnapshot);
+	LOG_INFO("Physics snapshot of " + std::to_string(mSnapshotIds.size()) + " actors (" + std::to_string(mSnapshotData.size()) + " bytes) "
+		+ (loadedSnapshotComplete ? "taken from file" : "serialized") + " in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) + " ms");
+}
+
+void fphysicscontroller::restore_snapshot()
+{
+	fetch_results();
+	if (mResetSnapshot.mCollection == nullptr) {
+		LOG_ERROR("There is no physics snapshot to restore");
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (auto& [actor, id] : mSnapshotIds) {
+		//Static actors never move
+		PxRigidDynamic* liveActor = actor->is<PxRigidDynamic>();
+		PxBase* savedObject = mResetSnapshot.mCollection->find(id);
+		PxRigidDynamic* savedActor = (savedObject != nullptr) ? savedObject->is<PxRigidDynamic>() : nullptr;
+		if (liveActor == nullptr || savedActor == nullptr) {
+			continue;
+		}
+		if (liveActor->getRigidBodyFlags() & PxRigidBodyFlag::eKINEMATIC) {
+			set_kinematic_pose(liveActor, savedActor->getGlobalPose());
+		}
+		else {
+			liveActor->setGlobalPose(savedActor->getGlobalPose());
+			liveActor->setLinearVelocity(savedActor->getLinearVelocity());
+			liveActor->setAngularVelocity(savedActor->getAngularVelocity());
+			mark_moved(liveActor);
+		}
+	}
+	//The reset is a jump, the models must not slide back to their initial poses
+	apply_to_dynamic_objects(true);
+	LOG_INFO("Restored physics snapshot in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) + " ms");
+}
+
+PxRigidActor* fphysicscontroller::take_loaded_actor(fmodel* instance, PxConcreteType::Enum actorType, PxGeometryType::Enum geometryType)
+{
+	if (mLoadedSnapshot.mCollection == nullptr) {
+		return nullptr;
 	}
-	mFoundation->release();
+	PxBase* object = mLoadedSnapshot.mCollection->find(snapshot_id(instance));
+	PxRigidActor* actor = (object != nullptr && object->getConcreteType() == actorType) ? object->is<PxRigidActor>() : nullptr;
+	PxShape* shape = nullptr;
+	if (actor == nullptr || actor->getNbShapes() != 1 || actor->getShapes(&shape, 1) != 1 || shape->getGeometryType() != geometryType
+		|| mSnapshotIds.count(actor) > 0) {
+		//The level has changed since the snapshot has been stored -> construct the actor and store a new snapshot
+		mLoadedSnapshotMatches = false;
+		return nullptr;
+	}
+	++mTakenSnapshotActors;
+	return actor;
+}
+
+bool fphysicscontroller::deserialize_snapshot(const std::vector<uint8_t>& data, snapshot& target)
+{
+	//The objects are created inside the given memory, which has to be aligned
+	target.mMemory.resize(data.size() + PX_SERIAL_FILE_ALIGN);
+	void* aligned = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(target.mMemory.data()) + PX_SERIAL_FILE_ALIGN - 1) & ~uintptr_t(PX_SERIAL_FILE_ALIGN - 1));
+	memcpy(aligned, data.data(), data.size());
+	target.mCollection = PxSerialization::createCollectionFromBinary(aligned, *mRuntime->mSerializationRegistry, mRuntime->mSharedCollection);
+	if (target.mCollection == nullptr) {
+		LOG_ERROR("Deserializing a physics snapshot failed");
+		target.mMemory.clear();
+		return false;
+	}
+	return true;
+}
+
+void fphysicscontroller::release_snapshot(snapshot& target)
+{
+	if (target.mCollection != nullptr) {
+		PxCollectionExt::releaseObjects(*target.mCollection);
+		target.mCollection->release();
+		target.mCollection = nullptr;
+	}
+	target.mMemory.clear();
 }
 
-void fphysicserrorcallback::reportError(physx::PxErrorCode::Enum code, const char* message, const char* file, int line) {
-	std::stringstream ss;
-	ss << "PhysX Error (" << code << "): \"" << message << "\" in file \"" << file << "\"::" << line << std::endl;
-	LOG_ERROR(ss.str());
+uint64_t fphysicscontroller::scene_hash() const
+{
+	uint32_t version = PX_PHYSICS_VERSION;
+	uint64_t hash = fphysicsruntime::hash_bytes(&version, sizeof(version));
+	for (const fmodel& model : scene->get_models()) {
+		size_t sizes[2] = { model.mPositions.size(), model.mIndices.size() };
+		hash = fphysicsruntime::hash_bytes(model.mName.data(), model.mName.size(), hash);
+		hash = fphysicsruntime::hash_bytes(&model.mTransformation, sizeof(model.mTransformation), hash);
+		hash = fphysicsruntime::hash_bytes(sizes, sizeof(sizes), hash);
+	}
+	return hash;
+}
+
+void fphysicscontroller::cleanup() {
+	fetch_results();
+	//Pruning structures have to be released before their actors
+	for (PxPruningStructure* pruningStructure : mPruningStructures) {
+		pruningStructure->release();
+	}
+	mPruningStructures.clear();
+	//Also releases the actors of the character controllers
+	mControllerManager->release();
+	//PxScene::release only removes the actors from the scene, and the physics runtime outlives the level. So the actors created
+	//for this level are released here, with their exclusive shapes (the meshes stay cached in the runtime). The actors taken from
+	//the loaded snapshot are owned by its collection and released with it below.
+	PxU32 actorCount = mPxScene->getNbActors(PxActorTypeFlag::eRIGID_STATIC | PxActorTypeFlag::eRIGID_DYNAMIC);
+	std::vector<PxActor*> actors(actorCount);
+	mPxScene->getActors(PxActorTypeFlag::eRIGID_STATIC | PxActorTypeFlag::eRIGID_DYNAMIC, actors.data(), actorCount);
+	actors.insert(actors.end(), mPendingStatics.begin(), mPendingStatics.end());
+	mPendingStatics.clear();
+	for (PxActor* actor : actors) {
+		if (mLoadedSnapshot.mCollection == nullptr || !mLoadedSnapshot.mCollection->contains(*actor)) {
+			actor->release();
+		}
+	}
+	mSnapshotIds.clear();
+	dynamicObjects.clear();
+	dynamicObjectIndices.clear();
+	movedObjects.clear();
+	mPxScene->release();
+	//The actors taken from the loaded snapshot live in its memory
+	release_snapshot(mResetSnapshot);
+	release_snapshot(mLoadedSnapshot);
 }
@@ -4,54 +4,247 @@
 
 using namespace physx;
 
-class fphysicserrorcallback : public physx::PxErrorCallback {
-public:
-	virtual void reportError(physx::PxErrorCode::Enum code, const char* message, const char* file, int line);
-
-};
+#define ASYNC_PHYSICS 1						//Default mode: Overlap the PhysX simulation with rendering (see fphysicscontroller)
+#define PHYSICS_TIMING_LOG_INTERVAL 600		//Number of physics steps after which the average step timings are logged
 
 /*
-Management of PhysX-classes. Has functions for creation of rigidbodies.
-Can be used by level logic classes to use physics.
+Management of the PhysX scene of a level. Has functions for creation of rigidbodies.
+Can be used by level logic classes to use physics. The global PhysX objects are shared by all levels (see fphysicsruntime).
+In asynchronous mode, the simulation of a step is started at the end of a fixed update (simulate_async) and its results are
+fetched at the beginning of the next one (fetch_results), so that PhysX runs while the frame is recorded and submitted.
+Level logic classes should call fetch_results, update and simulate_async in every fixed update; the calls that do not apply
+to the current mode do nothing.
+After initialization, the actors created for models are serialized into a snapshot (PhysX binary collection), which is used
+to reset the level and, if stored on disk, to skip the construction of these actors the next time the level is loaded.
 */
 class fphysicscontroller {
 public:
-	PxFoundation* mFoundation;
-	PxPvdTransport* mTransport;
-	PxPvd* mPvd;
-	PxPhysics* mPhysics;
-	PxCpuDispatcher* mDispatcher;
+	fphysicsruntime* mRuntime;
+	PxPhysics* mPhysics;			//Shortcut to the runtime's physics object
+	PxCooking* mCooking;			//Shortcut to the runtime's cooking object
+	PxMaterial* mDefaultMaterial;	//Shortcut to the runtime's default material
 	PxScene* mPxScene;
-	PxCooking* mCooking;
 	PxControllerManager* mControllerManager;
-	fphysicserrorcallback gDefaultErrorCallback;
-	PxDefaultAllocator gDefaultAllocatorCallback;
-	PxMaterial* mDefaultMaterial;
 
-	//Initializes PhysX
-	fphysicscontroller(fscene* scene);
+	//Creates the PhysX scene of a level. Broadphase and pruners are taken from the runtime's configuration.
+	fphysicscontroller(fscene* scene, fphysicsruntime* runtime);
+
+	//Adds a static actor to the batch of static actors (all create_rigid_static functions do this). The batch is added to the
+	//scene by finish_static_actors.
+	void add_static_actor(PxRigidStatic* actor);
+
+	//Adds all batched static actors to the scene at once, with a precomputed pruning structure for scene queries.
+	//Should be called at the end of a level's initialization (it is also called before the next simulation if there are batched actors).
+	void finish_static_actors();
 
-	//Should be called every fixed time step. Simulates physics and applies to dynamic rigid bodies
+	//MBP only (no-op for the other broadphases): Adds broadphase regions covering the given bounds, fattened to leave room for
+	//falling and jumping out of the level. The constructor covers the bounds of the scene's models; actors outside of them have
+	//to be covered by calling this before they are added.
+	void add_broadphase_regions(const PxBounds3& bounds);
+
+	//Should be called every fixed time step. Simulates physics and applies to dynamic rigid bodies.
+	//In asynchronous mode, only applies the current poses to the dynamic rigid bodies, the simulation is started by simulate_async.
 	void update(const float& stepSize);
 
+	//Waits for the simulation started by simulate_async, if there is one. Must be called before reading or writing
+	//PhysX state outside of the fixed update (e.g. when resetting the level or releasing actors).
+	void fetch_results();
+
+	//Starts simulating a step in the background (asynchronous mode only). Should be called at the end of the fixed update.
+	void simulate_async(const float& stepSize);
+
+	//Enables or disables the asynchronous mode. Waits for a running simulation.
+	void set_async(bool async);
+
+	//Returns true if the simulation is currently running in the background
+	bool is_simulating() const { return mSimulating; }
+
+	//Returns the time in ms the last step was simulating in the background before its results were needed
+	double get_last_overlap_time() const { return mLastOverlapTime; }
+
+	//Returns the time in ms the main thread had to wait for the simulation in the last step (the whole step in synchronous mode)
+	double get_last_wait_time() const { return mLastWaitTime; }
+
+	//Returns the number of dynamic objects whose transformation has been written to their model in the last step
+	uint32_t get_synced_object_count() const { return mSyncedObjects; }
+
+	//Returns the number of dynamic objects that have been skipped in the last step, because their actor did not move
+	uint32_t get_skipped_object_count() const { return static_cast<uint32_t>(dynamicObjects.size()) - mSyncedObjects; }
+
 	//Creates an actor for a box with corner vertices +-1/+-1/+-1, and a linear transformation
 	//set dynamic to true if changes of the transform of the actor should be applied to the model
+	//Static actors should not be moved, use a kinematic actor for moving objects instead.
 	PxRigidStatic* create_rigid_static_for_scaled_unit_box(fmodel* model, bool dynamic = false);
 
 	//Creates an actor for a plane with corner vertices +-1/+-1/0, and a linear transformation
 	//set dynamic to true if changes of the transform of the actor should be applied to the model
 	PxRigidStatic* create_rigid_static_for_scaled_plane(fmodel* model, bool dynamic = false);
 
+	//Creates an actor with a triangle mesh collider built from the model's own vertices and indices.
+	//The cooked mesh is cached (see fphysicsruntime), the model's scale is applied as mesh scale.
+	//The mesh collides from both sides, such that single-sided geometry (e.g. planes) blocks the player from behind as well.
+	PxRigidStatic* create_rigid_static_for_triangle_mesh(fmodel* model, bool dynamic = false);
+
+	//Creates an actor with a collider for the convex hull of the model's vertices
+	PxRigidStatic* create_rigid_static_for_convex_mesh(fmodel* model, bool dynamic = false);
+
+	//Creates a kinematic actor with a collider for the convex hull of the model's vertices
+	PxRigidDynamic* create_kinematic_for_convex_mesh(fmodel* model);
+
+	//Creates a kinematic actor for a box with corner vertices +-1/+-1/+-1, and a linear transformation.
+	//Kinematic actors are moved with move_kinematic, their transform is always applied to the model.
+	PxRigidDynamic* create_kinematic_for_scaled_unit_box(fmodel* model);
+
+	//Creates a kinematic actor for a plane with corner vertices +-1/+-1/0, and a linear transformation
+	PxRigidDynamic* create_kinematic_for_scaled_plane(fmodel* model);
+
+	//Moves a kinematic actor to the given pose during the next simulation step
+	void move_kinematic(PxRigidDynamic* actor, const PxTransform& target);
+
+	//Returns the pose a kinematic actor will have after the next simulation step (its target if one is set, its current pose otherwise)
+	PxTransform get_kinematic_pose(PxRigidDynamic* actor);
+
+	//Teleports a kinematic actor to the given pose (e.g. when resetting the level)
+	void set_kinematic_pose(PxRigidDynamic* actor, const PxTransform& pose);
+
+	//Queues a raycast for the next execute_queries call. Returns the index of its result.
+	size_t queue_raycast(const PxVec3& origin, const PxVec3& direction, float distance);
+
+	//Queues a sweep for the next execute_queries call. Returns the index of its result.
+	size_t queue_sweep(const PxGeometry& geometry, const PxTransform& pose, const PxVec3& direction, float distance);
+
+	//Executes all queued raycasts and sweeps together (in parallel on the job system) and clears the queue. Does nothing if the queue is empty.
+	//Gameplay code queues its queries for a step and executes them once, instead of querying the scene one by one.
+	//Must not be called while simulating.
+	void execute_queries();
+
+	//Returns the closest blocking hit of a raycast/sweep of the last execute_queries call (actor is nullptr if nothing was hit)
+	const PxRaycastHit& get_raycast_result(size_t index) const { return mRaycastResults[index]; }
+	const PxSweepHit& get_sweep_result(size_t index) const { return mSweepResults[index]; }
+
+	//Returns the time in ms of the last execute_queries call
+	double get_last_query_time() const { return mLastQueryTime; }
+
+	//Tags all shapes of the actor with a gameplay id (stored in word0 of the query filter data), so that hits can be mapped
+	//to gameplay objects without searching. 0 = no id.
+	static void set_query_id(PxRigidActor* actor, uint32_t id);
+
+	//Returns the gameplay id of a hit shape (see set_query_id)
+	static uint32_t get_query_id(const PxShape* shape) { return shape->getQueryFilterData().word0; }
+
+	//Serializes all actors created for models into the level's snapshot and stores it on disk (if enabled and not loaded from there).
+	//Should be called at the end of a level's initialization, after finish_static_actors.
+	void take_snapshot();
+
+	//Resets the poses (and velocities) of all kinematic and dynamic actors to the snapshot. Waits for a running simulation.
+	void restore_snapshot();
+
+	//Returns true if the actors of this level have been taken from a snapshot file instead of being constructed
+	bool is_loaded_from_snapshot() const { return mLoadedSnapshot.mCollection != nullptr; }
+
+	//Releases the actors of the level, the PhysX scene, the pruning structures, the snapshots and the controller manager (the runtime stays alive)
 	void cleanup();
 
 private:
 
 	struct dynamicobject {
-		PxRigidStatic* dynamicActor;
+		PxRigidActor* dynamicActor;
 		fmodel* dynamicInstance;
 		glm::mat4 scale;
+		PxTransform syncedPose;			//Pose that has last been written to the model
+		bool moved = false;				//Whether the object is already in movedObjects
+		uint32_t syncedStep = 0;		//Step in which the object has last been synced (for counting)
+	};
+
+	struct raycastquery {
+		PxVec3 origin;
+		PxVec3 direction;
+		float distance;
+	};
+
+	struct sweepquery {
+		PxGeometryHolder geometry;
+		PxTransform pose;
+		PxVec3 direction;
+		float distance;
+	};
+
+	//A deserialized PhysX collection and the memory its objects live in
+	struct snapshot {
+		std::vector<uint8_t> mMemory;
+		PxCollection* mCollection = nullptr;
 	};
 
 	fscene* scene;
 	std::vector<dynamicobject> dynamicObjects;
+	std::unordered_map<PxActor*, size_t> dynamicObjectIndices;	//Index in dynamicObjects for each registered actor
+	std::vector<size_t> movedObjects;							//Dynamic objects that might have moved since the last sync
+	uint32_t mSyncedObjects = 0;	//Number of objects synced in the current step
+	uint32_t mSyncStep = 1;			//Number of the current step for the sync counters
+	std::vector<PxRigidActor*> mPendingStatics;				//Static actors not yet added to the scene
+	std::vector<PxPruningStructure*> mPruningStructures;	//One per batch of static actors
+	std::vector<raycastquery> mRaycastQueries;		//Queued raycasts
+	std::vector<sweepquery> mSweepQueries;			//Queued sweeps
+	std::vector<PxRaycastHit> mRaycastResults;		//Results of the last executed raycasts
+	std::vector<PxSweepHit> mSweepResults;			//Results of the last executed sweeps
+	double mLastQueryTime = 0;
+	std::unordered_map<PxRigidActor*, PxSerialObjectId> mSnapshotIds;	//Serial id of every actor created for a model
+	std::vector<uint8_t> mSnapshotData;		//Serialized snapshot
+	std::string mSnapshotPath;				//Path of the snapshot file ("" = snapshot files are disabled)
+	snapshot mResetSnapshot;				//Deserialized copy of the snapshot, from which the poses are restored
+	snapshot mLoadedSnapshot;				//Snapshot loaded from disk, whose actors are used by the create functions
+	uint32_t mTakenSnapshotActors = 0;		//Number of actors used from the loaded snapshot
+	bool mLoadedSnapshotMatches = true;		//False if the level created an actor that does not match the loaded snapshot
+
+	bool mAsync = ASYNC_PHYSICS;	//Whether the simulation runs in the background
+	bool mSimulating = false;		//Whether a simulation has been started and not fetched yet
+	std::chrono::steady_clock::time_point mSimulateStartTime;	//Time at which the running simulation has been started
+	double mLastOverlapTime = 0;
+	double mLastWaitTime = 0;
+	double mOverlapTimeSum = 0;		//Accumulated timings for logging
+	double mWaitTimeSum = 0;
+	uint32_t mTimedSteps = 0;
+
+	//Applies the poses of the moved actors to their models and marks these models as dirty in the scene
+	//snap: The models jump to the new poses instead of being interpolated from the previous step (see fscene::set_model_transform)
+	void apply_to_dynamic_objects(bool snap = false);
+
+	//Remembers that the given dynamic object might have moved
+	void mark_moved(PxActor* actor);
+
+	//Marks the actors reported active by the last simulation as moved. Must be called right after fetching the results.
+	void collect_active_actors();
+
+	//Splits a model transformation into a pose and the scale along its axes
+	static PxTransform unscaled_pose(const glm::mat4& transform, glm::vec3& scale);
+
+	//Creates a kinematic actor without shapes
+	PxRigidDynamic* create_kinematic(const PxTransform& pose);
+
+	//Attaches an exclusive shape with the given geometry and the default material to the actor
+	void attach_shape(PxRigidActor* actor, const PxGeometry& geometry);
+
+	//Adds the actor to the scene and registers it for the model
+	void add_actor_for_model(PxRigidActor* actor, fmodel* instance, const glm::vec3& scale, bool dynamic);
+
+	//Serial id of the actor of a model in the snapshot
+	static PxSerialObjectId snapshot_id(const fmodel* instance) { return PxSerialObjectId(instance->mModelIndex) + 1; }
+
+	//Returns the actor of the model from the loaded snapshot if there is one with the given type and geometry, nullptr otherwise
+	PxRigidActor* take_loaded_actor(fmodel* instance, PxConcreteType::Enum actorType, PxGeometryType::Enum geometryType);
+
+	//Deserializes snapshot data into target. Returns false on failure.
+	bool deserialize_snapshot(const std::vector<uint8_t>& data, snapshot& target);
+
+	//Releases all objects of a deserialized snapshot and its memory
+	void release_snapshot(snapshot& target);
+
+	//Hash of the models of the scene, which identifies the snapshot file of a level
+	uint64_t scene_hash() const;
+
+	//Bounds of all models of the scene in world space
+	PxBounds3 scene_bounds() const;
+
+	//Accumulates the timings of the last step and logs the averages regularly
+	void record_step_timing();
 };
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "includes.h"
+
+using namespace physx;
+
+fphysicsruntime::fphysicsruntime(const fphysicsconfig& config) {
+	mConfig = config;
+	auto initStart = std::chrono::steady_clock::now();
+
+	mFoundation = PxCreateFoundation(PX_PHYSICS_VERSION, mAllocatorCallback, mErrorCallback);
+	if (!mFoundation) {
+		throw std::runtime_error("PxCreateFoundation failed!");
+	}
+
+	bool recordMemoryAllocations = true;
+
+	if (mConfig.mConnectPvd) {
+		mPvd = PxCreatePvd(*mFoundation);
+		mTransport = PxDefaultPvdSocketTransportCreate(mConfig.mPvdHost.c_str(), mConfig.mPvdPort, 10);
+		mPvd->connect(*mTransport, PxPvdInstrumentationFlag::eALL);
+	}
+
+	mPhysics = PxCreatePhysics(PX_PHYSICS_VERSION, *mFoundation, PxTolerancesScale(), recordMemoryAllocations, mPvd);
+	if (!mPhysics) {
+		throw std::runtime_error("PxCreatePhysics failed!");
+	}
+
+	mCooking = PxCreateCooking(PX_PHYSICS_VERSION, *mFoundation, PxCookingParams(PxTolerancesScale()));
+	if (!mCooking) {
+		throw std::runtime_error("PxCreateCooking failed!");
+	}
+	mDispatcher = new fpxdispatcher(fjobsystem::instance());
+
+	mDefaultMaterial = mPhysics->createMaterial(1, 1, 0.3);
+	mCharacterMaterial = mPhysics->createMaterial(1, 1, 0);
+
+	//The materials are not part of the level snapshots, the snapshots reference them by these ids
+	mSerializationRegistry = PxSerialization::createSerializationRegistry(*mPhysics);
+	mSharedCollection = PxCreateCollection();
+	mSharedCollection->add(*mDefaultMaterial, PxSerialObjectId(1) << 32);
+	mSharedCollection->add(*mCharacterMaterial, (PxSerialObjectId(1) << 32) + 1);
+
+	LOG_INFO("PhysX runtime initialized in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initStart).count()) + " ms");
+}
+
+fphysicsruntime::~fphysicsruntime() {
+	release_cached_meshes();
+	mSharedCollection->release();
+	mSerializationRegistry->release();
+	mCharacterMaterial->release();
+	mDefaultMaterial->release();
+	delete mDispatcher;
+	mCooking->release();
+	mPhysics->release();
+	if (mPvd != nullptr) {
+		mPvd->release();
+		mTransport->release();
+	}
+	mFoundation->release();
+}
+
+PxTriangleMesh* fphysicsruntime::get_triangle_mesh(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+	uint64_t hash = mesh_hash(positions, &indices, 't');
+	auto it = mTriangleMeshes.find(hash);
+	if (it != mTriangleMeshes.end()) {
+		++mCachedMeshes;
+		return it->second;
+	}
+
+	PxTriangleMesh* mesh = nullptr;
+	std::string path = cache_file_path(hash, ".tri");
+	std::vector<uint8_t> data;
+	if (read_cache_file(path, data)) {
+		PxDefaultMemoryInputData input(data.data(), static_cast<PxU32>(data.size()));
+		mesh = mPhysics->createTriangleMesh(input);
+	}
+	if (mesh != nullptr) {
+		++mCachedMeshes;
+	}
+	else {
+		//Not cached (or the cache file is from an incompatible build) -> cook
+		auto cookStart = std::chrono::steady_clock::now();
+		PxTriangleMeshDesc desc;
+		desc.points.count = static_cast<PxU32>(positions.size());
+		desc.points.stride = sizeof(glm::vec3);
+		desc.points.data = positions.data();
+		desc.triangles.count = static_cast<PxU32>(indices.size() / 3);
+		desc.triangles.stride = 3 * sizeof(uint32_t);
+		desc.triangles.data = indices.data();
+		PxDefaultMemoryOutputStream stream;
+		if (!mCooking->cookTriangleMesh(desc, stream)) {
+			throw std::runtime_error("Cooking of a triangle mesh failed!");
+		}
+		write_cache_file(path, stream.getData(), stream.getSize());
+		PxDefaultMemoryInputData input(stream.getData(), stream.getSize());
+		mesh = mPhysics->createTriangleMesh(input);
+		++mCookedMeshes;
+		LOG_INFO("Cooked triangle mesh with " + std::to_string(desc.triangles.count) + " triangles in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cookStart).count()) + " ms");
+	}
+	mTriangleMeshes[hash] = mesh;
+	return mesh;
+}
+
+PxConvexMesh* fphysicsruntime::get_convex_mesh(const std::vector<glm::vec3>& positions)
+{
+	uint64_t hash = mesh_hash(positions, nullptr, 'c');
+	auto it = mConvexMeshes.find(hash);
+	if (it != mConvexMeshes.end()) {
+		++mCachedMeshes;
+		return it->second;
+	}
+
+	PxConvexMesh* mesh = nullptr;
+	std::string path = cache_file_path(hash, ".cvx");
+	std::vector<uint8_t> data;
+	if (read_cache_file(path, data)) {
+		PxDefaultMemoryInputData input(data.data(), static_cast<PxU32>(data.size()));
+		mesh = mPhysics->createConvexMesh(input);
+	}
+	if (mesh != nullptr) {
+		++mCachedMeshes;
+	}
+	else {
+		auto cookStart = std::chrono::steady_clock::now();
+		PxConvexMeshDesc desc;
+		desc.points.count = static_cast<PxU32>(positions.size());
+		desc.points.stride = sizeof(glm::vec3);
+		desc.points.data = positions.data();
+		desc.flags = PxConvexFlag::eCOMPUTE_CONVEX;
+		PxDefaultMemoryOutputStream stream;
+		if (!mCooking->cookConvexMesh(desc, stream)) {
+			throw std::runtime_error("Cooking of a convex mesh failed!");
+		}
+		write_cache_file(path, stream.getData(), stream.getSize());
+		PxDefaultMemoryInputData input(stream.getData(), stream.getSize());
+		mesh = mPhysics->createConvexMesh(input);
+		++mCookedMeshes;
+		LOG_INFO("Cooked convex mesh with " + std::to_string(desc.points.count) + " vertices in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cookStart).count()) + " ms");
+	}
+	mConvexMeshes[hash] = mesh;
+	return mesh;
+}
+
+void fphysicsruntime::release_cached_meshes()
+{
+	for (auto& [hash, mesh] : mTriangleMeshes) {
+		mesh->release();
+	}
+	for (auto& [hash, mesh] : mConvexMeshes) {
+		mesh->release();
+	}
+	mTriangleMeshes.clear();
+	mConvexMeshes.clear();
+}
+
+uint64_t fphysicsruntime::hash_bytes(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t fphysicsruntime::mesh_hash(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>* indices, char type)
+{
+	uint32_t version = PX_PHYSICS_VERSION;
+	uint64_t hash = hash_bytes(&version, sizeof(version));
+	hash = hash_bytes(&type, sizeof(type), hash);
+	hash = hash_bytes(positions.data(), positions.size() * sizeof(glm::vec3), hash);
+	if (indices != nullptr) {
+		hash = hash_bytes(indices->data(), indices->size() * sizeof(uint32_t), hash);
+	}
+	return hash;
+}
+
+std::string fphysicsruntime::cache_file_path(uint64_t hash, const char* extension) const
+{
+	if (mConfig.mCookingCacheDirectory.empty()) {
+		return "";
+	}
+	std::stringstream ss;
+	ss << mConfig.mCookingCacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << extension;
+	return ss.str();
+}
+
+bool fphysicsruntime::read_cache_file(const std::string& path, std::vector<uint8_t>& data) const
+{
+	if (path.empty()) {
+		return false;
+	}
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		return false;
+	}
+	data.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), data.size()));
+}
+
+void fphysicsruntime::write_cache_file(const std::string& path, const void* data, size_t size) const
+{
+	if (path.empty()) {
+		return;
+	}
+	std::error_code error;
+	std::filesystem::create_directories(mConfig.mCookingCacheDirectory, error);
+	std::ofstream file(path, std::ios::binary);
+	if (!file || !file.write(static_cast<const char*>(data), size)) {
+		LOG_ERROR("Could not write cache file " + path);
+	}
+}
+
+void fphysicserrorcallback::reportError(physx::PxErrorCode::Enum code, const char* message, const char* file, int line) {
+	std::stringstream ss;
+	ss << "PhysX Error (" << code << "): \"" << message << "\" in file \"" << file << "\"::" << line << std::endl;
+	LOG_ERROR(ss.str());
+}
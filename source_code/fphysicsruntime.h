@@ -0,0 +1,96 @@
+#pragma once
+#include "includes.h"
+
+class fphysicserrorcallback : public physx::PxErrorCallback {
+public:
+	virtual void reportError(physx::PxErrorCode::Enum code, const char* message, const char* file, int line);
+
+};
+
+/*
+Configuration of the PhysX runtime
+*/
+struct fphysicsconfig {
+	physx::PxVec3 mGravity = physx::PxVec3(0.0f, -9.81f, 0.0f);	//Gravity of all level scenes
+#if _DEBUG
+	bool mConnectPvd = true;					//Whether to connect to the PhysX Visual Debugger
+#else
+	bool mConnectPvd = false;
+#endif
+	std::string mPvdHost = "localhost";			//Host of the PhysX Visual Debugger
+	int mPvdPort = 5425;						//Port of the PhysX Visual Debugger
+	std::string mCookingCacheDirectory = "cache/physx";	//Directory for cooked meshes and level snapshots (empty = nothing is stored on disk)
+	bool mUseSnapshotFiles = true;				//Whether the physics snapshot of a level is stored on disk and used to skip actor construction on the next load
+	physx::PxBroadPhaseType::Enum mBroadPhase = physx::PxBroadPhaseType::eABP;	//Broadphase of the level scenes (eSAP, eMBP or eABP)
+	physx::PxU32 mMbpSubdivisions = 4;			//eMBP only: the bounds of the level are split into mMbpSubdivisions^2 regions
+	physx::PxPruningStructureType::Enum mStaticPruner = physx::PxPruningStructureType::eDYNAMIC_AABB_TREE;	//Scene query structure of static actors
+	physx::PxPruningStructureType::Enum mDynamicPruner = physx::PxPruningStructureType::eDYNAMIC_AABB_TREE;	//Scene query structure of kinematic and dynamic actors
+	float mStepRate = 60.0f;					//Physics steps per second. The scene interpolates the dynamic models between the last two steps.
+	int mMaxCatchUpSteps = 4;					//Maximum number of physics steps per frame. Time beyond that is dropped, so slow frames slow down the game instead of piling up steps.
+};
+
+/*
+Process-lifetime PhysX objects, which are shared by all levels: foundation, physics, cooking, CPU dispatcher, materials and
+the PhysX Visual Debugger connection. Owned by fgamecontrol. Levels only create and release their own scene (see fphysicscontroller).
+Also caches cooked collision meshes: in memory for the runtime's lifetime and on disk (keyed by a hash of the mesh data),
+so that a mesh is cooked only once and later loads just deserialize the cooked stream.
+The serialization registry and the shared objects (materials) are used by the level snapshots (see fphysicscontroller).
+*/
+class fphysicsruntime {
+public:
+	physx::PxFoundation* mFoundation = nullptr;
+	physx::PxPvdTransport* mTransport = nullptr;
+	physx::PxPvd* mPvd = nullptr;
+	physx::PxPhysics* mPhysics = nullptr;
+	physx::PxCooking* mCooking = nullptr;
+	physx::PxCpuDispatcher* mDispatcher = nullptr;
+	physx::PxMaterial* mDefaultMaterial = nullptr;		//Material of the level geometry
+	physx::PxMaterial* mCharacterMaterial = nullptr;	//Material of the player's character controller
+	physx::PxSerializationRegistry* mSerializationRegistry = nullptr;
+	physx::PxCollection* mSharedCollection = nullptr;	//Objects shared by all levels, referenced by the level snapshots
+	fphysicsconfig mConfig;
+
+	//Initializes PhysX
+	fphysicsruntime(const fphysicsconfig& config = fphysicsconfig());
+
+	//Releases all PhysX objects. All scenes must have been released before.
+	~fphysicsruntime();
+
+	//Returns a triangle mesh for the given vertices and triangle indices. Cooks it only if it is in neither cache.
+	physx::PxTriangleMesh* get_triangle_mesh(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+	//Returns the convex hull of the given vertices (at most 255 polygons). Cooks it only if it is in neither cache.
+	physx::PxConvexMesh* get_convex_mesh(const std::vector<glm::vec3>& positions);
+
+	//Empties the in-memory mesh cache. Meshes that are still used by shapes stay alive until these are released.
+	void release_cached_meshes();
+
+	//Returns the number of meshes that had to be cooked and the number of meshes that were found in a cache
+	uint32_t get_cooked_mesh_count() const { return mCookedMeshes; }
+	uint32_t get_cached_mesh_count() const { return mCachedMeshes; }
+
+	//FNV-1a hash of the given bytes. Pass a previous result as hash to continue hashing.
+	static uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+	//Path of the cache file for a hash ("" if the disk cache is disabled)
+	std::string cache_file_path(uint64_t hash, const char* extension) const;
+	//Reads a file from the disk cache. Returns false if there is none.
+	bool read_cache_file(const std::string& path, std::vector<uint8_t>& data) const;
+	//Writes a file to the disk cache. Failures are only logged, the data is created again next time.
+	void write_cache_file(const std::string& path, const void* data, size_t size) const;
+
+	fphysicsruntime(const fphysicsruntime&) = delete;
+	fphysicsruntime& operator=(const fphysicsruntime&) = delete;
+
+private:
+	fphysicserrorcallback mErrorCallback;
+	physx::PxDefaultAllocator mAllocatorCallback;
+
+	std::unordered_map<uint64_t, physx::PxTriangleMesh*> mTriangleMeshes;	//In-memory cache of triangle meshes by hash
+	std::unordered_map<uint64_t, physx::PxConvexMesh*> mConvexMeshes;		//In-memory cache of convex meshes by hash
+	uint32_t mCookedMeshes = 0;
+	uint32_t mCachedMeshes = 0;
+
+	//FNV-1a hash of the mesh data, the mesh type and the PhysX version
+	static uint64_t mesh_hash(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>* indices, char type);
+};
@@ -3,11 +3,12 @@
 #define _USE_MATH_DEFINES
 #include <Math.h>
 
-fplayercontrol::fplayercontrol(fphysicscontroller* physics, fscene* scene, bool fly, float eyeheight, PxUserControllerHitReport* callback)
+fplayercontrol::fplayercontrol(fphysicscontroller* physics, fscene* scene, finput* input, bool fly, float eyeheight, PxUserControllerHitReport* callback)
 {
 	//---- INITIALIZING DATA ----
 	this->physics = physics;
 	this->scene = scene;
+	this->input = input;
 	this->camera = &scene->get_camera();
 	this->fly = fly;
 	this->eyeheight = eyeheight;
@@ -25,7 +26,7 @@ fplayercontrol::fplayercontrol(fphysicscontroller* physics, fscene* scene, bool
 	desc.upDirection = PxVec3(0, 1, 0);
 	desc.nonWalkableMode = PxControllerNonWalkableMode::ePREVENT_CLIMBING;
 	desc.slopeLimit = cosf(glm::radians(10.0f));
-	desc.material = physics->mPhysics->createMaterial(1, 1, 0);
+	desc.material = physics->mRuntime->mCharacterMaterial;
 	desc.reportCallback = this;
 	cameraController = physics->mControllerManager->createController(desc);
 }
@@ -34,31 +35,31 @@ fplayercontrol::fplayercontrol(fphysicscontroller* physics, fscene* scene, bool
 void fplayercontrol::pre_px_update(float deltaT)
 {
 	//----- CHECK MIRROR INTERACTION -----
-	bool leftClicked = gvk::input().mouse_button_down(0);
+	//The mirror ray has been queued at the end of the last step and is executed together with all other queued queries
+	physics->execute_queries();
+	int lookedAtMirror = mirror_from_query();
+	bool leftClicked = input->mouse_button_down(0);
 	//Click active -> interact with mirror
 	if (leftClicked) {
 		//No mirror hit yet -> Check for hit via raycasting
 		if (movingMirror == -1) {
-			int i = raycastMirror();
-			if (i != -1) {
-				movingMirror = i;
-			}
+			movingMirror = lookedAtMirror;
 		}
 		//Mirror hit -> Rotate according to mouse
 		if (movingMirror != -1) {
-			double deltaX = gvk::input().delta_cursor_position().x;
-			double deltaY = gvk::input().delta_cursor_position().y;
+			double deltaX = input->delta_cursor_position().x;
+			double deltaY = input->delta_cursor_position().y;
 			float angle = -deltaX * MOUSE_SENTIVITY;
 			PxQuat rotation = PxQuat(angle, PxVec3(0, 1, 0));
 			glm::vec3 mPosition;
-			for (PxRigidStatic* mirrorActor : mirrorActors[movingMirror]) {
-				PxTransform transform = mirrorActor->getGlobalPose();
+			for (PxRigidDynamic* mirrorActor : mirrorActors[movingMirror]) {
+				//The level might have moved the mirror in this step already
+				PxTransform transform = physics->get_kinematic_pose(mirrorActor);
 				PxQuat newQ = rotation * transform.q;
-				mirrorActor->setGlobalPose(PxTransform(transform.p, newQ));
+				physics->move_kinematic(mirrorActor, PxTransform(transform.p, newQ));
 				mPosition = glm::vec3(transform.p.x, transform.p.y, transform.p.z);
-				fmodel* model = (fmodel*)mirrorActor->userData;
-				model->mFlags |= 2;
 			}
+			set_highlighted_mirror(movingMirror);
 			look_into_direction(glm::normalize(mPosition - camera->translation()));
 		}
 	}
@@ -68,21 +69,7 @@ void fplayercontrol::pre_px_update(float deltaT)
 			movingMirror = -1;
 			look_into_direction(-camera->z_axis());
 		}
-		int i = raycastMirror();
-		int j = 0;
-		for (auto mirrorParts : mirrorActors) {
-			for (auto mirror : mirrorParts) {
-				fmodel* model = (fmodel*)mirror->userData;
-				if (j == i && (model->mFlags & 2) == 0) {
-					//Looked at
-					model->mFlags |= 2;
-				}
-				else if (j != i && (model->mFlags & 2) != 0) {
-					model->mFlags &= ~2;
-				}
-			}
-			++j;
-		}
+		set_highlighted_mirror(lookedAtMirror);
 	}
 }
 
@@ -100,25 +87,25 @@ void fplayercontrol::post_px_update(float deltaT) {
 		straight.y = 0;
 	}
 	
-	if (gvk::input().key_down(gvk::key_code::w)) {
+	if (input->key_down(finput_key::w)) {
 		moveDir += straight;
 	}
-	if (gvk::input().key_down(gvk::key_code::s)) {
+	if (input->key_down(finput_key::s)) {
 		moveDir -= straight;
 	}
-	if (gvk::input().key_down(gvk::key_code::d)) {
+	if (input->key_down(finput_key::d)) {
 		moveDir += camera->x_axis();
 	}
-	if (gvk::input().key_down(gvk::key_code::a)) {
+	if (input->key_down(finput_key::a)) {
 		moveDir -= camera->x_axis();
 	}
-	if (fly && gvk::input().key_down(gvk::key_code::e)) {
+	if (fly && input->key_down(finput_key::e)) {
 		moveDir += camera->y_axis();
 	}
-	if (fly && gvk::input().key_down(gvk::key_code::q)) {
+	if (fly && input->key_down(finput_key::q)) {
 		moveDir -= camera->y_axis();
 	}
-	if (jumpbase != nullptr && gvk::input().key_down(gvk::key_code::space) && jump == -1) {
+	if (jumpbase != nullptr && input->key_down(finput_key::space) && jump == -1) {
 		PxBounds3 basebounds = jumpbase->getWorldBounds();
 		PxExtendedVec3 camPos = cameraController->getPosition();
 		//Make sure the player still stands on the last contact point
@@ -147,18 +134,23 @@ void fplayercontrol::post_px_update(float deltaT) {
 
 	//---- MOVE CAMERA CONTROLLER ----
 	cameraController->move(PxVec3(moveDir.x, moveDir.y, moveDir.z), 0.001f, deltaT, PxControllerFilters());
+	//Camera and character are rendered between the last two steps, like the dynamic models of the scene
 	PxExtendedVec3 camPos = cameraController->getPosition();
-	camera->set_translation(glm::vec3(camPos.x, camPos.y + eyeheight * 1.5f / 4.0f, camPos.z));
+	scene->set_camera_translation(glm::vec3(camPos.x, camPos.y + eyeheight * 1.5f / 4.0f, camPos.z));
 
 	scene->set_character_position(glm::vec3(camPos.x, camPos.y, camPos.z));
+	on_final_region();
+
+	//The mirror ray of the next step starts from the new camera position
+	queue_mirror_query();
 }
 
 void fplayercontrol::update(float deltaT)
 {
 	//Check Mouse Interactions (only if no mirror is focused)
 	if (movingMirror == -1) {
-		double deltaX = gvk::input().delta_cursor_position().x;
-		double deltaY = gvk::input().delta_cursor_position().y;
+		double deltaX = input->delta_cursor_position().x;
+		double deltaY = input->delta_cursor_position().y;
 		horizontalAngle += deltaX * MOUSE_SENTIVITY;
 		verticalAngle = glm::max(glm::min(verticalAngle + deltaY * 0.005, M_PI / 2 - 0.02), -M_PI / 2 + 0.02);
 	}
@@ -178,46 +170,47 @@ void fplayercontrol::beam_along(const glm::vec3& direction)
 {
 	PxExtendedVec3 camPos = cameraController->getPosition() + PxExtendedVec3(direction.x, direction.y, direction.z);
 	cameraController->setPosition(PxExtendedVec3(camPos.x, camPos.y, camPos.z));
-	camera->set_translation(glm::vec3(camPos.x, camPos.y + eyeheight * 1.5f / 4.0f, camPos.z));
+	//A beam is not interpolated
+	scene->set_camera_translation(glm::vec3(camPos.x, camPos.y + eyeheight * 1.5f / 4.0f, camPos.z), true);
+	scene->set_character_position(glm::vec3(camPos.x, camPos.y, camPos.z), true);
+	on_final_region();
 }
 
 void fplayercontrol::update_position()
 {
 	glm::vec3 camPos = camera->translation();
 	cameraController->setPosition(PxExtendedVec3(camPos.x, camPos.y - eyeheight * 1.5f / 4.0f, camPos.z));
+	//The reset position must not be interpolated from the old one
+	scene->set_camera_translation(camPos, true);
+	scene->set_character_position(glm::vec3(camPos.x, camPos.y - eyeheight * 1.5f / 4.0f, camPos.z), true);
 	look_into_direction(-camera->z_axis());
 }
 
-void fplayercontrol::add_mirror(std::vector<PxRigidStatic*> actors, float maxDistance)
+void fplayercontrol::add_mirror(std::vector<PxRigidDynamic*> actors, float maxDistance)
 {
-	this->mirrorActors.push_back(actors);
-	std::vector<PxTransform> transforms;
-	for (size_t i = 0; i < actors.size(); ++i) {
-		transforms.push_back(actors[i]->getGlobalPose());
+	//Hits on the mirror's shapes can be mapped to the mirror directly
+	for (PxRigidDynamic* actor : actors) {
+		fphysicscontroller::set_query_id(actor, static_cast<uint32_t>(mirrorActors.size() + 1));
 	}
-	this->mirrorOriginalTransformations.push_back(transforms);
+	this->mirrorActors.push_back(actors);
 	this->mirrorMaxDistances.push_back(maxDistance);
 }
 
-void fplayercontrol::reset_mirrors() {
-	for (size_t i = 0; i < mirrorActors.size(); ++i) {
-		for (size_t j = 0; j < mirrorActors[i].size(); ++j) {
-			mirrorActors[i][j]->setGlobalPose(mirrorOriginalTransformations[i][j]);
-		}
-	}
-}
-
-void fplayercontrol::set_final_region(PxRigidStatic* finalRegion)
+void fplayercontrol::set_final_region(PxRigidActor* finalRegion)
 {
 	this->finalRegion = finalRegion;
 }
 
 bool fplayercontrol::on_final_region()
 {
-	PxVec3 finMin = finalRegion->getWorldBounds().minimum;
-	PxVec3 finMax = finalRegion->getWorldBounds().maximum;
-	PxExtendedVec3 camPos = cameraController->getPosition();
-	return camPos.x > finMin.x&& camPos.x < finMax.x && camPos.z > finMin.z&& camPos.z < finMax.z;
+	//World bounds must not be read while the simulation is running, use the result of the last fixed update then
+	if (finalRegion != nullptr && !physics->is_simulating()) {
+		PxVec3 finMin = finalRegion->getWorldBounds().minimum;
+		PxVec3 finMax = finalRegion->getWorldBounds().maximum;
+		PxExtendedVec3 camPos = cameraController->getPosition();
+		onfinalregion = camPos.x > finMin.x&& camPos.x < finMax.x && camPos.z > finMin.z&& camPos.z < finMax.z;
+	}
+	return onfinalregion;
 }
 
 bool fplayercontrol::fell_down()
@@ -227,6 +220,7 @@ bool fplayercontrol::fell_down()
 
 void fplayercontrol::cleanup()
 {
+	physics->fetch_results();
 	cameraController->release();
 }
 
@@ -254,26 +248,49 @@ void fplayercontrol::onObstacleHit(const PxControllerObstacleHit& hit)
 	}
 }
 
-int fplayercontrol::raycastMirror()
+void fplayercontrol::queue_mirror_query()
 {
 	glm::vec3 camPos = camera->translation();
 	glm::vec3 camDir = -camera->z_axis();
-	PxRaycastBuffer hit;
-	physics->mPxScene->raycast(PxVec3(camPos.x + camDir.x * 0.45, camPos.y + camDir.y * 0.45, camPos.z + camDir.z * 0.45), PxVec3(camDir.x, camDir.y, camDir.z), 50, hit);
-	//If looking at a mirror -> set as current moving mirror
-	if (hit.hasBlock) {
-		PxActor* hitActor = hit.block.actor;
-		for (size_t i = 0; i < mirrorActors.size(); ++i) {
-			//if hitActor contained in list mirrorActors[i]
-			if (std::find(mirrorActors[i].begin(), mirrorActors[i].end(), hitActor) != mirrorActors[i].end()) {
-				if (hit.block.distance <= mirrorMaxDistances[i]) {
-					return i;
-				}
-				else {
-					return -1;
-				}
-			}
+	mirrorQuery = physics->queue_raycast(PxVec3(camPos.x + camDir.x * 0.45, camPos.y + camDir.y * 0.45, camPos.z + camDir.z * 0.45), PxVec3(camDir.x, camDir.y, camDir.z), 50);
+}
+
+int fplayercontrol::mirror_from_query()
+{
+	if (mirrorQuery == NO_MIRROR_QUERY) {
+		return -1;
+	}
+	const PxRaycastHit& hit = physics->get_raycast_result(mirrorQuery);
+	mirrorQuery = NO_MIRROR_QUERY;
+	if (hit.shape == nullptr) {
+		return -1;
+	}
+	//The shapes of mirror i are tagged with the query id i + 1
+	int i = static_cast<int>(fphysicscontroller::get_query_id(hit.shape)) - 1;
+	if (i < 0 || i >= static_cast<int>(mirrorActors.size()) || hit.distance > mirrorMaxDistances[i]) {
+		return -1;
+	}
+	return i;
+}
+
+void fplayercontrol::set_highlighted_mirror(int mirror)
+{
+	if (mirror == highlightedMirror) {
+		return;
+	}
+	if (highlightedMirror != -1) {
+		for (PxRigidDynamic* mirrorActor : mirrorActors[highlightedMirror]) {
+			fmodel* model = (fmodel*)mirrorActor->userData;
+			model->mFlags &= ~2;
+			scene->mark_model_dirty(model->mModelIndex);
+		}
+	}
+	if (mirror != -1) {
+		for (PxRigidDynamic* mirrorActor : mirrorActors[mirror]) {
+			fmodel* model = (fmodel*)mirrorActor->userData;
+			model->mFlags |= 2;
+			scene->mark_model_dirty(model->mModelIndex);
 		}
 	}
-	return -1;
+	highlightedMirror = mirror;
 }
\ No newline at end of file
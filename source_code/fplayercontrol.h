@@ -4,6 +4,7 @@
 
 #define MOUSE_SENTIVITY 0.001f
 #define WALK_SPEED 0.075f
+#define NO_MIRROR_QUERY SIZE_MAX
 
 /*
 Control for Player. Implements the player and mirror movements.
@@ -12,14 +13,14 @@ Can be used by the level logic objects.
 class fplayercontrol : private PxUserControllerHitReport {
 private:
 	fscene* scene;
+	finput* input;
 	fphysicscontroller* physics;
 	gvk::camera* camera;
 	PxController* cameraController;
 	PxUserControllerHitReport* additionalCallback;
-	std::vector<std::vector<PxRigidStatic*>> mirrorActors;
-	std::vector<std::vector<PxTransform>> mirrorOriginalTransformations;
+	std::vector<std::vector<PxRigidDynamic*>> mirrorActors;
 	std::vector<float> mirrorMaxDistances;
-	PxRigidStatic* finalRegion = nullptr;
+	PxRigidActor* finalRegion = nullptr;
 
 	double lastCursorX = NAN, lastCursorY = NAN;
 	float horizontalAngle = 0;
@@ -30,9 +31,16 @@ private:
 	bool fly = false;
 	float eyeheight;
 	int movingMirror = -1;
+	int highlightedMirror = -1;			//Mirror whose models are currently flagged as selected
+	size_t mirrorQuery = NO_MIRROR_QUERY;		//Index of the queued mirror ray in the physics controller's query results
 	bool onfinalregion = false;
 
-	int raycastMirror();
+	//Queues the ray for picking and highlighting mirrors in the physics controller
+	void queue_mirror_query();
+	//Returns the index of the mirror hit by the last executed mirror ray, -1 if none (or if it was too far away)
+	int mirror_from_query();
+	//Sets the selection flag of the given mirror's models and clears it on the previous one (only if it changed)
+	void set_highlighted_mirror(int mirror);
 
 public:
 	/*
@@ -40,16 +48,18 @@ public:
 	Parameters:
 	physics: Physics Controller to use
 	scene: Scene Object
+	input: Input of the gameplay (see finput)
 	fly: If flymode should be activated or not (default: false)
 	eyehight: How high above the ground the camera should be (default: 1.0)
 	callback: Callback to call when character touches something
 	*/
-	fplayercontrol(fphysicscontroller* physics, fscene* scene, bool fly = false, float eyeheight = 1.0, PxUserControllerHitReport* callback = nullptr);
+	fplayercontrol(fphysicscontroller* physics, fscene* scene, finput* input, bool fly = false, float eyeheight = 1.0, PxUserControllerHitReport* callback = nullptr);
 
 	//Update-Functions update the player and the mirrors
-	//This method should be called before the physics-update
+	//This method should be called before the physics-update. Mirror raycasts and rotations act on the latest physics state,
+	//so in asynchronous physics mode it must be called after fetch_results.
 	void pre_px_update(float deltaT);
-	//This method should be called after the physics-update
+	//This method should be called after the physics-update (and before simulate_async in asynchronous physics mode)
 	void post_px_update(float deltaT);
 	//This method should be called during update (only mouse motion)
 	void update(float deltaT);
@@ -63,14 +73,13 @@ public:
 	//Updates position and direction of the character according to the camera data. Should be called when changing the camera data
 	void update_position();
 
-	//Registers a mirror to move. actors is a list of actors belonging to the mirror (e.g. border and plane)
+	//Registers a mirror to move. actors is a list of kinematic actors belonging to the mirror (e.g. border and plane)
 	//maxDistance is the maximum distance from which the mirror can be moved
-	void add_mirror(std::vector<PxRigidStatic*> actors, float maxDistance = 10000);
-	//Resets the mirrors to their original positions
-	void reset_mirrors();
+	void add_mirror(std::vector<PxRigidDynamic*> actors, float maxDistance = 10000);
 	//Sets the final region
-	void set_final_region(PxRigidStatic* finalRegion);
+	void set_final_region(PxRigidActor* finalRegion);
 	//Returns true if the player stands on the final region
+	//While the physics simulation is running in the background, the result of the last fixed update is returned.
 	bool on_final_region();
 	//Returns true, if the players y coordinate is below 20
 	bool fell_down();
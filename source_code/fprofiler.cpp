@@ -0,0 +1,111 @@
+#include "includes.h"
+
+std::atomic<bool> fprofiler::sEnabled = false;
+std::mutex fprofiler::sMutex;
+std::vector<std::unique_ptr<fprofiler::thread_buffer>> fprofiler::sBuffers;
+thread_local fprofiler::thread_buffer* fprofiler::tOwnBuffer = nullptr;
+thread_local std::string fprofiler::tThreadName;
+fprofiler::thread_buffer* fprofiler::sGpuBuffer = nullptr;
+
+int64_t fprofiler::now_ns()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+fprofiler::thread_buffer* fprofiler::add_buffer(const std::string& name)
+{
+	auto buffer = std::make_unique<thread_buffer>();
+	buffer->mThreadId = static_cast<uint32_t>(sBuffers.size());
+	buffer->mName = name.empty() ? "Thread " + std::to_string(buffer->mThreadId) : name;
+	sBuffers.push_back(std::move(buffer));
+	return sBuffers.back().get();
+}
+
+fprofiler::thread_buffer& fprofiler::own_buffer()
+{
+	if (tOwnBuffer == nullptr) {
+		std::lock_guard<std::mutex> lock(sMutex);
+		tOwnBuffer = add_buffer(tThreadName);
+	}
+	return *tOwnBuffer;
+}
+
+void fprofiler::set_thread_name(const std::string& name)
+{
+	tThreadName = name;
+	if (tOwnBuffer != nullptr) {
+		std::lock_guard<std::mutex> lock(sMutex);
+		tOwnBuffer->mName = name;
+	}
+}
+
+void fprofiler::push(thread_buffer& buffer, const event& e)
+{
+	uint64_t index = buffer.mWritten.load(std::memory_order_relaxed);
+	buffer.mEvents[index % FPROFILE_BUFFER_EVENTS] = e;
+	//Publishes the event to write_trace
+	buffer.mWritten.store(index + 1, std::memory_order_release);
+}
+
+void fprofiler::record(const char* name, int64_t start, int64_t end)
+{
+	push(own_buffer(), { name, nullptr, start, end, 0.0 });
+}
+
+void fprofiler::record_gpu(const char* name, int64_t start, int64_t end)
+{
+	if (sGpuBuffer == nullptr) {
+		std::lock_guard<std::mutex> lock(sMutex);
+		sGpuBuffer = add_buffer("GPU");
+	}
+	push(*sGpuBuffer, { name, nullptr, start, end, 0.0 });
+}
+
+void fprofiler::record_counter(const char* name, const char* series, double value)
+{
+	int64_t now = now_ns();
+	push(own_buffer(), { name, series, now, now, value });
+}
+
+size_t fprofiler::write_trace(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file) {
+		throw std::runtime_error("Could not write the trace " + path);
+	}
+	std::lock_guard<std::mutex> lock(sMutex);
+	size_t eventCount = 0;
+	uint64_t lostEvents = 0;
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+	bool first = true;
+	for (auto& buffer : sBuffers) {
+		file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->mThreadId
+			<< ",\"args\":{\"name\":\"" << buffer->mName << "\"}}";
+		first = false;
+
+		uint64_t written = buffer->mWritten.load(std::memory_order_acquire);
+		uint64_t begin = glm::max(buffer->mDumped, (written > FPROFILE_BUFFER_EVENTS / 2) ? written - FPROFILE_BUFFER_EVENTS / 2 : uint64_t(0));
+		lostEvents += begin - buffer->mDumped;
+		for (uint64_t i = begin; i < written; ++i) {
+			const event& e = buffer->mEvents[i % FPROFILE_BUFFER_EVENTS];
+			//Complete events and counters with timestamps in microseconds
+			if (e.mSeries == nullptr) {
+				file << ",\n{\"name\":\"" << e.mName << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->mThreadId
+					<< ",\"ts\":" << double(e.mStart) / 1000.0 << ",\"dur\":" << double(e.mEnd - e.mStart) / 1000.0 << "}";
+			}
+			else {
+				file << ",\n{\"name\":\"" << e.mName << "\",\"ph\":\"C\",\"pid\":1,\"tid\":" << buffer->mThreadId
+					<< ",\"ts\":" << double(e.mStart) / 1000.0 << ",\"args\":{\"" << e.mSeries << "\":" << e.mValue << "}}";
+			}
+		}
+		eventCount += written - begin;
+		buffer->mDumped = written;
+	}
+	file << std::endl << "]}" << std::endl;
+	if (lostEvents > 0) {
+		LOG_WARNING("The profiler has overwritten " + std::to_string(lostEvents) + " events before they were written to " + path);
+	}
+	return eventCount;
+}
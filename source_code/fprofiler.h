@@ -0,0 +1,104 @@
+#pragma once
+#include "includes.h"
+
+#ifndef FPROFILE_ENABLED
+#define FPROFILE_ENABLED 1				//Compile-time switch for the FPROFILE_SCOPE instrumentation (0 = compiled out completely)
+#endif
+#define FPROFILE_BUFFER_EVENTS 65536	//Events per thread, older events are overwritten (about 2.5 MB per thread)
+
+/*
+Lightweight CPU profiler for the frame phases, with output in the Chrome trace event format (chrome://tracing, Perfetto).
+Code regions are instrumented with FPROFILE_SCOPE("name"), which records the time from the macro to the end of the scope.
+Every thread writes into its own ring buffer, which is registered once under a mutex on the thread's first event;
+recording itself takes no lock. The names must be string literals (only the pointers are stored).
+Recording is switched on and off at runtime with set_enabled. While disabled, a scope only reads an atomic flag;
+with FPROFILE_ENABLED 0 the macro expands to nothing.
+GPU timings (see fgputimer) go to a separate "GPU" track, statistics can be recorded as counters.
+write_trace can be called while other threads record: it writes the events since the last call, at most half a buffer per
+thread (the other half may be overwritten concurrently).
+*/
+class fprofiler {
+public:
+	//Measures the time of a scope, see FPROFILE_SCOPE
+	class scope {
+	public:
+		scope(const char* name) : mName(name), mStart(is_enabled() ? now_ns() : -1) {}
+		~scope() {
+			if (mStart >= 0) {
+				record(mName, mStart, now_ns());
+			}
+		}
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+	private:
+		const char* mName;
+		int64_t mStart;		//-1 = not recorded
+	};
+
+	//Starts or stops recording
+	static void set_enabled(bool enabled) {
+		sEnabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	static bool is_enabled() {
+		return sEnabled.load(std::memory_order_relaxed);
+	}
+
+	//Sets the name of the calling thread in the trace (e.g. "Main", "Worker 3"). Does not register a buffer.
+	static void set_thread_name(const std::string& name);
+
+	//Records a GPU interval on the GPU track (times on the profiler's clock). Must only be called from one thread.
+	static void record_gpu(const char* name, int64_t start, int64_t end);
+
+	//Records the value of a series of a counter at the current time on the calling thread (shown as graph in the trace)
+	static void record_counter(const char* name, const char* series, double value);
+
+	//Writes the events recorded since the last call as Chrome trace JSON. Returns the number of written events.
+	//Throws a runtime_error if the file cannot be written.
+	static size_t write_trace(const std::string& path);
+
+	//Time in ns since the start of the profiler
+	static int64_t now_ns();
+
+private:
+	struct event {
+		const char* mName;
+		const char* mSeries;	//nullptr = interval, otherwise a counter value
+		int64_t mStart;			//ns
+		int64_t mEnd;			//ns
+		double mValue;			//Value of a counter
+	};
+
+	struct thread_buffer {
+		std::vector<event> mEvents = std::vector<event>(FPROFILE_BUFFER_EVENTS);
+		std::atomic<uint64_t> mWritten = 0;	//Number of events recorded so far (the ring buffer index is mWritten % FPROFILE_BUFFER_EVENTS)
+		uint64_t mDumped = 0;				//Value of mWritten at the last write_trace
+		uint32_t mThreadId = 0;
+		std::string mName;
+	};
+
+	static std::atomic<bool> sEnabled;
+	static std::mutex sMutex;									//Protects sBuffers and the thread names
+	static std::vector<std::unique_ptr<thread_buffer>> sBuffers;	//All buffers (they are kept after their threads have ended)
+	static thread_local thread_buffer* tOwnBuffer;				//Buffer of the calling thread, nullptr until its first event
+	static thread_local std::string tThreadName;				//Name of the calling thread, used when its buffer is registered
+	static thread_buffer* sGpuBuffer;							//Buffer of the GPU track, nullptr until the first GPU event
+
+	static void record(const char* name, int64_t start, int64_t end);
+	static void push(thread_buffer& buffer, const event& e);
+
+	//Registers a new buffer (sMutex has to be locked)
+	static thread_buffer* add_buffer(const std::string& name);
+
+	//Returns the calling thread's buffer, registers it on the first call
+	static thread_buffer& own_buffer();
+};
+
+#if FPROFILE_ENABLED
+#define FPROFILE_CONCAT_INNER(a, b) a##b
+#define FPROFILE_CONCAT(a, b) FPROFILE_CONCAT_INNER(a, b)
+//Records the time until the end of the current scope under the given name (a string literal)
+#define FPROFILE_SCOPE(name) fprofiler::scope FPROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define FPROFILE_SCOPE(name)
+#endif
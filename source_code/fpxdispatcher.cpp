@@ -0,0 +1,23 @@
+#include "includes.h"
+
+void fpxdispatcher::submitTask(physx::PxBaseTask& task)
+{
+	//PhysX blocks in fetchResults without helping, so without workers nobody would execute the tasks
+	if (mInline || mJobSystem.worker_count() == 0) {
+		FPROFILE_SCOPE(task.getName());
+		task.run();
+		task.release();
+		return;
+	}
+	physx::PxBaseTask* pxTask = &task;
+	mJobSystem.submit([pxTask]() {
+		FPROFILE_SCOPE(pxTask->getName());
+		pxTask->run();
+		pxTask->release();
+	});
+}
+
+uint32_t fpxdispatcher::getWorkerCount() const
+{
+	return mInline ? 1u : static_cast<uint32_t>(glm::max(mJobSystem.worker_count(), size_t(1)));
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "includes.h"
+
+/*
+PhysX CPU dispatcher running the PhysX tasks on the engine-wide job system instead of PhysX' own worker threads.
+In inline mode (or if the job system has no workers), tasks are executed directly in submitTask.
+*/
+class fpxdispatcher : public physx::PxCpuDispatcher {
+public:
+	fpxdispatcher(fjobsystem& jobSystem, bool runInline = false) : mJobSystem(jobSystem), mInline(runInline) {}
+
+	//Called by PhysX for every task that is ready to run
+	void submitTask(physx::PxBaseTask& task) override;
+
+	//Number of threads PhysX may use in parallel
+	uint32_t getWorkerCount() const override;
+
+private:
+	fjobsystem& mJobSystem;
+	bool mInline;
+};
@@ -4,25 +4,49 @@ void frenderer::initialize()
 {
 	// Create a descriptor cache that helps us to conveniently create descriptor sets:
 	mDescriptorCache = gvk::context().create_descriptor_cache();
+	//The default depth has to fit into the device's limit as well
+	set_max_recursion_depth(mMaxRecursionDepth);
 	
-	//Create Focus Hit Buffer
+	//Create Focus Hit Buffers and ray counters, one per focus query slot
 	uint32_t initialfocushit = 0;
-	size_t n = gvk::context().main_window()->number_of_frames_in_flight();
-	mFocusHitBuffers.resize(n);
-	mFadeBuffers.resize(n);
-	for (int i = 0; i < n; ++i) {
-		mFocusHitBuffers[i] = gvk::context().create_buffer(
+	for (auto& slot : mFocusQuerySlots) {
+		slot.mHitBuffer = gvk::context().create_buffer(
 			avk::memory_usage::host_coherent, {},
 			avk::storage_buffer_meta::create_from_size(sizeof(uint32_t))
 		);
-		mFocusHitBuffers[i]->fill(&initialfocushit, 0, avk::sync::not_required());
+		slot.mHitBuffer->fill(&initialfocushit, 0, avk::sync::not_required());
+		slot.mRayCounterBuffer = gvk::context().create_buffer(
+			avk::memory_usage::host_coherent, {},
+			avk::storage_buffer_meta::create_from_size(sizeof(ray_counts<uint32_t>))
+		);
+		slot.mRayCounterBuffer->fill(&mFocusQueryRayCounts, 0, avk::sync::not_required());
+	}
 
+	size_t n = gvk::context().main_window()->number_of_frames_in_flight();
+	mFadeBuffers.resize(n);
+	mRayCounterBuffers.resize(n);
+	mRayCounterGenerations.resize(n, UINT32_MAX);
+	mRayBudgetBuffers.resize(n);
+	for (int i = 0; i < n; ++i) {
 		mFadeBuffers[i] = gvk::context().create_buffer(
 			avk::memory_usage::host_coherent, {},
 			avk::uniform_buffer_meta::create_from_size(sizeof(float))
 		);
 		mFadeBuffers[i]->fill(&fadeValue, 0, avk::sync::not_required());
+
+		mRayCounterBuffers[i] = gvk::context().create_buffer(
+			avk::memory_usage::host_coherent, {},
+			avk::storage_buffer_meta::create_from_size(sizeof(ray_counts<uint32_t>))
+		);
+		mRayCounterBuffers[i]->fill(&mRayCounts, 0, avk::sync::not_required());
+
+		mRayBudgetBuffers[i] = gvk::context().create_buffer(
+			avk::memory_usage::host_coherent, {},
+			avk::uniform_buffer_meta::create_from_data(mRayBudget)
+		);
+		mRayBudgetBuffers[i]->fill(&mRayBudget, 0, avk::sync::not_required());
 	}
+	mGpuTimer.initialize(mQueue, n);
 
 	// Create offscreen image views to ray-trace into, one for each frame in flight:
 	mOffscreenImageViews.reserve(n);
@@ -39,36 +63,125 @@ void frenderer::initialize()
 		assert((mOffscreenImageViews.back()->create_info().subresourceRange.aspectMask & vk::ImageAspectFlagBits::eColor) == vk::ImageAspectFlagBits::eColor);
 	}
 
+	//The offscreen images are still needed as fallback. If the surface and the format support storage usage, the swap chain
+	//images have been created with storage usage as well (see main and swap_chain_supports_storage) and we can skip the copy.
+#if DIRECT_SWAPCHAIN_OUTPUT
+	auto formatProperties = gvk::context().physical_device().getFormatProperties(frmt);
+	mDirectOutputSupported = mSwapChainStorage && (formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage);
+	mDirectOutput = mDirectOutputSupported;
+	LOG_INFO(mDirectOutputSupported ? "Ray tracing directly into the swap chain images." : "Swap chain images do not support storage usage, using offscreen images.");
+#endif
+
 	create_descriptor_sets_for_scene();
 }
 
 void frenderer::update()
 {
+	FPROFILE_SCOPE("frenderer::update");
 	auto index = gvk::context().main_window()->in_flight_index_for_frame();
 
 	mFadeBuffers[index]->fill(&fadeValue, 0, avk::sync::not_required());
 
-	auto focushitcount = mFocusHitBuffers[index]->read<uint32_t>(0, avk::sync::not_required());
-	mLevelLogic->set_focus_hit_value(double(focushitcount) / double(gvk::context().main_window()->swap_chain_extent().width * gvk::context().main_window()->swap_chain_extent().height));
-	focushitcount = 0;
+	measure_frame_time();
+	poll_focus_queries();
+	mLevelLogic->set_focus_hit_value(mFocusHitValue);
+}
+
+void frenderer::measure_frame_time()
+{
+	int path = mDirectOutput ? 1 : 0;
+	mFrameTimeSum[path] += gvk::time().delta_time();
+	if (++mFrameTimeCount[path] % FRAME_TIME_LOG_INTERVAL != 0) {
+		return;
+	}
+	auto average = [this](int p) { return mFrameTimeCount[p] == 0 ? 0.0 : mFrameTimeSum[p] / mFrameTimeCount[p] * 1000.0; };
+	LOG_INFO("Average frame time: offscreen copy " + std::to_string(average(0)) + " ms (" + std::to_string(mFrameTimeCount[0]) + " frames), direct output "
+		+ std::to_string(average(1)) + " ms (" + std::to_string(mFrameTimeCount[1]) + " frames)");
+	for (const std::string& name : mGpuTimer.get_scope_names()) {
+		fgputimer::statistics stats = mGpuTimer.get_statistics(name);
+		LOG_INFO(name + ": min " + std::to_string(stats.mMin) + " ms, avg " + std::to_string(stats.mAverage) + " ms, p99 " + std::to_string(stats.mP99)
+			+ " ms (last " + std::to_string(stats.mFrames) + " frames)");
+	}
+	ray_counts<uint64_t> lastFrame;
+	lastFrame += mRayCounts;
+	LOG_INFO("Last frame: " + ray_counts_to_string(lastFrame, 1));
+	ray_counts<uint64_t> lastFocusQuery;
+	lastFocusQuery += mFocusQueryRayCounts;
+	LOG_INFO("Last focus query: " + ray_counts_to_string(lastFocusQuery, 1));
+}
+
+void frenderer::poll_focus_queries()
+{
+	//The focus query covers the focus region (a fraction of 2*FOCUS_REGION_SIZE x 2*FOCUS_REGION_SIZE*aspectRatio of the screen's
+	//extent in NDC) with resolution^2 rays. Scale its hit count to the fraction of the screen, such that the values stay the same
+	//as if every pixel in the focus region was counted.
+	auto extent = gvk::context().main_window()->swap_chain_extent();
+	double aspectRatio = double(extent.width) / double(extent.height);
+	double regionFraction = FOCUS_REGION_SIZE * glm::min(FOCUS_REGION_SIZE * aspectRatio, 1.0);
+
+	auto currentFrame = static_cast<int64_t>(gvk::context().main_window()->current_frame());
+	for (auto& slot : mFocusQuerySlots) {
+		if (!slot.mPending || gvk::context().device().getFenceStatus(slot.mFence->handle()) != vk::Result::eSuccess) {
+			continue;
+		}
+		slot.mPending = false;
+		slot.mCommandBuffer = avk::command_buffer{};
+
+		//Counts and results from before a scene change do not belong to the level
+		if (slot.mGeneration != mSceneGeneration) {
+			continue;
+		}
+		//Every completed query has been traced, even if a newer result is already known
+		slot.mRayCounterBuffer->read(&mFocusQueryRayCounts, 0, avk::sync::not_required());
+		mLevelFocusQueryRayCounts += mFocusQueryRayCounts;
+		++mLevelFocusQueries;
+		if (fprofiler::is_enabled()) {
+			uint64_t focusQueryRays = 0;
+			for (uint32_t count : mFocusQueryRayCounts.mRaysPerDepth) {
+				focusQueryRays += count;
+			}
+			fprofiler::record_counter("GPU rays", "focus query", double(focusQueryRays));
+		}
 
-	mFocusHitBuffers[index]->fill(&focushitcount, 0, avk::sync::not_required());
+		//Results older than the current one are of no use anymore
+		if (slot.mFrameId <= mFocusHitFrameId) {
+			continue;
+		}
+		auto focushitcount = slot.mHitBuffer->read<uint32_t>(0, avk::sync::not_required());
+		mFocusHitValue = double(focushitcount) / double(mFocusQueryResolution * mFocusQueryResolution) * regionFraction;
+		mFocusHitFrameId = slot.mFrameId;
+		mFocusReadbackLatencyFrames = currentFrame - slot.mFrameId;
+		mFocusReadbackLatencyMs = (glfwGetTime() - slot.mSubmitTime) * 1000.0;
+	}
 }
 
-void frenderer::render()
+void frenderer::submit_focus_query(size_t inFlightIndex)
 {
+	FPROFILE_SCOPE("frenderer focus query recording");
+	auto freeSlot = std::find_if(mFocusQuerySlots.begin(), mFocusQuerySlots.end(), [](const focus_query_slot& slot) { return !slot.mPending; });
+	if (freeSlot == mFocusQuerySlots.end()) {
+		//The GPU is lagging behind, keep using the last result
+		++mSkippedFocusQueries;
+		return;
+	}
+	auto& slot = *freeSlot;
 	auto mainWnd = gvk::context().main_window();
-	auto inFlightIndex = mainWnd->in_flight_index_for_frame();
-
-	//An alternative would be to record the command buffers in advance, that would however disable the push constants, 
-	//so we would need to use a uniform buffer for the camera matrix. And recording every frame shouldn't be too much anyway.
 
 	auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
 	auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-	
 	cmdbfr->begin_recording();
-	cmdbfr->bind_pipeline(avk::const_referenced(mPipeline));
-	cmdbfr->bind_descriptors(mPipeline->layout(), mDescriptorCache.get_or_create_descriptor_sets({
+	record_frame_start(*cmdbfr, inFlightIndex);
+
+	//Reset the hit count and the ray counters on the GPU, so that the CPU never has to touch a buffer that might still be in use
+	cmdbfr->handle().fillBuffer(slot.mHitBuffer->handle(), 0, sizeof(uint32_t), 0u);
+	cmdbfr->handle().fillBuffer(slot.mRayCounterBuffer->handle(), 0, sizeof(ray_counts<uint32_t>), 0u);
+	cmdbfr->establish_global_memory_barrier(
+		avk::pipeline_stage::transfer,                                  avk::pipeline_stage::ray_tracing_shaders,
+		avk::memory_access::transfer_write_access,                      avk::memory_access::shader_buffers_and_images_write_access
+	);
+
+	// Trace a small, fixed grid of rays through the focus region and count the focusphere hits
+	auto descriptorSets = mDescriptorCache.get_or_create_descriptor_sets({
 		avk::descriptor_binding(0, 0, mScene->get_model_buffer(inFlightIndex)),
 		avk::descriptor_binding(0, 1, mScene->get_material_buffer(inFlightIndex)),
 		avk::descriptor_binding(0, 2, mScene->get_light_buffer()),
@@ -81,41 +194,149 @@ void frenderer::render()
 		avk::descriptor_binding(2, 0, mScene->get_tlas()[inFlightIndex]),
 		avk::descriptor_binding(3, 0, mScene->get_background_buffer(inFlightIndex)),
 		avk::descriptor_binding(3, 1, mScene->get_gradient_buffer()),
-		avk::descriptor_binding(4, 0, mFocusHitBuffers[inFlightIndex]),
-		avk::descriptor_binding(5, 0, mFadeBuffers[inFlightIndex])
-	}));
-
-	// Set the push constants:
-	auto cameraTransform = mScene->get_camera().global_transformation_matrix();
-	cmdbfr->handle().pushConstants(mPipeline->layout_handle(), vk::ShaderStageFlagBits::eRaygenNV, 0, sizeof(cameraTransform), &cameraTransform);
-
-	//mPipeline->print_shader_binding_table_groups();
-	
-	// TRACE. THA. RAYZ.
+		avk::descriptor_binding(4, 0, slot.mHitBuffer),
+		avk::descriptor_binding(4, 1, slot.mRayCounterBuffer),
+		avk::descriptor_binding(5, 0, mFadeBuffers[inFlightIndex]),
+		avk::descriptor_binding(5, 1, mRayBudgetBuffers[inFlightIndex])
+	});
+	cmdbfr->bind_pipeline(avk::const_referenced(mFocusQueryPipeline));
+	cmdbfr->bind_descriptors(mFocusQueryPipeline->layout(), descriptorSets);
+	auto extent = mainWnd->swap_chain_extent();
+	focus_query_push_constants focusQueryConstants = { mScene->get_camera().global_transformation_matrix(), float(extent.width) / float(extent.height), mMaxRecursionDepth };
+	cmdbfr->handle().pushConstants(mFocusQueryPipeline->layout_handle(), vk::ShaderStageFlagBits::eRaygenNV, 0, sizeof(focusQueryConstants), &focusQueryConstants);
+	uint32_t timerScope = mGpuTimer.begin(*cmdbfr, inFlightIndex, "GPU focus query");
 	cmdbfr->trace_rays(
-		gvk::for_each_pixel(mainWnd),
-		mPipeline->shader_binding_table(),
+		vk::Extent3D{ mFocusQueryResolution, mFocusQueryResolution, 1u },
+		mFocusQueryPipeline->shader_binding_table(),
 		avk::using_raygen_group_at_index(0),
 		avk::using_miss_group_at_index(0),
 		avk::using_hit_group_at_index(0)
 	);
+	mGpuTimer.end(*cmdbfr, inFlightIndex, timerScope);
 
-	// Sync ray tracing with transfer:
+	// Make the hit count and the ray counters visible to the host once the fence is signalled:
 	cmdbfr->establish_global_memory_barrier(
-		avk::pipeline_stage::ray_tracing_shaders,                       avk::pipeline_stage::transfer,
-		avk::memory_access::shader_buffers_and_images_write_access,     avk::memory_access::transfer_read_access
+		avk::pipeline_stage::ray_tracing_shaders,                       avk::pipeline_stage::host,
+		avk::memory_access::shader_buffers_and_images_write_access,     avk::memory_access::host_read_access
 	);
+	cmdbfr->end_recording();
+
+	// No semaphores needed, the query does not touch the swap chain
+	slot.mFence = mQueue->submit_with_fence(*cmdbfr);
+	slot.mCommandBuffer = std::move(cmdbfr);
+	slot.mFrameId = static_cast<int64_t>(mainWnd->current_frame());
+	slot.mSubmitTime = glfwGetTime();
+	slot.mGeneration = mSceneGeneration;
+	slot.mPending = true;
+}
+
+void frenderer::render()
+{
+	FPROFILE_SCOPE("frenderer::render");
+	auto mainWnd = gvk::context().main_window();
+	auto inFlightIndex = mainWnd->in_flight_index_for_frame();
+
+	//The frame that used this in-flight index before has completed at this point, so its counters and timestamps can be read
+	read_ray_counters(inFlightIndex);
+	mRayCounterGenerations[inFlightIndex] = mSceneGeneration;
+	update_ray_budget(inFlightIndex);
+	mGpuTimer.read_results(inFlightIndex);
+	mFrameStartRecorded = false;
+
+	//An alternative would be to record the command buffers in advance, that would however disable the push constants, 
+	//so we would need to use a uniform buffer for the camera matrix. And recording every frame shouldn't be too much anyway.
+
+	// The focus query is submitted first and separately, so that its result is available as early as possible
+	submit_focus_query(inFlightIndex);
 
-	mainWnd->current_backbuffer()->image_view_at(0)->get_image().set_target_layout(vk::ImageLayout::ePresentSrcKHR);
-	avk::copy_image_to_another(mOffscreenImageViews[inFlightIndex]->get_image(), mainWnd->current_backbuffer()->image_view_at(0)->get_image(), avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {}));
+	auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
+	auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 	
-	// Make sure to properly sync with ImGui manager which comes afterwards (it uses a graphics pipeline):
-	cmdbfr->establish_global_memory_barrier(
-		avk::pipeline_stage::transfer,                                  avk::pipeline_stage::color_attachment_output,
-		avk::memory_access::transfer_write_access,                      avk::memory_access::color_attachment_write_access
-	);
+	{
+		FPROFILE_SCOPE("frenderer command recording");
+		cmdbfr->begin_recording();
+		record_frame_start(*cmdbfr, inFlightIndex);
+		auto& backbufferView = mainWnd->current_backbuffer()->image_view_at(0);
+		auto& backbufferImage = backbufferView->get_image();
+		//A captured frame is read from the offscreen image
+		bool directOutput = mDirectOutput && mCapturePath.empty();
+		if (directOutput) {
+			// The ray generation shader writes into the swap chain image, which has to be in general layout for that
+			backbufferImage.transition_to_layout(vk::ImageLayout::eGeneral, avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {}));
+		}
+		auto descriptorSets = mDescriptorCache.get_or_create_descriptor_sets({
+			avk::descriptor_binding(0, 0, mScene->get_model_buffer(inFlightIndex)),
+			avk::descriptor_binding(0, 1, mScene->get_material_buffer(inFlightIndex)),
+			avk::descriptor_binding(0, 2, mScene->get_light_buffer()),
+			avk::descriptor_binding(0, 3, mScene->get_image_samplers()),
+			avk::descriptor_binding(6, 0, mScene->get_index_buffer_views()),
+			avk::descriptor_binding(0, 5, mScene->get_texcoord_buffer_views()),
+			avk::descriptor_binding(0, 6, mScene->get_normal_buffer_views()),
+			avk::descriptor_binding(0, 7, mScene->get_tangent_buffer_views()),
+			avk::descriptor_binding(1, 0, directOutput ? backbufferView->as_storage_image() : mOffscreenImageViews[inFlightIndex]->as_storage_image()),
+			avk::descriptor_binding(2, 0, mScene->get_tlas()[inFlightIndex]),
+			avk::descriptor_binding(3, 0, mScene->get_background_buffer(inFlightIndex)),
+			avk::descriptor_binding(3, 1, mScene->get_gradient_buffer()),
+			avk::descriptor_binding(4, 0, mFocusQuerySlots[0].mHitBuffer),	// Not used by the main pipeline, but both pipelines share the layout
+			avk::descriptor_binding(4, 1, mRayCounterBuffers[inFlightIndex]),
+			avk::descriptor_binding(5, 0, mFadeBuffers[inFlightIndex]),
+			avk::descriptor_binding(5, 1, mRayBudgetBuffers[inFlightIndex])
+		});
+		auto cameraTransform = mScene->get_camera().global_transformation_matrix();
+
+		// Render the image
+		cmdbfr->bind_pipeline(avk::const_referenced(mPipeline));
+		cmdbfr->bind_descriptors(mPipeline->layout(), descriptorSets);
+
+		// Set the push constants:
+		cmdbfr->handle().pushConstants(mPipeline->layout_handle(), vk::ShaderStageFlagBits::eRaygenNV, 0, sizeof(cameraTransform), &cameraTransform);
+
+		//mPipeline->print_shader_binding_table_groups();
 	
-	cmdbfr->end_recording();
+		// TRACE. THA. RAYZ.
+		uint32_t timerScope = mGpuTimer.begin(*cmdbfr, inFlightIndex, "GPU ray tracing");
+		cmdbfr->trace_rays(
+			gvk::for_each_pixel(mainWnd),
+			mPipeline->shader_binding_table(),
+			avk::using_raygen_group_at_index(0),
+			avk::using_miss_group_at_index(0),
+			avk::using_hit_group_at_index(0)
+		);
+		mGpuTimer.end(*cmdbfr, inFlightIndex, timerScope);
+
+		if (directOutput) {
+			backbufferImage.transition_to_layout(vk::ImageLayout::ePresentSrcKHR, avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {}));
+
+			// Make sure to properly sync with ImGui manager which comes afterwards (it uses a graphics pipeline):
+			cmdbfr->establish_global_memory_barrier(
+				avk::pipeline_stage::ray_tracing_shaders,                       avk::pipeline_stage::color_attachment_output,
+				avk::memory_access::shader_buffers_and_images_write_access,     avk::memory_access::color_attachment_write_access
+			);
+		}
+		else {
+			// Sync ray tracing with transfer:
+			cmdbfr->establish_global_memory_barrier(
+				avk::pipeline_stage::ray_tracing_shaders,                       avk::pipeline_stage::transfer,
+				avk::memory_access::shader_buffers_and_images_write_access,     avk::memory_access::transfer_read_access
+			);
+			if (!mCapturePath.empty()) {
+				record_capture(*cmdbfr, inFlightIndex);
+			}
+
+			backbufferImage.set_target_layout(vk::ImageLayout::ePresentSrcKHR);
+			timerScope = mGpuTimer.begin(*cmdbfr, inFlightIndex, "GPU copy to back buffer");
+			avk::copy_image_to_another(mOffscreenImageViews[inFlightIndex]->get_image(), backbufferImage, avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {}));
+			mGpuTimer.end(*cmdbfr, inFlightIndex, timerScope);
+
+			// Make sure to properly sync with ImGui manager which comes afterwards (it uses a graphics pipeline):
+			cmdbfr->establish_global_memory_barrier(
+				avk::pipeline_stage::transfer,                                  avk::pipeline_stage::color_attachment_output,
+				avk::memory_access::transfer_write_access,                      avk::memory_access::color_attachment_write_access
+			);
+		}
+	
+		cmdbfr->end_recording();
+	}
 
 	// The swap chain provides us with an "image available semaphore" for the current frame.
 	// Only after the swapchain image has become available, we may start rendering into it.
@@ -124,11 +345,72 @@ void frenderer::render()
 	// Submit the draw call and take care of the command buffer's lifetime:
 	mQueue->submit(cmdbfr, imageAvailableSemaphore);
 	mainWnd->handle_lifetime(std::move(cmdbfr));
+
+	if (!mCapturePath.empty()) {
+		write_capture();
+	}
+}
+
+void frenderer::record_capture(avk::command_buffer_t& cmd, size_t inFlightIndex)
+{
+	//Only 8-bit RGBA/BGRA images can be written as PPM without conversion
+	auto format = gvk::format_from_window_color_buffer(gvk::context().main_window());
+	if (format != vk::Format::eB8G8R8A8Unorm && format != vk::Format::eR8G8B8A8Unorm) {
+		LOG_WARNING("Cannot capture frames of format " + vk::to_string(format) + ", only B8G8R8A8Unorm and R8G8B8A8Unorm are supported.");
+		mCapturePath.clear();
+		return;
+	}
+	auto resolution = gvk::context().main_window()->resolution();
+	mCaptureBuffer = gvk::context().create_buffer(
+		avk::memory_usage::host_coherent, vk::BufferUsageFlagBits::eTransferDst,
+		avk::generic_buffer_meta::create_from_size(size_t(resolution.x) * resolution.y * 4)
+	);
+	//The ray generation shader has written the offscreen image in general layout
+	vk::BufferImageCopy region(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), vk::Offset3D(0, 0, 0), vk::Extent3D(resolution.x, resolution.y, 1));
+	cmd.handle().copyImageToBuffer(mOffscreenImageViews[inFlightIndex]->get_image().handle(), vk::ImageLayout::eGeneral, mCaptureBuffer->handle(), region);
+	cmd.establish_global_memory_barrier(
+		avk::pipeline_stage::transfer,                                  avk::pipeline_stage::host,
+		avk::memory_access::transfer_write_access,                      avk::memory_access::host_read_access
+	);
+}
+
+void frenderer::write_capture()
+{
+	//A capture is not part of the normal frame flow, so stalling here is fine
+	gvk::context().device().waitIdle();
+	auto resolution = gvk::context().main_window()->resolution();
+	std::vector<glm::u8vec4> texels(size_t(resolution.x) * resolution.y);
+	mCaptureBuffer->read(texels.data(), 0, avk::sync::not_required());
+	bool bgra = gvk::format_from_window_color_buffer(gvk::context().main_window()) == vk::Format::eB8G8R8A8Unorm;
+	fimage image(resolution.x, resolution.y);
+	for (size_t i = 0; i < texels.size(); ++i) {
+		image.mPixels[i] = bgra ? glm::u8vec3(texels[i].z, texels[i].y, texels[i].x) : glm::u8vec3(texels[i]);
+	}
+	image.save_ppm(mCapturePath);
+	LOG_INFO("Captured the frame to " + mCapturePath);
+	mCapturePath.clear();
+	mCaptureBuffer = avk::buffer{};
+}
+
+void frenderer::record_frame_start(avk::command_buffer_t& cmd, size_t inFlightIndex)
+{
+	if (mFrameStartRecorded) {
+		return;
+	}
+	mFrameStartRecorded = true;
+	mGpuTimer.begin_frame(cmd, inFlightIndex, static_cast<int64_t>(gvk::context().main_window()->current_frame()));
+	uint32_t timerScope = mGpuTimer.begin(cmd, inFlightIndex, "GPU TLAS update");
+	mScene->record_tlas_update(cmd, inFlightIndex);
+	mGpuTimer.end(cmd, inFlightIndex, timerScope);
 }
 
 void frenderer::set_scene(fscene* scene)
 {
 	mScene = scene;
+	log_level_ray_counts();
+	//Pending focus queries and ray counters still belong to the old scene
+	++mSceneGeneration;
+	mFocusHitValue = 0.0;
 	if (mOffscreenImageViews.size() > 0) {
 		//only if already initalized
 		create_descriptor_sets_for_scene();
@@ -162,7 +444,193 @@ void frenderer::create_descriptor_sets_for_scene()
 		avk::descriptor_binding(2, 0, mScene->get_tlas()[0]),				// Just take any, this is just to define the layout
 		avk::descriptor_binding(3, 0, mScene->get_background_buffer(0)),	// Just take any, this is just to define the layout
 		avk::descriptor_binding(3, 1, mScene->get_gradient_buffer()),
-		avk::descriptor_binding(4, 0, mFocusHitBuffers[0]),				// Just take any, this is just to define the layout
-		avk::descriptor_binding(5, 0, mFadeBuffers[0])						// Just take any, this is just to define the layout
+		avk::descriptor_binding(4, 0, mFocusQuerySlots[0].mHitBuffer),	// Just take any, this is just to define the layout (only used by the focus query)
+		avk::descriptor_binding(4, 1, mRayCounterBuffers[0]),				// Just take any, this is just to define the layout
+		avk::descriptor_binding(5, 0, mFadeBuffers[0]),						// Just take any, this is just to define the layout
+		avk::descriptor_binding(5, 1, mRayBudgetBuffers[0])				// Just take any, this is just to define the layout
 	);
+
+	//The focus query uses the same shader table layout as the main pipeline (such that the instance offsets of the leaves stay valid),
+	//but only follows mirror reflections and does no shading at all
+	mFocusQueryPipeline = gvk::context().create_ray_tracing_pipeline_for(
+		avk::define_shader_table(
+			avk::ray_generation_shader("shaders/focusquery.rgen.spv"),
+			avk::triangles_hit_group::create_with_rahit_and_rchit("shaders/default.rahit.spv", "shaders/focusquery.rchit.spv"),
+			avk::triangles_hit_group::create_with_rahit_and_rchit("shaders/shadowray.rahit.spv", "shaders/shadowray.rchit.spv"),
+			avk::miss_shader("shaders/focusquery.rmiss.spv"),
+			avk::miss_shader("shaders/shadowray.rmiss.spv"),
+			avk::triangles_hit_group::create_with_rahit_and_rchit("shaders/leaves.rahit.spv", "shaders/focusquery.rchit.spv"),
+			avk::triangles_hit_group::create_with_rahit_and_rchit("shaders/leaves.rahit.spv", "shaders/shadowray.rchit.spv")
+		),
+		gvk::context().get_max_ray_tracing_recursion_depth(),
+		avk::push_constant_binding_data{ avk::shader_type::ray_generation, 0, sizeof(focus_query_push_constants) },
+		avk::descriptor_binding(0, 0, mScene->get_model_buffer(0)),
+		avk::descriptor_binding(0, 1, mScene->get_material_buffer(0)),
+		avk::descriptor_binding(0, 2, mScene->get_light_buffer()),
+		avk::descriptor_binding(0, 3, mScene->get_image_samplers()),
+		avk::descriptor_binding(6, 0, mScene->get_index_buffer_views()),
+		avk::descriptor_binding(0, 5, mScene->get_texcoord_buffer_views()),
+		avk::descriptor_binding(0, 6, mScene->get_normal_buffer_views()),
+		avk::descriptor_binding(0, 7, mScene->get_tangent_buffer_views()),
+		avk::descriptor_binding(1, 0, mOffscreenImageViews[0]->as_storage_image()),
+		avk::descriptor_binding(2, 0, mScene->get_tlas()[0]),
+		avk::descriptor_binding(3, 0, mScene->get_background_buffer(0)),
+		avk::descriptor_binding(3, 1, mScene->get_gradient_buffer()),
+		avk::descriptor_binding(4, 0, mFocusQuerySlots[0].mHitBuffer),
+		avk::descriptor_binding(4, 1, mFocusQuerySlots[0].mRayCounterBuffer),
+		avk::descriptor_binding(5, 0, mFadeBuffers[0]),
+		avk::descriptor_binding(5, 1, mRayBudgetBuffers[0])
+	);
+}
+
+void frenderer::read_ray_counters(size_t inFlightIndex)
+{
+	mRayCounterBuffers[inFlightIndex]->read(&mRayCounts, 0, avk::sync::not_required());
+	ray_counts<uint32_t> zeros;
+	mRayCounterBuffers[inFlightIndex]->fill(&zeros, 0, avk::sync::not_required());
+
+	//Counters of frames from before a scene change (or of no frame at all) do not belong to the level
+	if (mRayCounterGenerations[inFlightIndex] != mSceneGeneration) {
+		return;
+	}
+	mLevelRayCounts += mRayCounts;
+	++mLevelFrames;
+
+	if (fprofiler::is_enabled()) {
+		uint64_t reflectionRays = 0;
+		for (size_t depth = 1; depth < RAY_DEPTH_COUNTERS; ++depth) {
+			reflectionRays += mRayCounts.mRaysPerDepth[depth];
+		}
+		fprofiler::record_counter("GPU rays", "primary", mRayCounts.mRaysPerDepth[0]);
+		fprofiler::record_counter("GPU rays", "reflection", double(reflectionRays));
+#if RAY_STATISTICS
+		fprofiler::record_counter("GPU rays", "shadow", mRayCounts.mShadowRays);
+		fprofiler::record_counter("GPU shader invocations", "closest hit", double(mRayCounts.mClosestHits + mRayCounts.mLeavesClosestHits + mRayCounts.mShadowClosestHits));
+		fprofiler::record_counter("GPU shader invocations", "any hit", double(mRayCounts.mAnyHits + mRayCounts.mLeavesAnyHits + mRayCounts.mShadowAnyHits));
+		fprofiler::record_counter("GPU shader invocations", "miss", double(mRayCounts.mMisses + mRayCounts.mShadowMisses));
+#endif
+	}
+}
+
+bool frenderer::swap_chain_supports_storage(GLFWwindow* window)
+{
+	uint32_t extensionCount = 0;
+	const char** extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+	if (extensions == nullptr) {
+		return false;
+	}
+	vk::ApplicationInfo applicationInfo("Focus! swap chain check", 1, nullptr, 0, VK_API_VERSION_1_2);
+	vk::UniqueInstance instance = vk::createInstanceUnique(vk::InstanceCreateInfo({}, &applicationInfo, 0, nullptr, extensionCount, extensions));
+	VkSurfaceKHR surface;
+	if (glfwCreateWindowSurface(instance.get(), window, nullptr, &surface) != VK_SUCCESS) {
+		return false;
+	}
+#if VK_HEADER_VERSION >= 162
+	const std::string rayTracingExtension = VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME;
+#else
+	const std::string rayTracingExtension = VK_KHR_RAY_TRACING_EXTENSION_NAME;
+#endif
+	//gvk picks the device later, so every device it could pick has to support storage usage
+	bool supported = false;
+	for (const vk::PhysicalDevice& device : instance->enumeratePhysicalDevices()) {
+		auto deviceExtensions = device.enumerateDeviceExtensionProperties();
+		bool rayTracing = std::any_of(deviceExtensions.begin(), deviceExtensions.end(), [&rayTracingExtension](const vk::ExtensionProperties& e) {
+			return rayTracingExtension == e.extensionName;
+		});
+		if (!rayTracing) {
+			continue;
+		}
+		bool deviceSupported = static_cast<bool>(device.getSurfaceCapabilitiesKHR(surface).supportedUsageFlags & vk::ImageUsageFlagBits::eStorage);
+		for (const vk::SurfaceFormatKHR& format : device.getSurfaceFormatsKHR(surface)) {
+			bool srgb = format.format == vk::Format::eB8G8R8A8Srgb || format.format == vk::Format::eR8G8B8A8Srgb || format.format == vk::Format::eA8B8G8R8SrgbPack32;
+			if (!srgb && !(device.getFormatProperties(format.format).optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage)) {
+				deviceSupported = false;
+			}
+		}
+		if (!deviceSupported) {
+			supported = false;
+			break;
+		}
+		supported = true;
+	}
+	instance->destroySurfaceKHR(surface);
+	return supported;
+}
+
+void frenderer::set_max_recursion_depth(uint32_t depth)
+{
+	uint32_t deviceLimit = gvk::context().get_max_ray_tracing_recursion_depth();
+	uint32_t maxDepth = (deviceLimit > 2) ? deviceLimit - 2 : 0;
+	if (depth > maxDepth) {
+		LOG_WARNING("Reflection recursion depth " + std::to_string(depth) + " exceeds the device's ray tracing recursion limit of "
+			+ std::to_string(deviceLimit) + ", using " + std::to_string(maxDepth));
+		depth = maxDepth;
+	}
+	mMaxRecursionDepth = depth;
+	mRayBudget.mFocusDepth = depth;
+	mRayBudget.mPeripheryDepth = depth;
+}
+
+std::string frenderer::ray_counts_to_string(const ray_counts<uint64_t>& counts, uint64_t frames)
+{
+	auto average = [frames](uint64_t count) { return std::to_string(frames == 0 ? 0 : (count + frames / 2) / frames); };
+	uint64_t reflectionRays = 0;
+	for (size_t depth = 1; depth < RAY_DEPTH_COUNTERS; ++depth) {
+		reflectionRays += counts.mRaysPerDepth[depth];
+	}
+	std::string text = "primary " + average(counts.mRaysPerDepth[0]) + ", reflection " + average(reflectionRays);
+#if RAY_STATISTICS
+	text += ", shadow " + average(counts.mShadowRays) + " rays; closest hit " + average(counts.mClosestHits) + " (leaves " + average(counts.mLeavesClosestHits)
+		+ ", shadow " + average(counts.mShadowClosestHits) + "), any hit " + average(counts.mAnyHits) + " (leaves " + average(counts.mLeavesAnyHits)
+		+ ", shadow " + average(counts.mShadowAnyHits) + "), miss " + average(counts.mMisses) + " (shadow " + average(counts.mShadowMisses) + ") invocations";
+#else
+	text += " rays";
+#endif
+	return text;
+}
+
+void frenderer::log_level_ray_counts()
+{
+	if (mLevelFrames > 0) {
+		LOG_INFO("Average per frame of the level (" + std::to_string(mLevelFrames) + " frames): " + ray_counts_to_string(mLevelRayCounts, mLevelFrames));
+	}
+	if (mLevelFocusQueries > 0) {
+		LOG_INFO("Average per focus query of the level (" + std::to_string(mLevelFocusQueries) + " queries): " + ray_counts_to_string(mLevelFocusQueryRayCounts, mLevelFocusQueries));
+	}
+	mLevelRayCounts = ray_counts<uint64_t>();
+	mLevelFrames = 0;
+	mLevelFocusQueryRayCounts = ray_counts<uint64_t>();
+	mLevelFocusQueries = 0;
+}
+
+void frenderer::update_ray_budget(size_t inFlightIndex)
+{
+	uint64_t totalRays = 0;
+	for (uint32_t count : mRayCounts.mRaysPerDepth) {
+		totalRays += count;
+	}
+
+	if (mRaysPerFrameBudget == 0) {
+		mRayBudget.mPeripheryDepth = mMaxRecursionDepth;
+	}
+	else if (mBudgetCooldown > 0) {
+		--mBudgetCooldown;
+	}
+	else {
+		uint32_t depth = mRayBudget.mPeripheryDepth;
+		//Over budget -> Remove the deepest bounce in the periphery
+		if (totalRays > mRaysPerFrameBudget && depth > 0) {
+			--depth;
+		}
+		//The next bounce can have at most as many rays as the current deepest one -> Increase only if that still fits
+		else if (depth < mMaxRecursionDepth && totalRays + mRayCounts.mRaysPerDepth[glm::min(depth, uint32_t(RAY_DEPTH_COUNTERS - 1))] <= mRaysPerFrameBudget) {
+			++depth;
+		}
+		if (depth != mRayBudget.mPeripheryDepth) {
+			mRayBudget.mPeripheryDepth = depth;
+			mBudgetCooldown = static_cast<uint32_t>(gvk::context().main_window()->number_of_frames_in_flight());
+		}
+	}
+
+	mRayBudgetBuffers[inFlightIndex]->fill(&mRayBudget, 0, avk::sync::not_required());
 }
@@ -1,9 +1,22 @@
 #pragma once
 #include "includes.h"
+#define RAY_DEPTH_COUNTERS 8		//Number of bounce depths counted in the ray counter buffer (must match the shaders)
+#define RAY_STATISTICS 1			//Count shadow rays and shader invocations in the ray counter buffer as well (must match the shaders)
+#define FOCUS_QUERY_RESOLUTION 64	//Default number of focus query rays per dimension
+#define FOCUS_REGION_SIZE 0.2		//Half size of the central focus region in normalized device coordinates (must match the shaders)
+#define FOCUS_QUERY_SLOTS 4			//Number of focus queries that can be in flight at the same time
+#define DIRECT_SWAPCHAIN_OUTPUT 1	//Request storage usage for the swap chain images, such that the image can be ray traced directly into them
+#define FRAME_TIME_LOG_INTERVAL 600	//Number of frames after which the average frame times of both output paths are logged
+#define DEFAULT_MAX_RECURSION_DEPTH 4	//Default maximum reflection depth (see set_max_recursion_depth)
+#define DEFAULT_MIN_THROUGHPUT 0.05f	//Default minimum reflection throughput outside the focus region (see set_min_reflection_throughput)
 
 /*
 Renderer class. Responsible for rendering the image and everything related to that (creating descriptor sets, command buffers etc.).
 Also manages the focus hit count buffer and the fade buffer.
+The focus hit value is computed by a separate, small ray tracing dispatch (the focus query), which traces a fixed grid of rays
+through the central focus region, so that the gameplay does not depend on the render resolution.
+The focus query is submitted on its own with a fence, so that its result can be read back as soon as it is available instead of
+waiting until the whole frame (and its in-flight index) has come around again. The newest completed result is always used.
 */
 class frenderer : public gvk::invokee {
 private:
@@ -13,12 +26,153 @@ private:
 	flevellogic* mLevelLogic = nullptr;
 
 	avk::ray_tracing_pipeline mPipeline;
+	avk::ray_tracing_pipeline mFocusQueryPipeline;
+	uint32_t mFocusQueryResolution = FOCUS_QUERY_RESOLUTION;	//Focus query rays per dimension
+
+	//Push constants of the focus query ray generation shader
+	struct focus_query_push_constants {
+		glm::mat4 mCameraTransform;
+		float mAspectRatio;
+		uint32_t mMaxDepth;
+	};
+	//A focus query submission. The hit count buffer and the command buffer must stay alive until the fence has been signalled.
+	//Every slot has its own ray counters, such that the query's rays and invocations are not mixed into the counts of the frames.
+	struct focus_query_slot {
+		avk::buffer mHitBuffer;
+		avk::buffer mRayCounterBuffer;
+		avk::fence mFence;
+		avk::command_buffer mCommandBuffer;
+		int64_t mFrameId = -1;			//Frame in which the query was submitted
+		double mSubmitTime = 0.0;		//CPU time of the submission
+		uint32_t mGeneration = 0;		//Scene generation the query was traced in
+		bool mPending = false;
+	};
+	std::array<focus_query_slot, FOCUS_QUERY_SLOTS> mFocusQuerySlots;
+	uint32_t mSceneGeneration = 0;				//Increased with every scene change, results of older queries are dropped
+	double mFocusHitValue = 0.0;				//Newest completed focus hit value
+	int64_t mFocusHitFrameId = -1;				//Frame in which the newest completed focus query was submitted
+	int64_t mFocusReadbackLatencyFrames = 0;	//Frames between submission and readback of the newest completed focus query
+	double mFocusReadbackLatencyMs = 0.0;		//Time between submission and readback of the newest completed focus query
+	uint32_t mSkippedFocusQueries = 0;			//Number of frames without a focus query, because all slots were still pending
+
+	//Reads back all completed focus queries without blocking and keeps the newest result
+	void poll_focus_queries();
+	//Records and submits the focus query for the current frame into a free slot
+	void submit_focus_query(size_t inFlightIndex);
+
 	//We need each of the following several times, as we have several frames in flight
 	std::vector<avk::image_view> mOffscreenImageViews;
-	std::vector<avk::buffer> mFocusHitBuffers;
 	std::vector<avk::buffer> mFadeBuffers;
+	std::vector<avk::buffer> mRayCounterBuffers;
+	std::vector<avk::buffer> mRayBudgetBuffers;
 	float fadeValue = 0.0f;
 
+	bool mSwapChainStorage = false;				//Whether the swap chain images have been requested with storage usage
+	bool mDirectOutputSupported = false;		//Whether the swap chain images can be written as storage images
+	bool mDirectOutput = false;					//Trace directly into the swap chain image instead of copying the offscreen image into it
+	std::array<double, 2> mFrameTimeSum = {};	//Accumulated frame times per output path (0 = offscreen copy, 1 = direct)
+	std::array<uint32_t, 2> mFrameTimeCount = {};	//Number of accumulated frames per output path
+
+	//Accumulates the frame time of the current output path and logs the averages of both paths regularly
+	void measure_frame_time();
+
+	std::string mCapturePath;					//PPM file that the next frame is written to ("" = no capture)
+	avk::buffer mCaptureBuffer;					//Host readable copy of the captured offscreen image
+
+	//Records the copy of the offscreen image into mCaptureBuffer (after the ray tracing has written it)
+	void record_capture(avk::command_buffer_t& cmd, size_t inFlightIndex);
+	//Waits for the captured frame and writes it to mCapturePath
+	void write_capture();
+
+	//Reflection recursion budget (mirrored in the shaders' RayBudget uniform)
+	struct ray_budget_gpu_data {
+		uint32_t mFocusDepth;		//Maximum reflection depth inside the central focus region (never lowered)
+		uint32_t mPeripheryDepth;	//Maximum reflection depth outside the focus region
+		float mMinThroughput;		//Minimum accumulated throughput for reflections outside the focus region
+		uint32_t mPadding = 0;
+	};
+	ray_budget_gpu_data mRayBudget = { DEFAULT_MAX_RECURSION_DEPTH, DEFAULT_MAX_RECURSION_DEPTH, DEFAULT_MIN_THROUGHPUT };
+	uint32_t mMaxRecursionDepth = DEFAULT_MAX_RECURSION_DEPTH;	//Recursion depth used when the budget is not exceeded
+	uint64_t mRaysPerFrameBudget = 0;			//Global ray budget per frame, 0 = unlimited
+	uint32_t mBudgetCooldown = 0;				//Frames to wait until the effects of the last depth change are visible in the counters
+
+	//Adapts the periphery recursion depth to the global ray budget, using the counters of the last completed frame
+	void update_ray_budget(size_t inFlightIndex);
+
+public:
+	//Ray and shader invocation counts (the layout of the shaders' RayCounters buffer with T = uint32_t).
+	//The focus query counts into its own buffers, of its invocations only the any-hit ones are counted (with RAY_STATISTICS).
+	template <typename T>
+	struct ray_counts {
+		std::array<T, RAY_DEPTH_COUNTERS> mRaysPerDepth = {};	//Rays per bounce depth (0 = primary rays)
+		T mShadowRays = 0;			//The counts below stay 0 without RAY_STATISTICS
+		T mClosestHits = 0;			//Invocations of default.rchit
+		T mLeavesClosestHits = 0;	//Invocations of leaves.rchit
+		T mShadowClosestHits = 0;	//Invocations of shadowray.rchit
+		T mAnyHits = 0;				//Invocations of default.rahit
+		T mLeavesAnyHits = 0;		//Invocations of leaves.rahit
+		T mShadowAnyHits = 0;		//Invocations of shadowray.rahit
+		T mMisses = 0;				//Invocations of default.rmiss
+		T mShadowMisses = 0;		//Invocations of shadowray.rmiss
+
+		template <typename U>
+		ray_counts& operator+=(const ray_counts<U>& other) {
+			for (size_t i = 0; i < RAY_DEPTH_COUNTERS; ++i) {
+				mRaysPerDepth[i] += other.mRaysPerDepth[i];
+			}
+			mShadowRays += other.mShadowRays;
+			mClosestHits += other.mClosestHits;
+			mLeavesClosestHits += other.mLeavesClosestHits;
+			mShadowClosestHits += other.mShadowClosestHits;
+			mAnyHits += other.mAnyHits;
+			mLeavesAnyHits += other.mLeavesAnyHits;
+			mShadowAnyHits += other.mShadowAnyHits;
+			mMisses += other.mMisses;
+			mShadowMisses += other.mShadowMisses;
+			return *this;
+		}
+
+		template <typename U>
+		ray_counts& operator-=(const ray_counts<U>& other) {
+			for (size_t i = 0; i < RAY_DEPTH_COUNTERS; ++i) {
+				mRaysPerDepth[i] -= other.mRaysPerDepth[i];
+			}
+			mShadowRays -= other.mShadowRays;
+			mClosestHits -= other.mClosestHits;
+			mLeavesClosestHits -= other.mLeavesClosestHits;
+			mShadowClosestHits -= other.mShadowClosestHits;
+			mAnyHits -= other.mAnyHits;
+			mLeavesAnyHits -= other.mLeavesAnyHits;
+			mShadowAnyHits -= other.mShadowAnyHits;
+			mMisses -= other.mMisses;
+			mShadowMisses -= other.mShadowMisses;
+			return *this;
+		}
+	};
+
+private:
+	ray_counts<uint32_t> mRayCounts;			//Counts of the last completed frame
+	ray_counts<uint64_t> mLevelRayCounts;		//Sum of the counts of all completed frames of the current scene
+	uint64_t mLevelFrames = 0;					//Number of frames in mLevelRayCounts
+	std::vector<uint32_t> mRayCounterGenerations;	//Per frame in flight: scene generation of the frame that writes the counters
+	ray_counts<uint32_t> mFocusQueryRayCounts;		//Counts of the last completed focus query
+	ray_counts<uint64_t> mLevelFocusQueryRayCounts;	//Sum of the counts of all completed focus queries of the current scene
+	uint64_t mLevelFocusQueries = 0;				//Number of focus queries in mLevelFocusQueryRayCounts
+
+	//Reads and resets the ray counters of the last frame that used the in-flight index, adds them to the level's counts
+	//and records them as profiler counters
+	void read_ray_counters(size_t inFlightIndex);
+
+	//Returns the counts averaged over the given number of frames as readable text
+	static std::string ray_counts_to_string(const ray_counts<uint64_t>& counts, uint64_t frames);
+
+	fgputimer mGpuTimer;						//GPU times of the TLAS update, the focus query, the ray tracing and the copy
+	bool mFrameStartRecorded = false;			//Whether record_frame_start has been recorded in the current frame
+
+	//Records what has to come first in the frame's first submitted command buffer (focus query or image): the reset of
+	//the timestamp queries and the TLAS update. Does nothing if it has already been recorded in this frame.
+	void record_frame_start(avk::command_buffer_t& cmd, size_t inFlightIndex);
+
 public:
 	frenderer() {}
 	frenderer(fscene* scene, flevellogic* levellogic) : mScene(scene), mLevelLogic(levellogic) {}
@@ -26,7 +180,7 @@ public:
 	//Initializes image views, pipeline, buffers, descriptor sets...
 	void initialize();
 
-	//Writes to FadeBuffer and reads from FocusHitBuffer and passes the value to level logic
+	//Writes to FadeBuffer, reads back completed focus queries and passes the newest focus hit value to level logic
 	void update() override;
 
 	//Starts rendering
@@ -35,6 +189,85 @@ public:
 	//Sets the current fade-value
 	void set_fade_value(float val) { fadeValue = val; }
 
+	//Sets the maximum number of rays (primary + reflection) per frame. If exceeded, the reflection depth is lowered
+	//in the periphery first, the central focus region always keeps the full depth. 0 disables the budget.
+	void set_ray_budget(uint64_t raysPerFrame) { mRaysPerFrameBudget = raysPerFrame; }
+
+	//Sets the maximum reflection recursion depth. It is clamped to what the device's ray tracing recursion limit allows
+	//(the primary ray and the shadow rays of the last hit need two levels in addition to the reflections).
+	void set_max_recursion_depth(uint32_t depth);
+
+	//Sets the throughput below which reflections outside the focus region are not traced any further
+	void set_min_reflection_throughput(float throughput) { mRayBudget.mMinThroughput = throughput; }
+
+	//Returns the number of rays traced per bounce depth (index 0 = primary rays) in the last completed frame
+	const std::array<uint32_t, RAY_DEPTH_COUNTERS>& get_rays_per_depth() const { return mRayCounts.mRaysPerDepth; }
+
+	//Returns the ray and shader invocation counts of the last completed frame
+	const ray_counts<uint32_t>& get_ray_counts() const { return mRayCounts; }
+
+	//Returns the summed counts of all completed frames of the current scene and their number
+	const ray_counts<uint64_t>& get_level_ray_counts(uint64_t& frames) const { frames = mLevelFrames; return mLevelRayCounts; }
+
+	//Returns the counts of the last completed focus query
+	const ray_counts<uint32_t>& get_focus_query_ray_counts() const { return mFocusQueryRayCounts; }
+
+	//Returns the summed counts of all completed focus queries of the current scene and their number
+	const ray_counts<uint64_t>& get_level_focus_query_ray_counts(uint64_t& queries) const { queries = mLevelFocusQueries; return mLevelFocusQueryRayCounts; }
+
+	//Logs the average counts per frame and per focus query of the current scene (also done when the scene changes) and starts counting anew
+	void log_level_ray_counts();
+
+	//Sets the number of focus query rays per dimension (the focus query traces resolution x resolution rays)
+	void set_focus_query_resolution(uint32_t resolution) { mFocusQueryResolution = resolution; }
+
+	//Returns the frame number in which the focus query of the current focus hit value was submitted (-1 if there is none yet)
+	int64_t get_focus_hit_frame() const { return mFocusHitFrameId; }
+
+	//Returns the number of frames between submission and readback of the current focus hit value
+	int64_t get_focus_readback_latency_frames() const { return mFocusReadbackLatencyFrames; }
+
+	//Returns the time in milliseconds between submission and readback of the current focus hit value
+	double get_focus_readback_latency_ms() const { return mFocusReadbackLatencyMs; }
+
+	//Returns the number of frames in which no focus query could be submitted, because all slots were still in use
+	uint32_t get_skipped_focus_queries() const { return mSkippedFocusQueries; }
+
+	//Returns whether the swap chain images of the window can be created with storage usage, on every ray tracing capable device:
+	//the surface has to support storage usage and all of its non-sRGB formats the storage image feature. gvk creates its device
+	//and surface only together with the swap chain, so this uses a temporary instance and surface. Has to be called after the
+	//window has been opened and before gvk::start.
+	static bool swap_chain_supports_storage(GLFWwindow* window);
+
+	//Sets whether the swap chain images have been requested with storage usage (see swap_chain_supports_storage).
+	//Has to be called before initialize; without it, the renderer always uses the offscreen images.
+	void set_swap_chain_storage(bool storage) { mSwapChainStorage = storage; }
+
+	//Enables or disables ray tracing directly into the swap chain images (only possible if the swap chain images support storage usage)
+	void set_direct_output(bool direct) { mDirectOutput = direct && mDirectOutputSupported; }
+
+	//Returns whether the image is currently ray traced directly into the swap chain images
+	bool is_direct_output() const { return mDirectOutput; }
+
+	//Writes the next rendered frame to the given PPM file, to compare the GPU with the CPU reference renderer (see fcpurenderer).
+	//The frame is ray traced into the offscreen image even with direct output, and render waits until it is done.
+	void capture_frame(const std::string& path) { mCapturePath = path; }
+
+	//Returns the GPU timer with the statistics of the frame's GPU work
+	const fgputimer& get_gpu_timer() const { return mGpuTimer; }
+	fgputimer& get_gpu_timer() { return mGpuTimer; }
+
+	//Writes the GPU times of every frame with their rolling statistics to the given CSV file ("" = stop)
+	void set_gpu_timing_csv(const std::string& path) { mGpuTimer.set_csv_path(path); }
+
+	//Returns the ray budget settings (see set_ray_budget, set_max_recursion_depth and set_min_reflection_throughput)
+	uint64_t get_ray_budget() const { return mRaysPerFrameBudget; }
+	uint32_t get_max_recursion_depth() const { return mMaxRecursionDepth; }
+	float get_min_reflection_throughput() const { return mRayBudget.mMinThroughput; }
+
+	//Returns the reflection depth currently used outside the focus region
+	uint32_t get_periphery_depth() const { return mRayBudget.mPeripheryDepth; }
+
 	//Execution order per frame: Game Control, Level Logic, Scene, Renderer
 	int32_t execution_order() const override {
 		return 4;
@@ -36,6 +36,9 @@ void fscene::create_buffers_for_model(fmodel& newElement)
 		avk::sync::with_barriers(mainWindow->command_buffer_lifetime_handler())
 	);
 	indexBuffer.enable_shared_ownership();
+	auto& device = gvk::context().device();
+	mBuildInputBytes = glm::max(mBuildInputBytes, static_cast<size_t>(device.getBufferMemoryRequirements(positionsBuffer->handle()).size
+		+ device.getBufferMemoryRequirements(indexBuffer->handle()).size));
 	
 	auto texCoordsBuffer = gvk::context().create_buffer(
 		avk::memory_usage::device, {},
@@ -92,77 +95,79 @@ void fscene::create_buffers_for_model(fmodel& newElement)
 	//   before we start building the TLAS.
 	blas->build({ avk::vertex_index_buffer_pair{ positionsBuffer, indexBuffer } }, {}, avk::sync::wait_idle()); // Wait idle could be optimized, but lifetime of positionsBuffer and indexBuffer must be handled
 	mBLASs.push_back(std::move(blas));
-
-	mModelData.emplace_back(newElement);
 }
 
 gvk::material_gpu_data& fscene::get_material_data(size_t materialIndex)
 {
-	mUpdateMaterials = gvk::context().main_window()->number_of_frames_in_flight();
+	mUpdateMaterials = mFramesInFlight;
 	return mGpuMaterials[materialIndex];
 }
 
 std::unique_ptr<fscene> fscene::load_scene(const std::string& filename, const std::string& characterfilename)
 {
-	auto mainWindow = gvk::context().main_window();
-	auto fif = mainWindow->number_of_frames_in_flight();
+	double loadStart = glfwGetTime();
+	auto s = load_scene_data(filename, characterfilename);
+	double cpuTime = glfwGetTime() - loadStart;
+	s->create_gpu_data();
+	LOG_INFO("Loaded " + filename + " in " + std::to_string((glfwGetTime() - loadStart) * 1000.0) + " ms (CPU data: " + std::to_string(cpuTime * 1000.0)
+		+ " ms, " + std::to_string(fjobsystem::instance().worker_count()) + " worker threads)");
+	return s;
+}
 
+std::unique_ptr<fscene> fscene::load_scene_data(const std::string& filename, const std::string& characterfilename)
+{
 	std::unique_ptr<fscene> s = std::make_unique<fscene>();
 	s->mLoadedScene = gvk::model_t::load_from_file(filename, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
-	s->mCgbCharacter = gvk::model_t::load_from_file(characterfilename, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
+	s->mLights = s->mLoadedScene->lights();
 
 	auto cameras = s->mLoadedScene->cameras();
 	assert(cameras.size() > 0);
 	s->mCamera = cameras[0];
 
+	//Collect all meshes first, such that the models can be filled in parallel
 	auto distinctMaterials = s->mLoadedScene->distinct_material_configs();
-	s->mMaterials.reserve(distinctMaterials.size());
-	s->mModels.reserve(distinctMaterials.size());
-	s->mTexCoordBufferViews.reserve(100);
-	s->mNormalBufferViews.reserve(100);
-	s->mTangentBufferViews.reserve(100);
-	s->mIndexBufferViews.reserve(100);
-
-	//Iterate over materials
+	std::vector<std::pair<size_t, size_t>> meshes;	//Material index and mesh index of each model
+	s->mMaterials.reserve(distinctMaterials.size() + 1);
 	for (const auto& pair : distinctMaterials) {
 		s->mMaterials.push_back(pair.first);
-		auto matIndex = s->mMaterials.size() - 1;
-
-		//Iterate over meshes per material
 		for (const auto& meshindex : pair.second) {
-			auto& newElement = s->mModels.emplace_back();
-			newElement.mModelIndex = s->mModels.size() - 1;
-			newElement.mMaterialIndex = matIndex;
-
-			newElement.mName = s->mLoadedScene->name_of_mesh(meshindex);
-			newElement.mTransparent = (newElement.mName == "Sphere");
-			newElement.mFlags = (newElement.mTransparent) ? 1 : 0;
-			newElement.mTransformation = s->mLoadedScene->transformation_matrix_for_mesh(meshindex);
-
-			//Get CPU-Data
-			gvk::append_indices_and_vertex_data(
-				gvk::additional_index_data(newElement.mIndices, [&]() { return s->mLoadedScene->indices_for_mesh<uint32_t>(meshindex);						}),
-				gvk::additional_vertex_data(newElement.mPositions, [&]() { return s->mLoadedScene->positions_for_mesh(meshindex);							}),
-				gvk::additional_vertex_data(newElement.mTexCoords, [&]() { return s->mLoadedScene->texture_coordinates_for_mesh<glm::vec2>(meshindex);		}),
-				gvk::additional_vertex_data(newElement.mNormals, [&]() { return s->mLoadedScene->normals_for_mesh(meshindex);								}),
-				gvk::additional_vertex_data(newElement.mTangents, [&]() { return s->mLoadedScene->tangents_for_mesh(meshindex);								})
-			);
-			
-			s->create_buffers_for_model(newElement);
-
+			meshes.emplace_back(s->mMaterials.size() - 1, meshindex);
 		}
 	}
+	s->mModels.resize(meshes.size());
 
-	//Character
-	s->mCharacterIndex = s->mModelData.size();
+	//Get CPU-Data (the assimp scene is only read here, so this is safe to do in parallel)
+	fjobsystem::instance().parallel_for(0, meshes.size(), 1, [&s, &meshes](size_t i) {
+		auto [matIndex, meshindex] = meshes[i];
+		auto& newElement = s->mModels[i];
+		newElement.mModelIndex = i;
+		newElement.mMaterialIndex = matIndex;
+
+		newElement.mName = s->mLoadedScene->name_of_mesh(meshindex);
+		newElement.mTransparent = (newElement.mName == "Sphere");
+		newElement.mFlags = (newElement.mTransparent) ? 1 : 0;
+		newElement.mTransformation = s->mLoadedScene->transformation_matrix_for_mesh(meshindex);
+
+		gvk::append_indices_and_vertex_data(
+			gvk::additional_index_data(newElement.mIndices, [&]() { return s->mLoadedScene->indices_for_mesh<uint32_t>(meshindex);						}),
+			gvk::additional_vertex_data(newElement.mPositions, [&]() { return s->mLoadedScene->positions_for_mesh(meshindex);							}),
+			gvk::additional_vertex_data(newElement.mTexCoords, [&]() { return s->mLoadedScene->texture_coordinates_for_mesh<glm::vec2>(meshindex);		}),
+			gvk::additional_vertex_data(newElement.mNormals, [&]() { return s->mLoadedScene->normals_for_mesh(meshindex);								}),
+			gvk::additional_vertex_data(newElement.mTangents, [&]() { return s->mLoadedScene->tangents_for_mesh(meshindex);								})
+		);
+	});
+
+	//Character (its assimp scene is only needed here)
+	gvk::model cgbCharacter = gvk::model_t::load_from_file(characterfilename, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
+	s->mCharacterIndex = s->mModels.size();
 	fmodel character;
 	character.mModelIndex = s->mCharacterIndex;
-	character.mPositions = s->mCgbCharacter->positions_for_mesh(0);
-	character.mTexCoords = s->mCgbCharacter->texture_coordinates_for_mesh<glm::vec2>(0);
-	character.mNormals = s->mCgbCharacter->normals_for_mesh(0);
-	character.mTangents = s->mCgbCharacter->tangents_for_mesh(0);
-	character.mIndices = s->mCgbCharacter->indices_for_mesh<uint32_t>(0);
-	character.mTransformation = s->mCgbCharacter->transformation_matrix_for_mesh(0);
+	character.mPositions = cgbCharacter->positions_for_mesh(0);
+	character.mTexCoords = cgbCharacter->texture_coordinates_for_mesh<glm::vec2>(0);
+	character.mNormals = cgbCharacter->normals_for_mesh(0);
+	character.mTangents = cgbCharacter->tangents_for_mesh(0);
+	character.mIndices = cgbCharacter->indices_for_mesh<uint32_t>(0);
+	character.mTransformation = cgbCharacter->transformation_matrix_for_mesh(0);
 	character.mMaterialIndex = s->mMaterials.size();
 	character.mTransparent = true;
 	character.mName = "Character";
@@ -171,41 +176,89 @@ std::unique_ptr<fscene> fscene::load_scene(const std::string& filename, const st
 	auto charMat = gvk::material_config();
 	charMat.mDiffuseReflectivity = glm::vec4(0.5);
 	s->mMaterials.push_back(charMat);
-	s->create_buffers_for_model(character);
 
-	s->mModelBuffers.resize(fif);
+	s->mBackgroundColor = glm::vec4(0.3, 0.3, 0.3, 0);
+	//Placeholders until create_gpu_data, such that the level logic can change the materials of scenes without GPU-data
+	s->mGpuMaterials.resize(s->mMaterials.size());
+	s->mModelDirtyFrames.resize(s->mModels.size(), 0);
+	s->mPreviousTransforms.resize(s->mModels.size());
+	s->mModelInterpolated.resize(s->mModels.size(), false);
+	s->mModelData.reserve(s->mModels.size());
+	for (const fmodel& model : s->mModels) {
+		s->mModelData.emplace_back(model);
+	}
+	return s;
+}
+
+std::vector<gvk::lightsource_gpu_data> fscene::get_light_data() const
+{
+	std::vector<gvk::lightsource_gpu_data> lights;
+	lights.resize(mLights.size());
+	gvk::convert_for_gpu_usage(mLights, mLights.size(), glm::mat4{1.0f}, lights);
+	return lights;
+}
+
+std::vector<float> fscene::get_perlin_gradients() const
+{
+	std::vector<float> gradients(PERLIN_LONSEGS * PERLIN_LATSEGS * 2, 0.0f);
+	srand(mModels.size());
+	for (uint32_t i = 0; i < PERLIN_LONSEGS; ++i) {
+		for (uint32_t j = 0; j < PERLIN_LATSEGS; ++j) {
+			float x = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+			float y = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+			glm::vec2 vec = glm::vec2(x, y);
+			vec = glm::normalize(vec);
+			gradients[PERLIN_LATSEGS * i + 2 * j + 0] = vec.x;
+			gradients[PERLIN_LATSEGS * i + 2 * j + 1] = vec.y;
+		}
+	}
+	return gradients;
+}
+
+void fscene::create_gpu_data()
+{
+	auto mainWindow = gvk::context().main_window();
+	auto fif = mainWindow->number_of_frames_in_flight();
+	mFramesInFlight = static_cast<int>(fif);
+
+	mTexCoordBufferViews.reserve(mModels.size());
+	mNormalBufferViews.reserve(mModels.size());
+	mTangentBufferViews.reserve(mModels.size());
+	mIndexBufferViews.reserve(mModels.size());
+	for (fmodel& model : mModels) {
+		create_buffers_for_model(model);
+	}
+
+	mModelBuffers.resize(fif);
 	for (size_t i = 0; i < fif; ++i) {
-		s->mModelBuffers[i] = gvk::context().create_buffer(
+		mModelBuffers[i] = gvk::context().create_buffer(
 			avk::memory_usage::host_coherent, {},
-			avk::storage_buffer_meta::create_from_data(s->mModelData)
+			avk::storage_buffer_meta::create_from_data(mModelData)
 		);
-		s->mModelBuffers[i]->fill(s->mModelData.data(), 0, avk::sync::not_required());
+		mModelBuffers[i]->fill(mModelData.data(), 0, avk::sync::not_required());
 	}
 
 	//----CREATE GPU BUFFERS-----
 	//Materials + Textures
 	auto [gpuMaterials, imageSamplers] = gvk::convert_for_gpu_usage<gvk::material_gpu_data>(
-		s->mMaterials, true, true,
+		mMaterials, true, true,
 		avk::image_usage::general_texture,
 		avk::filter_mode::trilinear,
 		avk::sync::with_barriers(mainWindow->command_buffer_lifetime_handler())
 	);
-	s->mMaterialBuffers.resize(fif);
+	mMaterialBuffers.resize(fif);
 	for (size_t i = 0; i < fif; ++i) {
-		s->mMaterialBuffers[i] = gvk::context().create_buffer(
+		mMaterialBuffers[i] = gvk::context().create_buffer(
 			avk::memory_usage::host_coherent, {},
 			avk::storage_buffer_meta::create_from_data(gpuMaterials)
 		);
-		s->mMaterialBuffers[i]->fill(gpuMaterials.data(), 0, avk::sync::not_required());
+		mMaterialBuffers[i]->fill(gpuMaterials.data(), 0, avk::sync::not_required());
 	}
-	s->mGpuMaterials = gpuMaterials;
-	s->mImageSamplers = std::move(imageSamplers);
+	mGpuMaterials = gpuMaterials;
+	mImageSamplers = std::move(imageSamplers);
 
 	//Lights
-	std::vector<gvk::lightsource> loadedLights = s->mLoadedScene->lights();
-	std::vector<gvk::lightsource_gpu_data> lights;
-	lights.resize(loadedLights.size());
-	gvk::convert_for_gpu_usage(loadedLights, loadedLights.size(), glm::mat4{1.0f}, lights);
+	std::vector<gvk::lightsource_gpu_data> lights = get_light_data();
 	
 	uint32_t lightCount = lights.size();
 	uint32_t buffersize = sizeof(gvk::lightsource_gpu_data) * lights.size() + sizeof(uint32_t)*4;
@@ -214,53 +267,39 @@ std::unique_ptr<fscene> fscene::load_scene(const std::string& filename, const st
 	memcpy(udata, &lightCount, sizeof(uint32_t));
 	memcpy(udata + 4, lights.data(), sizeof(gvk::lightsource_gpu_data) * lights.size());
 	gvk::lightsource_gpu_data* test = reinterpret_cast<gvk::lightsource_gpu_data*>(udata + 4);
-	s->mLightBuffer = gvk::context().create_buffer(
+	mLightBuffer = gvk::context().create_buffer(
 		avk::memory_usage::device, {},
 		avk::storage_buffer_meta::create_from_size(buffersize)
 	);
-	s->mLightBuffer->fill(data, 0, avk::sync::wait_idle(true));
+	mLightBuffer->fill(data, 0, avk::sync::wait_idle(true));
 	delete[] data;
 
 	//Background Color Buffer
-	s->mBackgroundColor = glm::vec4(0.3, 0.3, 0.3, 0);
-	s->mPerlinBackgroundBuffers.resize(fif);
+	mPerlinBackgroundBuffers.resize(fif);
 	for (size_t i = 0; i < fif; ++i) {
-		s->mPerlinBackgroundBuffers[i] = gvk::context().create_buffer(
+		mPerlinBackgroundBuffers[i] = gvk::context().create_buffer(
 			avk::memory_usage::host_coherent, {},
-			avk::uniform_buffer_meta::create_from_data(s->mBackgroundColor)
+			avk::uniform_buffer_meta::create_from_data(mBackgroundColor)
 		);
-		s->mPerlinBackgroundBuffers[i]->fill(&s->mBackgroundColor, 0, avk::sync::not_required());
+		mPerlinBackgroundBuffers[i]->fill(&mBackgroundColor, 0, avk::sync::not_required());
 	}
 
 	//Perlin Gradient Buffer
-	uint32_t lonsegs = 100;
-	uint32_t latsegs = 50;
-	float* gdata = new float[lonsegs * latsegs * 2];
-	srand(s->mModels.size());
-	for (uint32_t i = 0; i < lonsegs; ++i) {
-		for (uint32_t j = 0; j < latsegs; ++j) {
-			float x = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-			float y = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-			glm::vec2 vec = glm::vec2(x, y);
-			vec = glm::normalize(vec);
-			gdata[latsegs * i + 2 * j + 0] = vec.x;
-			gdata[latsegs * i + 2 * j + 1] = vec.y;
-		}
-	}
-	s->mPerlinGradientBuffer = gvk::context().create_buffer(
+	std::vector<float> gradients = get_perlin_gradients();
+	mPerlinGradientBuffer = gvk::context().create_buffer(
 		avk::memory_usage::host_coherent, {},
-		avk::storage_buffer_meta::create_from_size(sizeof(float) * lonsegs * latsegs * 2)
+		avk::storage_buffer_meta::create_from_size(sizeof(float) * gradients.size())
 	);
-	s->mPerlinGradientBuffer->fill(gdata, 0, avk::sync::not_required());
-	delete gdata;
+	mPerlinGradientBuffer->fill(gradients.data(), 0, avk::sync::not_required());
 
 	//---- CREATE TLAS -----
-	s->mTLASs.reserve(fif);
+	mTLASs.reserve(fif);
+	mTlasUpdatePending.resize(fif, false);
 	for (decltype(fif) i = 0; i < fif; ++i) {
 		// Each TLAS owns every BLAS (this will only work, if the BLASs themselves stay constant, i.e. read access
-		auto tlas = gvk::context().create_top_level_acceleration_structure(s->mGeometryInstances.size(), true);
+		auto tlas = gvk::context().create_top_level_acceleration_structure(mGeometryInstances.size(), true);
 		// Build the TLAS, ...
-		tlas->build(s->mGeometryInstances, {}, avk::sync::with_barriers(
+		tlas->build(mGeometryInstances, {}, avk::sync::with_barriers(
 					gvk::context().main_window()->command_buffer_lifetime_handler(),
 					// Sync before building the TLAS:
 					[](avk::command_buffer_t& commandBuffer, avk::pipeline_stage destinationStage, std::optional<avk::read_memory_access> readAccess){
@@ -279,10 +318,92 @@ std::unique_ptr<fscene> fscene::load_scene(const std::string& filename, const st
 					avk::sync::presets::default_handler_after_operation
 				)
 		);
-		s->mTLASs.push_back(std::move(tlas));
+		mTLASs.push_back(std::move(tlas));
 	}
 
-	return std::move(s);
+	//The level logic adjusts the models after loading (e.g. the leaf shader), so all models are written in the first frames
+	for (fmodel& model : mModels) {
+		mark_model_dirty(model.mModelIndex);
+	}
+}
+
+void fscene::release_cpu_data()
+{
+	for (fmodel& model : mModels) {
+		//Swapping with empty vectors frees the memory (clear keeps the capacity)
+		std::vector<glm::vec3>().swap(model.mPositions);
+		std::vector<glm::vec2>().swap(model.mTexCoords);
+		std::vector<glm::vec3>().swap(model.mNormals);
+		std::vector<glm::vec3>().swap(model.mTangents);
+		std::vector<uint32_t>().swap(model.mIndices);
+	}
+	mLoadedScene = gvk::model{};
+	mCpuDataReleased = true;
+}
+
+fscene::memory_report fscene::get_memory_report() const
+{
+	memory_report r;
+	for (const fmodel& model : mModels) {
+		r.mPositions += model.mPositions.capacity() * sizeof(glm::vec3);
+		r.mTexCoords += model.mTexCoords.capacity() * sizeof(glm::vec2);
+		r.mNormals += model.mNormals.capacity() * sizeof(glm::vec3);
+		r.mTangents += model.mTangents.capacity() * sizeof(glm::vec3);
+		r.mIndices += model.mIndices.capacity() * sizeof(uint32_t);
+		r.mModelData += sizeof(fmodel) + model.mName.capacity();
+	}
+	if (!mCpuDataReleased) {
+		const aiScene* scene = mLoadedScene->handle();
+		for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+			const aiMesh* mesh = scene->mMeshes[m];
+			size_t vectorsPerVertex = 1 + (mesh->HasNormals() ? 1 : 0) + (mesh->HasTangentsAndBitangents() ? 2 : 0) + mesh->GetNumUVChannels();
+			r.mImporter += mesh->mNumVertices * (vectorsPerVertex * sizeof(aiVector3D) + mesh->GetNumColorChannels() * sizeof(aiColor4D))
+				+ mesh->mNumFaces * (sizeof(aiFace) + 3 * sizeof(unsigned int));
+		}
+	}
+	r.mModelData += mMaterials.capacity() * sizeof(gvk::material_config) + mModelData.capacity() * sizeof(fmodel_gpu_data)
+		+ mGpuMaterials.capacity() * sizeof(gvk::material_gpu_data) + mPreviousTransforms.capacity() * sizeof(glm::mat4)
+		+ mModelDirtyFrames.capacity() * sizeof(int) + mGeometryInstances.capacity() * sizeof(avk::geometry_instance);
+
+	//Scenes without GPU-data have no resources
+	if (mTLASs.empty()) {
+		return r;
+	}
+	auto& device = gvk::context().device();
+	auto bufferSize = [&device](const vk::Buffer& buffer) { return static_cast<size_t>(device.getBufferMemoryRequirements(buffer).size); };
+	for (size_t i = 0; i < mModels.size(); ++i) {
+		r.mVertexBuffers += bufferSize(mTexCoordBufferViews[i]->buffer_handle()) + bufferSize(mNormalBufferViews[i]->buffer_handle())
+			+ bufferSize(mTangentBufferViews[i]->buffer_handle());
+		r.mIndexBuffers += bufferSize(mIndexBufferViews[i]->buffer_handle());
+		r.mBLASs += static_cast<size_t>(mBLASs[i]->required_acceleration_structure_size());
+	}
+	for (size_t i = 0; i < mTLASs.size(); ++i) {
+		r.mTLASs += static_cast<size_t>(mTLASs[i]->required_acceleration_structure_size());
+		r.mPerFrameBuffers += bufferSize(mModelBuffers[i]->handle()) + bufferSize(mMaterialBuffers[i]->handle()) + bufferSize(mPerlinBackgroundBuffers[i]->handle());
+	}
+	for (const auto& sampler : mImageSamplers) {
+		r.mTextures += static_cast<size_t>(device.getImageMemoryRequirements(sampler->get_image_view()->get_image().handle()).size);
+	}
+	r.mConstantBuffers = bufferSize(mLightBuffer->handle()) + bufferSize(mPerlinGradientBuffer->handle());
+	r.mBuildInputs = mBuildInputBytes;
+	return r;
+}
+
+std::string fscene::memory_report::megabytes(size_t bytes)
+{
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(2) << double(bytes) / (1024.0 * 1024.0);
+	return text.str();
+}
+
+std::string fscene::memory_report::to_string() const
+{
+	auto mb = &megabytes;
+	return "CPU " + mb(cpu_bytes()) + " MB (positions " + mb(mPositions) + ", texture coordinates " + mb(mTexCoords) + ", normals " + mb(mNormals)
+		+ ", tangents " + mb(mTangents) + ", indices " + mb(mIndices) + ", assimp scene " + mb(mImporter) + ", model data " + mb(mModelData)
+		+ "), GPU " + mb(gpu_bytes()) + " MB (vertex buffers " + mb(mVertexBuffers) + ", index buffers " + mb(mIndexBuffers) + ", BLASs " + mb(mBLASs)
+		+ ", TLASs " + mb(mTLASs) + ", textures " + mb(mTextures) + ", per-frame buffers " + mb(mPerFrameBuffers) + ", constant buffers " + mb(mConstantBuffers)
+		+ ", BLAS build inputs " + mb(mBuildInputs) + " while loading)";
 }
 
 fmodel* fscene::get_model_by_name(const std::string& name)
@@ -295,26 +416,126 @@ fmodel* fscene::get_model_by_name(const std::string& name)
 	throw new std::runtime_error("Did not find model " + name);
 }
 
-void fscene::set_character_position(const glm::vec3& position)
+void fscene::set_character_position(const glm::vec3& position, bool snap)
 {
-	mModels[mCharacterIndex].mTransformation[3] = glm::vec4(position, 1.0f);
+	glm::mat4 transformation = mModels[mCharacterIndex].mTransformation;
+	glm::vec4 newColumn = glm::vec4(position, 1.0f);
+	if (transformation[3] != newColumn || snap) {
+		transformation[3] = newColumn;
+		set_model_transform(mCharacterIndex, transformation, snap);
+	}
 }
 
-void fscene::update()
+void fscene::set_camera_translation(const glm::vec3& translation, bool snap)
 {
-	int i = 0;
-	for (fmodel& model : mModels) {
-		mGeometryInstances[i].set_transform_column_major(gvk::to_array(model.mTransformation));
+	if (snap) {
+		mCameraInterpolated = false;
+	}
+	else {
+		if (!mCameraInterpolated) {
+			mPreviousCameraTranslation = mCamera.translation();
+			mCameraInterpolated = true;
+		}
+		mStepCameraTranslation = translation;
+	}
+	mCamera.set_translation(translation);
+}
+
+void fscene::mark_model_dirty(size_t modelIndex)
+{
+	if (mModelDirtyFrames[modelIndex] == 0) {
+		mDirtyModels.push_back(modelIndex);
+	}
+	//Every frame in flight has its own model buffer and TLAS, so all of them have to receive the change
+	mModelDirtyFrames[modelIndex] = mFramesInFlight;
+}
+
+void fscene::set_model_transform(size_t modelIndex, const glm::mat4& transformation, bool snap)
+{
+	fmodel& model = mModels[modelIndex];
+	if (snap) {
+		mPreviousTransforms[modelIndex] = transformation;
+	}
+	else if (!mModelInterpolated[modelIndex]) {
+		mPreviousTransforms[modelIndex] = model.mTransformation;
+		mModelInterpolated[modelIndex] = true;
+		mInterpolatedModels.push_back(modelIndex);
+	}
+	model.mTransformation = transformation;
+	mark_model_dirty(modelIndex);
+}
+
+void fscene::begin_physics_step()
+{
+	//The models that are not moved by the new step have to show their final transformation
+	for (size_t i : mInterpolatedModels) {
+		mModelInterpolated[i] = false;
+		mark_model_dirty(i);
+	}
+	mInterpolatedModels.clear();
+	//The step has to continue from the exact camera position of the last step, not from the interpolated one
+	if (mCameraInterpolated) {
+		mCamera.set_translation(mStepCameraTranslation);
+		mCameraInterpolated = false;
+	}
+}
+
+void fscene::set_interpolation_alpha(float alpha)
+{
+	mInterpolationAlpha = alpha;
+	if (mCameraInterpolated) {
+		mCamera.set_translation(glm::mix(mPreviousCameraTranslation, mStepCameraTranslation, alpha));
+	}
+}
+
+bool fscene::update_model_data()
+{
+	FPROFILE_SCOPE("fscene::update_model_data");
+	//The interpolated transformations change every frame, even without a physics step
+	for (size_t i : mInterpolatedModels) {
+		mark_model_dirty(i);
+	}
+
+	//Only the models that changed during the last frames in flight. Independent per model -> in parallel batches
+	bool modelsChanged = !mDirtyModels.empty();
+	mLastUpdatedModels = mDirtyModels.size();
+	fjobsystem::instance().parallel_for(0, mDirtyModels.size(), 32, [this](size_t d) {
+		size_t i = mDirtyModels[d];
+		fmodel& model = mModels[i];
+		glm::mat4 transformation = mModelInterpolated[i] ? utility::interpolate_transform(mPreviousTransforms[i], model.mTransformation, mInterpolationAlpha) : model.mTransformation;
 		if (model.mLeaf) {
 			model.mTransparent = true;
-			mGeometryInstances[i].set_instance_offset(4);
 		}
-		mGeometryInstances[i].mFlags = (model.mTransparent) ? vk::GeometryInstanceFlagBitsNV::eForceNoOpaque : vk::GeometryInstanceFlagBitsNV::eForceOpaque;
-		mModelData[i] = model;
-		++i;
+		//Scenes without GPU-data have no geometry instances
+		if (!mGeometryInstances.empty()) {
+			mGeometryInstances[i].set_transform_column_major(gvk::to_array(transformation));
+			if (model.mLeaf) {
+				mGeometryInstances[i].set_instance_offset(4);
+			}
+			mGeometryInstances[i].mFlags = (model.mTransparent) ? vk::GeometryInstanceFlagBitsNV::eForceNoOpaque : vk::GeometryInstanceFlagBitsNV::eForceOpaque;
+		}
+		mModelData[i] = fmodel_gpu_data(model, transformation);
+	});
+	//Count down the dirty frames and drop the models that have reached all frames in flight
+	size_t stillDirty = 0;
+	for (size_t i : mDirtyModels) {
+		if (--mModelDirtyFrames[i] > 0) {
+			mDirtyModels[stillDirty++] = i;
+		}
 	}
+	mDirtyModels.resize(stillDirty);
+	return modelsChanged;
+}
+
+void fscene::update()
+{
+	FPROFILE_SCOPE("fscene::update");
+	bool modelsChanged = update_model_data();
 	auto fidx = gvk::context().main_window()->in_flight_index_for_frame();
-	mModelBuffers[fidx]->fill(mModelData.data(), 0, avk::sync::not_required());
+	FPROFILE_SCOPE("fscene buffer fills");
+	if (modelsChanged) {
+		mModelBuffers[fidx]->fill(mModelData.data(), 0, avk::sync::not_required());
+	}
 	if (mUpdateMaterials > 0) {
 		--mUpdateMaterials;
 		mMaterialBuffers[fidx]->fill(mGpuMaterials.data(), 0, avk::sync::not_required());
@@ -322,8 +543,21 @@ void fscene::update()
 
 	mPerlinBackgroundBuffers[fidx]->fill(&mBackgroundColor, 0, avk::sync::not_required());
 
-	mTLASs[fidx]->update(mGeometryInstances, {}, avk::sync::with_barriers(
-			gvk::context().main_window()->command_buffer_lifetime_handler(),
+	//The TLAS update is recorded by the renderer (see record_tlas_update)
+	if (modelsChanged) {
+		mTlasUpdatePending[fidx] = true;
+	}
+}
+
+bool fscene::record_tlas_update(avk::command_buffer_t& cmd, size_t inFlightIndex)
+{
+	if (!mTlasUpdatePending[inFlightIndex]) {
+		return false;
+	}
+	FPROFILE_SCOPE("fscene TLAS update");
+	mTlasUpdatePending[inFlightIndex] = false;
+	mTLASs[inFlightIndex]->update(mGeometryInstances, {}, avk::sync::with_barriers_into_existing_command_buffer(
+			cmd,
 			{}, // Nothing to wait for
 			[](avk::command_buffer_t& commandBuffer, avk::pipeline_stage srcStage, std::optional<avk::write_memory_access> srcAccess){
 				// We want this update to be as efficient/as tight as possible
@@ -334,4 +568,5 @@ void fscene::update()
 			}
 		)
 	);
+	return true;
 }
\ No newline at end of file
@@ -1,11 +1,15 @@
 #pragma once
 #include "includes.h"
 
+#define PERLIN_LONSEGS 100	//Number of Perlin gradients of the sky along the longitude (must match default.rmiss)
+#define PERLIN_LATSEGS 50	//Number of Perlin gradients of the sky along the latitude (must match default.rmiss)
+
 /*
 Represents a single model in the scene
 */
 struct fmodel {
 	size_t mModelIndex;					//Index of this object in the scene's model array
+	//Geometry (empty after fscene::release_cpu_data)
 	std::vector<glm::vec3> mPositions;	//List of vertex positions
 	std::vector<glm::vec2> mTexCoords;	//List of texture coordinates
 	std::vector<glm::vec3> mNormals;	//List of normals
@@ -28,9 +32,12 @@ struct fmodel_gpu_data {
 	alignas(16) uint32_t mFlags = 0;	//Flags (see above)
 
 	//Creates the gpudata for a given fmodel
-	fmodel_gpu_data(const fmodel& model) {
+	fmodel_gpu_data(const fmodel& model) : fmodel_gpu_data(model, model.mTransformation) {}
+
+	//Creates the gpudata for a given fmodel, which is rendered with the given transformation (e.g. an interpolated one)
+	fmodel_gpu_data(const fmodel& model, const glm::mat4& transformation) {
 		mMaterialIndex = static_cast<uint32_t>(model.mMaterialIndex);
-		mNormalMatrix = glm::transpose(glm::inverse(model.mTransformation));
+		mNormalMatrix = glm::transpose(glm::inverse(transformation));
 		mFlags = model.mFlags;
 	}
 };
@@ -43,15 +50,28 @@ struct fscene : public gvk::invokee {
 
 private:
 	//CPU-Data
-	gvk::model mLoadedScene;						//cgbase-object for reading in the scene data
+	gvk::model mLoadedScene;						//cgbase-object for reading in the scene data (empty after release_cpu_data)
+	std::vector<gvk::lightsource> mLights;			//Light sources of the loaded scene
 	std::vector<gvk::material_config> mMaterials;	//List of materials (using cgbase's material representation)
 	std::vector<fmodel> mModels;					//List of models
 	gvk::camera mCamera;							//Camera object
 	glm::vec4 mBackgroundColor;						//Current background color of the scene
 	int mUpdateMaterials = 0;						//Whether the materials have to be updated (as a decrementing frame-counter)
+	std::vector<int> mModelDirtyFrames;				//Per model: Number of frames in flight that still have to receive its changes
+	std::vector<size_t> mDirtyModels;				//Indices of all models with mModelDirtyFrames > 0
+	int mFramesInFlight = 1;						//Number of frames in flight (the number of per-frame buffers and TLASs)
+	size_t mLastUpdatedModels = 0;					//Number of models written to the GPU-data in the last update
+	//Interpolation between physics steps
+	std::vector<glm::mat4> mPreviousTransforms;		//Per model: Transformation after the previous physics step (only valid for interpolated models)
+	std::vector<bool> mModelInterpolated;			//Per model: Whether the model has been moved by the current physics step
+	std::vector<size_t> mInterpolatedModels;		//Indices of all models with mModelInterpolated set
+	float mInterpolationAlpha = 1.0f;				//Position of the rendered frame between the previous (0) and the current (1) physics step
+	glm::vec3 mPreviousCameraTranslation;			//Camera position after the previous physics step (only valid if mCameraInterpolated)
+	glm::vec3 mStepCameraTranslation;				//Camera position after the current physics step (only valid if mCameraInterpolated)
+	bool mCameraInterpolated = false;				//Whether the camera has been moved by the current physics step
 	//Character
-	gvk::model mCgbCharacter;						//Character model
 	size_t mCharacterIndex;							//Index of the character model in the models-array
+	bool mCpuDataReleased = false;					//Whether release_cpu_data has been called
 
 	//For GPU
 	std::vector<fmodel_gpu_data> mModelData;				//List of model-gpu-data
@@ -75,12 +95,49 @@ private:
 	//Acceleration Structures
 	std::vector<avk::bottom_level_acceleration_structure> mBLASs;	//Bottom Level Acceleration Structures (only once, constant)
 	std::vector<avk::top_level_acceleration_structure> mTLASs;		//Top Level Acceleration Structures (one per frame in flight)
+	std::vector<bool> mTlasUpdatePending;							//Per frame in flight: whether the TLAS has to be updated with the geometry instances
+	size_t mBuildInputBytes = 0;									//Largest position and index buffers of a BLAS build (freed after the build)
 
 	//Help-function
 	void create_buffers_for_model(fmodel& model);
 
 public:
 
+	//Memory of a scene in bytes (see get_memory_report)
+	struct memory_report {
+		//CPU
+		size_t mPositions = 0;			//Geometry of the models
+		size_t mTexCoords = 0;
+		size_t mNormals = 0;
+		size_t mTangents = 0;
+		size_t mIndices = 0;
+		size_t mImporter = 0;			//Meshes of the assimp scene (estimated from their vertex and face counts)
+		size_t mModelData = 0;			//Models, materials, their GPU-data copies and the per-model update state
+		//GPU (memory requirements of the resources, without the allocator's block overhead)
+		size_t mVertexBuffers = 0;		//Texture coordinate, normal and tangent texel buffers
+		size_t mIndexBuffers = 0;		//Index texel buffers
+		size_t mBLASs = 0;
+		size_t mTLASs = 0;				//All frames in flight
+		size_t mTextures = 0;
+		size_t mPerFrameBuffers = 0;	//Model, material and background buffers of all frames in flight
+		size_t mConstantBuffers = 0;	//Light and Perlin gradient buffers
+		size_t mBuildInputs = 0;		//Largest position and index buffers of a BLAS build (only while create_gpu_data runs, not part of gpu_bytes)
+
+		size_t cpu_bytes() const {
+			return mPositions + mTexCoords + mNormals + mTangents + mIndices + mImporter + mModelData;
+		}
+
+		size_t gpu_bytes() const {
+			return mVertexBuffers + mIndexBuffers + mBLASs + mTLASs + mTextures + mPerFrameBuffers + mConstantBuffers;
+		}
+
+		//Returns the sizes per category in MB
+		std::string to_string() const;
+
+		//Formats a size in MB with two decimals
+		static std::string megabytes(size_t bytes);
+	};
+
 	//Loads the scene
 	//filename: Path to the scene collada file
 	//charachterfilename: Path to the character collada file
@@ -91,6 +148,36 @@ public:
 	*/
 	static std::unique_ptr<fscene> load_scene(const std::string& filename, const std::string& characterfilename);
 
+	//Loads only the CPU-data of the scene (models, materials, camera), without creating any GPU resources.
+	//The mesh data is extracted in parallel on the job system.
+	static std::unique_ptr<fscene> load_scene_data(const std::string& filename, const std::string& characterfilename);
+
+	//Creates the GPU buffers, textures and acceleration structures for a scene loaded with load_scene_data
+	void create_gpu_data();
+
+	//Frees the data that is only needed for creating the GPU-data and the physics actors: the geometry of the models and the
+	//assimp scene. Has to be called after create_gpu_data and after the level logic has been initialized. Afterwards, the scene
+	//cannot be used by fcputracer, flevelsolver or fcpurenderer anymore.
+	void release_cpu_data();
+
+	//Returns whether release_cpu_data has been called
+	bool is_cpu_data_released() const {
+		return mCpuDataReleased;
+	}
+
+	//Returns the current CPU and GPU memory of the scene
+	memory_report get_memory_report() const;
+
+	//Returns all models of the scene
+	std::vector<fmodel>& get_models() {
+		return mModels;
+	}
+
+	//Returns all materials of the scene (as loaded, changes through get_material_data are not included)
+	const std::vector<gvk::material_config>& get_materials() const {
+		return mMaterials;
+	}
+
 	//----------------------
 	//---Getter Functions---
 	//----------------------
@@ -143,6 +230,16 @@ public:
 		return mCamera;
 	}
 
+	const glm::vec4& get_background_color() const {
+		return mBackgroundColor;
+	}
+
+	//Returns the light sources of the scene, as they are stored in the light buffer
+	std::vector<gvk::lightsource_gpu_data> get_light_data() const;
+
+	//Returns the gradients of the Perlin noise in the sky, as they are stored in the gradient buffer
+	std::vector<float> get_perlin_gradients() const;
+
 	fmodel* get_model_by_name(const std::string& name);
 
 	/*This function has a side effect. If this is called, it is assumed that the returned material will be changed
@@ -162,12 +259,48 @@ public:
 		mBackgroundColor = glm::vec4(backgroundColor, 1.0f);
 	}
 
-	//Sets the current position of the character
-	void set_character_position(const glm::vec3& position);
+	//Sets the current position of the character. Like set_model_transform, it is rendered between the last two physics steps.
+	//snap: Skips the interpolation (e.g. when the character is reset)
+	void set_character_position(const glm::vec3& position, bool snap = false);
+
+	//Sets the camera position of a physics step. Until the next step, the camera is placed between its previous and this
+	//position (see set_interpolation_alpha). begin_physics_step moves it back to this position, so that the step sees the exact position.
+	//snap: Skips the interpolation (e.g. when the player is reset or teleported)
+	void set_camera_translation(const glm::vec3& translation, bool snap = false);
+
+	//Has to be called after changing the transformation or the flags of a model, so that the change reaches the GPU.
+	//Models that are not marked are skipped by update (and the TLAS is not updated at all if no model changed).
+	void mark_model_dirty(size_t modelIndex);
 
-	//Updates all model data on the GPU, as well as the background color buffer. The material buffer is updated if needed
+	//Sets the transformation of a model moved by a physics step. Until the next step, the model is rendered
+	//between its previous and this transformation (see set_interpolation_alpha). The model is marked dirty.
+	//snap: Skips the interpolation (e.g. when the model is reset)
+	void set_model_transform(size_t modelIndex, const glm::mat4& transformation, bool snap = false);
+
+	//Has to be called before every physics step. The models and the camera moved by the last step stop interpolating.
+	void begin_physics_step();
+
+	//Sets how far the rendered frame is between the last two physics steps (0 = previous step, 1 = last step)
+	//and places an interpolated camera accordingly
+	void set_interpolation_alpha(float alpha);
+
+	//Returns the number of models whose GPU-data has been written in the last update
+	size_t get_last_updated_model_count() const {
+		return mLastUpdatedModels;
+	}
+
+	//CPU part of update: writes the transformations and flags of the dirty models to the model data and the geometry instances
+	//(skipped for scenes without GPU-data) and counts down their dirty frames. Returns whether a model has been written.
+	bool update_model_data();
+
+	//Updates the data of the dirty models on the GPU, as well as the background color buffer. The material buffer is updated if needed.
+	//If models have changed, the TLAS of the frame in flight is marked for record_tlas_update.
 	void update() override;
 
+	//Records the pending TLAS update of the frame in flight into the command buffer, followed by a barrier for the ray tracing
+	//shaders (which also holds for command buffers submitted later). Returns false if there was nothing to update.
+	bool record_tlas_update(avk::command_buffer_t& cmd, size_t inFlightIndex);
+
 	int32_t execution_order() const override {
 		return 3;
 	}
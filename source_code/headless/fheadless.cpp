@@ -0,0 +1,449 @@
+#include "../includes.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#define HEADLESS_ASPECT_RATIO (16.0f / 9.0f)	//Aspect ratio of the focus query (focus_rt's window is 1920x1080)
+#define HEADLESS_MAX_DEPTH 4					//Reflection depth of the focus query (frenderer's default)
+#define GOLDEN_WIDTH 480						//Size of the golden images
+#define GOLDEN_HEIGHT 270
+#define GOLDEN_TOLERANCE 8						//Largest channel difference (0-255) that still counts as equal
+#define GOLDEN_MAX_BAD_PIXELS 0.001				//Largest fraction of pixels above the tolerance for a passed test
+#define GPU_TOLERANCE 24						//Same for the comparison of GPU captures with the CPU reference renderer, whose textures
+#define GPU_MAX_BAD_PIXELS 0.02					//are not mipmapped and whose transparent hits may differ (see fcpurenderer)
+#define BOT_MIN_BEHAVIOUR_TIME 0.5f				//Time range in s after which a bot changes its behaviour
+#define BOT_MAX_BEHAVIOUR_TIME 2.0f
+#define BOT_MAX_TURN_RATE 400.0f				//Maximum horizontal cursor movement of a bot in pixels per second
+
+/*
+Headless replay of a gameplay recording (see finput, recorded with focus_rt --record <file>).
+Runs the level logic and physics of the recorded levels frame by frame with the recorded input and frame times,
+without window and without GPU (the scenes only contain their CPU-data). The levels are switched in the recorded frames and
+the level logic uses the recorded focus hit values (which the GPU of the recorded session delivered), so the replay does not
+depend on the timing of the focus query.
+Prints one line per level: frames, physics steps, replayed game time, wall-clock time, final status and camera position.
+Equal recordings give equal results, so the output can be compared between builds to check physics and gameplay for regressions.
+Usage: focus_headless <recording>
+
+Golden image test of the shading path: renders every level from its start camera with the CPU reference renderer (fcpurenderer)
+and compares the images to the golden images level<id>.ppm in the given directory. A missing golden image fails the test,
+--update (re)creates all of them. For failed levels, the render and a difference image are written next to the golden image.
+Prints one line per level and returns 1 if a level failed.
+Usage: focus_headless --golden <directory> [--update]
+
+GPU comparison: compares the frames captured by focus_rt --capture <directory> (level<id>.ppm, every level from its start camera)
+with the CPU reference renderer at the same resolution, which checks that the shaders and fcpurenderer still agree.
+Missing captures fail. Like the golden test, failed levels get the CPU render and a difference image next to the capture.
+Usage: focus_headless --compare-gpu <directory>
+
+Server mode: simulates many independent instances of a level in parallel, as fast as possible, for automated play-throughs.
+Every instance has its own scene, level logic, PhysX scene and CPU focus evaluation, and is played by a random bot.
+Every frame advances the game by exactly one physics step, won and lost levels are reset. The instances are loaded one after
+another (using the job system), then the job system is emptied and the instances are stepped on their own threads, so the
+PhysX tasks and focus rays of an instance run inline on its thread. Prints the simulated steps per second of every instance
+and of all instances together.
+Usage: focus_headless --server <level> <instances> <simulated seconds> [threads]
+
+Solvability check: searches the eye positions on the goal region and mirror orientations from which the focusphere of a level
+is seen (see flevelsolver), on all threads of the job system. The level is only loaded, not played, so all models are at their
+initial positions. Prints a summary line and one line per found solution (eye position, mirror yaws in degrees, reflections).
+Usage: focus_headless --solve <level> [angle steps] [position steps]
+*/
+
+//Returns the current time in milliseconds
+static double now_ms()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//A level of the replay
+struct headless_level {
+	int mId = 0;
+	std::unique_ptr<fscene> mScene;
+	std::unique_ptr<flevellogic> mLogic;
+	std::unique_ptr<fcputracer> mTracer;
+	uint64_t mFrames = 0;		//Number of replayed frames
+	double mGameTime = 0;		//Sum of the replayed frame times in s
+	double mWallTime = 0;		//Time for replaying the frames in ms (without loading)
+};
+
+//Loads the CPU-data of a level and initializes its logic. T is the flevellogic class.
+template <typename T>
+static void load_level(headless_level& level, fphysicsruntime* runtime, finput* input)
+{
+	level.mScene = fscene::load_scene_data(T::level_path(), CHAR_PATH);
+	level.mLogic = std::make_unique<T>(level.mScene.get(), runtime, input);
+	level.mLogic->initialize();
+	level.mTracer = std::make_unique<fcputracer>(level.mScene.get());
+	level.mTracer->build();
+}
+
+//Creates the level with the given index (1-4), like fgamecontrol does
+static headless_level create_level(int id, fphysicsruntime* runtime, finput* input)
+{
+	headless_level level;
+	level.mId = id;
+	switch (id) {
+		case 1: load_level<flevel1logic>(level, runtime, input); break;
+		case 2: load_level<flevel2logic>(level, runtime, input); break;
+		case 3: load_level<flevel3logic>(level, runtime, input); break;
+		case 4: load_level<flevel4logic>(level, runtime, input); break;
+		default: throw std::runtime_error("The recording contains the unknown level " + std::to_string(id));
+	}
+	return level;
+}
+
+//Prints the results of a level and releases it
+static void finish_level(headless_level& level)
+{
+	static const char* statusNames[] = { "running", "won", "lost" };
+	glm::vec3 camera = level.mScene->get_camera().translation();
+	std::cout << level.mId << ";" << level.mFrames << ";" << level.mLogic->step_count() << ";" << level.mGameTime << ";" << level.mWallTime << ";"
+		<< statusNames[static_cast<int>(level.mLogic->level_status())] << ";" << camera.x << ";" << camera.y << ";" << camera.z << std::endl;
+	level.mLogic->finalize();
+	level.mTracer.reset();
+	level.mLogic.reset();
+	level.mScene.reset();
+}
+
+//Random player of the server mode: mostly walks forward, strafes, turns, jumps and turns mirrors at random
+struct headless_bot {
+	std::mt19937 mRandom;
+	float mBehaviourTime = 0.0f;			//Time until the next change of behaviour
+	uint16_t mKeysDown = 0;
+	glm::vec2 mTurnRate = glm::vec2(0.0f);	//Cursor movement per second
+	uint8_t mButtons = 0;
+
+	headless_bot(uint32_t seed) : mRandom(seed) {}
+
+	//Sets the input of the next frame
+	void next_frame(finput& input, float deltaTime)
+	{
+		mBehaviourTime -= deltaTime;
+		if (mBehaviourTime <= 0.0f) {
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			mBehaviourTime = glm::mix(BOT_MIN_BEHAVIOUR_TIME, BOT_MAX_BEHAVIOUR_TIME, unit(mRandom));
+			mKeysDown = 0;
+			if (unit(mRandom) < 0.8f) {
+				mKeysDown |= finput::key_bit(finput_key::w);
+			}
+			if (unit(mRandom) < 0.2f) {
+				mKeysDown |= finput::key_bit(unit(mRandom) < 0.5f ? finput_key::a : finput_key::d);
+			}
+			if (unit(mRandom) < 0.2f) {
+				mKeysDown |= finput::key_bit(finput_key::space);
+			}
+			mTurnRate = glm::vec2((unit(mRandom) * 2.0f - 1.0f) * BOT_MAX_TURN_RATE, (unit(mRandom) * 2.0f - 1.0f) * 0.1f * BOT_MAX_TURN_RATE);
+			mButtons = (unit(mRandom) < 0.1f) ? 1 : 0;
+		}
+		input.script_frame(deltaTime, mKeysDown, mTurnRate * deltaTime, mButtons);
+	}
+};
+
+//A level instance of the server mode
+struct server_instance {
+	finput mInput;
+	headless_bot mBot;
+	headless_level mLevel;
+	uint32_t mWins = 0;
+	uint32_t mLosses = 0;
+
+	server_instance(uint32_t seed) : mBot(seed) {}
+};
+
+//Runs the server mode, see above
+static void run_server(int levelId, uint32_t instanceCount, double seconds, uint32_t threadCount)
+{
+	fphysicsconfig physicsConfig;
+	physicsConfig.mConnectPvd = false;
+	fphysicsruntime physicsRuntime(physicsConfig);
+	const float stepSize = 1.0f / physicsConfig.mStepRate;
+	const uint64_t frames = static_cast<uint64_t>(seconds * physicsConfig.mStepRate);
+
+	std::vector<std::unique_ptr<server_instance>> instances;
+	double loadStart = now_ms();
+	for (uint32_t i = 0; i < instanceCount; ++i) {
+		auto instance = std::make_unique<server_instance>(i + 1);
+		instance->mInput.start_scripted();
+		instance->mLevel = create_level(levelId, &physicsRuntime, &instance->mInput);
+		instances.push_back(std::move(instance));
+	}
+	LOG_INFO("Loaded " + std::to_string(instanceCount) + " instances of level " + std::to_string(levelId) + " in " + std::to_string(now_ms() - loadStart) + " ms");
+
+	//Every instance runs on one thread from here on
+	size_t workerCount = fjobsystem::instance().worker_count();
+	fjobsystem::instance().set_worker_count(0);
+	std::atomic<uint32_t> nextInstance = 0;
+	auto simulate = [&]() {
+		for (uint32_t i = nextInstance++; i < instanceCount; i = nextInstance++) {
+			server_instance& instance = *instances[i];
+			headless_level& level = instance.mLevel;
+			double start = now_ms();
+			for (uint64_t frame = 0; frame < frames; ++frame) {
+				instance.mBot.next_frame(instance.mInput, stepSize);
+				instance.mInput.begin_frame();
+				levelstatus status = level.mLogic->level_status();
+				if (status == levelstatus::WON) {
+					++instance.mWins;
+					level.mLogic->reset();
+				}
+				else if (status == levelstatus::LOST) {
+					++instance.mLosses;
+					level.mLogic->reset();
+				}
+				level.mLogic->update();
+				level.mTracer->update_instances();
+				level.mLogic->set_focus_hit_value(level.mTracer->compute_focus_hit_value(level.mScene->get_camera().global_transformation_matrix(),
+					HEADLESS_ASPECT_RATIO, FOCUS_QUERY_RESOLUTION, HEADLESS_MAX_DEPTH));
+				++level.mFrames;
+			}
+			level.mWallTime = now_ms() - start;
+			level.mGameTime = double(frames) * stepSize;
+		}
+	};
+	double start = now_ms();
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < glm::min(threadCount, instanceCount); ++t) {
+		threads.emplace_back(simulate);
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double wallTime = now_ms() - start;
+	fjobsystem::instance().set_worker_count(workerCount);
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "instance;frames;steps;wins;losses;game_s;wall_ms;steps_per_s" << std::endl;
+	uint64_t totalSteps = 0;
+	for (uint32_t i = 0; i < instanceCount; ++i) {
+		headless_level& level = instances[i]->mLevel;
+		uint64_t steps = level.mLogic->step_count();
+		totalSteps += steps;
+		std::cout << i << ";" << level.mFrames << ";" << steps << ";" << instances[i]->mWins << ";" << instances[i]->mLosses << ";"
+			<< level.mGameTime << ";" << level.mWallTime << ";" << double(steps) / (level.mWallTime / 1000.0) << std::endl;
+	}
+	std::cout << "all;" << uint64_t(frames) * instanceCount << ";" << totalSteps << ";;;" << seconds * instanceCount << ";" << wallTime << ";"
+		<< double(totalSteps) / (wallTime / 1000.0) << std::endl;
+
+	for (auto& instance : instances) {
+		headless_level& level = instance->mLevel;
+		level.mLogic->finalize();
+		level.mTracer.reset();
+		level.mLogic.reset();
+		level.mScene.reset();
+	}
+}
+
+//Runs the solvability check of a level and prints its solutions
+static void run_solver(int id, const flevelsolver::settings& config)
+{
+	std::string path;
+	switch (id) {
+		case 1: path = flevel1logic::level_path(); break;
+		case 2: path = flevel2logic::level_path(); break;
+		case 3: path = flevel3logic::level_path(); break;
+		case 4: path = flevel4logic::level_path(); break;
+		default: throw std::runtime_error("Unknown level " + std::to_string(id));
+	}
+	std::unique_ptr<fscene> scene = fscene::load_scene_data(path, CHAR_PATH);
+	flevelsolver solver(scene.get());
+	flevelsolver::result result = solver.solve(config);
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "level;mirrors;configurations;solutions;pruned_rays;traced_rays;time_ms;threads" << std::endl;
+	std::cout << id << ";" << solver.mirror_count() << ";" << result.mConfigurations << ";" << result.mSolutions.size() << ";"
+		<< result.mPrunedRays << ";" << result.mTracedRays << ";" << result.mTime << ";" << fjobsystem::instance().worker_count() + 1 << std::endl;
+	std::cout << "eye_x;eye_z";
+	for (size_t m = 0; m < solver.mirror_count(); ++m) {
+		std::cout << ";yaw_" << m + 1;
+	}
+	std::cout << ";reflections" << std::endl;
+	for (const flevelsolver::solution& solution : result.mSolutions) {
+		std::cout << solution.mEye.x << ";" << solution.mEye.z;
+		for (float yaw : solution.mYaws) {
+			std::cout << ";" << glm::degrees(yaw);
+		}
+		std::cout << ";" << solution.mReflections << std::endl;
+	}
+}
+
+//Compares a rendered image with a reference image and prints the result line of the level. On failure, the render and a
+//difference image are written next to the reference (prefix_render.ppm, prefix_diff.ppm). Returns whether the images match.
+static bool check_image(int id, double renderTime, const fimage& image, const fimage& reference, const std::string& prefix,
+	uint32_t tolerance, double maxBadPixels)
+{
+	fimage diff;
+	fimage::difference result = fimage::compare(reference, image, tolerance, &diff);
+	bool passed = double(result.mBadPixels) <= maxBadPixels * double(image.mPixels.size());
+	if (!passed) {
+		image.save_ppm(prefix + "_render.ppm");
+		diff.save_ppm(prefix + "_diff.ppm");
+	}
+	std::cout << id << ";" << renderTime << ";" << result.mRmse << ";" << result.mMaxDifference << ";" << result.mBadPixels << ";"
+		<< (passed ? "passed" : "failed") << std::endl;
+	return passed;
+}
+
+//Runs the golden image test, returns the number of failed levels
+static int run_golden_test(const std::string& directory, bool update)
+{
+	fphysicsconfig physicsConfig;
+	physicsConfig.mConnectPvd = false;
+	fphysicsruntime physicsRuntime(physicsConfig);
+	finput input;
+
+	int failed = 0;
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "level;render_ms;rmse;max_difference;bad_pixels;status" << std::endl;
+	for (int id = 1; id <= 4; ++id) {
+		headless_level level = create_level(id, &physicsRuntime, &input);
+		fcpurenderer renderer(level.mScene.get(), level.mTracer.get());
+		double start = now_ms();
+		fimage image = renderer.render(level.mScene->get_camera().global_transformation_matrix(), GOLDEN_WIDTH, GOLDEN_HEIGHT, fcpurenderer::ray_budget());
+		double renderTime = now_ms() - start;
+
+		std::string prefix = (std::filesystem::path(directory) / ("level" + std::to_string(id))).string();
+		std::string goldenPath = prefix + ".ppm";
+		if (update) {
+			image.save_ppm(goldenPath);
+			std::cout << id << ";" << renderTime << ";0;0;0;created" << std::endl;
+		}
+		else if (!std::filesystem::exists(goldenPath)) {
+			//Without its golden image a level would pass unchecked
+			image.save_ppm(prefix + "_render.ppm");
+			std::cout << id << ";" << renderTime << ";;;;missing" << std::endl;
+			++failed;
+		}
+		else if (!check_image(id, renderTime, image, fimage::load_ppm(goldenPath), prefix, GOLDEN_TOLERANCE, GOLDEN_MAX_BAD_PIXELS)) {
+			++failed;
+		}
+		level.mLogic->finalize();
+	}
+	return failed;
+}
+
+//Compares the GPU captures in the directory with the CPU reference renderer, returns the number of failed levels
+static int run_gpu_comparison(const std::string& directory)
+{
+	fphysicsconfig physicsConfig;
+	physicsConfig.mConnectPvd = false;
+	fphysicsruntime physicsRuntime(physicsConfig);
+	finput input;
+
+	int failed = 0;
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "level;render_ms;rmse;max_difference;bad_pixels;status" << std::endl;
+	for (int id = 1; id <= 4; ++id) {
+		std::string prefix = (std::filesystem::path(directory) / ("level" + std::to_string(id))).string();
+		std::string capturePath = prefix + ".ppm";
+		if (!std::filesystem::exists(capturePath)) {
+			std::cout << id << ";;;;;missing" << std::endl;
+			++failed;
+			continue;
+		}
+		fimage capture = fimage::load_ppm(capturePath);
+		//Same state as the capture: the level is initialized, but not played
+		headless_level level = create_level(id, &physicsRuntime, &input);
+		fcpurenderer renderer(level.mScene.get(), level.mTracer.get());
+		double start = now_ms();
+		fimage image = renderer.render(level.mScene->get_camera().global_transformation_matrix(), capture.mWidth, capture.mHeight, fcpurenderer::ray_budget());
+		double renderTime = now_ms() - start;
+		if (!check_image(id, renderTime, image, capture, prefix, GPU_TOLERANCE, GPU_MAX_BAD_PIXELS)) {
+			++failed;
+		}
+		level.mLogic->finalize();
+	}
+	return failed;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		if (argc < 2) {
+			std::cout << "Usage: focus_headless <recording>" << std::endl;
+			std::cout << "       focus_headless --golden <directory> [--update]" << std::endl;
+			std::cout << "       focus_headless --compare-gpu <directory>" << std::endl;
+			std::cout << "       focus_headless --server <level> <instances> <simulated seconds> [threads]" << std::endl;
+			std::cout << "       focus_headless --solve <level> [angle steps] [position steps]" << std::endl;
+			return 1;
+		}
+		if (std::string(argv[1]) == "--solve") {
+			if (argc < 3) {
+				std::cout << "Usage: focus_headless --solve <level> [angle steps] [position steps]" << std::endl;
+				return 1;
+			}
+			flevelsolver::settings config;
+			if (argc > 3) {
+				config.mAngleSteps = static_cast<uint32_t>(std::stoul(argv[3]));
+			}
+			if (argc > 4) {
+				config.mPositionSteps = static_cast<uint32_t>(std::stoul(argv[4]));
+			}
+			config.mMaxDepth = HEADLESS_MAX_DEPTH;
+			run_solver(std::stoi(argv[2]), config);
+			return 0;
+		}
+		if (std::string(argv[1]) == "--server") {
+			if (argc < 5) {
+				std::cout << "Usage: focus_headless --server <level> <instances> <simulated seconds> [threads]" << std::endl;
+				return 1;
+			}
+			uint32_t threads = (argc > 5) ? static_cast<uint32_t>(std::stoul(argv[5])) : glm::max(std::thread::hardware_concurrency(), 1u);
+			run_server(std::stoi(argv[2]), static_cast<uint32_t>(std::stoul(argv[3])), std::stod(argv[4]), threads);
+			return 0;
+		}
+		if (std::string(argv[1]) == "--golden") {
+			if (argc < 3) {
+				std::cout << "Usage: focus_headless --golden <directory> [--update]" << std::endl;
+				return 1;
+			}
+			bool update = (argc > 3 && std::string(argv[3]) == "--update");
+			return (run_golden_test(argv[2], update) == 0) ? 0 : 1;
+		}
+		if (std::string(argv[1]) == "--compare-gpu") {
+			if (argc < 3) {
+				std::cout << "Usage: focus_headless --compare-gpu <directory>" << std::endl;
+				return 1;
+			}
+			return (run_gpu_comparison(argv[2]) == 0) ? 0 : 1;
+		}
+		finput input;
+		fphysicsconfig physicsConfig;
+		physicsConfig.mConnectPvd = false;
+		input.start_replay(argv[1], physicsConfig);
+		fphysicsruntime physicsRuntime(physicsConfig);
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "level;frames;steps;game_s;wall_ms;status;camera_x;camera_y;camera_z" << std::endl;
+		headless_level level;
+		//Same order as in fgamecontrol::update: level switches and resets happen before the level logic of a frame
+		while (input.begin_frame()) {
+			if (input.level() != level.mId) {
+				if (level.mLogic) {
+					finish_level(level);
+				}
+				level = create_level(input.level(), &physicsRuntime, &input);
+			}
+			else if (level.mLogic->level_status() == levelstatus::LOST) {
+				level.mLogic->reset();
+			}
+			//The level logic takes the recorded focus hit value (see finput), no focus query is needed
+			double start = now_ms();
+			level.mLogic->update();
+			level.mWallTime += now_ms() - start;
+			level.mGameTime += input.delta_time();
+			++level.mFrames;
+		}
+		if (level.mLogic) {
+			finish_level(level);
+		}
+		input.stop();
+	}
+	catch (std::runtime_error& re)
+	{
+		LOG_ERROR_EM(re.what());
+		return 1;
+	}
+	return 0;
+}
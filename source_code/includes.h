@@ -1,10 +1,32 @@
 #pragma once
 #include <gvk.hpp>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <xmmintrin.h>
 #include <PxPhysicsAPI.h>
 #include <PxFoundation.h>
 #include "utility.h"
+#include "fprofiler.h"
+#include "fjobsystem.h"
+#include "fpxdispatcher.h"
 #include "fscene.h"
+#include "fcputracer.h"
+#include "fcpurenderer.h"
+#include "flevelsolver.h"
+#include "fphysicsruntime.h"
+#include "finput.h"
 #include "fphysicscontroller.h"
 #include "fplayercontrol.h"
 #include "hsvinterpolator.h"
@@ -13,5 +35,7 @@
 #include "flevel2logic.h"
 #include "flevel3logic.h"
 #include "flevel4logic.h"
+#include "fgputimer.h"
 #include "frenderer.h"
+#include "fflythrough.h"
 #include "fgamecontrol.h"
\ No newline at end of file
@@ -8,4 +8,20 @@ glm::mat4x3 utility::to_glm_mat4x3(PxMat44 mat)
 glm::mat4x3 utility::to_glm_mat4x3(PxTransform t)
 {
 	return to_glm_mat4x3(PxMat44(t));
+}
+
+glm::mat4 utility::interpolate_transform(const glm::mat4& from, const glm::mat4& to, float alpha)
+{
+	glm::vec3 fromScale = glm::vec3(glm::length(glm::vec3(from[0])), glm::length(glm::vec3(from[1])), glm::length(glm::vec3(from[2])));
+	glm::vec3 toScale = glm::vec3(glm::length(glm::vec3(to[0])), glm::length(glm::vec3(to[1])), glm::length(glm::vec3(to[2])));
+	glm::quat fromRotation = glm::quat_cast(glm::mat3(glm::vec3(from[0]) / fromScale.x, glm::vec3(from[1]) / fromScale.y, glm::vec3(from[2]) / fromScale.z));
+	glm::quat toRotation = glm::quat_cast(glm::mat3(glm::vec3(to[0]) / toScale.x, glm::vec3(to[1]) / toScale.y, glm::vec3(to[2]) / toScale.z));
+
+	glm::mat4 result = glm::mat4_cast(glm::slerp(fromRotation, toRotation, alpha));
+	glm::vec3 scale = glm::mix(fromScale, toScale, alpha);
+	result[0] *= scale.x;
+	result[1] *= scale.y;
+	result[2] *= scale.z;
+	result[3] = glm::mix(from[3], to[3], alpha);
+	return result;
 }
\ No newline at end of file
@@ -7,4 +7,6 @@ class utility {
 public:
 	static glm::mat4x3 to_glm_mat4x3(PxMat44 mat);
 	static glm::mat4x3 to_glm_mat4x3(PxTransform t);
+	//Interpolates between two transformations made of translation, rotation and scale (translation and scale linearly, rotation spherically)
+	static glm::mat4 interpolate_transform(const glm::mat4& from, const glm::mat4& to, float alpha);
 };
\ No newline at end of file